@@ -5,7 +5,9 @@ include $(CLEAR_VARS)
 LOCAL_MODULE_TAGS := eng
 LOCAL_C_INCLUDES += $(LOCAL_PATH)
 LOCAL_CPPFLAGS += -I$(LOCAL_PATH)/../../external/linux-lib/vpu/
-LOCAL_SRC_FILES := camera.cpp cameraParams.cpp fb2_overlay.cpp fourcc.cpp hexDump.cpp memcopy.S v4l_display.cpp
+LOCAL_SRC_FILES := camera.cpp cameraParams.cpp fb2_overlay.cpp fourcc.cpp hexDump.cpp memcopy.S v4l_display.cpp \
+	bufferHandle.cpp captureThread.cpp pipeline.cpp cameraStages.cpp cameraApp.cpp rtpH264.cpp gopRing.cpp mp4Mux.cpp \
+	yuvScale.cpp.neon
 LOCAL_MODULE := libbdhw
 include $(BUILD_STATIC_LIBRARY)
 
@@ -0,0 +1,121 @@
+/*
+ * Module bitstreamRing.cpp
+ *
+ * This module defines the methods of the bitstreamRing_t class
+ * as declared in bitstreamRing.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "bitstreamRing.h"
+#include <stdio.h>
+#include <string.h>
+#include "debugPrint.h"
+
+bitstreamRing_t::bitstreamRing_t(unsigned slotSize, unsigned numSlots)
+	: block_(0)
+	, phys_(0)
+	, virt_(0)
+	, slotSize_((slotSize+1023)&~1023)	// VPU takes the size in kB
+	, numSlots_((MAXSLOTS < numSlots) ? MAXSLOTS : (numSlots ? numSlots : 1))
+	, next_(0)
+	, held_(0)
+	, starved_(0)
+	, overflows_(0)
+{
+	memset((void *)inUse_,0,sizeof(inUse_));
+	block_ = physPool_t::shared().alloc(size());
+	if (0 == block_) {
+		fprintf(stderr,"Unable to obtain %u bytes of physical memory\n", size());
+		return ;
+	}
+	phys_ = block_->phys ;
+	virt_ = block_->virt ;
+	debugPrint( "bitstream ring: %u slots of %u bytes: phys 0x%x, virt %p\n",
+		    numSlots_, slotSize_, phys_, virt_ );
+}
+
+bitstreamRing_t::~bitstreamRing_t(void)
+{
+	if (virt_) {
+		if (held_)
+			fprintf(stderr, "%s: %u slots still held\n", __func__, held_);
+		physPool_t::shared().release(block_);
+	}
+}
+
+bool bitstreamRing_t::acquire(unsigned &slot)
+{
+	if (!worked())
+		return false ;
+	for (unsigned i = 0 ; i < numSlots_ ; i++) {
+		unsigned s = (next_+i) % numSlots_ ;
+		if (__sync_bool_compare_and_swap(inUse_+s,0,1)) {
+			__sync_fetch_and_add(&held_,1);
+			next_ = (s+1) % numSlots_ ;
+			slot = s ;
+			return true ;
+		}
+	}
+	__sync_fetch_and_add(&starved_,1);
+	return false ;
+}
+
+void bitstreamRing_t::release(unsigned slot)
+{
+	if ((slot < numSlots_) && __sync_bool_compare_and_swap(inUse_+slot,1,0))
+		__sync_fetch_and_sub(&held_,1);
+	else
+		fprintf(stderr, "%s: slot %u not held\n", __func__, slot);
+}
+
+void bitstreamRing_t::release(void const *data)
+{
+	unsigned char const *p = (unsigned char const *)data ;
+	if ((p < virt_) || (p >= virt_+size())) {
+		fprintf(stderr, "%s: %p is not in the ring\n", __func__, data);
+		return ;
+	}
+	release((unsigned)((p-virt_)/slotSize_));
+}
+
+#ifdef STANDALONE_BITSTREAMRING
+#include "imx_vpu.h"
+
+int main(int argc, char const * const argv[])
+{
+	vpu_t vpu ;
+	if (!vpu.worked())
+		return -1 ;
+
+	bitstreamRing_t ring(1000,3);
+	if (!ring.worked()) {
+		fprintf(stderr, "Error allocating ring\n");
+		return -1 ;
+	}
+	printf("%u slots of %u bytes at 0x%x\n", ring.numSlots(), ring.slotSize(), ring.phys());
+	unsigned a, b, c, d ;
+	if (!ring.acquire(a) || !ring.acquire(b) || !ring.acquire(c)) {
+		fprintf(stderr, "Error acquiring slots\n");
+		return -1 ;
+	}
+	if (ring.acquire(d)) {
+		fprintf(stderr, "acquired slot %u from a full ring\n", d);
+		return -1 ;
+	}
+	ring.release(ring.slotVirt(b)+ring.slotSize()-1);
+	if (!ring.acquire(d) || (d != b)) {
+		fprintf(stderr, "expected slot %u back\n", b);
+		return -1 ;
+	}
+	if (ring.toVirt(ring.slotPhys(c)+10) != ring.slotVirt(c)+10) {
+		fprintf(stderr, "address translation error\n");
+		return -1 ;
+	}
+	ring.release(a);
+	ring.release(c);
+	ring.release(d);
+	printf("%u held, %u starved\n", ring.numHeld(), ring.numStarved());
+	return (0 == ring.numHeld()) && (1 == ring.numStarved()) ? 0 : -1 ;
+}
+#endif
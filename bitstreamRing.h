@@ -0,0 +1,81 @@
+#ifndef __BITSTREAMRING_H__
+#define __BITSTREAMRING_H__ "$Id$"
+
+/*
+ * bitstreamRing.h
+ *
+ * This header file declares the bitstreamRing_t class, which
+ * splits one physically contiguous allocation into a set of
+ * equal-sized slots for VPU encoder output.
+ *
+ * The encoder acquire()s a slot for each frame and hands its
+ * address to the VPU (picStreamBufferAddr). The consumer of the
+ * encoded data release()s the slot when it is done with it,
+ * possibly from another thread, so file and network sinks can
+ * work on frame N while the VPU writes frame N+1.
+ *
+ * If the consumers hold every slot, acquire() fails and the
+ * encoder should skip the frame rather than overwrite data
+ * that is still in use.
+ *
+ * The memory comes from physPool_t::shared(), so a ring for a new
+ * encoder usually reuses the memory of the last one.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+#include "physPool.h"
+
+class bitstreamRing_t {
+public:
+	enum {
+		DEFAULTSLOTS = 4,
+		MAXSLOTS = 32
+	};
+
+	// slotSize is rounded up to a multiple of 1k
+	bitstreamRing_t(unsigned slotSize, unsigned numSlots = DEFAULTSLOTS);
+	~bitstreamRing_t(void);
+
+	bool worked(void) const { return 0 != virt_ ; }
+
+	// the whole allocation, for EncOpenParam
+	PhysicalAddress phys(void) const { return phys_ ; }
+	unsigned size(void) const { return slotSize_*numSlots_ ; }
+
+	unsigned slotSize(void) const { return slotSize_ ; }
+	unsigned numSlots(void) const { return numSlots_ ; }
+	unsigned numHeld(void) const { return held_ ; }
+
+	// claims the next free slot, in order
+	bool acquire(unsigned &slot);
+	void release(unsigned slot);
+	// release by any pointer into a slot
+	void release(void const *data);
+
+	PhysicalAddress slotPhys(unsigned slot) const { return phys_ + slot*slotSize_ ; }
+	unsigned char *slotVirt(unsigned slot) const { return virt_ + slot*slotSize_ ; }
+
+	// translates a VPU address within the allocation
+	unsigned char *toVirt(PhysicalAddress addr) const { return virt_ + (addr - phys_); }
+
+	// statistics
+	unsigned numStarved(void) const { return starved_ ; }	// acquire() failures
+	unsigned numOverflows(void) const { return overflows_ ; }
+	void overflowed(void){ __sync_fetch_and_add(&overflows_,1); }
+
+private:
+	bitstreamRing_t(bitstreamRing_t const &); // no copies
+
+	physPool_t::block_t    *block_ ;
+	PhysicalAddress		phys_ ;
+	unsigned char	       *virt_ ;
+	unsigned		slotSize_ ;
+	unsigned		numSlots_ ;
+	unsigned		next_ ;
+	int volatile		inUse_[MAXSLOTS];
+	unsigned volatile	held_ ;
+	unsigned volatile	starved_ ;
+	unsigned volatile	overflows_ ;
+};
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Module bufferHandle.cpp
+ *
+ * This module defines the utility routines declared in
+ * bufferHandle.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "bufferHandle.h"
+#include <sys/ioctl.h>
+#include <errno.h>
+
+/*
+ * Freescale/NXP kernels add this to <linux/dma-buf.h>. Older
+ * toolchains don't have the header at all, so define it here.
+ */
+#ifndef DMA_BUF_IOCTL_PHYS
+#define DMA_BUF_IOCTL_PHYS	_IOW('b', 10, unsigned long)
+#endif
+
+unsigned long dmabuf_phys(int dmafd)
+{
+	if (0 > dmafd)
+		return 0 ;
+
+	unsigned long phys = 0 ;
+	int rv ;
+	do {
+		rv = ioctl(dmafd, DMA_BUF_IOCTL_PHYS, &phys);
+	} while ((0 > rv) && (EINTR == errno));
+
+	return (0 == rv) ? phys : 0 ;
+}
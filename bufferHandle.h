@@ -0,0 +1,41 @@
+#ifndef __BUFFERHANDLE_H__
+#define __BUFFERHANDLE_H__ "$Id$"
+
+/*
+ * bufferHandle.h
+ *
+ * This header file declares the bufferHandle_t structure, which
+ * describes a single frame buffer in a form that can be handed
+ * from the camera_t class to its consumers (the VPU encoders and
+ * v4l_display_t) without copying the frame data.
+ *
+ * A handle carries up to three views of the same memory:
+ *
+ *	dmafd	- a DMABUF file descriptor from VIDIOC_EXPBUF, or -1
+ *		  if the driver or kernel can't export buffers
+ *	phys	- the physical address for the VPU or IPU, or 0 if
+ *		  it isn't known (e.g. the vivid virtual driver)
+ *	virt	- a CPU mapping for software consumers
+ *
+ * The handle does not own any of these. The producer (normally
+ * camera_t) keeps them valid for its lifetime.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+struct bufferHandle_t {
+	int		dmafd ;
+	unsigned long	phys ;
+	unsigned char  *virt ;
+	unsigned	length ;
+	unsigned	index ;
+};
+
+/*
+ * Returns the physical address behind a DMABUF file descriptor
+ * using the i.MX-specific DMA_BUF_IOCTL_PHYS, or 0 if the kernel
+ * doesn't support it or the buffer isn't physically contiguous.
+ */
+unsigned long dmabuf_phys(int dmafd);
+
+#endif
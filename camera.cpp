@@ -24,6 +24,7 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <linux/types.h>
 #include <stdint.h>
 //#include <linux/mxc_v4l2.h>
@@ -54,20 +55,37 @@ camera_t::camera_t
   unsigned    height,
   unsigned    fps,
   unsigned    pixelformat,
-  rotation_e  rotation )
+  rotation_e  rotation,
+  unsigned    numBuffers,
+  memory_e    memory )
 : fd_( -1 )
 , w_(width)
 , h_(height)
+, memory_(memory)
 , v4l_buffers_(0)
+, planes_(0)
 , buffers_(0)
+, planeMem_(0)
+, handles_(0)
 , n_buffers_(0)
-, buffer_length_(0)
+, num_planes_(1)
+, imgSize_(0)
+, haveUserBuffers_(false)
 , numRead_(0)
 , frame_drops_(0)
 , lastRead_(0xffffffff)
+, clock_(CLOCK_REALTIME)
+, haveLast_(false)
+, lastSequence_(0)
+, bucketUs_((2000000/(fps ? fps : 30)+cameraStats_t::HISTOGRAM_BUCKETS-1)/cameraStats_t::HISTOGRAM_BUCKETS)
 {
 	struct stat st;
 
+	memset(&fmt_,0,sizeof(fmt_));
+	memset(&lastTimestamp_,0,sizeof(lastTimestamp_));
+	pthread_mutex_init(&statsLock_,0);
+	resetStats();
+
 	if (-1 == stat (devName, &st)) {
 		ERRMSG( "Cannot identify '%s': %d, %s\n",
 			devName, errno, strerror (errno));
@@ -88,6 +106,7 @@ camera_t::camera_t
 	}
 
 	struct v4l2_capability cap;
+	unsigned caps ;
 	if (-1 == xioctl (fd_, VIDIOC_QUERYCAP, &cap)) {
 		if (EINVAL == errno) {
 			ERRMSG( "%s is no V4L2 device\n", devName);
@@ -98,7 +117,14 @@ camera_t::camera_t
 		goto bail ;
 	}
 
-	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+	caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities ;
+	if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+		fmt_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE ;
+	}
+	else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+		fmt_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ;
+	}
+	else {
 		ERRMSG( "%s is no video capture device\n", devName);
 		goto bail ;
 	}
@@ -109,6 +135,14 @@ camera_t::camera_t
 
 	int input ;
 	int r;
+	bool physFromOffset ;
+
+	/*
+	 * Older Freescale capture drivers (mxc_v4l2) return the physical
+	 * address of each buffer in v4l2_buffer.m.offset. Only trust that
+	 * when nothing better is available and we know the driver.
+	 */
+	physFromOffset = (0 == strncmp((char const *)cap.driver,"mxc",3));
 
 	input = isYUV(pixelformat) ? 0 : 1 ;
 
@@ -120,11 +154,11 @@ camera_t::camera_t
 	}
 
 	struct v4l2_cropcap cropcap ; memset(&cropcap,0,sizeof(cropcap));
-	cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	cropcap.type = fmt_.type;
 
 	if (0 == xioctl (fd_, VIDIOC_CROPCAP, &cropcap)) {
 		struct v4l2_crop crop ; memset(&crop,0,sizeof(crop));
-		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		crop.type = fmt_.type;
 		crop.c = cropcap.defrect; /* reset to default */
 
 		if (-1 == xioctl (fd_, VIDIOC_S_CROP, &crop)) {
@@ -142,28 +176,72 @@ camera_t::camera_t
 		/* Errors ignored. */
 	}
 
-	memset(&fmt_,0,sizeof(fmt_));
-
-	fmt_.type               = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt_.fmt.pix.width       = width ;
-	fmt_.fmt.pix.height      = height ;
-	fmt_.fmt.pix.pixelformat = pixelformat ;
+	unsigned fmtWidth, fmtHeight ;
+	if (multiplanar()) {
+		fmt_.fmt.pix_mp.width       = width ;
+		fmt_.fmt.pix_mp.height      = height ;
+		fmt_.fmt.pix_mp.pixelformat = pixelformat ;
+		fmt_.fmt.pix_mp.field       = V4L2_FIELD_ANY ;
+	}
+	else {
+		fmt_.fmt.pix.width       = width ;
+		fmt_.fmt.pix.height      = height ;
+		fmt_.fmt.pix.pixelformat = pixelformat ;
+	}
 
 	if (-1 == xioctl (fd_, VIDIOC_S_FMT, &fmt_)) {
 		perror("VIDIOC_S_FMT");
 		goto bail ;
 	}
 
-	ERRMSG("%s: set pixel format %s, sizeimage == %u\n", __func__, fourcc_str(fmt_.fmt.pix.pixelformat), fmt_.fmt.pix.sizeimage);
+	if (multiplanar()) {
+		fmtWidth = fmt_.fmt.pix_mp.width ;
+		fmtHeight = fmt_.fmt.pix_mp.height ;
+		num_planes_ = fmt_.fmt.pix_mp.num_planes ;
+		if ((0 == num_planes_) || (VIDEO_MAX_PLANES < num_planes_)) {
+			ERRMSG( "invalid plane count %u\n", num_planes_);
+			goto bail ;
+		}
+		for (unsigned p = 0 ; p < num_planes_ ; p++)
+			imgSize_ += fmt_.fmt.pix_mp.plane_fmt[p].sizeimage ;
+	}
+	else {
+		fmtWidth = fmt_.fmt.pix.width ;
+		fmtHeight = fmt_.fmt.pix.height ;
+		imgSize_ = fmt_.fmt.pix.sizeimage ;
+	}
 
-	if ( (width != fmt_.fmt.pix.width)
+	ERRMSG("%s: set pixel format %s, %u plane(s), sizeimage == %u\n", __func__, fourcc_str(pixelformat), num_planes_, imgSize_);
+
+	if ( (width != fmtWidth)
 	     ||
-	     (height != fmt_.fmt.pix.height) ) {
-		ERRMSG( "%ux%u not supported: %ux%u\n", width, height,fmt_.fmt.pix.width, fmt_.fmt.pix.height);
+	     (height != fmtHeight) ) {
+		ERRMSG( "%ux%u not supported: %ux%u\n", width, height, fmtWidth, fmtHeight);
 		goto bail ;
 	}
 
-	ERRMSG("%s: size: %ux%u\n", __func__, fmt_.fmt.pix.width, fmt_.fmt.pix.height);
+	ERRMSG("%s: size: %ux%u\n", __func__, fmtWidth, fmtHeight);
+
+	/*
+	 * Only the stride of the first plane is reported: chroma strides
+	 * are implied by it. Formats with a memory plane per component
+	 * (NV12M and friends) aren't described by frameLayout_t, so use
+	 * getPlane() for those.
+	 */
+	layout_.init(pixelformat, fmtWidth, fmtHeight, stride());
+	if (layout_.valid()) {
+		if (layout_.size > imgSize_) {
+			ERRMSG( "sizeimage %u is too small for %u-byte lines\n", imgSize_, stride());
+			goto bail ;
+		}
+		if (layout_.padded())
+			ERRMSG("%s: lines padded to %u bytes\n", __func__, stride());
+	}
+
+	if ((MEMORY_USERPTR == memory_) && (1 != num_planes_)) {
+		ERRMSG( "USERPTR capture only supports single-plane formats\n");
+		goto bail ;
+	}
 
 /*
 	struct v4l2_control rotate_control ; memset(&rotate_control,0,sizeof(rotate_control));
@@ -175,6 +253,8 @@ camera_t::camera_t
 	}
 */
 	struct v4l2_streamparm stream_parm;
+	memset(&stream_parm,0,sizeof(stream_parm));
+	stream_parm.type = fmt_.type ;
 
 	if (-1 == xioctl (fd_, VIDIOC_G_PARM, &stream_parm)) {
 		perror("VIDIOC_G_PARM");
@@ -188,13 +268,14 @@ camera_t::camera_t
 
 	struct v4l2_requestbuffers req ; memset(&req,0,sizeof(req));
 
-	req.count       = 5;
-	req.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	req.memory      = V4L2_MEMORY_MMAP;
+	req.count       = numBuffers ? numBuffers : DEFAULT_BUFFERS ;
+	req.type        = fmt_.type;
+	req.memory      = memory_;
 
 	if (-1 == xioctl (fd_, VIDIOC_REQBUFS, &req)) {
 		if (EINVAL == errno) {
-			ERRMSG( "%s does not support memory mapping\n", devName);
+			ERRMSG( "%s does not support %s\n", devName,
+				(MEMORY_MMAP == memory_) ? "memory mapping" : "user pointers");
 		}
 		else {
 			perror("VIDIOC_REQBUFS");
@@ -206,49 +287,83 @@ camera_t::camera_t
 		ERRMSG( "Insufficient buffer memory on %s\n", devName);
 		goto bail ;
 	}
+	if (req.count != numBuffers)
+		ERRMSG( "%s: asked for %u buffers, got %u\n", devName, numBuffers, req.count);
 
         v4l_buffers_ = (struct v4l2_buffer *)calloc (req.count, sizeof(v4l_buffers_[0]));
-	if (!v4l_buffers_) {
+	planes_ = (struct v4l2_plane *)calloc (req.count*VIDEO_MAX_PLANES, sizeof(planes_[0]));
+	buffers_ = (unsigned char **)calloc (req.count, sizeof (buffers_[0]));
+	planeMem_ = (unsigned char **)calloc (req.count*VIDEO_MAX_PLANES, sizeof (planeMem_[0]));
+	handles_ = (bufferHandle_t *)calloc (req.count, sizeof (handles_[0]));
+	if (!(v4l_buffers_ && planes_ && buffers_ && planeMem_ && handles_)) {
 		ERRMSG( "Out of memory\n");
 		goto bail ;
 	}
 
-	buffers_ = (unsigned char **)calloc (req.count, sizeof (buffers_[0]));
-
-	if (!buffers_) {
-		ERRMSG( "Out of memory\n");
-		goto bail ;
+	if (MEMORY_USERPTR == memory_) {
+		// nothing to map: setUserBuffers() fills in the handles
+		for (n_buffers_ = 0; n_buffers_ < req.count; ++n_buffers_) {
+			handles_[n_buffers_].dmafd = -1 ;
+			handles_[n_buffers_].index = n_buffers_ ;
+		}
+		pfd_.fd = fd_ ;
+		pfd_.events = POLLIN ;
+		return ;
 	}
 
 	for (n_buffers_ = 0; n_buffers_ < req.count; ++n_buffers_) {
 		struct v4l2_buffer &buf = v4l_buffers_[n_buffers_];
-		memset(&buf,0,sizeof(buf));
+		initBuffer(buf,n_buffers_);
 
-		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory      = V4L2_MEMORY_MMAP;
-		buf.index       = n_buffers_ ;
+		bufferHandle_t &handle = handles_[n_buffers_];
+		handle.dmafd  = -1 ;
+		handle.index  = n_buffers_ ;
 
 		if (-1 == xioctl (fd_, VIDIOC_QUERYBUF, &buf)) {
 			perror ("VIDIOC_QUERYBUF");
 			goto bail; 
 		}
-		debugPrint("%s: buffer lengths %u/%u\n", __func__, buffer_length_,buf.length);
-		assert((0 == buffer_length_)||(buf.length == buffer_length_)); // only handle single buffer size
-                buffer_length_ = buf.length;
-		buffers_[n_buffers_] = (unsigned char *)
-		mmap (NULL /* start anywhere */,
-		      buf.length,
-		      PROT_READ /* required */,
-		      MAP_SHARED /* recommended */,
-		      fd_, buf.m.offset);
-
-		if (MAP_FAILED == buffers_[n_buffers_]) {
-			perror("mmap");
-			goto bail ;
+
+		for (unsigned p = 0 ; p < num_planes_ ; p++) {
+			unsigned length = multiplanar() ? buf.m.planes[p].length : buf.length ;
+			unsigned offset = multiplanar() ? buf.m.planes[p].m.mem_offset : buf.m.offset ;
+			debugPrint("%s: buffer %u plane %u length %u\n", __func__, n_buffers_, p, length);
+			unsigned char *mem = (unsigned char *)
+				mmap (NULL /* start anywhere */,
+				      length,
+				      PROT_READ /* required */,
+				      MAP_SHARED /* recommended */,
+				      fd_, offset);
+
+			if (MAP_FAILED == mem) {
+				perror("mmap");
+				goto bail ;
+			}
+			planeMem_[n_buffers_*VIDEO_MAX_PLANES+p] = mem ;
 		}
+		buffers_[n_buffers_] = planeMem_[n_buffers_*VIDEO_MAX_PLANES];
+
+		handle.virt   = buffers_[n_buffers_];
+		handle.length = multiplanar() ? buf.m.planes[0].length : buf.length ;
+#ifdef VIDIOC_EXPBUF
+		struct v4l2_exportbuffer expbuf ; memset(&expbuf,0,sizeof(expbuf));
+		expbuf.type  = fmt_.type ;
+		expbuf.index = n_buffers_ ;
+		expbuf.plane = 0 ;
+		expbuf.flags = O_CLOEXEC | O_RDWR ;
+		if (0 == xioctl (fd_, VIDIOC_EXPBUF, &expbuf)) {
+			handle.dmafd = expbuf.fd ;
+			handle.phys  = dmabuf_phys(expbuf.fd);
+		}
+		else
+			debugPrint("%s: VIDIOC_EXPBUF(%u): %m\n", __func__, n_buffers_);
+#endif
+		if ((0 == handle.phys) && physFromOffset && !multiplanar())
+			handle.phys = buf.m.offset ;
+		debugPrint("%s: buffer %u: dmafd %d, phys 0x%lx\n", __func__, n_buffers_, handle.dmafd, handle.phys);
 
-		if (fmt_.fmt.pix.sizeimage > buf.length)
-			ERRMSG("camera_imgsize=%x but buf.length=%x\n", fmt_.fmt.pix.sizeimage, buf.length);
+		if (imgSize_ > handle.length*num_planes_)
+			ERRMSG("camera_imgsize=%x but buf.length=%x\n", imgSize_, handle.length);
 	}
 	pfd_.fd = fd_ ;
 	pfd_.events = POLLIN ;
@@ -261,14 +376,39 @@ bail:
 }
 
 camera_t::~camera_t(void) {
-	if ( buffers_ ) {
-		while ( 0 < n_buffers_ ) {
-			munmap(buffers_[n_buffers_-1],buffer_length_);
-			--n_buffers_ ;
+	if ( handles_ ) {
+		for (unsigned i = 0 ; i < n_buffers_ ; i++) {
+			if ((MEMORY_MMAP == memory_) && (0 <= handles_[i].dmafd))
+				close(handles_[i].dmafd);
+		}
+	}
+	if ( planeMem_ ) {
+		for (unsigned i = 0 ; i < n_buffers_ ; i++) {
+			for (unsigned p = 0 ; p < num_planes_ ; p++) {
+				unsigned char *mem = planeMem_[i*VIDEO_MAX_PLANES+p];
+				if (mem && (MAP_FAILED != mem)) {
+					unsigned length = multiplanar()
+							? planes_[i*VIDEO_MAX_PLANES+p].length
+							: v4l_buffers_[i].length ;
+					munmap(mem,length);
+				}
+			}
 		}
+		free(planeMem_);
+		planeMem_ = 0 ;
+	}
+	if ( handles_ ) {
+		free(handles_);
+		handles_ = 0 ;
+	}
+	if ( buffers_ ) {
 		free(buffers_);
 		buffers_ = 0 ;
 	}
+	if (planes_) {
+		free(planes_);
+		planes_ = 0 ;
+	}
 	if (v4l_buffers_) {
 		free(v4l_buffers_);
                 v4l_buffers_ = 0 ;
@@ -277,6 +417,67 @@ camera_t::~camera_t(void) {
 		close(fd_);
 		fd_ = -1 ;
 	}
+	pthread_mutex_destroy(&statsLock_);
+}
+
+/*
+ * Fill in the constant parts of a v4l2_buffer for the specified
+ * index. In multi-planar mode, buf.m.planes points into planes_.
+ */
+void camera_t::initBuffer(struct v4l2_buffer &buf, unsigned index)
+{
+	memset(&buf,0,sizeof(buf));
+	buf.type        = fmt_.type;
+	buf.memory      = memory_;
+	buf.index       = index ;
+	if (multiplanar()) {
+		buf.m.planes = planes_ + index*VIDEO_MAX_PLANES ;
+		buf.length   = num_planes_ ;
+	}
+	if (MEMORY_USERPTR == memory_) {
+		bufferHandle_t const &handle = handles_[index];
+		if (multiplanar()) {
+			buf.m.planes[0].m.userptr = (unsigned long)handle.virt ;
+			buf.m.planes[0].length    = handle.length ;
+		}
+		else {
+			buf.m.userptr = (unsigned long)handle.virt ;
+			buf.length    = handle.length ;
+		}
+	}
+}
+
+unsigned char *camera_t::getPlane(unsigned index, unsigned plane) const
+{
+	if ((index >= n_buffers_) || (plane >= num_planes_))
+		return 0 ;
+	return (MEMORY_MMAP == memory_)
+		? planeMem_[index*VIDEO_MAX_PLANES+plane]
+		: handles_[index].virt ;
+}
+
+bool camera_t::setUserBuffers(bufferHandle_t const *buffers, unsigned count)
+{
+	if ( !isOpen() || (MEMORY_USERPTR != memory_) )
+		return false ;
+	if (count != n_buffers_) {
+		ERRMSG( "%s: need %u buffers, not %u\n", __func__, n_buffers_, count);
+		return false ;
+	}
+	for (unsigned i = 0 ; i < count ; i++) {
+		if (buffers[i].length < imgSize_) {
+			ERRMSG( "%s: buffer %u is too small (%u < %u)\n", __func__, i, buffers[i].length, imgSize_);
+			return false ;
+		}
+	}
+	for (unsigned i = 0 ; i < count ; i++) {
+		handles_[i] = buffers[i];
+		handles_[i].index = i ;
+		buffers_[i] = buffers[i].virt ;
+		initBuffer(v4l_buffers_[i],i);
+	}
+	haveUserBuffers_ = true ;
+	return true ;
 }
 
 // capture interface
@@ -285,20 +486,17 @@ bool camera_t::startCapture(void)
 	if ( !isOpen() )
 		return false ;
 
+	if ((MEMORY_USERPTR == memory_) && !haveUserBuffers_) {
+		ERRMSG( "%s: no user buffers supplied\n", __func__);
+		return false ;
+	}
+
 	unsigned int i;
 
+	haveLast_ = false ;
 	for (i = 0; i < n_buffers_; ++i) {
-		struct v4l2_buffer buf ; memset(&buf,0,sizeof(buf));
-
-		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory      = V4L2_MEMORY_MMAP;
-		buf.index       = i;
-		buf.m.offset    = 0;
-
-		if (-1 == xioctl (fd_, VIDIOC_QUERYBUF, &buf)) {
-			perror ("VIDIOC_QUERYBUF");
-			return false; 
-		}
+		struct v4l2_buffer buf ;
+		initBuffer(buf,i);
 		if (-1 == xioctl (fd_, VIDIOC_QBUF, &buf)) {
 			perror ("VIDIOC_QBUF");
 			return false ;
@@ -308,7 +506,7 @@ bool camera_t::startCapture(void)
 		}
 	}
 
-	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	enum v4l2_buf_type type = (enum v4l2_buf_type)fmt_.type;
 
 	if (-1 == xioctl (fd_, VIDIOC_STREAMON, &type)) {
 		perror ("VIDIOC_STREAMON");
@@ -321,34 +519,46 @@ bool camera_t::startCapture(void)
 }
 
 bool camera_t::grabFrame(void const *&data,int &index) {
+	cameraFrame_t frame ;
+	if (grabFrame(frame)) {
+		data = frame.data ;
+		index = frame.index ;
+		return true ;
+	}
+	index = -1 ;
+	return false ;
+}
+
+bool camera_t::grabFrame(cameraFrame_t &frame) {
 
 	int timeout = 100 ; // 1/10 second max 
-	index = -1 ;
+	frame.index = -1 ;
 	while (1) {
 		int numReady = poll(&pfd_, 1, timeout);
 		if ( 0 < numReady ) {
 			debugPrint( "%s: %d fds ready\n", __func__, numReady );
 			timeout = 0 ;
 			struct v4l2_buffer buf ;
+			struct v4l2_plane planes[VIDEO_MAX_PLANES];
 			memset(&buf,0,sizeof(buf));
-			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			buf.memory = V4L2_MEMORY_MMAP;
+			buf.type = fmt_.type;
+			buf.memory = memory_;
+			if (multiplanar()) {
+				memset(planes,0,sizeof(planes));
+				buf.m.planes = planes ;
+				buf.length = num_planes_ ;
+			}
 			int rv ;
 			if (0 == (rv = xioctl (fd_, VIDIOC_DQBUF, &buf))) {
 				++ numRead_ ;
-				if (0 != (rv = xioctl (fd_, VIDIOC_QUERYBUF, &buf))) {
-					fprintf(stderr, "QUERYBUF:%d:%m\n", rv);
-				}
-				if (0 <= index) {
-					ERRMSG("camera frame drop\n");
-					++frame_drops_ ;
-					returnFrame(data,index);
-				}
 				assert (buf.index < n_buffers_);
-				data = buffers_[buf.index];
-				index = buf.index ;
-				debugPrint( "DQ index %u: %p\n", index, data );
-				lastRead_ = index ;
+				updateStats(buf);
+				frame.data = buffers_[buf.index];
+				frame.index = buf.index ;
+				frame.timestamp = buf.timestamp ;
+				frame.sequence = buf.sequence ;
+				debugPrint( "DQ index %u: %p\n", frame.index, frame.data );
+				lastRead_ = frame.index ;
 				break;
 			}
 			else if ((errno != EAGAIN)&&(errno != EINTR)) {
@@ -361,16 +571,13 @@ bool camera_t::grabFrame(void const *&data,int &index) {
 		}
 		break; // continue from middle
 	}
-	debugPrint( "%s: returning %d\n", __func__,(0 <= index));
-	return (0 <= index);
+	debugPrint( "%s: returning %d\n", __func__,(0 <= frame.index));
+	return (0 <= frame.index);
 }
 
 void camera_t::returnFrame(void const *data, int index) {
 	struct v4l2_buffer buf ;
-	memset(&buf,0,sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE ;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index  = index ;
+	initBuffer(buf,index);
 	if (0 != xioctl (fd_, VIDIOC_QBUF, &buf))
 		perror("VIDIOC_QBUF");
 	else {
@@ -378,11 +585,120 @@ void camera_t::returnFrame(void const *data, int index) {
 	}
 }
 
+static long long timevalDiffUs(struct timeval const &a, struct timeval const &b)
+{
+	return ((long long)(a.tv_sec-b.tv_sec)*1000000)+(a.tv_usec-b.tv_usec);
+}
+
+static struct timeval clockNow(int clock)
+{
+	struct timespec ts ;
+	clock_gettime(clock,&ts);
+	struct timeval tv ;
+	tv.tv_sec = ts.tv_sec ;
+	tv.tv_usec = ts.tv_nsec / 1000 ;
+	return tv ;
+}
+
+void camera_t::updateStats(struct v4l2_buffer const &buf)
+{
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+	clock_ = ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		? CLOCK_MONOTONIC
+		: CLOCK_REALTIME ;
+#endif
+	long long latency = timevalDiffUs(clockNow(clock_),buf.timestamp);
+	if (0 > latency)
+		latency = 0 ;
+	pthread_mutex_lock(&statsLock_);
+	stats_.frames++ ;
+	if (stats_.maxLatencyUs < latency)
+		stats_.maxLatencyUs = latency ;
+	stats_.avgLatencyUs += ((int)latency-(int)stats_.avgLatencyUs)/16 ;
+
+	if (haveLast_) {
+		unsigned gap = buf.sequence-lastSequence_-1 ;
+		if ((0 != gap) && (gap < 0x80000000)) {
+			debugPrint("%s: driver dropped %u frames before %u\n", __func__, gap, buf.sequence);
+			frame_drops_ += gap ;
+			stats_.driverDrops += gap ;
+		}
+
+		long long interval = timevalDiffUs(buf.timestamp,lastTimestamp_);
+		if (0 > interval)
+			interval = 0 ;
+		// normalize to a single frame period when frames were lost
+		if ((0 != gap) && (gap < 0x80000000))
+			interval /= (gap+1);
+		if (interval < stats_.minIntervalUs)
+			stats_.minIntervalUs = interval ;
+		if (interval > stats_.maxIntervalUs)
+			stats_.maxIntervalUs = interval ;
+		if (0 == stats_.avgIntervalUs)
+			stats_.avgIntervalUs = interval ;
+		int deviation = (int)interval-(int)stats_.avgIntervalUs ;
+		stats_.avgIntervalUs += deviation/16 ;
+		if (0 > deviation)
+			deviation = -deviation ;
+		stats_.jitterUs += (deviation-(int)stats_.jitterUs)/16 ;
+
+		unsigned bucket = interval/stats_.bucketUs ;
+		if (bucket >= cameraStats_t::HISTOGRAM_BUCKETS)
+			bucket = cameraStats_t::HISTOGRAM_BUCKETS-1 ;
+		stats_.histogram[bucket]++ ;
+	}
+	pthread_mutex_unlock(&statsLock_);
+	haveLast_ = true ;
+	lastSequence_ = buf.sequence ;
+	lastTimestamp_ = buf.timestamp ;
+}
+
+void camera_t::resetStats(void)
+{
+	pthread_mutex_lock(&statsLock_);
+	memset(&stats_,0,sizeof(stats_));
+	stats_.bucketUs = bucketUs_ ;
+	stats_.minIntervalUs = ~0U ;
+	pthread_mutex_unlock(&statsLock_);
+}
+
+cameraStats_t camera_t::stats(void) const
+{
+	pthread_mutex_lock(&statsLock_);
+	cameraStats_t rval = stats_ ;
+	pthread_mutex_unlock(&statsLock_);
+	return rval ;
+}
+
+void camera_t::dumpStats(void) const
+{
+	cameraStats_t const s = stats();
+	printf( "%u frames, %u dropped by driver\n", s.frames, s.driverDrops);
+	if (1 < s.frames) {
+		printf( "interval: min %u, max %u, avg %u, jitter %u us\n",
+			s.minIntervalUs, s.maxIntervalUs,
+			s.avgIntervalUs, s.jitterUs);
+	}
+	printf( "latency at dequeue: avg %u, max %u us\n", s.avgLatencyUs, s.maxLatencyUs);
+	for (unsigned i = 0 ; i < cameraStats_t::HISTOGRAM_BUCKETS ; i++) {
+		if (s.histogram[i]) {
+			printf( "\t%s%5.1f ms: %u\n",
+				(i == cameraStats_t::HISTOGRAM_BUCKETS-1) ? ">=" : "  ",
+				(i*s.bucketUs)/1000.0, s.histogram[i]);
+		}
+	}
+}
+
+long long camera_t::frameAgeUs(cameraFrame_t const &frame) const
+{
+	return timevalDiffUs(clockNow(clock_),frame.timestamp);
+}
+
 bool camera_t::stopCapture(void){
 	if ( !isOpen() )
 		return false ;
 
-	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	enum v4l2_buf_type type = (enum v4l2_buf_type)fmt_.type;
 	if (-1 == xioctl (fd_, VIDIOC_STREAMOFF, &type)) {
 		perror ("VIDIOC_STREAMOFF");
 		return false ;
@@ -420,10 +736,38 @@ int main(int argc, char const **argv) {
 			params.getCameraHeight(),
 			params.getCameraFPS(),
 			params.getCameraFourcc(),
-			params.getCameraRotation());
+			params.getCameraRotation(),
+			params.getCameraBuffers(),
+			params.getCameraMemory());
 	long long end = tickMs();
 	if ( camera.isOpen() ) {
 		printf( "camera opened in %llu ms\n",end-start);
+		printf( "%u buffers, %u plane(s)%s\n", camera.numBuffers(), camera.numPlanes(),
+			camera.multiplanar() ? " (multi-planar API)" : "");
+		if (camera_t::MEMORY_USERPTR == camera.memory()) {
+			unsigned const pageSize = getpagesize();
+			unsigned const length = (camera.imgSize()+pageSize-1)&~(pageSize-1);
+			bufferHandle_t *userBufs = new bufferHandle_t [camera.numBuffers()];
+			for (unsigned b = 0 ; b < camera.numBuffers(); b++) {
+				memset(userBufs+b,0,sizeof(userBufs[b]));
+				userBufs[b].dmafd = -1 ;
+				userBufs[b].length = length ;
+				if (0 != posix_memalign((void **)&userBufs[b].virt,pageSize,length)) {
+					perror("posix_memalign");
+					return -1 ;
+				}
+			}
+			if (!camera.setUserBuffers(userBufs,camera.numBuffers())) {
+				ERRMSG( "Error setting user buffers\n" );
+				return -1 ;
+			}
+			delete [] userBufs ; // camera_t copies the handles, frame memory lives until exit
+		}
+		bufferHandle_t const *handles = camera.getHandles();
+		for (unsigned b = 0 ; b < camera.numBuffers(); b++) {
+			printf( "buffer %u: %u bytes, dmafd %d, phys 0x%lx\n",
+				b, handles[b].length, handles[b].dmafd, handles[b].phys);
+		}
 		start = tickMs();
 		if ( camera.startCapture() ) {
 			end = tickMs();
@@ -458,6 +802,19 @@ int main(int argc, char const **argv) {
 					}
 					else
 						perror(outFileName);
+
+					// check that the exported DMABUF views the same memory
+					bufferHandle_t const &handle = handles[index];
+					if (0 <= handle.dmafd) {
+						void *dmamem = mmap(0,handle.length,PROT_READ,MAP_SHARED,handle.dmafd,0);
+						if (MAP_FAILED != dmamem) {
+							printf( "dmabuf %d %s frame data\n", handle.dmafd,
+								(0 == memcmp(dmamem,data,camera.imgSize())) ? "matches" : "DOES NOT MATCH");
+							munmap(dmamem,handle.length);
+						}
+						else
+							perror("mmap(dmabuf)");
+					}
 				}
 				start = tickMs();
 				camera.returnFrame(data,index);
@@ -474,6 +831,7 @@ int main(int argc, char const **argv) {
 				printf( "maxGrab: %llu ms, maxRelease: %llu ms\n", maxGrab, maxRelease );
 				unsigned long elapsed = (endCapture-startCapture);
 				printf( "%u frames in %lu ms (%u fps)\n", numFrames, elapsed, (numFrames*1000)/elapsed );
+				camera.dumpStats();
 				rval = 0 ;
 			}
 			else
@@ -11,6 +11,20 @@
  * Note that this class sets the camera file descriptor to
  * non-blocking. Use poll() or select() to wait for a frame.
  *
+ * Each capture buffer is also exported as a DMABUF (VIDIOC_EXPBUF)
+ * when the driver supports it, and described by a bufferHandle_t
+ * so that encoders and displays can import the buffer directly
+ * instead of guessing at physical addresses.
+ *
+ * Both the single-planar and multi-planar (_MPLANE) capture APIs
+ * are supported. The multi-planar API is used only when the device
+ * doesn't offer the single-planar one.
+ *
+ * In MEMORY_USERPTR mode, the camera doesn't allocate any frame
+ * memory. The caller must hand over its own buffers (one per
+ * requested buffer) with setUserBuffers() before startCapture().
+ * This allows capture straight into encoder- or pool-owned memory.
+ *
  * Change History : 
  *
  * $Log$
@@ -21,6 +35,48 @@
 
 #include <linux/videodev2.h>
 #include <sys/poll.h>
+#include <pthread.h>
+#include "bufferHandle.h"
+#include "fourcc.h"
+
+/*
+ * Describes a single captured frame. The index identifies the
+ * buffer for returnFrame() and for consumers of the buffer handles.
+ */
+struct cameraFrame_t {
+	int		index ;
+	void const     *data ;
+	struct timeval	timestamp ;	// capture time from the driver
+	unsigned	sequence ;	// driver frame counter
+};
+
+/*
+ * Capture timing statistics, gathered as frames are dequeued.
+ *
+ * Intervals are measured between driver timestamps of consecutive
+ * frames, and jitter is the smoothed deviation of each interval
+ * from the smoothed average (as in RFC 3550). Latency is the age
+ * of each frame when it was dequeued.
+ *
+ * The interval histogram spans two frame periods at the configured
+ * frame rate (2ms buckets at 30fps, 12.5ms at 5fps), so intervals
+ * of a frame or two late land in their own buckets at any rate.
+ */
+struct cameraStats_t {
+	enum {
+		HISTOGRAM_BUCKETS = 32
+	};
+	unsigned	bucketUs ;		// width of each histogram bucket
+	unsigned	frames ;
+	unsigned	driverDrops ;		// from sequence gaps
+	unsigned	minIntervalUs ;
+	unsigned	maxIntervalUs ;
+	unsigned	avgIntervalUs ;
+	unsigned	jitterUs ;
+	unsigned	avgLatencyUs ;
+	unsigned	maxLatencyUs ;
+	unsigned	histogram[HISTOGRAM_BUCKETS];	// last bucket holds the overflow
+};
 
 class camera_t {
 public:
@@ -32,12 +88,21 @@ public:
 		ROTATE_90_RIGHT = 4,
 		ROTATE_90_LEFT = 7
 	};
+	enum memory_e {
+		MEMORY_MMAP = V4L2_MEMORY_MMAP,
+		MEMORY_USERPTR = V4L2_MEMORY_USERPTR
+	};
+	enum {
+		DEFAULT_BUFFERS = 5
+	};
 	camera_t( char const *devName,
 		  unsigned    width,
 		  unsigned    height,
 		  unsigned    fps,
 		  unsigned    pixelformat,
-		  rotation_e  rotation = ROTATE_NONE );
+		  rotation_e  rotation = ROTATE_NONE,
+		  unsigned    numBuffers = DEFAULT_BUFFERS,
+		  memory_e    memory = MEMORY_MMAP );
 	~camera_t(void);
 
 	bool isOpen(void) const { return 0 <= fd_ ;}
@@ -45,17 +110,33 @@ public:
 
 	unsigned getWidth(void) const { return w_ ;}
 	unsigned getHeight(void) const { return h_ ;}
-	unsigned stride(void) const { return fmt_.fmt.pix.bytesperline ;}
-	unsigned imgSize(void) const { return fmt_.fmt.pix.sizeimage ;}
+	unsigned getFourcc(void) const { return multiplanar() ? fmt_.fmt.pix_mp.pixelformat : fmt_.fmt.pix.pixelformat ;}
+	unsigned stride(void) const { return multiplanar() ? fmt_.fmt.pix_mp.plane_fmt[0].bytesperline : fmt_.fmt.pix.bytesperline ;}
+	unsigned imgSize(void) const { return imgSize_ ;}
+
+	// where Y, U and V are, honoring the line padding reported by the driver
+	frameLayout_t const &layout(void) const { return layout_ ; }
 	unsigned numBuffers(void) const { return n_buffers_ ; }
         struct v4l2_buffer *v4l2_Buffers(void) const { return v4l_buffers_ ;}
 	unsigned char **getBuffers(void) const { return buffers_ ; }
+	bufferHandle_t const *getHandles(void) const { return handles_ ; }
+
+	bool multiplanar(void) const { return V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == fmt_.type ; }
+	unsigned numPlanes(void) const { return num_planes_ ; }
+	// plane mappings for multi-planar formats (plane 0 == getBuffers()[index])
+	unsigned char *getPlane(unsigned index, unsigned plane) const ;
+
+	memory_e memory(void) const { return memory_ ; }
+
+	// USERPTR mode: supply numBuffers() buffers of at least imgSize() bytes
+	bool setUserBuffers(bufferHandle_t const *buffers, unsigned count);
 
 	// capture interface
 	bool startCapture(void);
 
 	// pull frames with this method
 	bool grabFrame(void const *&data,int &index);
+	bool grabFrame(cameraFrame_t &frame);
 
 	// return them with this method
 	void returnFrame(void const *data, int index);
@@ -63,21 +144,47 @@ public:
 	bool stopCapture(void);
 
 	unsigned numRead(void) const { return numRead_ ;}
+	// frames lost by the driver (detected from sequence gaps)
 	unsigned numDropped(void) const { return frame_drops_ ;}
 	unsigned lastRead(void) const { return lastRead_ ;}
+
+	// capture statistics can be read and reset from any thread
+	cameraStats_t stats(void) const ;
+	void resetStats(void);
+	void dumpStats(void) const ;
+
+	// microseconds since the frame was captured, using the driver's clock
+	long long frameAgeUs(cameraFrame_t const &frame) const ;
 private:
+	void initBuffer(struct v4l2_buffer &buf, unsigned index);
+	void updateStats(struct v4l2_buffer const &buf);
+
 	int                     fd_ ;
 	unsigned const          w_ ;
 	unsigned const          h_ ;
+	memory_e		memory_ ;
 	struct pollfd           pfd_ ;
 	struct v4l2_format      fmt_ ;
         struct v4l2_buffer 	*v4l_buffers_ ;
+	struct v4l2_plane	*planes_ ;	// [n_buffers_][VIDEO_MAX_PLANES]
 	unsigned char	        **buffers_ ;
+	unsigned char		**planeMem_ ;	// [n_buffers_][VIDEO_MAX_PLANES]
+	bufferHandle_t		*handles_ ;
 	unsigned                n_buffers_ ;
-	unsigned		buffer_length_ ;
+	unsigned		num_planes_ ;
+	unsigned		imgSize_ ;
+	frameLayout_t		layout_ ;
+	bool			haveUserBuffers_ ;
 	unsigned        	numRead_ ;
 	unsigned                frame_drops_ ;
 	unsigned        	lastRead_ ;
+	int			clock_ ;	// clock of v4l2_buffer.timestamp
+	bool			haveLast_ ;
+	unsigned		lastSequence_ ;
+	struct timeval		lastTimestamp_ ;
+	unsigned		bucketUs_ ;
+	mutable pthread_mutex_t	statsLock_ ;
+	cameraStats_t		stats_ ;
 };
 
 #endif
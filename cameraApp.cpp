@@ -0,0 +1,382 @@
+/*
+ * Module cameraApp.cpp
+ *
+ * This module defines the methods of the cameraApp_t class
+ * and the command-line helpers declared in cameraApp.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "cameraApp.h"
+#include "fourcc.h"
+#include "tickMs.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <signal.h>
+#include <sys/poll.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+
+stringSplit_t::stringSplit_t( char *line )
+: count_( 0 )
+{
+        while ( (count_ < MAXPARTS) && (0 != *line) ) {
+                ptrs_[count_++] = line++ ;
+                while ( isgraph(*line) )
+                        line++ ;
+                if ( *line ) {
+                        *line++ = 0 ;
+                        while ( isspace(*line) )
+                                line++ ;
+                }
+                else
+                        break;
+        }
+}
+
+bool getFraction(char const *cFrac, unsigned max, unsigned &offs ){
+        unsigned numerator ;
+        if ( isdigit(*cFrac) ) {
+                numerator = 0 ;
+                while (isdigit(*cFrac)) {
+                        numerator *= 10 ;
+                        numerator += (*cFrac-'0');
+                        cFrac++ ;
+                }
+        }
+        else
+                numerator = 1 ;
+
+        if ( '/' == *cFrac ) {
+                cFrac++ ;
+                unsigned denominator = 0 ;
+                while ( isdigit(*cFrac) ) {
+                        denominator *= 10 ;
+                        denominator += (*cFrac-'0');
+                        cFrac++ ;
+                }
+                if ( denominator && (numerator <= denominator)) {
+                        offs = (max*numerator)/denominator ;
+                        return true ;
+                }
+        }
+        else if ( '\0' == *cFrac ) {
+                offs = numerator ;
+                return true ;
+        }
+
+        return false ;
+}
+
+void trimCtrl(char *buf){
+        char *tail = buf+strlen(buf);
+        // trim trailing <CR> if needed
+        while ( tail > buf ) {
+                --tail ;
+                if ( iscntrl(*tail) ) {
+                        *tail = '\0' ;
+                }
+                else
+                        break;
+        }
+}
+
+static bool volatile doExit = false ;
+
+static void ctrlcHandler( int signo )
+{
+	printf( "<ctrl-c>(%d)\r\n", signo );
+	doExit = true ;
+}
+
+struct cameraApp_t::stages_t {
+	previewStage_t	*preview ;
+	snapshotSink_t	*rawSnapshot ;
+	snapshotSink_t	*jpegSnapshot ;
+	fileSink_t	*videoFile ;
+	mp4Sink_t	*mp4File ;
+	rtpSink_t	*rtp ;
+#ifndef ANDROID
+	encodeStage_t	*encoder ;
+	preEventSink_t	*preEvent ;
+#endif
+};
+
+cameraApp_t::cameraApp_t(cameraParams_t &params)
+	: params_(params)
+#ifndef ANDROID
+	, pool_(vpu_)
+	, scheduler_(vpu_)
+#endif
+	, camera_("/dev/video0",params.getCameraWidth(),
+		  params.getCameraHeight(),params.getCameraFPS(),
+		  params.getCameraFourcc(),
+		  params.getCameraRotation(),
+		  params.getCameraBuffers(),
+		  params.getCameraMemory())
+#ifndef ANDROID
+	, userBuffers_(0)
+#endif
+	, worked_(false)
+{
+	signal( SIGINT, ctrlcHandler );
+	signal( SIGHUP, ctrlcHandler );
+	printf("Updated version includes video support\n");
+        printf( "format %s\n", fourcc_str(params.getCameraFourcc()));
+	if (!camera_.isOpen()) {
+		fprintf(stderr, "Error opening camera\n" );
+		return ;
+	}
+	printf( "camera opened successfully\n");
+#ifndef ANDROID
+	userBuffers_ = new poolBuffers_t(camera_);
+	if (!userBuffers_->worked()) {
+		fprintf(stderr, "Error supplying capture buffers\n" );
+		return ;
+	}
+#endif
+	worked_ = true ;
+}
+
+cameraApp_t::~cameraApp_t(void)
+{
+#ifndef ANDROID
+	if (userBuffers_)
+		delete userBuffers_ ;
+#endif
+}
+
+void cameraApp_t::command(char *cmd, stages_t &stages)
+{
+        trimCtrl(cmd);
+        stringSplit_t split(cmd);
+        if ( 0 < split.getCount() ) {
+		if (stages.preview->command(split))
+			return ;
+                switch (tolower(split.getPtr(0)[0])) {
+                        case 'c': {
+                            stages.preview->toggleCopy();
+                            printf( "%scopying frames to overlay\n", stages.preview->copying() ? "" : "not " );
+                            break;
+                        }
+                        case 'f': {
+                                        int const fd = stages.preview->getFd();
+                                        struct fb_var_screeninfo variable_info;
+                                        int err = ioctl( fd, FBIOGET_VSCREENINFO, &variable_info );
+                                        if ( 0 == err ) {
+                                                variable_info.yoffset = (0 != variable_info.yoffset) ? 0 : variable_info.yres ;
+                                                err = ioctl( fd, FBIOPAN_DISPLAY, &variable_info );
+                                                if ( 0 == err ) {
+                                                        printf( "flipped to offset %d\n", variable_info.yoffset );
+                                                }
+                                                else
+                                                        perror( "FBIOPAN_DISPLAY" );
+                                        }
+                                        else
+                                                perror( "FBIOGET_VSCREENINFO");
+                                        break;
+                                }
+                        case 's': {
+				if (1 < split.getCount())
+					stages.rawSnapshot->arm(split.getPtr(1));
+				break;
+			}
+#ifndef ANDROID
+                        case 'j': {
+				if (1 < split.getCount()) {
+					stages.jpegSnapshot->arm(split.getPtr(1));
+					stages.encoder->requestJPEG('J' == split.getPtr(0)[0]);
+				}
+				break;
+			}
+                        case 'v': {
+				if (1 < split.getCount()) {
+					char const *fileName = split.getPtr(1);
+					unsigned len = strlen(fileName);
+					bool opened = ((4 < len) && (0 == strcmp(fileName+len-4,".mp4")))
+						    ? stages.mp4File->open(fileName)
+						    : stages.videoFile->open(fileName);
+					if (opened)
+						stages.encoder->startH264();
+				} else {
+					stages.videoFile->close();
+					stages.mp4File->close();
+				}
+				break;
+			}
+                        case 'u': {
+				if ((1 < split.getCount()) && stages.rtp->open(split.getPtr(1))) {
+					char sdp[512];
+					if (stages.rtp->sdp(sdp,sizeof(sdp)))
+						printf( "%s", sdp );
+					stages.encoder->startH264();
+				}
+				break;
+			}
+                        case 'b': {
+				if (1 < split.getCount()) {
+					unsigned kbps = strtoul(split.getPtr(1),0,0);
+					if (stages.encoder->setBitrate(kbps))
+						printf( "H264 bitrate %u kbps\n", kbps );
+				}
+				break;
+			}
+                        case 'e': {
+				if (!stages.preEvent->worked())
+					fprintf(stderr, "no event recording, use -p<seconds>\n" );
+				else if (1 < split.getCount()) {
+					unsigned ms = stages.preEvent->ring().bufferedMs();
+					if (stages.preEvent->trigger(split.getPtr(1)))
+						printf( "recording to %s from %u ms ago\n", split.getPtr(1), ms );
+				}
+				else
+					stages.preEvent->stop();
+				break;
+			}
+#endif
+                        case 'x': {
+				doExit = true ;
+				break;
+			}
+                        case 'r': {
+				stages.preview->reopen();
+				break;
+			}
+                        case '?': {
+                                        printf( "available commands:\n"
+                                                "\tf	- flip buffers\n"
+                                                "\tc	- toggle copy\n"
+                                                "%s"
+                                                "\ts filename - save raw data to filename\n"
+                                                "\tj filename - save JPEG data to filename (J for libjpeg)\n"
+                                                "\tv filename - save H264 video to filename (.mp4 for MP4), v alone stops\n"
+                                                "\tu ip:port  - send H264 video as RTP to ip:port\n"
+                                                "\tb kbps     - set H264 bitrate\n"
+                                                "\te filename - save H264 video from -p seconds ago, e alone stops\n"
+                                                "\tr 	- reopen display\n"
+                                                "\n"
+                                                "most start and end positions can be specified in fractions.\n"
+                                                "	/2 or 1/2 is halfway into buffer or memory\n"
+                                                "	/4 or 1/4 is a quarter of the way into buffer or memory\n",
+                                                stages.preview->help()
+                                              );
+                                }
+                }
+        }
+}
+
+int cameraApp_t::run(previewStage_t &preview)
+{
+	if (!worked_)
+		return -1 ;
+
+	captureThread_t capture(camera_);
+	captureSource_t source(capture,camera_);
+	snapshotSink_t rawSnapshot("raw",pipelineItem_t::RAW);
+	snapshotSink_t jpegSnapshot("jpeg",pipelineItem_t::JPEG);
+	fileSink_t videoFile("file",pipelineItem_t::H264|pipelineItem_t::HEADER);
+	mp4Sink_t mp4File("mp4",camera_.getWidth(),camera_.getHeight());
+	rtpSink_t rtp("rtp");
+#ifndef ANDROID
+	h264_encoder_t::rateControl_t rc ;
+	rc.fps = params_.getCameraFPS();
+	rc.kbps = params_.getBitrate();
+	rc.qp = params_.getQP();
+	rc.sliceBytes = params_.getSliceBytes();
+	rc.intraRefresh = params_.getIntraRefresh();
+	encodeStage_t encoder(pool_,scheduler_,camera_,params_.getGOP(),rc);
+	if (!encoder.prewarm())
+		fprintf(stderr, "Error opening encoders\n");
+	preEventSink_t preEvent("pre-event",
+				params_.getPreEventSeconds() ? params_.getPreEventKB()<<10 : 0,
+				params_.getPreEventSeconds());
+#endif
+	pipeline_t pipeline(3);
+
+	stages_t stages ;
+	stages.preview = &preview ;
+	stages.rawSnapshot = &rawSnapshot ;
+	stages.jpegSnapshot = &jpegSnapshot ;
+	stages.videoFile = &videoFile ;
+	stages.mp4File = &mp4File ;
+	stages.rtp = &rtp ;
+
+	pipeline.setSource(source);
+	pipeline.add(preview);
+	pipeline.add(rawSnapshot);
+	source.connect(preview);
+	source.connect(rawSnapshot);
+#ifndef ANDROID
+	stages.encoder = &encoder ;
+	pipeline.add(encoder);
+	pipeline.add(videoFile);
+	pipeline.add(mp4File);
+	pipeline.add(rtp);
+	pipeline.add(jpegSnapshot);
+	source.connect(encoder);
+	encoder.connect(videoFile);
+	encoder.connect(mp4File);
+	encoder.connect(rtp);
+	rtp.setFeedback(encodeStage_t::congestion,&encoder);
+	encoder.connect(jpegSnapshot);
+	stages.preEvent = &preEvent ;
+	if (preEvent.worked()) {
+		pipeline.add(preEvent);
+		encoder.connect(preEvent);
+		encoder.startH264();
+	}
+#endif
+
+	if (0 <= params_.getSaveFrameNumber())
+		rawSnapshot.arm("/tmp/camera.out",params_.getSaveFrameNumber());
+
+	if (!(capture.start() && pipeline.start())) {
+		fprintf(stderr, "Error starting capture\n" );
+		return -1 ;
+	}
+	printf( "camera streaming started successfully\n");
+
+	long long start = tickMs();
+	unsigned startFrames = capture.numPublished();
+	while (!doExit) {
+		struct pollfd fds[1];
+		fds[0].fd = fileno(stdin); // STDIN
+		fds[0].events = POLLIN|POLLERR;
+		int numReady = poll(fds,1,100);
+		if ( 0 < numReady ) {
+			char inBuf[512];
+			if ( fgets(inBuf,sizeof(inBuf),stdin) ) {
+				command(inBuf,stages);
+				long long elapsed = tickMs()-start;
+				if ( 0LL == elapsed )
+					elapsed = 1 ;
+				unsigned long frameCount = capture.numPublished()-startFrames ;
+				unsigned whole_fps = (frameCount*1000)/elapsed ;
+				unsigned frac_fps = ((frameCount*1000000)/elapsed)%1000 ;
+				printf( "%lu frames, start %llu, elapsed %llu %u.%03u fps. %u dropped\n",
+					frameCount, start, elapsed, whole_fps, frac_fps,
+					camera_.numDropped() + capture.numDropped() );
+				camera_.dumpStats();
+				camera_.resetStats();
+				pipeline.dumpStats();
+				pipeline.resetStats();
+#ifndef ANDROID
+				scheduler_.dumpStats();
+				scheduler_.resetStats();
+#endif
+				startFrames = capture.numPublished();
+				start = tickMs();
+			}
+			else {
+				printf( "[eof]\n");
+				break;
+			}
+		}
+	}
+	pipeline.stop();
+	preview.stopped();
+	capture.stop();
+        return 0 ;
+}
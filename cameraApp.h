@@ -0,0 +1,116 @@
+#ifndef __CAMERAAPP_H__
+#define __CAMERAAPP_H__ "$Id$"
+
+/*
+ * cameraApp.h
+ *
+ * This header file declares the cameraApp_t class, which is what
+ * camera_to_fb2 and camera_to_v4l have in common: it opens the VPU
+ * and the camera, runs the pipeline
+ *
+ *	capture -+-> preview
+ *		 +-> raw snapshot
+ *		 +-> encode -+-> H.264 file
+ *			     +-> MP4 file
+ *			     +-> H.264 RTP
+ *			     +-> JPEG snapshot
+ *			     +-> pre-event ring (-p)
+ *
+ * and takes commands from stdin until 'x', ctrl-c or end of file.
+ *
+ * Each program supplies the preview, a previewStage_t that shows
+ * frames on its display. It can add commands of its own through
+ * command() and help().
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "cameraStages.h"
+#include "cameraParams.h"
+#include "camera.h"
+
+/*
+ * Splits a command line into words, in place.
+ */
+class stringSplit_t {
+public:
+        enum {
+                MAXPARTS = 16
+        };
+
+        stringSplit_t( char *line );
+
+        unsigned getCount(void){ return count_ ;}
+        char const *getPtr(unsigned idx){ return ptrs_ [idx];}
+
+private:
+        stringSplit_t(stringSplit_t const &);
+
+        unsigned count_ ;
+        char    *ptrs_[MAXPARTS];
+};
+
+// "n", "n/d" or "/d" of max, into offs
+bool getFraction(char const *cFrac, unsigned max, unsigned &offs);
+
+// trims trailing control characters (<CR>, <LF>)
+void trimCtrl(char *buf);
+
+class previewStage_t : public pipelineStage_t {
+public:
+	previewStage_t(void)
+		: pipelineStage_t("preview",1)
+		, copy_(true) {}
+	virtual ~previewStage_t(void){}
+
+	// 'c' stops and starts copying frames to the display
+	bool copying(void) const { return copy_ ; }
+	void toggleCopy(void){ copy_ = !copy_ ; }
+
+	// of the display, for 'f'
+	virtual int getFd(void) = 0 ;
+
+	// 'r': re-opens the display with the current parameters
+	virtual void reopen(void) = 0 ;
+
+	// returns true if the command is one of the display's own
+	virtual bool command(stringSplit_t &split){ return false ; }
+	virtual char const *help(void) const { return "" ; }
+
+	// the pipeline has stopped, but capture hasn't yet
+	virtual void stopped(void){}
+private:
+	bool volatile copy_ ;
+};
+
+class cameraApp_t {
+public:
+	cameraApp_t(cameraParams_t &params);
+	~cameraApp_t(void);
+
+	bool worked(void) const { return worked_ ; }
+	camera_t &camera(void){ return camera_ ; }
+
+	// runs until told to exit. Returns the exit code.
+	int run(previewStage_t &preview);
+
+private:
+	cameraApp_t(cameraApp_t const &); // no copies
+
+	struct stages_t ;
+	void command(char *cmd, stages_t &stages);
+
+	cameraParams_t &params_ ;
+#ifndef ANDROID
+	vpu_t		vpu_ ;
+	encoderPool_t	pool_ ;
+	vpuScheduler_t	scheduler_ ;
+#endif
+	camera_t	camera_ ;
+#ifndef ANDROID
+	poolBuffers_t  *userBuffers_ ;
+#endif
+	bool		worked_ ;
+};
+
+#endif
@@ -46,7 +46,15 @@ cameraParams_t::cameraParams_t( int &argc, char const **&argv )
 , rotation(camera_t::ROTATE_NONE)
 , fps(30)
 , fourcc(V4L2_PIX_FMT_YUV420)
+, numBuffers(camera_t::DEFAULT_BUFFERS)
+, memory(camera_t::MEMORY_MMAP)
 , gopSize(0)
+, kbps(0)
+, qp(25)
+, sliceBytes(0)
+, intraRefresh(0)
+, preEventSeconds(0)
+, preEventKB(4096)
 , x(0)
 , y(0)
 , outwidth(480)
@@ -83,6 +91,9 @@ cameraParams_t::cameraParams_t( int &argc, char const **&argv )
 				else if ('h'==second) {
 					inheight = strtoul(param+2,0,0);
 				}
+				else if ('r'==second) {
+					intraRefresh = strtoul(param+2,0,0);
+				}
 				else if (isdigit(second))
 					iterations=strtol(param+1,0,0);
 				else
@@ -94,6 +105,25 @@ cameraParams_t::cameraParams_t( int &argc, char const **&argv )
 			else if( 'g' == tolower(*param) ){
 				gopSize = strtol(param+1,0,0);
 			}
+			else if ( 'v' == cmdchar ) {
+				kbps = strtoul(param+1,0,0);
+			}
+			else if ( 'm' == cmdchar ) {
+				sliceBytes = strtoul(param+1,0,0);
+			}
+			else if ( 'p' == cmdchar ) {
+				if ('k' == tolower(param[1]))
+					preEventKB = strtoul(param+2,0,0);
+				else
+					preEventSeconds = strtoul(param+1,0,0);
+			}
+			else if ( 'q' == cmdchar ) {
+				qp = strtoul(param+1,0,0);
+				if (51 < qp) {
+					fprintf(stderr, "Invalid quantizer %s, use 0..51\n", param+1);
+					qp = 25 ;
+				}
+			}
 			else if( '4' == *param ) {
 				unsigned fcc ; 
 				if(supported_fourcc(param+1,fcc)){
@@ -149,6 +179,16 @@ cameraParams_t::cameraParams_t( int &argc, char const **&argv )
 						}
 				}
 			}
+			else if ( 'n' == cmdchar ) {
+				numBuffers = strtoul(param+1,0,0);
+				if (2 > numBuffers) {
+					fprintf(stderr, "Invalid buffer count %s, need at least 2\n", param+1);
+					numBuffers = camera_t::DEFAULT_BUFFERS ;
+				}
+			}
+			else if ( 'u' == cmdchar ) {
+				memory = camera_t::MEMORY_USERPTR ;
+			}
 			else if ( 's' == cmdchar ) {
 				saveFrame = strtol(param+1,0,0);
 			}
@@ -158,7 +198,15 @@ cameraParams_t::cameraParams_t( int &argc, char const **&argv )
 					"\t-ih272        - set input height to 272\n"
 					"\t-f30          - set camera frames per second to 30\n"
 					"\t-4I420        - set camera fourcc to I420\n"
+					"\t-n5           - use 5 capture buffers\n"
+					"\t-u            - capture into user pointers instead of mmap\n"
 					"\t-g5           - set Group of Pictures (GOP) size to 5\n"
+					"\t-v2000        - set H.264 bitrate to 2000 kbps (default constant QP)\n"
+					"\t-q25          - set H.264 quantizer for constant QP to 25\n"
+					"\t-m1400        - split H.264 frames into slices of about 1400 bytes\n"
+					"\t-ir20         - intra-refresh 20 macroblocks per frame (use -g0 for no I-frames)\n"
+					"\t-p10          - keep the last 10 seconds of H.264 for event recording\n"
+					"\t-pk4096       - use up to 4096 KB for event recording\n"
 					"\t-x10          - set preview x position to 10\n"
 					"\t-y10          - set preview y position to 10\n"
 					"\t-ow480        - set preview width to 480\n"
@@ -196,7 +244,15 @@ void cameraParams_t::dump(void) const {
 		"	rotation == %u\n"
 		"	fps == %u\n"
 		"	fourcc == %s\n"
+		"	numBuffers == %u\n"
+		"	memory == %s\n"
 		"	gopSize == %u\n"
+		"	kbps == %u\n"
+		"	qp == %u\n"
+		"	sliceBytes == %u\n"
+		"	intraRefresh == %u\n"
+		"	preEventSeconds == %u\n"
+		"	preEventKB == %u\n"
 		"	x == %u\n"
 		"	y == %u\n"
 		"	outwidth == %u\n"
@@ -211,7 +267,15 @@ void cameraParams_t::dump(void) const {
 		, rotation
 		, fps
 		, fourcc_str(fourcc)
+		, numBuffers
+		, (camera_t::MEMORY_USERPTR == memory) ? "userptr" : "mmap"
 		, gopSize
+		, kbps
+		, qp
+		, sliceBytes
+		, intraRefresh
+		, preEventSeconds
+		, preEventKB
 		, x
 		, y
 		, outwidth
@@ -11,6 +11,7 @@
  * options to control:
  *
  *		input width, height, color-space, and rotation
+ *		capture buffer count and memory type (mmap or user pointers)
  *		preview width, height, position, transparency, and color-blending
  *
  * Copyright Boundary Devices, Inc. 2010
@@ -29,8 +30,16 @@ public:
 	char const *getCameraDeviceName(void) const { return cameraDevName ; }
 	unsigned getCameraFPS(void) const { return fps ; }
 	unsigned getCameraFourcc(void) const { return fourcc ; }
+	unsigned getCameraBuffers(void) const { return numBuffers ; }
+	camera_t::memory_e getCameraMemory(void) const { return memory ; }
 
 	unsigned getGOP(void) const { return gopSize ; }
+	unsigned getBitrate(void) const { return kbps ; }	// 0 for constant QP
+	unsigned getQP(void) const { return qp ; }
+	unsigned getSliceBytes(void) const { return sliceBytes ; }	// 0 for one slice per frame
+	unsigned getIntraRefresh(void) const { return intraRefresh ; }	// macroblocks per frame
+	unsigned getPreEventSeconds(void) const { return preEventSeconds ; }	// 0 for none
+	unsigned getPreEventKB(void) const { return preEventKB ; }
 
 	unsigned getPreviewX(void) const { return x ; }
 	unsigned getPreviewY(void) const { return y ; }
@@ -55,7 +64,15 @@ private:
 	camera_t::rotation_e rotation ;
 	unsigned fps ;
 	unsigned fourcc ;
+	unsigned numBuffers ;
+	camera_t::memory_e memory ;
 	unsigned gopSize ;
+	unsigned kbps ;
+	unsigned qp ;
+	unsigned sliceBytes ;
+	unsigned intraRefresh ;
+	unsigned preEventSeconds ;
+	unsigned preEventKB ;
 	unsigned x ;
 	unsigned y ;
 	unsigned outwidth ;
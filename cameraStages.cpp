@@ -0,0 +1,605 @@
+/*
+ * Module cameraStages.cpp
+ *
+ * This module defines the pipeline stages declared in
+ * cameraStages.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "cameraStages.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "debugPrint.h"
+
+#ifndef ANDROID
+#include "libjpeg_encoder.h"
+#endif
+
+captureSource_t::captureSource_t(captureThread_t &capture, camera_t &camera)
+	: pipelineSource_t("capture")
+	, capture_(capture)
+	, camera_(camera)
+{
+}
+
+void captureSource_t::releaseFrame(pipelineItem_t *item, void *opaque)
+{
+	((captureThread_t *)opaque)->release(item->frame);
+}
+
+bool captureSource_t::produce(void)
+{
+	cameraFrame_t frame ;
+	if (!capture_.getFrame(0,frame,100))
+		return capture_.running();
+
+	pipelineItem_t *item = pipelineItem_t::alloc(pipelineItem_t::RAW,0,releaseFrame,&capture_);
+	if (0 == item) {
+		capture_.release(frame);
+		return true ;
+	}
+	item->frame = frame ;
+	item->data = frame.data ;
+	item->length = camera_.imgSize();
+	emit(item);
+	item->release();
+	return true ;
+}
+
+#ifndef ANDROID
+
+poolBuffers_t::poolBuffers_t(camera_t &camera)
+	: count_(0)
+	, blocks_(0)
+	, worked_(true)
+{
+	if (camera_t::MEMORY_USERPTR != camera.memory())
+		return ;
+	physPool_t &pool = physPool_t::shared();
+	blocks_ = new physPool_t::block_t *[camera.numBuffers()];
+	bufferHandle_t *handles = new bufferHandle_t [camera.numBuffers()];
+	for (count_ = 0 ; count_ < camera.numBuffers() ; count_++) {
+		physPool_t::block_t *block = pool.alloc(camera.imgSize());
+		if (0 == block) {
+			fprintf(stderr, "%s: no memory for capture buffer %u\n", __func__, count_);
+			break;
+		}
+		blocks_[count_] = block ;
+		memset(handles+count_,0,sizeof(handles[count_]));
+		handles[count_].dmafd = block->fd ;
+		handles[count_].phys = block->phys ;
+		handles[count_].virt = block->virt ;
+		handles[count_].length = block->size ;
+		handles[count_].index = count_ ;
+	}
+	worked_ = (count_ == camera.numBuffers())
+		  && camera.setUserBuffers(handles,count_);
+	delete [] handles ;
+}
+
+poolBuffers_t::~poolBuffers_t(void)
+{
+	while (count_)
+		physPool_t::shared().release(blocks_[--count_]);
+	delete [] blocks_ ;
+}
+
+encodeStage_t::encodeStage_t
+	( encoderPool_t &pool,
+	  vpuScheduler_t &scheduler,
+	  camera_t &camera,
+	  unsigned gopSize,
+	  h264_encoder_t::rateControl_t const &rc )
+	: pipelineStage_t("encode",2)
+	, pool_(pool)
+	, scheduler_(scheduler)
+	, camera_(camera)
+	, gopSize_(gopSize)
+	, rc_(rc)
+	, h264_(false)
+	, restart_(false)
+	, jpegPending_(false)
+	, jpegSoftware_(false)
+	, h264Encoder_(0)
+	, jpegEncoder_(0)
+	, softJpeg_(0)
+	, closing_(false)
+	, h264Jobs_(0)
+	, h264Dropped_(0)
+{
+}
+
+encodeStage_t::~encodeStage_t(void)
+{
+	// the pipeline may be gone, so drop the output of queued frames
+	closing_ = true ;
+	scheduler_.drain();
+	if (h264Encoder_)
+		pool_.put(h264Encoder_);
+	if (jpegEncoder_)
+		pool_.put(jpegEncoder_);
+	delete softJpeg_ ;
+}
+
+bool encodeStage_t::getH264(void)
+{
+	h264Encoder_ = pool_.getH264(camera_.getWidth(),
+				     camera_.getHeight(),
+				     camera_.getFourcc(),
+				     gopSize_,
+				     camera_.getHandles(),
+				     camera_.numBuffers(),
+				     camera_.stride(),
+				     rc_);
+	return 0 != h264Encoder_ ;
+}
+
+bool encodeStage_t::getJPEG(void)
+{
+	jpegEncoder_ = pool_.getJPEG(camera_.getWidth(),
+				     camera_.getHeight(),
+				     camera_.getFourcc(),
+				     camera_.getHandles(),
+				     camera_.numBuffers(),
+				     camera_.stride());
+	return 0 != jpegEncoder_ ;
+}
+
+bool encodeStage_t::prewarm(void)
+{
+	bool worked = true ;
+	if ((0 == h264Encoder_) && !getH264())
+		worked = false ;
+	if ((0 == jpegEncoder_) && !getJPEG())
+		worked = false ;
+	return worked ;
+}
+
+bool encodeStage_t::setBitrate(unsigned kbps)
+{
+	h264_encoder_t *encoder = h264Encoder_ ;
+	if (encoder && !encoder->setBitrate(kbps))
+		return false ;
+	rc_.kbps = kbps ;	// for the next stream
+	return true ;
+}
+
+void encodeStage_t::rateFeedback(bool congested)
+{
+	h264_encoder_t *encoder = h264Encoder_ ;
+	if (encoder)
+		encoder->rateFeedback(congested);
+}
+
+void encodeStage_t::congestion(bool congested, void *encodeStage)
+{
+	((encodeStage_t *)encodeStage)->rateFeedback(congested);
+}
+
+/*
+ * Copies data that the encoder re-uses (e.g. SPS and PPS headers)
+ * into the item before passing it on.
+ */
+void encodeStage_t::emitCopy
+	( unsigned type,
+	  pipelineItem_t const *src,
+	  void const *data,
+	  unsigned length )
+{
+	pipelineItem_t *item = pipelineItem_t::alloc(type,length);
+	if (0 == item)
+		return ;
+	memcpy(item->buffer(),data,length);
+	item->frame = src->frame ;
+	item->startUs = src->startUs ;
+	emit(item);
+	item->release();
+}
+
+/*
+ * VPU output is passed on without a copy. The encoder's output
+ * slot is released when the last sink is done with the item.
+ */
+void encodeStage_t::releaseH264(pipelineItem_t *item, void *opaque)
+{
+	((h264_encoder_t *)opaque)->releaseOutput(item->data);
+}
+
+void encodeStage_t::releaseJPEG(pipelineItem_t *item, void *opaque)
+{
+	((mjpeg_encoder_t *)opaque)->releaseOutput(item->data);
+}
+
+bool encodeStage_t::emitOutput
+	( unsigned type,
+	  pipelineItem_t const *src,
+	  void const *data,
+	  unsigned length,
+	  pipelineItem_t::release_t onRelease,
+	  void *encoder )
+{
+	pipelineItem_t *item = pipelineItem_t::alloc(type,0,onRelease,encoder);
+	if (0 == item)
+		return false ;
+	item->data = data ;
+	item->length = length ;
+	item->frame = src->frame ;
+	item->startUs = src->startUs ;
+	emit(item);
+	item->release();
+	return true ;
+}
+
+void encodeStage_t::encodeJPEG(pipelineItem_t *item)
+{
+	jpegPending_ = false ;
+	if (jpegSoftware_) {
+		// stripes across the cores, since a still can be big
+		if (0 == softJpeg_) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			softJpeg_ = new libjpeg_encoder_t(camera_.layout(),
+							  libjpeg_encoder_t::settings_t(),
+							  (0 < cpus) ? cpus : 1);
+		}
+		if (softJpeg_->encode((unsigned char const *)item->data,item->length))
+			emitCopy(pipelineItem_t::JPEG,item,softJpeg_->jpegData(),softJpeg_->dataSize());
+		else
+			ERRMSG("%s: libjpeg encode error\n", name());
+		return ;
+	}
+	if ((0 == jpegEncoder_) && !getJPEG()) {
+		ERRMSG("%s: no JPEG encoder\n", name());
+		return ;
+	}
+	// the item holds the camera buffer until the VPU is done with it
+	item->addRef();
+	if (!scheduler_.submitJPEG(*jpegEncoder_,item->frame.index,
+				   vpuScheduler_t::PRIORITY_STILL,
+				   item->startUs+STILL_DEADLINE_MS*1000,
+				   jpegDone,this,item)) {
+		ERRMSG("%s: JPEG queue full\n", name());
+		item->release();
+	}
+}
+
+void encodeStage_t::jpegDone(vpuScheduler_t::result_t const &result, void *opaque)
+{
+	encodeStage_t *stage = (encodeStage_t *)opaque ;
+	pipelineItem_t *item = (pipelineItem_t *)result.tag ;
+	if (!result.worked)
+		ERRMSG("%s: JPEG encode error\n", stage->name());
+	else if (stage->closing_
+		 || !stage->emitOutput(pipelineItem_t::JPEG,item,result.data,result.length,
+				       releaseJPEG,stage->jpegEncoder_))
+		stage->jpegEncoder_->releaseOutput(result.data);
+	else
+		debugPrint("%s: JPEG waited %u us for the VPU, encoded in %u us\n",
+			   stage->name(), result.queueUs, result.encodeUs);
+	item->release();
+}
+
+void encodeStage_t::encodeH264(pipelineItem_t *item)
+{
+	if (restart_ || (0 == h264Encoder_)) {
+		restart_ = false ;
+		// frames of the last stream must be out before reconfiguring
+		if (h264Jobs_)
+			scheduler_.drain();
+		if (h264Encoder_ && !h264Encoder_->reconfigure(gopSize_,rc_)) {
+			pool_.put(h264Encoder_);
+			h264Encoder_ = 0 ;
+		}
+		if ((0 == h264Encoder_) && !getH264()) {
+			ERRMSG("%s: no H.264 encoder\n", name());
+			h264_ = false ;
+			return ;
+		}
+	}
+
+	// don't hold more camera buffers than the VPU can catch up on
+	if (MAXH264JOBS <= h264Jobs_) {
+		h264Dropped_++ ;
+		return ;
+	}
+	unsigned fps = rc_.fps ? rc_.fps : 30 ;
+	item->addRef();
+	__sync_fetch_and_add(&h264Jobs_,1);
+	if (!scheduler_.submitH264(*h264Encoder_,item->frame.index,
+				   vpuScheduler_t::PRIORITY_STREAM,
+				   item->startUs+1000000/fps,
+				   h264Done,this,item)) {
+		__sync_fetch_and_sub(&h264Jobs_,1);
+		h264Dropped_++ ;
+		item->release();
+	}
+}
+
+void encodeStage_t::h264Done(vpuScheduler_t::result_t const &result, void *opaque)
+{
+	encodeStage_t *stage = (encodeStage_t *)opaque ;
+	h264_encoder_t *encoder = stage->h264Encoder_ ;
+	pipelineItem_t *item = (pipelineItem_t *)result.tag ;
+	if (!result.worked) {
+		ERRMSG("%s: encode error(%d)\n", stage->name(), item->frame.index);
+	} else if (stage->closing_) {
+		encoder->releaseOutput(result.data);
+	} else {
+		if (result.iframe) {
+			void const *spsdata ;
+			unsigned sps_len ;
+			void const *ppsdata ;
+			unsigned pps_len ;
+			if (encoder->getSPS(spsdata,sps_len)
+			    &&
+			    encoder->getPPS(ppsdata,pps_len)) {
+				stage->emitCopy(pipelineItem_t::HEADER,item,spsdata,sps_len);
+				stage->emitCopy(pipelineItem_t::HEADER,item,ppsdata,pps_len);
+			}
+		}
+		if (!stage->emitOutput(pipelineItem_t::H264|(result.iframe ? pipelineItem_t::KEYFRAME : 0),
+				       item,result.data,result.length,releaseH264,encoder))
+			encoder->releaseOutput(result.data);
+	}
+	item->release();
+	__sync_fetch_and_sub(&stage->h264Jobs_,1);
+}
+
+/*
+ * Encoding is queued to the VPU scheduler and completes in its
+ * thread, so the worker is free for preview while the VPU runs.
+ * Stream frames take priority over stills, and a still is encoded
+ * between two stream frames.
+ */
+void encodeStage_t::process(pipelineItem_t *item)
+{
+	if (0 == (item->type & pipelineItem_t::RAW))
+		return ;
+	if (h264_)
+		encodeH264(item);
+	if (jpegPending_)
+		encodeJPEG(item);
+}
+
+#endif
+
+fileSink_t::fileSink_t(char const *name, unsigned typeMask, unsigned maxQueued)
+	: pipelineStage_t(name,maxQueued)
+	, typeMask_(typeMask)
+	, fOut_(0)
+	, haveKeyframe_(false)
+{
+	pthread_mutex_init(&lock_,0);
+}
+
+fileSink_t::~fileSink_t(void)
+{
+	close();
+	pthread_mutex_destroy(&lock_);
+}
+
+bool fileSink_t::open(char const *fileName)
+{
+	FILE *fOut = fopen(fileName,"wb");
+	if (0 == fOut) {
+		perror(fileName);
+		return false ;
+	}
+	pthread_mutex_lock(&lock_);
+	if (fOut_)
+		fclose(fOut_);
+	fOut_ = fOut ;
+	haveKeyframe_ = false ;
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+void fileSink_t::close(void)
+{
+	pthread_mutex_lock(&lock_);
+	if (fOut_) {
+		fclose(fOut_);
+		fOut_ = 0 ;
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+void fileSink_t::process(pipelineItem_t *item)
+{
+	if (0 == (item->type & typeMask_))
+		return ;
+	pthread_mutex_lock(&lock_);
+	if (fOut_) {
+		// H.264 streams must start with the headers
+		if (item->type & pipelineItem_t::HEADER)
+			haveKeyframe_ = true ;
+		if (haveKeyframe_ || !(item->type & pipelineItem_t::H264)) {
+			if (1 != fwrite(item->data,item->length,1,fOut_))
+				perror(name());
+		}
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+mp4Sink_t::mp4Sink_t
+	( char const *name,
+	  unsigned width,
+	  unsigned height,
+	  unsigned maxQueued )
+	: pipelineStage_t(name,maxQueued)
+	, mux_(mp4Mux_t::H264,width,height)
+{
+	pthread_mutex_init(&lock_,0);
+}
+
+mp4Sink_t::~mp4Sink_t(void)
+{
+	close();
+	pthread_mutex_destroy(&lock_);
+}
+
+bool mp4Sink_t::open(char const *fileName)
+{
+	pthread_mutex_lock(&lock_);
+	bool worked = mux_.open(fileName);
+	pthread_mutex_unlock(&lock_);
+	return worked ;
+}
+
+void mp4Sink_t::close(void)
+{
+	pthread_mutex_lock(&lock_);
+	if (mux_.isOpen()) {
+		mux_.close();
+		printf("%s: %u frames, %u fragments, %u dropped\n", name(),
+		       mux_.numFrames(), mux_.numFragments(), mux_.numDropped());
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+void mp4Sink_t::process(pipelineItem_t *item)
+{
+	pthread_mutex_lock(&lock_);
+	if (item->type & pipelineItem_t::HEADER)
+		mux_.addHeader(item->data,item->length);
+	else if (item->type & pipelineItem_t::H264) {
+		// capture time, not when the frame entered the pipeline
+		struct timeval const &tv = item->frame.timestamp ;
+		mux_.addFrame(item->data,item->length,
+			      (long long)tv.tv_sec*1000000 + tv.tv_usec,
+			      0 != (item->type & pipelineItem_t::KEYFRAME));
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+snapshotSink_t::snapshotSink_t(char const *name, unsigned typeMask)
+	: pipelineStage_t(name,1)
+	, typeMask_(typeMask)
+	, fileName_(0)
+	, skip_(0)
+{
+	pthread_mutex_init(&lock_,0);
+}
+
+snapshotSink_t::~snapshotSink_t(void)
+{
+	if (fileName_)
+		free(fileName_);
+	pthread_mutex_destroy(&lock_);
+}
+
+void snapshotSink_t::arm(char const *fileName, unsigned skip)
+{
+	pthread_mutex_lock(&lock_);
+	if (fileName_)
+		free(fileName_);
+	fileName_ = strdup(fileName);
+	skip_ = skip ;
+	pthread_mutex_unlock(&lock_);
+}
+
+void snapshotSink_t::process(pipelineItem_t *item)
+{
+	if (0 == (item->type & typeMask_))
+		return ;
+	char *fileName = 0 ;
+	pthread_mutex_lock(&lock_);
+	if (fileName_) {
+		if (0 == skip_) {
+			fileName = fileName_ ;
+			fileName_ = 0 ;
+		}
+		else
+			--skip_ ;
+	}
+	pthread_mutex_unlock(&lock_);
+	if (0 == fileName)
+		return ;
+
+	FILE *fOut = fopen(fileName,"wb");
+	if (fOut) {
+		fwrite(item->data,1,item->length,fOut);
+		fclose(fOut);
+		printf( "saved %u bytes of img %d to %s\n", item->length, item->frame.index, fileName);
+	} else
+		perror(fileName);
+	free(fileName);
+}
+
+rtpSink_t::rtpSink_t(char const *name, unsigned maxQueued, unsigned mtu)
+	: pipelineStage_t(name,maxQueued)
+	, rtp_(mtu)
+	, feedback_(0)
+	, feedbackOpaque_(0)
+{
+	pthread_mutex_init(&lock_,0);
+}
+
+rtpSink_t::~rtpSink_t(void)
+{
+	close();
+	pthread_mutex_destroy(&lock_);
+}
+
+bool rtpSink_t::open(char const *target)
+{
+	pthread_mutex_lock(&lock_);
+	bool worked = rtp_.open(target);
+	pthread_mutex_unlock(&lock_);
+	return worked ;
+}
+
+void rtpSink_t::close(void)
+{
+	pthread_mutex_lock(&lock_);
+	rtp_.close();
+	pthread_mutex_unlock(&lock_);
+}
+
+bool rtpSink_t::sdp(char *buf, unsigned size)
+{
+	pthread_mutex_lock(&lock_);
+	bool worked = rtp_.isOpen() && rtp_.sdp(buf,size);
+	pthread_mutex_unlock(&lock_);
+	return worked ;
+}
+
+void rtpSink_t::process(pipelineItem_t *item)
+{
+	if (0 == (item->type & (pipelineItem_t::H264|pipelineItem_t::HEADER)))
+		return ;
+	bool congested = (queued() > maxQueued()/2);
+	pthread_mutex_lock(&lock_);
+	bool const isOpen = rtp_.isOpen();
+	if (isOpen
+	    && !rtp_.send(item->data,item->length,item->frame.timestamp,
+			  0 != (item->type & pipelineItem_t::KEYFRAME)))
+		congested = true ;
+	pthread_mutex_unlock(&lock_);
+	// headers go out with the frame that follows
+	if (isOpen && feedback_ && (item->type & pipelineItem_t::H264))
+		feedback_(congested,feedbackOpaque_);
+}
+
+preEventSink_t::preEventSink_t
+	( char const *name,
+	  unsigned bytes,
+	  unsigned seconds,
+	  unsigned maxQueued )
+	: pipelineStage_t(name,maxQueued)
+	, ring_(bytes,seconds)
+{
+}
+
+void preEventSink_t::process(pipelineItem_t *item)
+{
+	if (0 == (item->type & (pipelineItem_t::H264|pipelineItem_t::HEADER)))
+		return ;
+	unsigned flags = 0 ;
+	if (item->type & pipelineItem_t::KEYFRAME)
+		flags |= gopRing_t::KEYFRAME ;
+	if (item->type & pipelineItem_t::HEADER)
+		flags |= gopRing_t::HEADER ;
+	ring_.add(item->data,item->length,flags,item->startUs);
+}
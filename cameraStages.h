@@ -0,0 +1,249 @@
+#ifndef __CAMERASTAGES_H__
+#define __CAMERASTAGES_H__ "$Id$"
+
+/*
+ * cameraStages.h
+ *
+ * This header file declares the pipeline stages shared by the
+ * camera test programs (see pipeline.h):
+ *
+ *	poolBuffers_t	- physPool_t memory for a USERPTR camera
+ *	captureSource_t	- publishes camera frames from a captureThread_t
+ *	encodeStage_t	- H.264 and JPEG encoding of camera frames
+ *	fileSink_t	- appends matching items to a file
+ *	mp4Sink_t	- writes H.264 to an MP4 file with capture
+ *			  timestamps (see mp4Mux.h)
+ *	snapshotSink_t	- writes one matching item to a file
+ *	rtpSink_t	- streams H.264 as RTP (see rtpH264.h)
+ *	preEventSink_t	- keeps the last few seconds of H.264 for
+ *			  event-triggered recording (see gopRing.h)
+ *
+ * The file and snapshot sinks take a mask of pipelineItem_t types
+ * and ignore other items, so they can all be connected to the same producer. Their
+ * targets can be changed from another thread while the pipeline
+ * is running.
+ *
+ * An rtpSink_t can report congestion (a backed-up queue or failed
+ * sends) to a feedback_t, such as encodeStage_t::congestion(), so
+ * the encoder can lower its bitrate to match the link.
+ *
+ * encodeStage_t takes its encoders from an encoderPool_t and runs
+ * them through a vpuScheduler_t, so a JPEG still can be taken
+ * while H.264 streams without holding up the stream. Call
+ * prewarm() before starting the pipeline so that the first video
+ * or snapshot request doesn't stall the capture path while the
+ * encoders open.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "pipeline.h"
+#include "captureThread.h"
+#include "rtpH264.h"
+#include "gopRing.h"
+#include "mp4Mux.h"
+#include <stdio.h>
+
+#ifndef ANDROID
+#include "imx_vpu.h"
+#include "imx_mjpeg_encoder.h"
+#include "imx_h264_encoder.h"
+#include "encoderPool.h"
+#include "vpuScheduler.h"
+#include "physPool.h"
+
+class libjpeg_encoder_t ;
+
+/*
+ * Hands a camera opened with MEMORY_USERPTR its frame buffers,
+ * from physPool_t::shared(), so that captured frames have the
+ * physical addresses the VPU and IPU need without a copy. Does
+ * nothing for an mmap camera. Keep it until capture has stopped.
+ */
+class poolBuffers_t {
+public:
+	poolBuffers_t(camera_t &camera);
+	~poolBuffers_t(void);
+
+	bool worked(void) const { return worked_ ; }
+private:
+	poolBuffers_t(poolBuffers_t const &); // no copies
+
+	unsigned		count_ ;
+	physPool_t::block_t   **blocks_ ;
+	bool			worked_ ;
+};
+#endif
+
+class captureSource_t : public pipelineSource_t {
+public:
+	captureSource_t(captureThread_t &capture, camera_t &camera);
+	virtual ~captureSource_t(void){}
+
+	virtual bool produce(void);
+private:
+	static void releaseFrame(pipelineItem_t *item, void *opaque);
+
+	captureThread_t &capture_ ;
+	camera_t	&camera_ ;
+};
+
+#ifndef ANDROID
+class encodeStage_t : public pipelineStage_t {
+public:
+	enum {
+		MAXH264JOBS = 2,	// frames queued to the VPU
+		STILL_DEADLINE_MS = 500
+	};
+
+	encodeStage_t(encoderPool_t &pool, vpuScheduler_t &scheduler,
+		      camera_t &camera, unsigned gopSize,
+		      h264_encoder_t::rateControl_t const &rc = h264_encoder_t::rateControl_t());
+	virtual ~encodeStage_t(void);
+
+	// open both encoders now, before the pipeline is started
+	bool prewarm(void);
+
+	// each start begins a new stream, with an IDR frame and headers
+	void startH264(void){ restart_ = true ; h264_ = true ; }
+	void stopH264(void){ h264_ = false ; }
+	bool encodingH264(void) const { return h264_ ; }
+
+	// H.264 rate control, see h264_encoder_t
+	bool setBitrate(unsigned kbps);
+	void rateFeedback(bool congested);
+	static void congestion(bool congested, void *encodeStage);
+
+	// encode the next frame as JPEG, with libjpeg if software
+	void requestJPEG(bool software){ jpegSoftware_ = software ; jpegPending_ = true ; }
+
+	// stream frames skipped because the VPU fell behind
+	unsigned numH264Dropped(void) const { return h264Dropped_ ; }
+
+	virtual void process(pipelineItem_t *item);
+private:
+	void emitCopy(unsigned type, pipelineItem_t const *src, void const *data, unsigned length);
+	bool emitOutput(unsigned type, pipelineItem_t const *src, void const *data, unsigned length,
+			pipelineItem_t::release_t onRelease, void *encoder);
+	static void releaseH264(pipelineItem_t *item, void *opaque);
+	static void releaseJPEG(pipelineItem_t *item, void *opaque);
+	void encodeJPEG(pipelineItem_t *item);
+	void encodeH264(pipelineItem_t *item);
+	static void jpegDone(vpuScheduler_t::result_t const &result, void *opaque);
+	static void h264Done(vpuScheduler_t::result_t const &result, void *opaque);
+	bool getH264(void);
+	bool getJPEG(void);
+
+	encoderPool_t	       &pool_ ;
+	vpuScheduler_t	       &scheduler_ ;
+	camera_t	       &camera_ ;
+	unsigned const		gopSize_ ;
+	h264_encoder_t::rateControl_t rc_ ;
+	bool volatile		h264_ ;
+	bool volatile		restart_ ;
+	bool volatile		jpegPending_ ;
+	bool volatile		jpegSoftware_ ;
+	h264_encoder_t	       *volatile h264Encoder_ ;	// from pool_
+	mjpeg_encoder_t	       *jpegEncoder_ ;
+	libjpeg_encoder_t      *softJpeg_ ;	// made on first use
+	bool volatile		closing_ ;
+	unsigned volatile	h264Jobs_ ;	// queued to scheduler_
+	unsigned		h264Dropped_ ;	// VPU behind
+};
+#endif
+
+class fileSink_t : public pipelineStage_t {
+public:
+	fileSink_t(char const *name, unsigned typeMask, unsigned maxQueued = 8);
+	virtual ~fileSink_t(void);
+
+	bool open(char const *fileName);
+	void close(void);
+
+	virtual void process(pipelineItem_t *item);
+private:
+	unsigned const	typeMask_ ;
+	pthread_mutex_t	lock_ ;
+	FILE	       *fOut_ ;
+	bool		haveKeyframe_ ;
+};
+
+class mp4Sink_t : public pipelineStage_t {
+public:
+	mp4Sink_t(char const *name, unsigned width, unsigned height,
+		  unsigned maxQueued = 8);
+	virtual ~mp4Sink_t(void);
+
+	bool open(char const *fileName);
+	void close(void);	// writes the index
+
+	mp4Mux_t const &mux(void) const { return mux_ ; }
+
+	virtual void process(pipelineItem_t *item);
+private:
+	pthread_mutex_t	lock_ ;
+	mp4Mux_t	mux_ ;
+};
+
+class snapshotSink_t : public pipelineStage_t {
+public:
+	snapshotSink_t(char const *name, unsigned typeMask);
+	virtual ~snapshotSink_t(void);
+
+	// write the matching item after skipping the specified number
+	void arm(char const *fileName, unsigned skip = 0);
+
+	virtual void process(pipelineItem_t *item);
+private:
+	unsigned const	typeMask_ ;
+	pthread_mutex_t	lock_ ;
+	char	       *fileName_ ;
+	unsigned	skip_ ;
+};
+
+class rtpSink_t : public pipelineStage_t {
+public:
+	typedef void (*feedback_t)(bool congested, void *opaque);
+
+	rtpSink_t(char const *name,
+		  unsigned maxQueued = 8,
+		  unsigned mtu = rtpH264_t::DEFAULT_MTU);
+	virtual ~rtpSink_t(void);
+
+	// target is of the form 192.168.0.100:0x2020
+	bool open(char const *target);
+	void close(void);
+
+	// SDP for the current target
+	bool sdp(char *buf, unsigned size);
+
+	// called after each frame is sent. Set before starting the pipeline.
+	void setFeedback(feedback_t feedback, void *opaque){ feedback_ = feedback ; feedbackOpaque_ = opaque ; }
+
+	virtual void process(pipelineItem_t *item);
+private:
+	pthread_mutex_t	lock_ ;
+	rtpH264_t	rtp_ ;
+	feedback_t	feedback_ ;
+	void	       *feedbackOpaque_ ;
+};
+
+class preEventSink_t : public pipelineStage_t {
+public:
+	preEventSink_t(char const *name, unsigned bytes, unsigned seconds,
+		       unsigned maxQueued = 8);
+	virtual ~preEventSink_t(void){}
+
+	bool worked(void) const { return ring_.worked(); }
+
+	// write the buffered stream, then live frames until stop()
+	bool trigger(char const *fileName){ return ring_.trigger(fileName); }
+	void stop(void){ ring_.stop(); }
+	gopRing_t const &ring(void) const { return ring_ ; }
+
+	virtual void process(pipelineItem_t *item);
+private:
+	gopRing_t	ring_ ;
+};
+
+#endif
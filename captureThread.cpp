@@ -0,0 +1,286 @@
+/*
+ * Module captureThread.cpp
+ *
+ * This module defines the methods of the captureThread_t class
+ * as declared in captureThread.h
+ *
+ * The ring only ever holds descriptors of frames that haven't
+ * been fully released. Since at most numBuffers() frames can be
+ * outstanding and the ring is at least that large, a slot is
+ * never overwritten before every consumer has read it.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "captureThread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "debugPrint.h"
+
+static int futex_wait(int volatile *addr, int val, int timeoutMs)
+{
+	struct timespec ts ;
+	struct timespec *pts = 0 ;
+	if (0 <= timeoutMs) {
+		ts.tv_sec = timeoutMs / 1000 ;
+		ts.tv_nsec = (timeoutMs % 1000) * 1000000 ;
+		pts = &ts ;
+	}
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, pts, 0, 0);
+}
+
+static int futex_wake(int volatile *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+captureThread_t::captureThread_t(camera_t &camera, unsigned numConsumers)
+	: camera_(camera)
+	, numConsumers_(numConsumers)
+	, ringSize_(1)
+	, ring_(0)
+	, refs_(0)
+	, inFlight_(0)
+	, published_(0)
+	, running_(false)
+	, stop_(false)
+	, dropped_(0)
+{
+	memset(cursor_,0,sizeof(cursor_));
+	if ((0 == numConsumers) || (MAXCONSUMERS < numConsumers)) {
+		ERRMSG("%s: invalid consumer count %u\n", __func__, numConsumers);
+		return ;
+	}
+	if (!camera.isOpen() || (MINQUEUED >= camera.numBuffers())) {
+		ERRMSG("%s: need an open camera with more than %u buffers\n", __func__, MINQUEUED);
+		return ;
+	}
+	while (ringSize_ < camera.numBuffers())
+		ringSize_ <<= 1 ;
+	refs_ = (int volatile *)calloc(camera.numBuffers(),sizeof(refs_[0]));
+	ring_ = (slot_t *)calloc(ringSize_,sizeof(ring_[0]));
+	if (0 == refs_ || 0 == ring_) {
+		ERRMSG("%s: out of memory\n", __func__);
+		free((void *)refs_); refs_ = 0 ;
+		free(ring_); ring_ = 0 ;
+		return ;
+	}
+	for (unsigned i = 0 ; i < ringSize_ ; i++)
+		ring_[i].seq = ~0U - i ; // anything but i
+}
+
+captureThread_t::~captureThread_t(void)
+{
+	stop();
+	if (refs_)
+		free((void *)refs_);
+	if (ring_)
+		free(ring_);
+}
+
+bool captureThread_t::start(void)
+{
+	if (!worked() || running_)
+		return false ;
+	if (!camera_.startCapture())
+		return false ;
+	stop_ = false ;
+	running_ = true ;
+	int err = pthread_create(&thread_, 0, threadRoutine, this);
+	if (0 != err) {
+		ERRMSG("%s: pthread_create: %s\n", __func__, strerror(err));
+		running_ = false ;
+		camera_.stopCapture();
+		return false ;
+	}
+	return true ;
+}
+
+void captureThread_t::stop(void)
+{
+	if (!running_)
+		return ;
+	stop_ = true ;
+	pthread_join(thread_,0);
+	running_ = false ;
+	camera_.stopCapture();
+
+	// wake any waiting consumers
+	__sync_fetch_and_add(&published_,0);
+	futex_wake(&published_);
+}
+
+void *captureThread_t::threadRoutine(void *arg)
+{
+	((captureThread_t *)arg)->run();
+	return 0 ;
+}
+
+void captureThread_t::run(void)
+{
+	int const maxInFlight = camera_.numBuffers()-MINQUEUED ;
+	debugPrint("%s: %u consumers, ring of %u\n", __func__, numConsumers_, ringSize_);
+	while (!stop_) {
+		cameraFrame_t frame ;
+		if (!camera_.grabFrame(frame))
+			continue ;
+
+		if (maxInFlight <= inFlight_) {
+			// consumers are too far behind: keep the driver fed
+			++dropped_ ;
+			camera_.returnFrame(frame.data,frame.index);
+			continue ;
+		}
+
+		__sync_fetch_and_add(&inFlight_,1);
+		refs_[frame.index] = numConsumers_ ;
+
+		unsigned seq = published_ ;
+		slot_t &slot = ring_[seq & (ringSize_-1)];
+		slot.frame = frame ;
+		__sync_synchronize();
+		slot.seq = seq ;
+		__sync_fetch_and_add(&published_,1);
+		futex_wake(&published_);
+	}
+}
+
+bool captureThread_t::getFrame(unsigned consumer, cameraFrame_t &frame, int timeoutMs)
+{
+	if (!worked() || (consumer >= numConsumers_))
+		return false ;
+
+	unsigned const seq = cursor_[consumer];
+	int avail ;
+	while (seq == (unsigned)(avail = published_)) {
+		if (!running_)
+			return false ;
+		if ((0 != futex_wait(&published_,avail,timeoutMs))
+		    &&
+		    (ETIMEDOUT == errno))
+			return false ;
+	}
+	__sync_synchronize();
+	slot_t const &slot = ring_[seq & (ringSize_-1)];
+	if (slot.seq != seq) {
+		ERRMSG("%s: ring overrun at %u (%u)\n", __func__, seq, slot.seq);
+		return false ;
+	}
+	frame = slot.frame ;
+	cursor_[consumer] = seq+1 ;
+	return true ;
+}
+
+void captureThread_t::release(cameraFrame_t const &frame)
+{
+	if ((0 > frame.index) || ((unsigned)frame.index >= camera_.numBuffers()))
+		return ;
+	if (0 == __sync_sub_and_fetch(&refs_[frame.index],1))
+		requeue(frame.index);
+}
+
+void captureThread_t::requeue(int index)
+{
+	camera_.returnFrame(camera_.getBuffers()[index],index);
+	__sync_fetch_and_sub(&inFlight_,1);
+}
+
+#ifdef STANDALONE_CAPTURETHREAD
+
+#include "cameraParams.h"
+#include "tickMs.h"
+#include <signal.h>
+
+static bool volatile die = false ;
+
+static void ctrlcHandler( int signo )
+{
+	printf( "<ctrl-c>(%d)\r\n", signo );
+	die = true ;
+}
+
+struct consumer_t {
+	captureThread_t	*capture ;
+	unsigned	 id ;
+	unsigned	 delayMs ;
+	unsigned	 count ;
+	unsigned	 gaps ;
+};
+
+static void *consumerThread(void *arg)
+{
+	consumer_t &c = *(consumer_t *)arg ;
+	unsigned lastSeq = 0 ;
+	while (!die) {
+		cameraFrame_t frame ;
+		if (c.capture->getFrame(c.id,frame,100)) {
+			if (c.count && (frame.sequence != lastSeq+1))
+				++c.gaps ;
+			lastSeq = frame.sequence ;
+			++c.count ;
+			if (c.delayMs)
+				usleep(c.delayMs*1000);
+			c.capture->release(frame);
+		}
+		else if (!c.capture->running())
+			break;
+	}
+	return 0 ;
+}
+
+/*
+ * Runs two consumers on the camera, one of which can be made
+ * slow with a command-line argument (milliseconds per frame).
+ */
+int main(int argc, char const **argv) {
+	cameraParams_t params(argc,argv);
+	signal( SIGINT, ctrlcHandler );
+	camera_t camera(params.getCameraDeviceName(),
+			params.getCameraWidth(),
+			params.getCameraHeight(),
+			params.getCameraFPS(),
+			params.getCameraFourcc(),
+			params.getCameraRotation(),
+			params.getCameraBuffers());
+	if (!camera.isOpen()) {
+		ERRMSG( "Error opening camera\n" );
+		return -1 ;
+	}
+	captureThread_t capture(camera,2);
+	if (!capture.worked() || !capture.start()) {
+		ERRMSG( "Error starting capture thread\n" );
+		return -1 ;
+	}
+	consumer_t consumers[2];
+	pthread_t threads[2];
+	for (unsigned i = 0 ; i < 2 ; i++) {
+		memset(consumers+i,0,sizeof(consumers[i]));
+		consumers[i].capture = &capture ;
+		consumers[i].id = i ;
+		consumers[i].delayMs = ((1 == i) && (1 < argc)) ? strtoul(argv[1],0,0) : 0 ;
+		pthread_create(threads+i,0,consumerThread,consumers+i);
+	}
+	long long start = tickMs();
+	while (!die && ((0 > params.getIterations()) || (consumers[0].count < (unsigned)params.getIterations())))
+		usleep(100000);
+	die = true ;
+	for (unsigned i = 0 ; i < 2 ; i++)
+		pthread_join(threads[i],0);
+	capture.stop();
+	long long elapsed = tickMs()-start ;
+	for (unsigned i = 0 ; i < 2 ; i++) {
+		printf( "consumer %u: %u frames, %u sequence gaps, %u ms/frame\n",
+			i, consumers[i].count, consumers[i].gaps, consumers[i].delayMs);
+	}
+	printf( "%u published, %u dropped by capture thread, %u dropped by camera in %llu ms\n",
+		capture.numPublished(), capture.numDropped(), camera.numDropped(), elapsed);
+	return 0 ;
+}
+
+#endif
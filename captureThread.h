@@ -0,0 +1,95 @@
+#ifndef __CAPTURETHREAD_H__
+#define __CAPTURETHREAD_H__ "$Id$"
+
+/*
+ * captureThread.h
+ *
+ * This header file declares the captureThread_t class, which
+ * dequeues frames from a camera_t in a dedicated thread and
+ * publishes them to one or more consumers through a lock-free
+ * ring of frame descriptors.
+ *
+ * Each published frame starts with one reference per consumer.
+ * Every consumer must release() each frame it gets, and the
+ * buffer is handed back to the driver when the last reference
+ * is dropped, so a slow consumer only delays its own frames.
+ *
+ * The thread always leaves at least MINQUEUED buffers with the
+ * driver. When consumers hold on to more than that, new frames
+ * are returned to the driver immediately and counted in
+ * numDropped() instead of stalling capture.
+ *
+ * Usage:
+ *
+ *	captureThread_t capture(camera, 2);
+ *	capture.start();
+ *	...	// in consumer thread N:
+ *	cameraFrame_t frame ;
+ *	if (capture.getFrame(N, frame, 100)) {
+ *		...
+ *		capture.release(frame);
+ *	}
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "camera.h"
+#include <pthread.h>
+
+class captureThread_t {
+public:
+	enum {
+		MAXCONSUMERS = 8,
+		MINQUEUED = 2
+	};
+
+	captureThread_t(camera_t &camera, unsigned numConsumers = 1);
+	~captureThread_t(void);
+
+	bool worked(void) const { return 0 != ring_ ; }
+
+	// starts capture on the camera and launches the thread
+	bool start(void);
+	// stops the thread and capture. Frames still held by consumers
+	// may be released afterwards.
+	void stop(void);
+	bool running(void) const { return running_ ; }
+
+	/*
+	 * Returns the next frame for the specified consumer, waiting
+	 * up to timeoutMs. Frames are returned in order, and each
+	 * consumer sees every published frame. Consumers should poll
+	 * running() when this returns false.
+	 */
+	bool getFrame(unsigned consumer, cameraFrame_t &frame, int timeoutMs);
+	void release(cameraFrame_t const &frame);
+
+	unsigned numPublished(void) const { return published_ ; }
+	unsigned numDropped(void) const { return dropped_ ; }
+
+private:
+	struct slot_t {
+		unsigned volatile	seq ;
+		cameraFrame_t		frame ;
+	};
+
+	static void *threadRoutine(void *arg);
+	void run(void);
+	void requeue(int index);
+
+	camera_t	       &camera_ ;
+	unsigned const		numConsumers_ ;
+	unsigned		ringSize_ ;	// power of two >= camera buffers
+	slot_t		       *ring_ ;
+	int volatile	       *refs_ ;		// per-buffer reference counts
+	int volatile		inFlight_ ;	// buffers not with the driver
+	int volatile		published_ ;	// futex word: frames published
+	unsigned		cursor_[MAXCONSUMERS];
+	bool volatile		running_ ;
+	bool volatile		stop_ ;
+	unsigned volatile	dropped_ ;
+	pthread_t		thread_ ;
+};
+
+#endif
+
@@ -25,6 +25,21 @@
  *
  * fields may be specified by name or bit numbers of the form "start[-end]"
  *
+ * Options:
+ *
+ *	-m<file>	- read and write file instead of /dev/mem, at
+ *			  offsets equal to the register addresses (for
+ *			  testing against a memory image)
+ *	-c<cpu>		- CPU revision in hex (e.g. 53000), instead of
+ *			  the one in /proc/cpuinfo
+ *	-t		- report how long reading the registers took
+ *	-d<file>	- register definitions, instead of the ones for
+ *			  the CPU (/etc/devregs_imx53.dat, for instance)
+ *	-C[file]	- compile the register definitions and exit. The
+ *			  output defaults to the .dat file's name with .db
+ *			  instead, where it's used in place of the .dat
+ *			  until the .dat changes.
+ *
  * (c) Copyright 2010 by Boundary Devices under GPLv2
  *
  */
@@ -38,6 +53,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <time.h>
 
 static bool word_access = false ;
 
@@ -198,16 +214,23 @@ enum ftState {
 	FT_FIELDSET	= 1
 };
 
+static char const *defsPath = 0 ;	// from -d, or chosen by CPU
+
 static char const *getDataPath(unsigned cpu) {
+	if (defsPath)
+		return defsPath ;
 	switch (cpu & 0xff000) {
 		case 0x63000:
-			return "/etc/devregs_imx6x.dat" ;
+			defsPath = "/etc/devregs_imx6x.dat" ;
+			break;
 		case 0x53000:
-			return "/etc/devregs_imx53.dat" ;
+			defsPath = "/etc/devregs_imx53.dat" ;
+			break;
 		default:
 			printf("unsupported CPU type: %x\n", cpu);
+			defsPath = "/etc/devregs.dat" ;
 	}
-	return "/etc/devregs.dat" ;
+	return defsPath ;
 }
 
 static struct reglist_t const *registerDefs(unsigned cputype = 0){
@@ -353,13 +376,606 @@ static struct reglist_t const *registerDefs(unsigned cputype = 0){
 	return regs ;
 }
 
+/*
+ * Compiled register definitions
+ *
+ *	devregs -C turns the register definitions into a file that's
+ *	used with mmap() rather than parsed, stored next to the .dat
+ *	as .db (e.g. /etc/devregs_imx53.db). It holds:
+ *
+ *		- the registers, in .dat order, each with a run of its
+ *		  own fields and the fieldset appended to them (if any)
+ *		- the fields, and the fieldsets, stored once however
+ *		  many registers use them
+ *		- the registers sorted by address, and by name
+ *		- a hash of the (lower case) names, for exact matches
+ *		- the names, sorted and without duplicates
+ *
+ *	All tables are arrays of 32-bit values in the byte order of
+ *	the machine that compiled them. A .db that's older than its
+ *	.dat is ignored.
+ */
+#define DB_MAGIC	"devregs"
+#define DB_VERSION	1
+#define NOFIELDSET	0xffffffff
+
+struct dbHeader_t {
+	char		magic[8];
+	unsigned	version ;
+	unsigned	size ;		// of the file
+	unsigned	srcSize ;	// of the .dat
+	unsigned	srcTime ;	// modification time of the .dat
+	unsigned	numRegs ;
+	unsigned	numFields ;
+	unsigned	numFieldSets ;
+	unsigned	hashSize ;	// a power of two
+	unsigned	regs ;		// file offsets
+	unsigned	fields ;
+	unsigned	fieldSets ;
+	unsigned	byAddress ;
+	unsigned	byName ;
+	unsigned	hash ;
+	unsigned	strings ;
+	unsigned	stringSize ;
+};
+
+struct dbRegister_t {
+	unsigned	address ;
+	unsigned	name ;		// offset in strings
+	unsigned	width ;
+	unsigned	fields ;	// index of the first
+	unsigned	numFields ;
+	unsigned	fieldSet ;	// or NOFIELDSET
+};
+
+struct dbField_t {
+	unsigned	name ;
+	unsigned	startbit ;
+	unsigned	bitcount ;
+};
+
+struct dbFieldSet_t {
+	unsigned	fields ;
+	unsigned	numFields ;
+};
+
+struct regDb_t {
+	struct dbHeader_t const	  *header ;	// 0 if there's no .db
+	struct dbRegister_t const *regs ;
+	struct dbField_t const	  *fields ;
+	struct dbFieldSet_t const *fieldSets ;
+	unsigned const		  *byAddress ;	// register indices
+	unsigned const		  *byName ;	// register indices
+	unsigned const		  *hash ;	// byName index+1, or 0
+	char const		  *strings ;
+};
+
+static struct regDb_t regDb ;
+
+static unsigned hashName(char const *name)
+{
+	unsigned h = 2166136261U ;
+	while (*name) {
+		h ^= (unsigned char)tolower(*name++);
+		h *= 16777619 ;
+	}
+	return h ;
+}
+
+static char *compiledPath(char const *datPath)
+{
+	unsigned len = strlen(datPath);
+	if ((4 < len) && (0 == strcmp(datPath+len-4,".dat")))
+		len -= 4 ;
+	char *path = (char *)malloc(len+4);
+	memcpy(path,datPath,len);
+	strcpy(path+len,".db");
+	return path ;
+}
+
+/*
+ * sorting for the compiler
+ */
+static struct dbRegister_t const *sortRegs ;
+static char const *sortStrings ;
+
+static int compareStrings(void const *lhs, void const *rhs)
+{
+	return strcmp(*(char const * const *)lhs,*(char const * const *)rhs);
+}
+
+static int compareByAddress(void const *lhs, void const *rhs)
+{
+	unsigned const l = *(unsigned const *)lhs ;
+	unsigned const r = *(unsigned const *)rhs ;
+	if (sortRegs[l].address != sortRegs[r].address)
+		return (sortRegs[l].address < sortRegs[r].address) ? -1 : 1 ;
+	return (l < r) ? -1 : (l > r) ? 1 : 0 ;
+}
+
+static int compareByName(void const *lhs, void const *rhs)
+{
+	unsigned const l = *(unsigned const *)lhs ;
+	unsigned const r = *(unsigned const *)rhs ;
+	int const diff = strcasecmp(sortStrings+sortRegs[l].name,sortStrings+sortRegs[r].name);
+	if (diff)
+		return diff ;
+	return (l < r) ? -1 : (l > r) ? 1 : 0 ;
+}
+
+static unsigned stringOffset(char const *const *names, unsigned count,
+			     unsigned const *offsets, char const *name)
+{
+	char const *const *found = (char const *const *)
+		bsearch(&name,names,count,sizeof(names[0]),compareStrings);
+	return offsets[found-names];
+}
+
+static int fieldSetIndex(struct fieldDescription_t const *f)
+{
+	int index = 0 ;
+	for (struct fieldSet_t const *fs = fieldsets ; fs ; fs = fs->next, index++) {
+		if (fs->fields && (f == fs->fields))
+			return index ;
+	}
+	return -1 ;
+}
+
+static bool compileDefs(char const *outPath)
+{
+	struct reglist_t const *defs = registerDefs();
+	if (0 == defs) {
+		fprintf(stderr, "%s: no registers to compile\n", defsPath);
+		return false ;
+	}
+	struct stat st ;
+	if (0 != stat(defsPath,&st)) {
+		perror(defsPath);
+		return false ;
+	}
+
+	unsigned numRegs = 0, numFields = 0, numFieldSets = 0 ;
+	for (struct fieldSet_t const *fs = fieldsets ; fs ; fs = fs->next) {
+		numFieldSets++ ;
+		for (struct fieldDescription_t const *f = fs->fields ; f ; f = f->next)
+			numFields++ ;
+	}
+	for (struct reglist_t const *r = defs ; r ; r = r->next) {
+		numRegs++ ;
+		for (struct fieldDescription_t const *f = r->fields ; f && (0 > fieldSetIndex(f)) ; f = f->next)
+			numFields++ ;
+	}
+
+	// string table
+	char const **names = new char const *[numRegs+numFields];
+	unsigned numNames = 0 ;
+	for (struct fieldSet_t const *fs = fieldsets ; fs ; fs = fs->next) {
+		for (struct fieldDescription_t const *f = fs->fields ; f ; f = f->next)
+			names[numNames++] = f->name ;
+	}
+	for (struct reglist_t const *r = defs ; r ; r = r->next) {
+		names[numNames++] = r->reg->name ;
+		for (struct fieldDescription_t const *f = r->fields ; f && (0 > fieldSetIndex(f)) ; f = f->next)
+			names[numNames++] = f->name ;
+	}
+	qsort(names,numNames,sizeof(names[0]),compareStrings);
+	unsigned *offsets = new unsigned [numNames];
+	unsigned unique = 0 ;
+	unsigned stringSize = 0 ;
+	for (unsigned i = 0 ; i < numNames ; i++) {
+		if (unique && (0 == strcmp(names[i],names[unique-1])))
+			continue;
+		names[unique] = names[i];
+		offsets[unique++] = stringSize ;
+		stringSize += strlen(names[i])+1 ;
+	}
+	stringSize = (stringSize+3) & ~3 ;
+
+	unsigned hashSize = 16 ;
+	while (hashSize < 2*numRegs)
+		hashSize *= 2 ;
+
+	struct dbHeader_t h ;
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,DB_MAGIC,sizeof(DB_MAGIC));
+	h.version = DB_VERSION ;
+	h.srcSize = st.st_size ;
+	h.srcTime = st.st_mtime ;
+	h.numRegs = numRegs ;
+	h.numFields = numFields ;
+	h.numFieldSets = numFieldSets ;
+	h.hashSize = hashSize ;
+	h.regs = sizeof(h);
+	h.fields = h.regs + numRegs*sizeof(struct dbRegister_t);
+	h.fieldSets = h.fields + numFields*sizeof(struct dbField_t);
+	h.byAddress = h.fieldSets + numFieldSets*sizeof(struct dbFieldSet_t);
+	h.byName = h.byAddress + numRegs*sizeof(unsigned);
+	h.hash = h.byName + numRegs*sizeof(unsigned);
+	h.strings = h.hash + hashSize*sizeof(unsigned);
+	h.stringSize = stringSize ;
+	h.size = h.strings + stringSize ;
+
+	char *image = (char *)calloc(1,h.size);
+	memcpy(image,&h,sizeof(h));
+	struct dbRegister_t *regs = (struct dbRegister_t *)(image+h.regs);
+	struct dbField_t *fields = (struct dbField_t *)(image+h.fields);
+	struct dbFieldSet_t *sets = (struct dbFieldSet_t *)(image+h.fieldSets);
+	unsigned *byAddress = (unsigned *)(image+h.byAddress);
+	unsigned *byName = (unsigned *)(image+h.byName);
+	unsigned *hash = (unsigned *)(image+h.hash);
+	char *strings = image+h.strings ;
+
+	for (unsigned i = 0 ; i < unique ; i++)
+		strcpy(strings+offsets[i],names[i]);
+
+	unsigned nextField = 0 ;
+	unsigned s = 0 ;
+	for (struct fieldSet_t const *fs = fieldsets ; fs ; fs = fs->next, s++) {
+		sets[s].fields = nextField ;
+		for (struct fieldDescription_t const *f = fs->fields ; f ; f = f->next) {
+			struct dbField_t &df = fields[nextField++];
+			df.name = stringOffset(names,unique,offsets,f->name);
+			df.startbit = f->startbit ;
+			df.bitcount = f->bitcount ;
+		}
+		sets[s].numFields = nextField-sets[s].fields ;
+	}
+	unsigned r = 0 ;
+	for (struct reglist_t const *rl = defs ; rl ; rl = rl->next, r++) {
+		struct dbRegister_t &dr = regs[r];
+		dr.address = rl->address ;
+		dr.name = stringOffset(names,unique,offsets,rl->reg->name);
+		dr.width = rl->width ;
+		dr.fields = nextField ;
+		dr.fieldSet = NOFIELDSET ;
+		for (struct fieldDescription_t const *f = rl->fields ; f ; f = f->next) {
+			int const set = fieldSetIndex(f);
+			if (0 <= set) {
+				dr.fieldSet = set ;
+				break;
+			}
+			struct dbField_t &df = fields[nextField++];
+			df.name = stringOffset(names,unique,offsets,f->name);
+			df.startbit = f->startbit ;
+			df.bitcount = f->bitcount ;
+		}
+		dr.numFields = nextField-dr.fields ;
+		byAddress[r] = byName[r] = r ;
+	}
+
+	sortRegs = regs ;
+	sortStrings = strings ;
+	qsort(byAddress,numRegs,sizeof(byAddress[0]),compareByAddress);
+	qsort(byName,numRegs,sizeof(byName[0]),compareByName);
+
+	// first of each name
+	for (unsigned i = 0 ; i < numRegs ; i++) {
+		char const *name = strings+regs[byName[i]].name ;
+		if (i && (0 == strcasecmp(name,strings+regs[byName[i-1]].name)))
+			continue;
+		unsigned slot = hashName(name) & (hashSize-1);
+		while (hash[slot])
+			slot = (slot+1) & (hashSize-1);
+		hash[slot] = i+1 ;
+	}
+
+	// replace, so a running devregs keeps a consistent file
+	char *tmpPath = (char *)malloc(strlen(outPath)+5);
+	sprintf(tmpPath,"%s.tmp",outPath);
+	bool worked = false ;
+	FILE *fOut = fopen(tmpPath,"wb");
+	if (fOut) {
+		worked = (1 == fwrite(image,h.size,1,fOut));
+		worked = (0 == fclose(fOut)) && worked ;
+		if (worked)
+			worked = (0 == rename(tmpPath,outPath));
+		if (!worked) {
+			perror(outPath);
+			unlink(tmpPath);
+		}
+	} else
+		perror(tmpPath);
+	if (worked)
+		printf("%s: %u registers, %u fields, %u fieldsets, %u bytes\n",
+		       outPath, numRegs, numFields, numFieldSets, h.size);
+	free(tmpPath);
+	free(image);
+	delete [] offsets ;
+	delete [] names ;
+	return worked ;
+}
+
+static bool validDb(struct dbHeader_t const *h, unsigned size)
+{
+	if ((size < sizeof(*h))
+	    || (0 != memcmp(h->magic,DB_MAGIC,sizeof(DB_MAGIC)))
+	    || (DB_VERSION != h->version)
+	    || (size != h->size)
+	    || (0 == h->hashSize)
+	    || (0 != (h->hashSize & (h->hashSize-1)))
+	    || (h->hashSize <= h->numRegs))
+		return false ;
+	unsigned long long end = sizeof(*h);
+	end += (unsigned long long)h->numRegs*sizeof(struct dbRegister_t);
+	end += (unsigned long long)h->numFields*sizeof(struct dbField_t);
+	end += (unsigned long long)h->numFieldSets*sizeof(struct dbFieldSet_t);
+	end += (unsigned long long)(2*h->numRegs+h->hashSize)*sizeof(unsigned);
+	if ((h->regs != sizeof(*h))
+	    || (h->fields != h->regs+h->numRegs*sizeof(struct dbRegister_t))
+	    || (h->fieldSets != h->fields+h->numFields*sizeof(struct dbField_t))
+	    || (h->byAddress != h->fieldSets+h->numFieldSets*sizeof(struct dbFieldSet_t))
+	    || (h->byName != h->byAddress+h->numRegs*sizeof(unsigned))
+	    || (h->hash != h->byName+h->numRegs*sizeof(unsigned))
+	    || (h->strings != end)
+	    || (0 == h->stringSize)
+	    || (end+h->stringSize != size))
+		return false ;
+
+	char const *image = (char const *)h ;
+	if ('\0' != image[size-1])
+		return false ;
+	struct dbRegister_t const *regs = (struct dbRegister_t const *)(image+h->regs);
+	struct dbField_t const *fields = (struct dbField_t const *)(image+h->fields);
+	struct dbFieldSet_t const *sets = (struct dbFieldSet_t const *)(image+h->fieldSets);
+	unsigned const *byAddress = (unsigned const *)(image+h->byAddress);
+	unsigned const *byName = (unsigned const *)(image+h->byName);
+	unsigned const *hash = (unsigned const *)(image+h->hash);
+	for (unsigned i = 0 ; i < h->numRegs ; i++) {
+		if ((regs[i].name >= h->stringSize)
+		    || (regs[i].fields > h->numFields)
+		    || (regs[i].numFields > h->numFields-regs[i].fields)
+		    || ((NOFIELDSET != regs[i].fieldSet) && (regs[i].fieldSet >= h->numFieldSets))
+		    || (byAddress[i] >= h->numRegs)
+		    || (byName[i] >= h->numRegs))
+			return false ;
+	}
+	for (unsigned i = 0 ; i < h->numFields ; i++) {
+		if ((fields[i].name >= h->stringSize) || (32 < fields[i].startbit+fields[i].bitcount))
+			return false ;
+	}
+	for (unsigned i = 0 ; i < h->numFieldSets ; i++) {
+		if ((sets[i].fields > h->numFields) || (sets[i].numFields > h->numFields-sets[i].fields))
+			return false ;
+	}
+	for (unsigned i = 0 ; i < h->hashSize ; i++) {
+		if (hash[i] > h->numRegs)
+			return false ;
+	}
+	return true ;
+}
+
+// 1 if mapped, 0 if path isn't compiled, -1 if it's corrupt
+static int mapDb(char const *path)
+{
+	int const fd = open(path,O_RDONLY);
+	if (0 > fd)
+		return 0 ;
+	struct stat st ;
+	void *image = MAP_FAILED ;
+	if ((0 == fstat(fd,&st)) && (sizeof(struct dbHeader_t) <= (unsigned long)st.st_size))
+		image = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (MAP_FAILED == image)
+		return 0 ;
+	struct dbHeader_t const *h = (struct dbHeader_t const *)image ;
+	if (0 != memcmp(h->magic,DB_MAGIC,sizeof(DB_MAGIC))) {
+		munmap(image,st.st_size);
+		return 0 ;	// not compiled
+	}
+	if (!validDb(h,st.st_size)) {
+		fprintf(stderr, "%s: invalid compiled register definitions\n", path);
+		munmap(image,st.st_size);
+		return -1 ;
+	}
+	char const *base = (char const *)image ;
+	regDb.header = h ;
+	regDb.regs = (struct dbRegister_t const *)(base+h->regs);
+	regDb.fields = (struct dbField_t const *)(base+h->fields);
+	regDb.fieldSets = (struct dbFieldSet_t const *)(base+h->fieldSets);
+	regDb.byAddress = (unsigned const *)(base+h->byAddress);
+	regDb.byName = (unsigned const *)(base+h->byName);
+	regDb.hash = (unsigned const *)(base+h->hash);
+	regDb.strings = base+h->strings ;
+	return 1 ;
+}
+
+/*
+ * openDb()	- uses compiled definitions if there are any
+ *
+ *	defsPath may itself be compiled. Otherwise, the .db beside it
+ *	is used if it was compiled from the current .dat.
+ */
+static bool openDb(void)
+{
+	int const mapped = mapDb(defsPath);
+	if (0 > mapped)
+		exit(1);
+	if (mapped)
+		return true ;
+	char *path = compiledPath(defsPath);
+	if (0 < mapDb(path)) {
+		struct stat st ;
+		if ((0 == stat(defsPath,&st))
+		    && (((unsigned)st.st_size != regDb.header->srcSize)
+			|| ((unsigned)st.st_mtime != regDb.header->srcTime))) {
+			fprintf(stderr, "%s doesn't match %s, run devregs -C\n", path, defsPath);
+			munmap((void *)regDb.header,regDb.header->size);
+			memset(&regDb,0,sizeof(regDb));
+		}
+	}
+	free(path);
+	return 0 != regDb.header ;
+}
+
+/*
+ * Returns the registers at indices as a list, in the same order. The
+ * nodes (and the fields of each fieldset) are allocated together.
+ */
+static struct reglist_t *dbReglist(unsigned const *indices, unsigned count)
+{
+	if (0 == count)
+		return 0 ;
+	unsigned numFields = 0 ;
+	for (unsigned i = 0 ; i < count ; i++)
+		numFields += regDb.regs[indices[i]].numFields ;
+	struct reglist_t *list = new struct reglist_t [count];
+	struct registerDescription_t *descs = new struct registerDescription_t [count];
+	struct fieldDescription_t *fields = numFields ? new struct fieldDescription_t [numFields] : 0 ;
+	struct fieldDescription_t **sets = 0 ;
+
+	for (unsigned i = 0 ; i < count ; i++) {
+		struct dbRegister_t const &dr = regDb.regs[indices[i]];
+		struct fieldDescription_t *tail = 0 ;
+		if (NOFIELDSET != dr.fieldSet) {
+			if (0 == sets) {
+				sets = new struct fieldDescription_t *[regDb.header->numFieldSets];
+				memset(sets,0,regDb.header->numFieldSets*sizeof(sets[0]));
+			}
+			struct dbFieldSet_t const &ds = regDb.fieldSets[dr.fieldSet];
+			if ((0 == sets[dr.fieldSet]) && ds.numFields) {
+				struct fieldDescription_t *sf = new struct fieldDescription_t [ds.numFields];
+				for (unsigned f = ds.numFields ; f > 0 ; f--) {
+					struct dbField_t const &df = regDb.fields[ds.fields+f-1];
+					sf[f-1].name = regDb.strings+df.name ;
+					sf[f-1].startbit = df.startbit ;
+					sf[f-1].bitcount = df.bitcount ;
+					sf[f-1].next = (f < ds.numFields) ? sf+f : 0 ;
+				}
+				sets[dr.fieldSet] = sf ;
+			}
+			tail = sets[dr.fieldSet];
+		}
+		for (unsigned f = dr.numFields ; f > 0 ; f--) {
+			struct dbField_t const &df = regDb.fields[dr.fields+f-1];
+			struct fieldDescription_t *newf = fields++ ;
+			newf->name = regDb.strings+df.name ;
+			newf->startbit = df.startbit ;
+			newf->bitcount = df.bitcount ;
+			newf->next = tail ;
+			tail = newf ;
+		}
+		descs[i].name = regDb.strings+dr.name ;
+		descs[i].fields = 0 ;
+		list[i].address = dr.address ;
+		list[i].width = dr.width ;
+		list[i].reg = descs+i ;
+		list[i].fields = tail ;
+		list[i].next = (i+1 < count) ? list+i+1 : 0 ;
+	}
+	delete [] sets ;
+	return list ;
+}
+
+static int compareDescending(void const *lhs, void const *rhs)
+{
+	unsigned const l = *(unsigned const *)lhs ;
+	unsigned const r = *(unsigned const *)rhs ;
+	return (l > r) ? -1 : (l < r) ? 1 : 0 ;
+}
+
+/*
+ * Registers named name or, if prefix, starting with it, as indices
+ * in reverse .dat order (the order parseRegisterSpec() has always
+ * returned them in). Returns the count.
+ */
+static unsigned dbMatchName(char const *name, bool prefix, unsigned *&indices)
+{
+	unsigned const *byName = regDb.byName ;
+	unsigned const numRegs = regDb.header->numRegs ;
+	unsigned first = numRegs ;
+	unsigned const len = strlen(name);
+	if (prefix) {
+		unsigned lo = 0, hi = numRegs ;
+		while (lo < hi) {
+			unsigned const mid = (lo+hi)/2 ;
+			if (0 > strncasecmp(regDb.strings+regDb.regs[byName[mid]].name,name,len))
+				lo = mid+1 ;
+			else
+				hi = mid ;
+		}
+		first = lo ;
+	} else {
+		unsigned const mask = regDb.header->hashSize-1 ;
+		unsigned slot = hashName(name) & mask ;
+		while (regDb.hash[slot]) {
+			unsigned const pos = regDb.hash[slot]-1 ;
+			if (0 == strcasecmp(regDb.strings+regDb.regs[byName[pos]].name,name)) {
+				first = pos ;
+				break;
+			}
+			slot = (slot+1) & mask ;
+		}
+	}
+	unsigned end = first ;
+	while ((end < numRegs)
+	       && (0 == (prefix ? strncasecmp(regDb.strings+regDb.regs[byName[end]].name,name,len)
+			 	: strcasecmp(regDb.strings+regDb.regs[byName[end]].name,name))))
+		end++ ;
+	unsigned const count = end-first ;
+	indices = new unsigned [count ? count : 1];
+	memcpy(indices,byName+first,count*sizeof(indices[0]));
+	qsort(indices,count,sizeof(indices[0]),compareDescending);
+	return count ;
+}
+
+// first register (in .dat order) at address
+static bool dbMatchAddress(unsigned long address, unsigned &index)
+{
+	unsigned const *byAddress = regDb.byAddress ;
+	unsigned lo = 0, hi = regDb.header->numRegs ;
+	while (lo < hi) {
+		unsigned const mid = (lo+hi)/2 ;
+		if (regDb.regs[byAddress[mid]].address < address)
+			lo = mid+1 ;
+		else
+			hi = mid ;
+	}
+	if ((lo < regDb.header->numRegs) && (address == regDb.regs[byAddress[lo]].address)) {
+		index = byAddress[lo];
+		return true ;
+	}
+	return false ;
+}
+
+/*
+ * keeps only the fields of reg named or numbered by fieldPart
+ */
+static bool selectFields(struct reglist_t *reg, char const *fieldPart)
+{
+	fieldDescription_t *rhs = reg->fields ;
+	reg->fields = 0 ;
+	if (isdigit(*fieldPart)) {
+		unsigned start, count ;
+		if (parseBits(fieldPart,start,count)) {
+			fieldDescription_t *newf = new struct fieldDescription_t ;
+			newf->name = strdup(fieldPart);	// outlives the spec
+			newf->startbit = start ;
+			newf->bitcount = count ;
+			newf->next = 0 ;
+			reg->fields = newf ;
+		}
+		else
+			return false ;
+	} else {
+		while (rhs) {
+			if( 0 == strcasecmp(fieldPart,rhs->name) ) {
+				fieldDescription_t *newf = new struct fieldDescription_t ;
+				memcpy(newf,rhs,sizeof(*newf));
+				newf->next = reg->fields ;
+				reg->fields = newf ;
+			}
+			rhs = rhs->next ;
+		}
+	} // search for named fields
+	return true ;
+}
+
 static struct reglist_t const *parseRegisterSpec(char const *regname)
 {
 	char const c = *regname ;
 
 	if(isalpha(c) || ('_' == c)){
                 struct reglist_t *out = 0 ;
-                struct reglist_t const *defs = registerDefs();
 		char *regPart = strdup(regname);
 		char *fieldPart = strchr(regPart,'.');
 		bool widthspec = false ;
@@ -374,38 +990,27 @@ static struct reglist_t const *parseRegisterSpec(char const *regname)
 			*fieldPart++ = '\0' ;
 			fieldLen = strlen(fieldPart);
 		}
+		if (regDb.header) {
+			// a field needs an exact register name
+			unsigned *indices ;
+			unsigned const count = dbMatchName(regPart,0 == fieldPart,indices);
+			out = dbReglist(indices,count);
+			delete [] indices ;
+			for (struct reglist_t *r = out ; r && fieldPart ; r = r->next) {
+				if (!selectFields(r,fieldPart))
+					return 0 ;
+			}
+			free(regPart);
+			return out ;
+		}
+                struct reglist_t const *defs = registerDefs();
 		unsigned const nameLen = strlen(regname);
 		while(defs){
                         if( 0 == strncasecmp(regPart,defs->reg->name,nameLen) ) {
 				struct reglist_t *newOne = new struct reglist_t ;
 				memcpy(newOne,defs,sizeof(*newOne));
-				if (fieldPart) {
-					newOne->fields = 0 ;
-					if (isdigit(*fieldPart)) {
-						unsigned start, count ;
-						if (parseBits(fieldPart,start,count)) {
-							fieldDescription_t *newf = new struct fieldDescription_t ;
-							newf->name = fieldPart ;
-							newf->startbit = start ;
-							newf->bitcount = count ;
-							newf->next = 0 ;
-							newOne->fields = newf ;
-						}
-						else
-							return 0 ;
-					} else {
-						fieldDescription_t *rhs = defs->fields ;
-						while (rhs) {
-							if( 0 == strcasecmp(fieldPart,rhs->name) ) {
-								fieldDescription_t *newf = new struct fieldDescription_t ;
-								memcpy(newf,rhs,sizeof(*newf));
-								newf->next = newOne->fields ;
-								newOne->fields = newf ;
-							}
-							rhs = rhs->next ;
-						}
-					} // search for named fields
-				} // only copy specified field
+				if (fieldPart && !selectFields(newOne,fieldPart))
+					return 0 ;
 				newOne->next = out ;
 				out = newOne ;
 			}
@@ -420,7 +1025,14 @@ static struct reglist_t const *parseRegisterSpec(char const *regname)
                         struct fieldDescription_t *field = 0 ;
 			unsigned start, count ;
 			struct reglist_t *out = 0 ;
-			struct reglist_t const *defs = registerDefs();
+			unsigned index ;
+			if (regDb.header) {
+				if (dbMatchAddress(address,index)) {
+					out = dbReglist(&index,1);
+					out->fields = field ;
+				}
+			}
+			struct reglist_t const *defs = regDb.header ? 0 : registerDefs();
 			unsigned const nameLen = strlen(regname);
 			while(defs){
 				if( defs->address == address ) {
@@ -475,12 +1087,18 @@ static struct reglist_t const *parseRegisterSpec(char const *regname)
 	return 0 ;
 }
 
+static char const *memPath = "/dev/mem" ;
+static bool showTiming = false ;
+static unsigned cpuOverride = 0 ;
+static bool compile = false ;
+static char const *compileTo = 0 ;	// default is beside the .dat
+
 static int getFd(void){
 	static int fd = -1 ;
 	if( 0 > fd ){
-		fd = open("/dev/mem", O_RDWR | O_SYNC);
+		fd = open(memPath, O_RDWR | O_SYNC);
 		if (fd<0) {
-			perror("/dev/mem");
+			perror(memPath);
 			exit(1);
 		}
 	}
@@ -489,24 +1107,69 @@ static int getFd(void){
 
 #define MAP_SIZE 4096
 #define MAP_MASK ( MAP_SIZE - 1 )
+#define MAX_MAPS 16
+
+/*
+ * Most recently used page mappings. Registers are spread over a
+ * few hundred pages, so keeping a handful mapped saves an
+ * munmap()/mmap() pair on most accesses.
+ */
+struct pageMap_t {
+	unsigned long	 page ;
+	void		*map ;
+	unsigned	 lastUse ;
+};
+
+static struct pageMap_t pageMaps[MAX_MAPS];
+static unsigned numMaps = 0 ;
+static unsigned mapUses = 0 ;
 
 static unsigned long volatile *getReg(unsigned long addr){
-	static void *map = 0 ;
-	static unsigned prevPage = -1U ;
-	unsigned page = addr & ~MAP_MASK ;
-	if( page != prevPage ){
-		if( map ){
-		   munmap(map,MAP_SIZE);
+	unsigned long const page = addr & ~MAP_MASK ;
+	struct pageMap_t *m = 0 ;
+	for (unsigned i = 0 ; i < numMaps ; i++) {
+		if (page == pageMaps[i].page) {
+			m = pageMaps+i ;
+			break;
 		}
-		map = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, getFd(), page );
-		if( MAP_FAILED == map ){
+	}
+	if( 0 == m ){
+		if (numMaps < MAX_MAPS) {
+			m = pageMaps+numMaps++ ;
+		} else {
+			m = pageMaps ;
+			for (unsigned i = 1 ; i < numMaps ; i++) {
+				if (pageMaps[i].lastUse < m->lastUse)
+					m = pageMaps+i ;
+			}
+			munmap(m->map,MAP_SIZE);
+		}
+		m->map = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, getFd(), page );
+		if( MAP_FAILED == m->map ){
 			perror("mmap");
 			exit(1);
 		}
-		prevPage = page ;
+		m->page = page ;
 	}
+	m->lastUse = ++mapUses ;
 	unsigned offs = addr & MAP_MASK ;
-	return (unsigned long volatile *)((char *)map+offs);
+	return (unsigned long volatile *)((char *)m->map+offs);
+}
+
+static bool readReg(struct reglist_t const *reg, unsigned long &rv)
+{
+	unsigned long volatile *regPtr = getReg(reg->address);
+	if( 2 == reg->width ) {
+		rv = *(unsigned short volatile *)regPtr ;
+	} else if( 4 == reg->width ) {
+		rv = *(unsigned volatile *)regPtr ;
+	} else if( 1 == reg->width ) {
+		rv = *(unsigned char volatile *)regPtr ;
+	} else {
+		fprintf(stderr, "Unsupported width in register %s\n", reg->reg ? reg->reg->name : "");
+		return false ;
+	}
+	return true ;
 }
 
 static unsigned fieldVal(struct fieldDescription_t *f, unsigned long v)
@@ -516,36 +1179,97 @@ static unsigned fieldVal(struct fieldDescription_t *f, unsigned long v)
 	return v ;
 }
 
-static void showReg(struct reglist_t const *reg)
+static void printReg(struct reglist_t const *reg, unsigned long rv)
 {
-	unsigned long rv ; 
-        unsigned long volatile *regPtr = getReg(reg->address);
-	if( 2 == reg->width ) {
-		unsigned short volatile *p = (unsigned short volatile *)regPtr ;
-		rv = *p ;
-		printf( "%s:0x%08lx\t=0x%04lx\n", reg->reg ? reg->reg->name : "", reg->address, rv );
-	} else if( 4 == reg->width ) {
-		unsigned long volatile *p = regPtr ;
-		rv = *p ;
-		printf( "%s:0x%08lx\t=0x%08lx\n", reg->reg ? reg->reg->name : "", reg->address, rv );
-	} else if( 1 == reg->width ) {
-		unsigned char volatile *p = (unsigned char volatile *)regPtr ;
-		rv = *p ;
-		printf( "%s:0x%08lx\t=0x%02lx\n", reg->reg ? reg->reg->name : "", reg->address, rv );
-	}
-	else {
-		fprintf(stderr, "Unsupported width in register %s\n", reg->reg->name);
-		return ;
-	}
-	fflush(stdout);
+	printf( "%s:0x%08lx\t=0x%0*lx\n", reg->reg ? reg->reg->name : "", reg->address, 2*reg->width, rv );
 	struct fieldDescription_t *f = reg->fields ;
 	while(f){
 		printf( "\t%-16s\t%2u-%2u\t=0x%x\n", f->name, f->startbit, f->startbit+f->bitcount-1, fieldVal(f,rv) );
-		fflush(stdout);
 		f=f->next ;
 	}
 }
 
+static void showReg(struct reglist_t const *reg)
+{
+	unsigned long rv ;
+	if (readReg(reg,rv)) {
+		printReg(reg,rv);
+		fflush(stdout);
+	}
+}
+
+struct regValue_t {
+	struct reglist_t const	*reg ;
+	unsigned long		 value ;
+	bool			 valid ;
+};
+
+static int compareAddress(void const *lhs, void const *rhs)
+{
+	unsigned long const l = (*(struct regValue_t * const *)lhs)->reg->address ;
+	unsigned long const r = (*(struct regValue_t * const *)rhs)->reg->address ;
+	return (l < r) ? -1 : (l > r) ? 1 : 0 ;
+}
+
+static long long tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((long long)ts.tv_sec*1000000)+(ts.tv_nsec/1000);
+}
+
+/*
+ * showRegs()	- displays a list of registers from a snapshot
+ *
+ *	The registers are sorted by address and read a page at a time,
+ *	so each page is mapped once, then they're decoded and printed
+ *	in list order. Only the listed registers are read (once each,
+ *	at their own width): the gaps between them may be reserved or
+ *	have read side effects, so a page isn't copied wholesale.
+ */
+static void showRegs(struct reglist_t const *regs)
+{
+	unsigned count = 0 ;
+	for (struct reglist_t const *r = regs ; r ; r = r->next)
+		count++ ;
+	if (0 == count)
+		return ;
+
+	struct regValue_t *values = new struct regValue_t [count];
+	struct regValue_t **byAddress = new struct regValue_t *[count];
+	unsigned i = 0 ;
+	for (struct reglist_t const *r = regs ; r ; r = r->next, i++) {
+		values[i].reg = r ;
+		values[i].valid = false ;
+		byAddress[i] = values+i ;
+	}
+	qsort(byAddress,count,sizeof(byAddress[0]),compareAddress);
+
+	long long const start = tickUs();
+	unsigned pages = 0 ;
+	unsigned long prevPage = 0 ;
+	for (i = 0 ; i < count ; i++) {
+		struct regValue_t *v = byAddress[i];
+		unsigned long const page = v->reg->address & ~MAP_MASK ;
+		if ((0 == i) || (page != prevPage))
+			pages++ ;
+		prevPage = page ;
+		v->valid = readReg(v->reg,v->value);
+	}
+	long long const readUs = tickUs()-start ;
+
+	for (i = 0 ; i < count ; i++) {
+		if (values[i].valid)
+			printReg(values[i].reg,values[i].value);
+	}
+	fflush(stdout);
+	if (showTiming)
+		fprintf(stderr, "%u registers in %u pages read in %lld us, %lld us total\n",
+			count, pages, readUs, tickUs()-start);
+	delete [] byAddress ;
+	delete [] values ;
+}
+
 static void putReg(struct reglist_t const *reg,unsigned long value){
 	unsigned address = 0 ;
 	unsigned shift = 0 ;
@@ -576,9 +1300,9 @@ static void putReg(struct reglist_t const *reg,unsigned long value){
 		printf( "%s:0x%04lx == 0x%04x...", reg->reg ? reg->reg->name : "", reg->address, *rv );
 		*rv = value ;
 	} else {
-		unsigned long volatile * const rv = getReg(reg->address);
+		unsigned volatile * const rv = (unsigned volatile *)getReg(reg->address);
 		value = (*rv&~mask) | ((value<<shift)&mask);
-		printf( "%s:0x%08lx == 0x%08lx...", reg->reg ? reg->reg->name : "", reg->address, *rv );
+		printf( "%s:0x%08lx == 0x%08x...", reg->reg ? reg->reg->name : "", reg->address, *rv );
 		*rv = value ;
 	}
 	printf( "0x%08lx\n", value );
@@ -593,6 +1317,22 @@ static void parseArgs( int &argc, char const **argv )
             			word_access = true ;
 				printf("using word access\n" );
 			}
+			else if( 'm' == *param ){
+				memPath = param+1 ;
+			}
+			else if( 'c' == *param ){
+				cpuOverride = strtoul(param+1,0,16);
+			}
+			else if( 't' == *param ){
+				showTiming = true ;
+			}
+			else if( 'd' == *param ){
+				defsPath = param+1 ;
+			}
+			else if( 'C' == *param ){
+				compile = true ;
+				compileTo = param[1] ? param+1 : 0 ;
+			}
 			else
 				printf( "unknown option %s\n", param );
 
@@ -607,7 +1347,9 @@ static void parseArgs( int &argc, char const **argv )
 }
 
 static int getcpu(unsigned &cpu) {
-	cpu = 0 ;
+	cpu = cpuOverride ;
+	if (cpu)
+		return 1 ;
 	FILE *fIn = fopen("/proc/cpuinfo", "r");
 	if (fIn) {
 		char inBuf[512];
@@ -634,30 +1376,39 @@ static int getcpu(unsigned &cpu) {
 
 int main(int argc, char const **argv)
 {
-	unsigned cpu ;
+	unsigned cpu = 0 ;
 
 	parseArgs(argc,argv);
 
-	if (!getcpu(cpu)) {
+	if (!defsPath && !getcpu(cpu)) {
 		fprintf(stderr, "Error reading CPU type\n");
 		return -1 ;
 	}
 //	printf( "CPU type is 0x%x\n", cpu);
-        registerDefs(cpu);
+	getDataPath(cpu);
+	if (compile) {
+		char *path = compiledPath(defsPath);
+		bool const worked = compileDefs(compileTo ? compileTo : path);
+		free(path);
+		return worked ? 0 : 1 ;
+	}
+	if (!openDb())
+		registerDefs(cpu);
 	if( 1 == argc ){
-                struct reglist_t const *defs = registerDefs();
-		while(defs){
-                        showReg(defs);
-			defs = defs->next ;
-		}
+		if (regDb.header) {
+			unsigned const numRegs = regDb.header->numRegs ;
+			unsigned *indices = new unsigned [numRegs];
+			for (unsigned i = 0 ; i < numRegs ; i++)
+				indices[i] = i ;
+			showRegs(dbReglist(indices,numRegs));
+			delete [] indices ;
+		} else
+			showRegs(registerDefs());
 	} else {
                 struct reglist_t const *regs = parseRegisterSpec(argv[1]);
 		if( regs ){
 			if( 2 == argc ){
-				while( regs ){
-					showReg(regs);
-					regs = regs->next ;
-				}
+				showRegs(regs);
 			} else {
 				char *end ;
 				unsigned long value = strtoul(argv[2],&end,16);
@@ -0,0 +1,373 @@
+/*
+ * Module encoderPool.cpp
+ *
+ * This module defines the methods of the encoderPool_t class
+ * as declared in encoderPool.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "encoderPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debugPrint.h"
+
+encoderPool_t::encoderPool_t(vpu_t &vpu)
+	: vpu_(vpu)
+	, uses_(0)
+	, hits_(0)
+	, misses_(0)
+{
+	pthread_mutex_init(&lock_,0);
+	memset(entries_,0,sizeof(entries_));
+}
+
+encoderPool_t::~encoderPool_t(void)
+{
+	for (unsigned i = 0 ; i < MAXENCODERS ; i++) {
+		entry_t &e = entries_[i];
+		if (UNUSED == e.kind)
+			continue ;
+		if (e.inUse)
+			fprintf(stderr, "%s: encoder %p still in use\n", __func__, e.encoder);
+		close(e);
+	}
+	pthread_mutex_destroy(&lock_);
+}
+
+encoderPool_t::entry_t *encoderPool_t::find
+	( kind_e kind,
+	  unsigned width,
+	  unsigned height,
+	  unsigned fourcc,
+	  unsigned stride,
+	  bufferHandle_t const *buffers,
+	  unsigned numBuffers )
+{
+	for (unsigned i = 0 ; i < MAXENCODERS ; i++) {
+		entry_t &e = entries_[i];
+		if ((kind != e.kind) || e.inUse
+		    || (width != e.width) || (height != e.height)
+		    || (fourcc != e.fourcc) || (stride != e.stride)
+		    || (numBuffers != e.numBuffers))
+			continue ;
+		// the encoder registered these buffers by address
+		unsigned b ;
+		for (b = 0 ; b < numBuffers ; b++) {
+			if ((buffers[b].phys != e.buffers[b].phys)
+			    || (buffers[b].virt != e.buffers[b].virt))
+				break ;
+		}
+		if (b == numBuffers)
+			return &e ;
+	}
+	return 0 ;
+}
+
+encoderPool_t::entry_t *encoderPool_t::allocate
+	( kind_e kind,
+	  unsigned width,
+	  unsigned height,
+	  unsigned fourcc,
+	  unsigned stride,
+	  bufferHandle_t const *buffers,
+	  unsigned numBuffers )
+{
+	entry_t *e = 0 ;
+	for (unsigned i = 0 ; i < MAXENCODERS ; i++) {
+		entry_t &cur = entries_[i];
+		if (UNUSED == cur.kind) {
+			e = &cur ;
+			break ;
+		}
+		if (!cur.inUse && ((0 == e) || (cur.lastUsed < e->lastUsed)))
+			e = &cur ;
+	}
+	if (0 == e)
+		return 0 ;
+	if (UNUSED != e->kind) {
+		debugPrint("%s: closing %ux%u encoder %p\n", __func__, e->width, e->height, e->encoder);
+		close(*e);
+	}
+
+	e->buffers = (bufferHandle_t *)malloc(numBuffers*sizeof(buffers[0]));
+	if (0 == e->buffers)
+		return 0 ;
+	memcpy(e->buffers,buffers,numBuffers*sizeof(buffers[0]));
+	e->kind = kind ;
+	e->encoder = 0 ;
+	e->inUse = true ;
+	e->lastUsed = ++uses_ ;
+	e->width = width ;
+	e->height = height ;
+	e->fourcc = fourcc ;
+	e->stride = stride ;
+	e->numBuffers = numBuffers ;
+	return e ;
+}
+
+void encoderPool_t::close(entry_t &e)
+{
+	if (H264 == e.kind)
+		delete (h264_encoder_t *)e.encoder ;
+	else if (JPEG == e.kind)
+		delete (mjpeg_encoder_t *)e.encoder ;
+	if (e.buffers)
+		free(e.buffers);
+	memset(&e,0,sizeof(e));
+}
+
+h264_encoder_t *encoderPool_t::getH264
+	( unsigned width,
+	  unsigned height,
+	  unsigned fourcc,
+	  unsigned gopSize,
+	  bufferHandle_t const *buffers,
+	  unsigned numBuffers,
+	  unsigned stride,
+	  h264_encoder_t::rateControl_t const &rc )
+{
+	pthread_mutex_lock(&lock_);
+	entry_t *e = find(H264,width,height,fourcc,stride,buffers,numBuffers);
+	if (e) {
+		e->inUse = true ;
+		e->lastUsed = ++uses_ ;
+		hits_++ ;
+	} else if (0 != (e = allocate(H264,width,height,fourcc,stride,buffers,numBuffers)))
+		misses_++ ;
+	pthread_mutex_unlock(&lock_);
+	if (0 == e) {
+		fprintf(stderr, "%s: all %u encoders are in use\n", __func__, MAXENCODERS);
+		return 0 ;
+	}
+
+	// the entry is ours now, so open or reconfigure without the lock
+	h264_encoder_t *encoder = (h264_encoder_t *)e->encoder ;
+	if (encoder && !encoder->reconfigure(gopSize,rc)) {
+		debugPrint("%s: settings changed, reopening\n", __func__);
+		delete encoder ;
+		encoder = 0 ;
+		pthread_mutex_lock(&lock_);
+		hits_-- ;
+		misses_++ ;
+		pthread_mutex_unlock(&lock_);
+	}
+	if (0 == encoder) {
+		encoder = new h264_encoder_t(vpu_,width,height,fourcc,gopSize,
+					     buffers,numBuffers,stride,rc);
+		if (!encoder->initialized()) {
+			delete encoder ;
+			encoder = 0 ;
+		}
+		e->encoder = encoder ;
+	}
+	if (0 == encoder) {
+		pthread_mutex_lock(&lock_);
+		close(*e);
+		pthread_mutex_unlock(&lock_);
+	}
+	return encoder ;
+}
+
+mjpeg_encoder_t *encoderPool_t::getJPEG
+	( unsigned width,
+	  unsigned height,
+	  unsigned fourcc,
+	  bufferHandle_t const *buffers,
+	  unsigned numBuffers,
+	  unsigned stride )
+{
+	pthread_mutex_lock(&lock_);
+	entry_t *e = find(JPEG,width,height,fourcc,stride,buffers,numBuffers);
+	if (e) {
+		e->inUse = true ;
+		e->lastUsed = ++uses_ ;
+		hits_++ ;
+	} else if (0 != (e = allocate(JPEG,width,height,fourcc,stride,buffers,numBuffers)))
+		misses_++ ;
+	pthread_mutex_unlock(&lock_);
+	if (0 == e) {
+		fprintf(stderr, "%s: all %u encoders are in use\n", __func__, MAXENCODERS);
+		return 0 ;
+	}
+
+	mjpeg_encoder_t *encoder = (mjpeg_encoder_t *)e->encoder ;
+	if (0 == encoder) {
+		encoder = new mjpeg_encoder_t(vpu_,width,height,fourcc,
+					      buffers,numBuffers,stride);
+		if (!encoder->initialized()) {
+			delete encoder ;
+			encoder = 0 ;
+			pthread_mutex_lock(&lock_);
+			close(*e);
+			pthread_mutex_unlock(&lock_);
+		}
+		else
+			e->encoder = encoder ;
+	}
+	return encoder ;
+}
+
+void encoderPool_t::put(void *encoder)
+{
+	if (0 == encoder)
+		return ;
+	pthread_mutex_lock(&lock_);
+	unsigned i ;
+	for (i = 0 ; i < MAXENCODERS ; i++) {
+		if (entries_[i].inUse && (encoder == entries_[i].encoder)) {
+			entries_[i].inUse = false ;
+			break ;
+		}
+	}
+	pthread_mutex_unlock(&lock_);
+	if (MAXENCODERS == i)
+		fprintf(stderr, "%s: encoder %p is not from this pool\n", __func__, encoder);
+}
+
+void encoderPool_t::put(h264_encoder_t *encoder)
+{
+	put((void *)encoder);
+}
+
+void encoderPool_t::put(mjpeg_encoder_t *encoder)
+{
+	put((void *)encoder);
+}
+
+void encoderPool_t::flush(void)
+{
+	pthread_mutex_lock(&lock_);
+	for (unsigned i = 0 ; i < MAXENCODERS ; i++) {
+		entry_t &e = entries_[i];
+		if ((UNUSED != e.kind) && !e.inUse)
+			close(e);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+unsigned encoderPool_t::numOpen(void) const
+{
+	unsigned count = 0 ;
+	for (unsigned i = 0 ; i < MAXENCODERS ; i++) {
+		if (UNUSED != entries_[i].kind)
+			count++ ;
+	}
+	return count ;
+}
+
+#ifdef STANDALONE_ENCODERPOOL
+#include <sys/time.h>
+#include <linux/videodev2.h>
+#include "physPool.h"
+
+static long long tickUs(void)
+{
+	struct timeval now ;
+	gettimeofday(&now,0);
+	return (long long)now.tv_sec*1000000 + now.tv_usec ;
+}
+
+int main(int argc, char const * const argv[])
+{
+	enum {
+		NUMBUFFERS = 3,
+		WIDTH = 640,
+		HEIGHT = 480
+	};
+	vpu_t vpu ;
+	if (!vpu.worked())
+		return -1 ;
+
+	physPool_t &frames = physPool_t::shared();
+	physPool_t::block_t *mem[NUMBUFFERS];
+	bufferHandle_t handles[NUMBUFFERS];
+	memset(handles,0,sizeof(handles));
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++) {
+		mem[i] = frames.alloc(WIDTH*HEIGHT*3/2);
+		if (0 == mem[i]) {
+			fprintf(stderr, "Error allocating frame buffer %u\n", i);
+			while (i--)
+				frames.release(mem[i]);
+			return -1 ;
+		}
+		handles[i].dmafd = mem[i]->fd ;
+		handles[i].phys = mem[i]->phys ;
+		handles[i].virt = mem[i]->virt ;
+		handles[i].length = WIDTH*HEIGHT*3/2 ;
+		handles[i].index = i ;
+		memset(handles[i].virt,0x80,handles[i].length);
+	}
+
+	int errors = 0 ;
+	{
+		encoderPool_t pool(vpu);
+		h264_encoder_t::rateControl_t rc ;
+
+		long long start = tickUs();
+		h264_encoder_t *h264 = pool.getH264(WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,30,handles,NUMBUFFERS,0,rc);
+		long long openUs = tickUs()-start ;
+		if (0 == h264) {
+			fprintf(stderr, "Error opening H.264 encoder\n");
+			return -1 ;
+		}
+		void const *outData ;
+		unsigned outLength ;
+		bool iframe ;
+		for (unsigned i = 0 ; i < 3 ; i++) {
+			if (h264->encode(i,outData,outLength,iframe))
+				h264->releaseOutput(outData);
+		}
+		pool.put(h264);
+
+		// a new stream with a different GOP and QP reuses the encoder
+		rc.qp = 30 ;
+		start = tickUs();
+		h264_encoder_t *again = pool.getH264(WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,10,handles,NUMBUFFERS,0,rc);
+		long long reuseUs = tickUs()-start ;
+		if (again != h264) {
+			fprintf(stderr, "H.264 encoder was not reused\n");
+			errors++ ;
+		}
+		if (again && again->encode(0,outData,outLength,iframe)) {
+			if (!iframe) {
+				fprintf(stderr, "reused encoder didn't start with an I-frame\n");
+				errors++ ;
+			}
+			again->releaseOutput(outData);
+		}
+
+		// a snapshot while the H.264 encoder is busy gets its own instance
+		start = tickUs();
+		mjpeg_encoder_t *jpeg = pool.getJPEG(WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,handles,NUMBUFFERS);
+		long long jpegOpenUs = tickUs()-start ;
+		pool.put(jpeg);
+		start = tickUs();
+		mjpeg_encoder_t *jpeg2 = pool.getJPEG(WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,handles,NUMBUFFERS);
+		long long jpegReuseUs = tickUs()-start ;
+		if ((0 == jpeg) || (jpeg2 != jpeg)) {
+			fprintf(stderr, "JPEG encoder was not reused\n");
+			errors++ ;
+		}
+		pool.put(jpeg2);
+		pool.put(again);
+
+		// fixed settings (rate control on) force a reopen
+		rc.kbps = 2000 ;
+		h264_encoder_t *cbr = pool.getH264(WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,30,handles,NUMBUFFERS,0,rc);
+		pool.put(cbr);
+
+		printf("H.264: open %lld us, reuse %lld us\n", openUs, reuseUs);
+		printf("JPEG: open %lld us, reuse %lld us\n", jpegOpenUs, jpegReuseUs);
+		printf("%u open, %u hits, %u misses\n", pool.numOpen(), pool.numHits(), pool.numMisses());
+		if ((2 != pool.numHits()) || (3 != pool.numMisses()) || (0 == cbr))
+			errors++ ;
+	}
+
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++)
+		frames.release(mem[i]);
+	printf("%d errors\n", errors);
+	return errors ? -1 : 0 ;
+}
+#endif
@@ -0,0 +1,115 @@
+#ifndef __ENCODERPOOL_H__
+#define __ENCODERPOOL_H__ "$Id$"
+
+/*
+ * encoderPool.h
+ *
+ * This header file declares the encoderPool_t class, which keeps
+ * VPU encoders open between uses.
+ *
+ * Opening an encoder allocates its bitstream buffers, opens a VPU
+ * instance, claims IRAM for search RAM, registers the frame buffers
+ * and (for H.264) generates SPS and PPS, which together take far
+ * longer than a frame. The pool hands back an idle encoder whose
+ * geometry and frame buffers match instead, so starting a stream or
+ * taking a snapshot costs next to nothing after the first time.
+ * encodeStage_t::prewarm() takes its encoders from the pool before
+ * streaming, to move even that out of the capture path.
+ *
+ * A reused H.264 encoder is reconfigured (GOP, bitrate, ...) through
+ * h264_encoder_t::reconfigure() and starts over with an IDR frame.
+ *
+ * The VPU has a limited number of instances, so the pool holds at
+ * most MAXENCODERS, and closes the least recently used idle one to
+ * make room.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "imx_vpu.h"
+#include "imx_h264_encoder.h"
+#include "imx_mjpeg_encoder.h"
+#include "bufferHandle.h"
+#include <pthread.h>
+
+class encoderPool_t {
+public:
+	enum {
+		MAXENCODERS = 4		// VPU instances
+	};
+
+	encoderPool_t(vpu_t &vpu);
+	~encoderPool_t(void);	// closes all encoders, which must be idle
+
+	/*
+	 * Return an idle encoder for these frame buffers, opening one if
+	 * needed. Returns 0 if the encoder can't be opened or all of the
+	 * instances are in use.
+	 */
+	h264_encoder_t *getH264(unsigned width,
+				unsigned height,
+				unsigned fourcc,
+				unsigned gopSize,
+				bufferHandle_t const *buffers,
+				unsigned numBuffers,
+				unsigned stride = 0,
+				h264_encoder_t::rateControl_t const &rc = h264_encoder_t::rateControl_t());
+	mjpeg_encoder_t *getJPEG(unsigned width,
+				 unsigned height,
+				 unsigned fourcc,
+				 bufferHandle_t const *buffers,
+				 unsigned numBuffers,
+				 unsigned stride = 0);
+
+	// hand an encoder back, still open, for the next get
+	void put(h264_encoder_t *encoder);
+	void put(mjpeg_encoder_t *encoder);
+
+	// closes the idle encoders, e.g. after the camera is reopened
+	void flush(void);
+
+	// statistics
+	unsigned numOpen(void) const ;
+	unsigned numHits(void) const { return hits_ ; }
+	unsigned numMisses(void) const { return misses_ ; }
+
+private:
+	encoderPool_t(encoderPool_t const &); // no copies
+
+	enum kind_e {
+		UNUSED,
+		H264,
+		JPEG
+	};
+
+	struct entry_t {
+		kind_e		kind ;
+		void	       *encoder ;
+		bool		inUse ;
+		unsigned	lastUsed ;
+		unsigned	width ;
+		unsigned	height ;
+		unsigned	fourcc ;
+		unsigned	stride ;
+		unsigned	numBuffers ;
+		bufferHandle_t *buffers ;	// copy, for matching
+	};
+
+	entry_t *find(kind_e kind, unsigned width, unsigned height,
+		      unsigned fourcc, unsigned stride,
+		      bufferHandle_t const *buffers, unsigned numBuffers);
+	entry_t *allocate(kind_e kind, unsigned width, unsigned height,
+			  unsigned fourcc, unsigned stride,
+			  bufferHandle_t const *buffers, unsigned numBuffers);
+	void close(entry_t &e);
+	void put(void *encoder);
+
+	vpu_t		       &vpu_ ;
+	pthread_mutex_t		lock_ ;
+	entry_t			entries_[MAXENCODERS];
+	unsigned		uses_ ;
+	unsigned		hits_ ;
+	unsigned		misses_ ;
+};
+
+#endif
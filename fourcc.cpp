@@ -18,82 +18,84 @@
 
 #define ARRAY_SIZE(__arr) (sizeof(__arr)/sizeof(__arr[0]))
 
-enum colorspace {
-	YUV,
-	RGB
+/*
+ * The order of this table is the order reported by
+ * supported_fourcc_formats(), and must match formatIndex() below.
+ *
+ *	fourcc, name, bytes, yuv, planes, uv col/row shift,
+ *	y/uv step, y/u/v byte, u/v plane, width alignment
+ */
+static fourccInfo_t const pix_formats[] = {
+	{V4L2_PIX_FMT_YUV420,	"YUV420",	1, true,  3, 1, 1, 1, 1, 0, 0, 0, 1, 2, 2},
+	{V4L2_PIX_FMT_YVU420,	"YVU420",	1, true,  3, 1, 1, 1, 1, 0, 0, 0, 2, 1, 2},
+	{V4L2_PIX_FMT_NV12,	"NV12",		1, true,  2, 1, 1, 1, 2, 0, 0, 1, 1, 1, 2},
+	{V4L2_PIX_FMT_YUV422P,	"YUV422P",	1, true,  3, 1, 0, 1, 1, 0, 0, 0, 1, 2, 2},
+	{v4l2_fourcc('Y','V','1','6'),"YVU422P",1, true,  3, 1, 0, 1, 1, 0, 0, 0, 2, 1, 2},
+	{V4L2_PIX_FMT_SBGGR8,	"SBGGR8",	1, false, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_SGBRG8,	"SGBRG8",	1, false, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_SGRBG10,	"SGRBG10",	2, false, 1, 0, 0, 2, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_SBGGR16,	"SBGGR16",	2, false, 1, 0, 0, 2, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_RGB565,	"RGB565",	2, false, 1, 0, 0, 2, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_UYVY,	"UYVY",		2, true,  1, 1, 0, 2, 4, 1, 0, 2, 0, 0, 2},
+	{V4L2_PIX_FMT_YUYV,	"YUYV",		2, true,  1, 1, 0, 2, 4, 0, 1, 3, 0, 0, 2},
+	{V4L2_PIX_FMT_RGB24,	"RGB24",	3, false, 1, 0, 0, 3, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_BGR24,	"BGR24",	3, false, 1, 0, 0, 3, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_RGB32,	"RGB32",	4, false, 1, 0, 0, 4, 0, 0, 0, 0, 0, 0, 1},
+	{V4L2_PIX_FMT_BGR32,	"BGR32",	4, false, 1, 0, 0, 4, 0, 0, 0, 0, 0, 0, 1},
 };
 
-#define PXF_PLANAR		1
-#define PXF_PLANAR_UV_W_HALF	2
-#define PXF_PLANAR_UV_H_HALF	4
-#define PXF_COLORSPACE_YUV	8
-#define PXF_PLANAR_PARTIAL	16
-#define PXF_PLANAR_V_FIRST	32
-#define PXF_COLORSPACE_YV_FIRST 64
-
-struct pixformat_info {
-	unsigned 	v4l2_format ;
-	char const 	*name ;
-	unsigned 	bytes_per_component ;
-	enum colorspace	colorspace ;
-	unsigned        flags ;
-};
+static int formatIndex(unsigned fourcc)
+{
+	switch (fourcc) {
+		case V4L2_PIX_FMT_YUV420:	return 0 ;
+		case V4L2_PIX_FMT_YVU420:	return 1 ;
+		case V4L2_PIX_FMT_NV12:		return 2 ;
+		case V4L2_PIX_FMT_YUV422P:	return 3 ;
+		case v4l2_fourcc('Y','V','1','6'): return 4 ;
+		case V4L2_PIX_FMT_SBGGR8:	return 5 ;
+		case V4L2_PIX_FMT_SGBRG8:	return 6 ;
+		case V4L2_PIX_FMT_SGRBG10:	return 7 ;
+		case V4L2_PIX_FMT_SBGGR16:	return 8 ;
+		case V4L2_PIX_FMT_RGB565:	return 9 ;
+		case V4L2_PIX_FMT_UYVY:		return 10 ;
+		case V4L2_PIX_FMT_YUYV:		return 11 ;
+		case V4L2_PIX_FMT_RGB24:	return 12 ;
+		case V4L2_PIX_FMT_BGR24:	return 13 ;
+		case V4L2_PIX_FMT_RGB32:	return 14 ;
+		case V4L2_PIX_FMT_BGR32:	return 15 ;
+	}
+	return -1 ;
+}
 
-static const struct pixformat_info pix_formats[] = {
-	{V4L2_PIX_FMT_YUV420,	"YUV420",	1, YUV, PXF_PLANAR | PXF_PLANAR_UV_W_HALF | PXF_PLANAR_UV_H_HALF},
-	{V4L2_PIX_FMT_YVU420,	"YVU420",	1, YUV, PXF_PLANAR | PXF_PLANAR_UV_W_HALF | PXF_PLANAR_UV_H_HALF | PXF_PLANAR_V_FIRST},
-	{V4L2_PIX_FMT_NV12,	"NV12",		1, YUV, PXF_PLANAR | PXF_PLANAR_UV_W_HALF | PXF_PLANAR_UV_H_HALF | PXF_PLANAR_PARTIAL},
-	{V4L2_PIX_FMT_YUV422P,	"YUV422P",	1, YUV, PXF_PLANAR | PXF_PLANAR_UV_W_HALF},
-	{v4l2_fourcc('Y','V','1','6'),"YVU422P",	1, YUV, PXF_PLANAR | PXF_PLANAR_UV_W_HALF | PXF_PLANAR_V_FIRST},
-	{V4L2_PIX_FMT_SBGGR8,	"SBGGR8",	1, RGB, 0},
-	{V4L2_PIX_FMT_SGBRG8,	"SGBRG8",	1, RGB, 0},
-	{V4L2_PIX_FMT_SGRBG10,	"SGRBG10",	2, RGB, 0},
-	{V4L2_PIX_FMT_SBGGR16,	"SBGGR16",	2, RGB, 0},
-	{V4L2_PIX_FMT_RGB565,	"RGB565",	2, RGB, 0},
-	{V4L2_PIX_FMT_UYVY,	"UYVY",		2, YUV, 0},
-	{V4L2_PIX_FMT_YUYV,	"YUYV",		2, YUV, 0},
-	{V4L2_PIX_FMT_RGB24,	"RGB24",	3, RGB, 0},
-	{V4L2_PIX_FMT_BGR24,	"BGR24",	3, RGB, 0},
-	{V4L2_PIX_FMT_RGB32,	"RGB32",	4, RGB, 0},
-	{V4L2_PIX_FMT_BGR32,	"BGR32",	4, RGB, 0},
-};
+fourccInfo_t const *fourccInfo(unsigned fourcc)
+{
+	int idx = formatIndex(fourcc);
+	return (0 <= idx) ? pix_formats+idx : 0 ;
+}
 
 unsigned bits_per_pixel(unsigned fourcc)
 {
-	for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
-		if(fourcc == pix_formats[i].v4l2_format)
-			return pix_formats[i].bytes_per_component*8 ;
-	}
-	return 0 ;
+	fourccInfo_t const *info = fourccInfo(fourcc);
+	return info ? info->bytesPerComponent*8 : 0 ;
 }
 
-static unsigned const *supported_formats = 0 ;
+static unsigned supported_formats[ARRAY_SIZE(pix_formats)];
 
 bool supported_fourcc(char const *arg, unsigned &fourcc){
 	fourcc = fourcc_from_str(arg);
-	for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
-		if(fourcc == pix_formats[i].v4l2_format)
-			return true ;
-	}
-	return false ;
+	return 0 != fourccInfo(fourcc);
 }
 
 bool supported_fourcc(unsigned fourcc){
-	for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
-		if(fourcc == pix_formats[i].v4l2_format)
-			return true ;
-	}
-	return false ;
+	return 0 != fourccInfo(fourcc);
 }
 
 void supported_fourcc_formats(unsigned const *&values, unsigned &numValues)
 {
-	if( 0 == supported_formats ){
-		unsigned *fmts = new unsigned [ARRAY_SIZE(pix_formats)];
+	if( 0 == supported_formats[0] ){
 		for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
-			fmts[i] = pix_formats[i].v4l2_format ;
+			supported_formats[i] = pix_formats[i].fourcc ;
 		}
-		supported_formats = (unsigned const *)fmts ;
 	}
 
 	values = supported_formats ;
@@ -102,208 +104,90 @@ void supported_fourcc_formats(unsigned const *&values, unsigned &numValues)
 
 bool isYUV(unsigned fourcc)
 {
-	for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
-		if(fourcc == pix_formats[i].v4l2_format)
-			return YUV == pix_formats[i].colorspace ;
-	}
-	return false ;
+	fourccInfo_t const *info = fourccInfo(fourcc);
+	return info && info->yuv ;
 }
 
-/*
- * In order to iterate through each of the bytes of Y, U, and V for each supported YUV frame
- * format we need to know each of these for Y, U, and V.
- *
- *		initial offset
- *		row divisor
- *		column divisor
- *		column adder
- *
- * In order to produce these, we'll need the width, height and fourcc value coming in.
- * The following table will allow these calculations based on multipliers, divisors and
- * fixed offsets based on W*H and W (height doesn't matter).
- *
- * The initial offset calculation is this:
- *		initial offset = (imwh_numerator*(W*H)/imwh_denominator) + (imw_numerator*W)/imw_denominator + fixed_offset ;
- *
- * The column divisors and adders are strictly constants.
- *
- */
-struct multiplier {
-	unsigned num ;
-	unsigned denom ;
-};
+frameLayout_t::frameLayout_t(void)
+{
+	clear();
+}
 
-struct scaler {
-	struct multiplier whmult ;
-	struct multiplier wmult ;
-	unsigned initial_offset ;
-	unsigned row_divisor ;
-	unsigned column_divisor ;
-	unsigned column_adder ;
-};
+frameLayout_t::frameLayout_t(unsigned fourcc, unsigned w, unsigned h,
+			     unsigned stride, unsigned uvStride)
+{
+	init(fourcc,w,h,stride,uvStride);
+}
 
-struct yuvOffsets_t {
-	unsigned fourcc ;
-	struct scaler	yscaler ;
-	struct scaler	uscaler ;
-	struct scaler	vscaler ;
-};
+void frameLayout_t::clear(void)
+{
+	info = 0 ;
+	width = height = 0 ;
+	numPlanes = 0 ;
+	memset(planes,0,sizeof(planes));
+	memset(&y,0,sizeof(y));
+	memset(&u,0,sizeof(u));
+	memset(&v,0,sizeof(v));
+	size = 0 ;
+	padded_ = false ;
+}
 
-/*
- * To take an example: YUV420P consists of an [W*H] Y plane followed by [W*H/4] U and V planes, so
- * its table entry will be this:
- *
- *	Y:  WH      W    offset rd cd ca	Y:  WH      W    offset rd cd ca 	Y:  WH      W    offset rd cd ca 
- *	  {{0,1}, {0,1},   0,    1, 1, 1}},	  {{1,1}, {0,1},   0,    2, 2, 1}},  	  {{0,1}, {0,1},   0,    2, 2, 1}}, 
- *
- * In English, all of the initial offsets yield zero for Y, the U plane is offset by 1*W*H and the V plane is offset by (5/4)*W*H (1.25).
- * Both row and column divisors are 1 for Y and 2 for both U and V planes.
- * All of the column adders are 1, so adjacent columns are adjacent in memory. 
- *
- * For the YUYV format, each of the W*H and W multipliers will yield zero, the fixed offsets will be 0, 1, and 3 for Y, U, and V and
- * the column adders will be 2, 4, and 4 since the Y values are two bytes apart in memory and U and V are two bytes apart.
- *
- */
-static struct yuvOffsets_t const yuvOffsets[] = {
-	{ V4L2_PIX_FMT_YUV420,		// YUV 420 planar
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{1,1}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{5,4}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
-	}
-,	{ V4L2_PIX_FMT_YVU420,		// YUV 420 planar
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{5,4}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{1,1}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
-	}
-,	{ V4L2_PIX_FMT_NV12,		// YUV 420 semi-planar
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{1,1}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	2		//	   column adder
-                }
-	,	{	{1,1}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	1		//	   initial offset
-		,	2		//	   row divisor
-		,	2		//	   column divisor
-		,	2		//	   column adder
-                }
-	}
-,	{ V4L2_PIX_FMT_YUV422P,		// YUV 422 planar
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{1,1}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
-	,	{	{3,2}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	1		//	   column adder
-                }
+bool frameLayout_t::init(unsigned fourcc, unsigned w, unsigned h,
+			 unsigned stride, unsigned uvStride)
+{
+	clear();
+	fourccInfo_t const *fmt = fourccInfo(fourcc);
+	if ((0 == fmt) || (0 == w) || (0 == h))
+		return false ;
+
+	unsigned const natural = w*fmt->yStep ;
+	if (0 == stride)
+		stride = natural ;
+	else if (stride < natural)
+		return false ;
+
+	unsigned const uvWidth = w >> fmt->uvColShift ;
+	unsigned const uvHeight = h >> fmt->uvRowShift ;
+	unsigned const uvNatural = uvWidth*fmt->uvStep ;
+	if (1 < fmt->numPlanes) {
+		if (0 == uvStride)
+			uvStride = ((stride*fmt->uvStep)/fmt->yStep) >> fmt->uvColShift ;
+		if (uvStride < uvNatural)
+			return false ;
 	}
-,	{ V4L2_PIX_FMT_YUYV,		// YUYV
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	2		//	   column adder
-                }
-	,	{	{0,1}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	1		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	4		//	   column adder
-                }
-	,	{	{0,1}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	3		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	4		//	   column adder
-                }
+
+	unsigned offset = 0 ;
+	for (unsigned p = 0 ; p < fmt->numPlanes ; p++) {
+		plane_t &plane = planes[p];
+		plane.offset = offset ;
+		plane.stride = p ? uvStride : stride ;
+		plane.height = p ? uvHeight : h ;
+		plane.size = plane.stride*plane.height ;
+		offset += plane.size ;
 	}
-,	{ V4L2_PIX_FMT_UYVY,		// UYVY
-		{	{0,1}		//	Y: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	1		//	   initial offset
-		,	1		//	   row divisor
-		,	1		//	   column divisor
-		,	2		//	   column adder
-                }
-	,	{	{0,1}		//	U: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	0		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	4		//	   column adder
-                }
-	,	{	{0,1}		//	V: W*H	multiplier
-		,	{0,1}		// 	   W multiplier
-		,	2		//	   initial offset
-		,	1		//	   row divisor
-		,	2		//	   column divisor
-		,	4		//	   column adder
-                }
+	numPlanes = fmt->numPlanes ;
+	size = offset ;
+	width = w ;
+	height = h ;
+	padded_ = (stride != natural) || ((1 < numPlanes) && (uvStride != uvNatural));
+
+	if (fmt->yuv) {
+		y.offset = planes[0].offset + fmt->yByte ;
+		y.step = fmt->yStep ;
+		y.stride = planes[0].stride ;
+		y.width = w ;
+		y.height = h ;
+
+		u.offset = planes[fmt->uPlane].offset + fmt->uByte ;
+		v.offset = planes[fmt->vPlane].offset + fmt->vByte ;
+		u.step = v.step = fmt->uvStep ;
+		u.stride = v.stride = planes[fmt->uPlane].stride ;
+		u.width = v.width = uvWidth ;
+		u.height = v.height = uvHeight ;
 	}
-};
+	info = fmt ;
+	return true ;
+}
 
 bool fourccOffsets(
 	unsigned fourcc,
@@ -320,40 +204,20 @@ bool fourccOffsets(
 	unsigned &uvadder,
 	unsigned &totalsize )
 {
-	unsigned WH = width*height;
-	for (unsigned i = 0 ; i < ARRAY_SIZE(yuvOffsets); i++) {
-		struct yuvOffsets_t const &entry = yuvOffsets[i];
-		if (entry.fourcc==fourcc) {
-			if ((entry.uscaler.row_divisor == entry.vscaler.row_divisor)
-			    &&
-			    (entry.uscaler.column_divisor == entry.vscaler.column_divisor)
-			    &&
-			    (entry.uscaler.column_adder == entry.vscaler.column_adder)) {
-				ysize=(WH/entry.yscaler.row_divisor/entry.yscaler.column_divisor);
-				uvsize=(WH/entry.uscaler.row_divisor/entry.uscaler.column_divisor);
-				totalsize = ysize+2*uvsize;
-				yadder = entry.yscaler.column_adder ;
-				uvadder = entry.uscaler.column_adder ;
-				uvrowdiv = entry.uscaler.row_divisor ;
-				uvcoldiv = entry.uscaler.column_divisor ;
-				yoffs = (WH*entry.yscaler.whmult.num)/entry.yscaler.whmult.denom
-				      + (width*entry.yscaler.wmult.num)/entry.yscaler.wmult.denom
-				      + entry.yscaler.initial_offset ;
-				uoffs = (WH*entry.uscaler.whmult.num)/entry.uscaler.whmult.denom
-				      + (width*entry.uscaler.wmult.num)/entry.uscaler.wmult.denom
-				      + entry.uscaler.initial_offset ;
-				voffs = (WH*entry.vscaler.whmult.num)/entry.vscaler.whmult.denom
-				      + (width*entry.vscaler.wmult.num)/entry.vscaler.wmult.denom
-				      + entry.vscaler.initial_offset ;
-				return true ;
-			} // this API can't handle different U and V sizes
-			else {
-				fprintf(stderr, "%s: Invalid fourcc for this API\n", __func__ );
-				break;
-			}
-		}
-	}
-	return false ;
+	frameLayout_t layout ;
+	if (!layout.init(fourcc,width,height) || !layout.info->yuv)
+		return false ;
+	ysize = layout.y.width*layout.y.height ;
+	uvsize = layout.u.width*layout.u.height ;
+	totalsize = layout.size ;
+	yadder = layout.y.step ;
+	uvadder = layout.u.step ;
+	uvrowdiv = 1 << layout.info->uvRowShift ;
+	uvcoldiv = 1 << layout.info->uvColShift ;
+	yoffs = layout.y.offset ;
+	uoffs = layout.u.offset ;
+	voffs = layout.v.offset ;
+	return true ;
 }
 
 #ifdef STANDALONE_FOURCC
@@ -361,6 +225,12 @@ bool fourccOffsets(
 #include <stdlib.h>
 
 int main(int argc, char const * const argv[]){
+    for( unsigned i = 0 ; i < ARRAY_SIZE(pix_formats); i++ ){
+        if( fourccInfo(pix_formats[i].fourcc) != pix_formats+i ){
+            fprintf(stderr, "formatIndex(%s) is out of sync with pix_formats[]\n", pix_formats[i].name);
+            return -1 ;
+        }
+    }
     if (1 < argc) {
         for( int arg = 1 ; arg < argc ; arg++ ){
 	    unsigned binary = 0 ;
@@ -403,6 +273,11 @@ int main(int argc, char const * const argv[]){
 			}
 			else
 				printf( "RGB format\n" );
+			frameLayout_t layout(binary,320,240,(320+32)*fourccInfo(binary)->yStep);
+			printf( "\twith 32 pixels of padding, %u planes, %u bytes\n", layout.numPlanes, layout.size);
+			for( unsigned p = 0 ; p < layout.numPlanes ; p++ )
+				printf( "\tplane %u: offset %u, stride %u, %u rows\n", p,
+					layout.planes[p].offset, layout.planes[p].stride, layout.planes[p].height);
             }
         }
     }
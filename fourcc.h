@@ -27,7 +27,7 @@ inline char const *fourcc_str(unsigned long fcc){
 
 inline unsigned fourcc_from_str(char const *fcc){
 	unsigned rval = 0 ;
-	strncpy((char *)&rval,fcc,sizeof(fcc));
+	strncpy((char *)&rval,fcc,sizeof(rval));
 	return rval ;
 }
 
@@ -58,6 +58,7 @@ unsigned bits_per_pixel(unsigned fourcc);
 /*
  * Use this to get the size and offsets of the y, u and v portions
  * of a YUV image format and the increment between samples of u and v.
+ * This assumes unpadded lines: new code should use frameLayout_t.
  *
  * Returns false if not a YUV image format.
  */
@@ -78,5 +79,103 @@ bool fourccOffsets(
 
 bool isYUV(unsigned fourcc);
 
+/*
+ * Static description of a pixel format, from a constant table.
+ * Lookups are a switch on the fourcc, so they're cheap enough to
+ * use per-frame.
+ *
+ * For YUV formats, the sample positions are described relative
+ * to the start of the plane holding each component:
+ *
+ *	YUV420 (I420)	3 planes, Y, U, V
+ *	YVU420 (YV12)	3 planes, Y, V, U
+ *	NV12		2 planes, Y and interleaved U/V (step 2)
+ *	YUV422P		3 planes, chroma full height
+ *	YUYV/UYVY	1 plane, Y step 2, U and V step 4
+ */
+struct fourccInfo_t {
+	unsigned	fourcc ;
+	char const     *name ;
+	unsigned char	bytesPerComponent ;	// of Y (or of a whole RGB pixel)
+	bool		yuv ;
+	unsigned char	numPlanes ;
+	unsigned char	uvColShift ;		// log2 of horizontal chroma subsampling
+	unsigned char	uvRowShift ;		// log2 of vertical chroma subsampling
+	unsigned char	yStep ;			// bytes between samples in a row
+	unsigned char	uvStep ;
+	unsigned char	yByte ;			// offset of the first sample in its plane
+	unsigned char	uByte ;
+	unsigned char	vByte ;
+	unsigned char	uPlane ;		// plane holding each component
+	unsigned char	vPlane ;
+	unsigned char	widthAlign ;		// width must be a multiple of this
+};
+
+/*
+ * Returns 0 if the format isn't supported
+ */
+fourccInfo_t const *fourccInfo(unsigned fourcc);
+
+/*
+ * Where each plane and each of Y, U and V lives in a frame of a
+ * given format and size. Compute one of these when the format is
+ * known (i.e. once per stream) and pass it around.
+ *
+ * Drivers often pad lines, so the stride of the first plane can
+ * be specified. The chroma stride defaults to the one implied by
+ * the format (e.g. half the Y stride for I420, the same for NV12),
+ * but can also be given when a driver reports it separately.
+ *
+ * For RGB formats only the plane information is filled in.
+ */
+struct frameLayout_t {
+	enum {
+		MAXPLANES = 3
+	};
+
+	struct plane_t {
+		unsigned	offset ;	// from the start of the frame
+		unsigned	stride ;	// bytes between rows
+		unsigned	height ;	// rows
+		unsigned	size ;
+	};
+
+	struct component_t {
+		unsigned	offset ;	// of the first sample, from the start of the frame
+		unsigned	step ;		// bytes between samples in a row
+		unsigned	stride ;	// bytes between rows
+		unsigned	width ;		// in samples
+		unsigned	height ;
+	};
+
+	frameLayout_t(void);
+	frameLayout_t(unsigned fourcc, unsigned width, unsigned height,
+		      unsigned stride = 0, unsigned uvStride = 0);
+
+	// returns false (and leaves the layout invalid) for unsupported formats
+	// or strides smaller than the width
+	bool init(unsigned fourcc, unsigned width, unsigned height,
+		  unsigned stride = 0, unsigned uvStride = 0);
+
+	bool valid(void) const { return 0 != info ; }
+
+	// true if any line is longer than the width requires
+	bool padded(void) const { return padded_ ; }
+
+	fourccInfo_t const *info ;
+	unsigned	width ;
+	unsigned	height ;
+	unsigned	numPlanes ;
+	plane_t		planes[MAXPLANES];
+	component_t	y ;
+	component_t	u ;
+	component_t	v ;
+	unsigned	size ;		// of the whole frame
+private:
+	void clear(void);
+
+	bool		padded_ ;
+};
+
 #endif
 
@@ -0,0 +1,417 @@
+/*
+ * Module gopRing.cpp
+ *
+ * This module defines the methods of the gopRing_t class
+ * as declared in gopRing.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "gopRing.h"
+#include <stdlib.h>
+#include <string.h>
+#include "debugPrint.h"
+
+gopRing_t::gopRing_t(unsigned bytes, unsigned seconds)
+	: size_(bytes & ~7)
+	, maxUs_((long long)seconds*1000000)
+	, arena_(0)
+	, haveThread_(false)
+	, shutdown_(false)
+	, stopping_(false)
+	, fOut_(0)
+	, dropped_(0)
+	, written_(0)
+{
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&cond_,0);
+	reset();
+	if (0 == size_)
+		return ;
+	arena_ = (unsigned char *)malloc(size_);
+	if (0 == arena_) {
+		ERRMSG("%s: error allocating %u bytes\n", __func__, size_);
+		return ;
+	}
+	if (0 != pthread_create(&thread_,0,threadRoutine,this)) {
+		perror("gopRing thread");
+		return ;
+	}
+	haveThread_ = true ;
+}
+
+gopRing_t::~gopRing_t(void)
+{
+	if (haveThread_) {
+		pthread_mutex_lock(&lock_);
+		if (fOut_) {
+			stopping_ = true ;
+			pthread_cond_broadcast(&cond_);
+			while (fOut_)
+				pthread_cond_wait(&cond_,&lock_);
+		}
+		shutdown_ = true ;
+		pthread_cond_broadcast(&cond_);
+		pthread_mutex_unlock(&lock_);
+		pthread_join(thread_,0);
+	}
+	if (arena_)
+		free(arena_);
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+unsigned gopRing_t::recordSize(unsigned length)
+{
+	return sizeof(record_t)+((length+7)&~7);
+}
+
+/*
+ * Finds room for a record at head_, or at the start of the arena
+ * if it won't fit at the end. Called with the lock held.
+ */
+bool gopRing_t::reserve(unsigned size, unsigned &offset)
+{
+	if (0 == records_)
+		head_ = tail_ = 0 ;
+	if ((head_ > tail_) || (0 == records_)) {
+		if (size_-head_ >= size) {
+			offset = head_ ;
+			return true ;
+		}
+		if (tail_ >= size) {
+			if (size_-head_ >= sizeof(record_t))
+				((record_t *)(arena_+head_))->length = 0 ;
+			offset = 0 ;
+			return true ;
+		}
+		return false ;
+	}
+	if (tail_-head_ >= size) {
+		offset = head_ ;
+		return true ;
+	}
+	return false ;
+}
+
+// Called with the lock held, and not while recording
+void gopRing_t::dropOldest(void)
+{
+	records_ -= gops_[firstGop_].records ;
+	firstGop_ = (firstGop_+1) % MAXGOPS ;
+	--numGops_ ;
+	if (numGops_)
+		tail_ = gops_[firstGop_].offset ;
+	else if (headerRecords_)
+		tail_ = headerOffset_ ;
+	else
+		head_ = tail_ = 0 ;
+}
+
+// Called with the lock held
+void gopRing_t::reset(void)
+{
+	head_ = tail_ = 0 ;
+	records_ = 0 ;
+	firstGop_ = numGops_ = 0 ;
+	headerOffset_ = -1 ;
+	headerRecords_ = 0 ;
+	waitKey_ = true ;
+	newestUs_ = 0 ;
+}
+
+void gopRing_t::add(void const *data, unsigned length, unsigned flags, long long timeUs)
+{
+	if ((0 == arena_) || (0 == length))
+		return ;
+	bool const key = (0 != (flags & KEYFRAME));
+	bool const header = (0 != (flags & HEADER));
+
+	pthread_mutex_lock(&lock_);
+	if (waitKey_ && !(key || header)) {
+		dropped_++ ;
+		pthread_mutex_unlock(&lock_);
+		return ;
+	}
+	waitKey_ = false ;
+
+	// a new GOP lets the oldest go once the rest cover the time limit
+	if (key && !fOut_) {
+		while ((1 < numGops_)
+		       && (timeUs-gops_[(firstGop_+1) % MAXGOPS].timeUs >= maxUs_))
+			dropOldest();
+		if (MAXGOPS == numGops_)
+			dropOldest();
+	}
+
+	unsigned const size = recordSize(length);
+	unsigned offset ;
+	while (!reserve(size,offset)) {
+		if (!fOut_ && numGops_ && ((1 < numGops_) || key)) {
+			dropOldest();
+			continue ;
+		}
+		// the GOP is bigger than the ring, or the writer is behind
+		if (!fOut_)
+			reset();
+		else
+			waitKey_ = true ;
+		dropped_++ ;
+		pthread_mutex_unlock(&lock_);
+		return ;
+	}
+
+	record_t *rec = (record_t *)(arena_+offset);
+	rec->length = length ;
+	rec->flags = flags ;
+	rec->timeUs = timeUs ;
+	memcpy(rec+1,data,length);
+	head_ = offset+size ;
+	records_++ ;
+	newestUs_ = timeUs ;
+
+	if (fOut_) {
+		pthread_cond_broadcast(&cond_);
+	} else if (header) {
+		if (0 == headerRecords_++)
+			headerOffset_ = offset ;
+	} else if (key) {
+		gop_t &gop = gops_[(firstGop_+numGops_++) % MAXGOPS];
+		gop.offset = headerRecords_ ? headerOffset_ : offset ;
+		gop.records = headerRecords_+1 ;
+		gop.timeUs = timeUs ;
+		headerRecords_ = 0 ;
+	} else {
+		gops_[(firstGop_+numGops_-1) % MAXGOPS].records += headerRecords_+1 ;
+		headerRecords_ = 0 ;
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+bool gopRing_t::trigger(char const *fileName)
+{
+	if (!worked() || recording())
+		return false ;
+	FILE *fOut = fopen(fileName,"wb");
+	if (0 == fOut) {
+		perror(fileName);
+		return false ;
+	}
+	pthread_mutex_lock(&lock_);
+	if (fOut_) {
+		pthread_mutex_unlock(&lock_);
+		fclose(fOut);
+		return false ;
+	}
+	// everything queued goes to the file, starting with the oldest GOP
+	firstGop_ = numGops_ = 0 ;
+	headerRecords_ = 0 ;
+	stopping_ = false ;
+	fOut_ = fOut ;
+	pthread_cond_broadcast(&cond_);
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+void gopRing_t::stop(void)
+{
+	pthread_mutex_lock(&lock_);
+	if (fOut_) {
+		stopping_ = true ;
+		pthread_cond_broadcast(&cond_);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+unsigned gopRing_t::bufferedMs(void) const
+{
+	pthread_mutex_lock((pthread_mutex_t *)&lock_);
+	unsigned ms = numGops_ ? (unsigned)((newestUs_-gops_[firstGop_].timeUs)/1000) : 0 ;
+	pthread_mutex_unlock((pthread_mutex_t *)&lock_);
+	return ms ;
+}
+
+void *gopRing_t::threadRoutine(void *arg)
+{
+	((gopRing_t *)arg)->run();
+	return 0 ;
+}
+
+void gopRing_t::run(void)
+{
+	bool writeError = false ;
+	pthread_mutex_lock(&lock_);
+	while (!shutdown_) {
+		FILE *const fOut = fOut_ ;
+		if ((0 == fOut) || ((0 == records_) && !stopping_)) {
+			pthread_cond_wait(&cond_,&lock_);
+			continue ;
+		}
+		if (0 == records_) {
+			// drained after stop(), so start collecting again
+			fOut_ = 0 ;
+			stopping_ = false ;
+			reset();
+			pthread_cond_broadcast(&cond_);
+			pthread_mutex_unlock(&lock_);
+			fclose(fOut);
+			writeError = false ;
+			pthread_mutex_lock(&lock_);
+			continue ;
+		}
+		unsigned offset = tail_ ;
+		if ((size_-offset < sizeof(record_t))
+		    || (0 == ((record_t *)(arena_+offset))->length))
+			offset = 0 ;
+		record_t const *rec = (record_t const *)(arena_+offset);
+
+		// the record stays put until tail_ moves past it
+		pthread_mutex_unlock(&lock_);
+		if ((rec->length != fwrite(rec+1,1,rec->length,fOut)) && !writeError) {
+			perror("gopRing");
+			writeError = true ;
+		}
+		pthread_mutex_lock(&lock_);
+		tail_ = offset+recordSize(rec->length);
+		records_-- ;
+		written_++ ;
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+#ifdef STANDALONE_GOPRING
+#include <unistd.h>
+
+enum {
+	FPS = 30,
+	GOP = 30
+};
+
+static unsigned frameLength(unsigned seq)
+{
+	return 2000+(seq*7919)%6000 ;
+}
+
+/*
+ * Each frame starts with a type byte ('S', 'P', 'I' or 'p') and
+ * its sequence number, and is padded to a varying length.
+ */
+static void feed(gopRing_t &ring, unsigned &seq, unsigned count)
+{
+	static unsigned char frame[8192];
+	while (count--) {
+		long long timeUs = (long long)seq*1000000/FPS ;
+		if (0 == (seq % GOP)) {
+			frame[0] = 'S' ;
+			memcpy(frame+1,&seq,sizeof(seq));
+			ring.add(frame,16,gopRing_t::HEADER,timeUs);
+			frame[0] = 'P' ;
+			ring.add(frame,8,gopRing_t::HEADER,timeUs);
+			frame[0] = 'I' ;
+		} else
+			frame[0] = 'p' ;
+		memcpy(frame+1,&seq,sizeof(seq));
+		unsigned length = frameLength(seq);
+		memset(frame+5,frame[0],length-5);
+		ring.add(frame,length,(0 == (seq % GOP)) ? gopRing_t::KEYFRAME : 0,timeUs);
+		seq++ ;
+	}
+}
+
+/*
+ * Reads back the file and checks that it starts with SPS, PPS and
+ * a keyframe, that no frames are missing, and returns the first
+ * and last sequence numbers.
+ */
+static bool check(char const *fileName, unsigned &first, unsigned &last)
+{
+	FILE *fIn = fopen(fileName,"rb");
+	if (0 == fIn) {
+		perror(fileName);
+		return false ;
+	}
+	unsigned char frame[8192];
+	unsigned count = 0 ;
+	bool worked = true ;
+	int c ;
+	while (worked && (EOF != (c = fgetc(fIn)))) {
+		unsigned seq ;
+		if (sizeof(seq) != fread(&seq,1,sizeof(seq),fIn)) {
+			worked = false ;
+			break ;
+		}
+		unsigned length = ('S' == c) ? 16 : ('P' == c) ? 8 : frameLength(seq);
+		if (length-5 != fread(frame,1,length-5,fIn)) {
+			worked = false ;
+			break ;
+		}
+		if (0 == count) {
+			worked = ('S' == c);
+			first = seq ;
+		} else if (('S' == c) || ('I' == c) || ('P' == c)) {
+			worked = (seq == last+(('S' == c) ? 1 : 0))
+				 && (0 == (seq % GOP));
+		} else
+			worked = (seq == last+1);
+		if (!worked)
+			fprintf(stderr, "%s: frame %u (%c) follows %u\n", fileName, seq, c, last);
+		last = seq ;
+		count++ ;
+	}
+	fclose(fIn);
+	return worked && count ;
+}
+
+int main(int argc, char const * const argv[])
+{
+	char const *fileName = (1 < argc) ? argv[1] : "/tmp/gopRing.out" ;
+	int errors = 0 ;
+
+	// plenty of memory, so the time limit applies
+	{
+		gopRing_t ring(1<<20,2);
+		unsigned seq = 0 ;
+		feed(ring,seq,10*FPS+5);
+		printf("%u GOPs, %u ms buffered\n", ring.numGops(), ring.bufferedMs());
+		if (!ring.trigger(fileName))
+			return -1 ;
+		unsigned triggered = seq ;
+		feed(ring,seq,3*FPS);
+		ring.stop();
+		while (ring.recording())
+			usleep(1000);
+		unsigned first, last ;
+		if (!check(fileName,first,last)) {
+			errors++ ;
+		} else {
+			printf("wrote frames %u..%u for trigger at %u, %u dropped\n",
+			       first, last, triggered, ring.numDropped());
+			if ((triggered-first < 2*FPS) || (triggered-first > 2*FPS+GOP)
+			    || (last != seq-1))
+				errors++ ;
+		}
+	}
+
+	// tight memory budget: fewer GOPs, but still whole ones
+	{
+		gopRing_t ring(200<<10,10);
+		unsigned seq = 0 ;
+		feed(ring,seq,5*FPS+12);
+		printf("%u GOPs, %u ms buffered in 200k\n", ring.numGops(), ring.bufferedMs());
+		unsigned triggered = seq ;
+		if (!ring.trigger(fileName))
+			return -1 ;
+		ring.stop();
+		while (ring.recording())
+			usleep(1000);
+		unsigned first, last ;
+		if (!check(fileName,first,last) || (last != triggered-1)) {
+			errors++ ;
+		} else
+			printf("wrote frames %u..%u\n", first, last);
+	}
+
+	printf("%d errors\n", errors);
+	return errors ? -1 : 0 ;
+}
+#endif
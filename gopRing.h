@@ -0,0 +1,110 @@
+#ifndef __GOPRING_H__
+#define __GOPRING_H__ "$Id$"
+
+/*
+ * gopRing.h
+ *
+ * This header file declares the gopRing_t class, which keeps the
+ * last few seconds of an H.264 stream in memory for pre-event
+ * recording.
+ *
+ * Frames are copied into a single arena allocated up front, so the
+ * memory used is fixed no matter the bitrate. The oldest whole GOP
+ * (SPS, PPS, keyframe and the frames that follow) is dropped to
+ * make room, or once the next GOP is older than the time limit, so
+ * the ring always starts at a keyframe.
+ *
+ * trigger() hands the ring to a writer thread, which writes it to
+ * a file and then follows the live frames until stop(). add() only
+ * copies into the arena, so the caller (e.g. a pipeline stage)
+ * never waits on the disk. If the writer falls behind and the ring
+ * fills, frames are dropped up to the next keyframe.
+ *
+ * The stream needs periodic keyframes (a GOP shorter than the
+ * ring), since the oldest GOP can't be dropped in part.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+
+class gopRing_t {
+public:
+	enum {
+		KEYFRAME	= 1,
+		HEADER		= 2,	// SPS or PPS, kept with the next keyframe
+		MAXGOPS		= 64
+	};
+
+	gopRing_t(unsigned bytes, unsigned seconds);
+	~gopRing_t(void);	// stops recording
+
+	bool worked(void) const { return (0 != arena_) && haveThread_ ; }
+
+	// from one thread only
+	void add(void const *data, unsigned length, unsigned flags, long long timeUs);
+
+	/*
+	 * Writes the ring to fileName, then live frames until stop().
+	 * Returns false if the file can't be created or a recording
+	 * is already in progress.
+	 */
+	bool trigger(char const *fileName);
+	void stop(void);	// the writer finishes what's queued
+	bool recording(void) const { return 0 != fOut_ ; }
+
+	// statistics
+	unsigned numGops(void) const { return numGops_ ; }
+	unsigned bufferedMs(void) const ;	// oldest keyframe to newest frame
+	unsigned numDropped(void) const { return dropped_ ; }
+	unsigned numWritten(void) const { return written_ ; }
+
+private:
+	gopRing_t(gopRing_t const &); // no copies
+
+	struct record_t {
+		unsigned	length ;	// 0 to wrap to the start
+		unsigned	flags ;
+		long long	timeUs ;
+	};
+
+	struct gop_t {
+		unsigned	offset ;
+		unsigned	records ;
+		long long	timeUs ;
+	};
+
+	static unsigned recordSize(unsigned length);
+	bool reserve(unsigned size, unsigned &offset);
+	void dropOldest(void);
+	void reset(void);
+	static void *threadRoutine(void *arg);
+	void run(void);
+
+	unsigned const	size_ ;
+	long long const	maxUs_ ;
+	unsigned char  *arena_ ;
+	unsigned	head_ ;		// next record
+	unsigned	tail_ ;		// oldest record
+	unsigned	records_ ;
+	gop_t		gops_[MAXGOPS];
+	unsigned	firstGop_ ;
+	unsigned	numGops_ ;
+	int		headerOffset_ ;	// SPS/PPS waiting for a keyframe
+	unsigned	headerRecords_ ;
+	bool		waitKey_ ;
+	long long	newestUs_ ;
+
+	pthread_mutex_t	lock_ ;
+	pthread_cond_t	cond_ ;
+	pthread_t	thread_ ;
+	bool		haveThread_ ;
+	bool		shutdown_ ;
+	bool		stopping_ ;
+	FILE	       *volatile fOut_ ;
+	unsigned	dropped_ ;
+	unsigned	written_ ;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __H264NAL_H__
+#define __H264NAL_H__ "$Id$"
+
+/*
+ * h264Nal.h
+ *
+ * This header file declares a routine to walk the NAL units of an
+ * H.264 Annex B byte stream, as produced by the VPU.
+ *
+ * A multi-slice frame comes out of the encoder as one buffer with
+ * a start code in front of each slice. Network sinks use this to
+ * send each slice on its own, so a lost datagram costs one slice
+ * rather than the whole frame.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+/*
+ * Finds the next NAL unit at or after offset. On success, the NAL
+ * unit (without its start code) is at data+start for nalLength bytes,
+ * its start code is the (3 or 4) bytes before that, and offset is
+ * advanced past it for the next call.
+ */
+inline bool h264NextNAL
+	( void const *data,
+	  unsigned length,
+	  unsigned &offset,
+	  unsigned &start,
+	  unsigned &nalLength )
+{
+	unsigned char const *p = (unsigned char const *)data ;
+	unsigned i = offset ;
+	while ((i+3 <= length) && !((0 == p[i]) && (0 == p[i+1]) && (1 == p[i+2])))
+		i++ ;
+	if (i+3 > length)
+		return false ;
+	start = i+3 ;
+
+	// the zero before the next 00 00 01 belongs to its start code
+	for (i = start ; i+3 <= length ; i++) {
+		if ((0 == p[i]) && (0 == p[i+1]) && (1 == p[i+2])) {
+			if (0 == p[i-1])
+				--i ;
+			break ;
+		}
+	}
+	if (i+3 > length)
+		i = length ;
+	nalLength = i-start ;
+	offset = i ;
+	return true ;
+}
+
+#endif
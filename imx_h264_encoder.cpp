@@ -19,8 +19,10 @@
 
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
-
-#define STREAM_BUF_SIZE		0x80000
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
 
 h264_encoder_t::h264_encoder_t(
 	vpu_t &vpu,
@@ -28,266 +30,109 @@ h264_encoder_t::h264_encoder_t(
 	unsigned h,
 	unsigned fourcc,
 	unsigned gopSize,
-	struct v4l2_buffer *v4lbuffers,
+	bufferHandle_t const *cameraBuffers,
 	unsigned numBuffers,
-	unsigned char **cameraBuffers)
-	: initialized_(false)
-	, fourcc_(fourcc)
-	, w_(w)
-	, h_(h)
-	, imgSize_(0)
-	, handle_(0)
-	, buffers(cameraBuffers)
-	, yoffs(0)
-	, uoffs(0)
-	, voffs(0)
+	unsigned stride,
+	rateControl_t const &rc)
+	: vpuEncoder_t(w,h,fourcc,cameraBuffers,numBuffers,stride)
+	, forceIntra_(false)
 	, spsdata(0)
 	, spslen(0)
 	, ppsdata(0)
 	, ppslen(0)
-	, gopsize((0 == gopSize)?1:gopSize)
+	, gopsize(gopFor(gopSize,rc.intraRefresh))
 	, frameidx(0)
+	, rc_(rc)
+	, kbps_(rc.kbps)
+	, changes_(0)
+	, lastCut_(0)
+	, lastRaise_(0)
+	, fd_(-1)
+	, wfd_(-1)
+	, haveThread_(false)
+	, stop_(false)
+	, pending_(false)
+	, encoding_(false)
+	, opaque_(0)
 {
-	if( (0 == w) || (0 == h) ) {
-		fprintf(stderr, "Invalid w or h (%ux%u)\n", w, h );
-		return ;
-	}
-	fprintf(stderr, "%s: %ux%u - %u buffers\n", __func__, w_, h_, numBuffers );
-	vpu_mem_desc mem_desc = {0};
-
-	unsigned ysize ;
-	unsigned yadder ;
-	unsigned uvsize ;
-	unsigned uvrowdiv ;
-	unsigned uvcoldiv ;
-	unsigned uvadder ;
-	unsigned totalsize ;
-	if( !fourccOffsets(fourcc,w,h,ysize,yoffs,yadder,uvsize,uvrowdiv,uvcoldiv,uoffs,voffs,uvadder,totalsize) ){
-		fprintf(stderr, "Invalid fourcc 0x%x\n", fourcc);
-		return ;
-	}
-	imgSize_ = totalsize ;
-
-printf( "%s: fourcc offsets %u/%u/%u, adders %u/%u\n", __func__, yoffs, uoffs,voffs, yadder,uvadder);
-printf( "%s: sizes %u/%u: %u\n", __func__, ysize, uvsize, totalsize);
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&cond_,0);
 
-	/* get physical contigous bit stream buffer */
-	mem_desc.size = STREAM_BUF_SIZE;
-	if (0 != IOGetPhyMem(&mem_desc)) {
-		fprintf(stderr,"Unable to obtain physical memory\n");
+	if (!usable())
 		return ;
-	}
-
-	/* mmap that physical buffer */
-	virt_bsbuf_addr = IOGetVirtMem(&mem_desc);
-	if (virt_bsbuf_addr <= 0) {
-		fprintf(stderr,"Unable to map physical memory\n");
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-
-	debugPrint( "stream buffer: %u bytes: phys 0x%lx, cpu 0x%lx, virt 0x%lx (%x)\n",
-		    mem_desc.size, mem_desc.phy_addr, mem_desc.cpu_addr, mem_desc.virt_uaddr, virt_bsbuf_addr );
-
-	phy_bsbuf_addr = mem_desc.phy_addr;
 
-	EncOpenParam encop = {0};
-	/* Fill up parameters for encoding */
-	encop.bitstreamBuffer = phy_bsbuf_addr;
-	encop.bitstreamBufferSize = STREAM_BUF_SIZE;
-	encop.bitstreamFormat = STD_AVC ;
+	EncOpenParam encop ;
+	defaultParams(encop,STD_AVC);
 
-	encop.picWidth = picwidth = w;
-	encop.picHeight = picheight = h;
-
-	/*Note: Frame rate cannot be less than 15fps per H.263 spec */
-	encop.frameRateInfo = 30;
-	encop.bitRate = 0 ;
-	encop.gopSize = gopsize ;
-	encop.slicemode.sliceMode = 0;	/* 0: 1 slice per picture; 1: Multiple slices per picture */
-	encop.slicemode.sliceSizeMode = 0; /* 0: silceSize defined by bits; 1: sliceSize defined by MB number*/
-	encop.slicemode.sliceSize = 4000;  /* Size of a slice in bits or MB numbers */
-
-	encop.initialDelay = 0;
-	encop.vbvBufferSize = 0;        /* 0 = ignore 8 */
-	encop.intraRefresh = 0;
-	encop.sliceReport = 0;
-	encop.mbReport = 0;
-	encop.mbQpReport = 0;
-	encop.rcIntraQp = -1;
-	encop.userQpMax = 0;
-	encop.userGamma = (Uint32)(0.75*32768);         /*  (0*32768 <= gamma <= 1*32768) */
-	encop.RcIntervalMode= 1;        /* 0:normal, 1:frame_level, 2:slice_level, 3: user defined Mb_level */
-	encop.MbInterval = 0;
-
-	if (uvsize == ysize/2) {
-	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 1 ; // YUV422 horizontal
-	} else if (uvsize == ysize/4) {
-	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 0 ; // YUV420
-	} else
-		printf( "%s: unknown input format: %u/%u\n", __func__,ysize,uvsize );
-printf( "%s: mjpg_source format %d\n", __func__, encop.EncStdParam.mjpgParam.mjpg_sourceFormat);
-	encop.ringBufferEnable = 0;
-	encop.dynamicAllocEnable = 0;
-	encop.chromaInterleave = (uoffs < voffs) ? (uoffs+uvsize > voffs)
-						 : (voffs+uvsize > uoffs);
-	debugPrint("check open params\n");
-
-	if (encop.bitstreamBuffer % 4) {	/* not 4-bit aligned */
-		printf( "--> bitstreamBuffer %lx\n", encop.bitstreamBuffer);
-	}
-	if (encop.bitstreamBufferSize % 1024 ||
-	    encop.bitstreamBufferSize < 1024 ||
-	    encop.bitstreamBufferSize > 16383 * 1024) {
-		printf( "--> bitstreamBufferSize %ld\n", encop.bitstreamBufferSize);
-	}
-	if (encop.bitstreamFormat != STD_MPEG4 &&
-	    encop.bitstreamFormat != STD_H263 &&
-	    encop.bitstreamFormat != STD_AVC &&
-	    encop.bitstreamFormat != STD_MJPG) {
-		printf( "--> bitstreamFormat %x\n", encop.bitstreamFormat);
-	}
-	if (encop.bitRate > 32767 || encop.bitRate < 0) {
-		printf( "--> bitrate %d\n", encop.bitRate);
-	}
-	if (encop.bitRate != 0 && encop.initialDelay > 32767) {
-		printf( "--> bitrate %d, initial delay %d\n", encop.bitRate, encop.initialDelay);
+	if (0 == rc_.fps)
+		rc_.fps = 30 ;
+	if (32767 < rc_.kbps) {
+		fprintf(stderr, "%s: bitrate limited to 32767 kbps\n", __func__);
+		rc_.kbps = kbps_ = 32767 ;
 	}
-	if (encop.bitRate != 0 && encop.initialDelay != 0 &&
-	    encop.vbvBufferSize < 0) {
-		printf( "--> bitrate %d, initial delay %d, vbvBufferSize %d\n", encop.bitRate, encop.initialDelay, encop.vbvBufferSize );
-	}
-	if (encop.gopSize > 60) {
-		printf( "--> gopSize %d\n", encop.gopSize );
-	}
-	if (encop.slicemode.sliceMode != 0 && encop.slicemode.sliceMode != 1) {
-		printf( "--> sliceMode %d\n", encop.slicemode.sliceMode );
-	}
-	if (encop.slicemode.sliceMode == 1) {
-		if (encop.slicemode.sliceSizeMode != 0 &&
-		    encop.slicemode.sliceSizeMode != 1) {
-			printf( "--> slicemode.sliceSizeMode %d\n", encop.slicemode.sliceSizeMode );
-		}
-		if (encop.slicemode.sliceSize == 0) {
-			printf( "--> slicemode.sliceSize %d\n", encop.slicemode.sliceSize );
-		}
-	}
-	if (cpu_is_mx27()) {
-		if (encop.sliceReport != 0 && encop.sliceReport != 1) {
-			printf( "--> sliceReport %d\n", encop.sliceReport );
-		}
-		if (encop.mbReport != 0 && encop.mbReport != 1) {
-			printf( "--> mbReport %d\n", encop.mbReport );
-		}
-	}
-	if (encop.intraRefresh < 0 || encop.intraRefresh >=
-	    (encop.picWidth * encop.picHeight / 256)) {
-		debugPrint( "--> intraRefresh %d, width %d, height %d\n", encop.intraRefresh, encop.picWidth, encop.picHeight );
-	}
-
-	debugPrint( "format %d, %ux%u\n", encop.bitstreamFormat, encop.picWidth, encop.picHeight );
+	if (51 < rc_.qp)
+		rc_.qp = 51 ;
 
-	if (encop.picWidth < 32 || encop.picHeight < 16) {
-	debugPrint( "bad size\n");
-	}
-
-debugPrint( "opening encoder\n" );
-
-	RetCode ret = vpu_EncOpen(&handle_, &encop);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Encoder open failed %d\n", ret);
-		IOFreePhyMem(&mem_desc);
+	encop.frameRateInfo = rc_.fps ;
+	encop.bitRate = rc_.kbps ;
+	encop.gopSize = gopsize ;
+	sliceModeFor(rc_.sliceBytes,encop.slicemode);
+
+	encop.initialDelay = rc_.kbps ? rc_.initialDelayMs : 0 ;
+	encop.vbvBufferSize = rc_.vbvBits ;	/* 0 = ignore */
+	encop.enableAutoSkip = 0 ;		/* never drop frames to hold the rate */
+	encop.intraRefresh = rc_.intraRefresh ;
+	encop.rcIntraQp = rc_.intraQp ? (int)rc_.intraQp : -1 ;
+	encop.userQpMin = rc_.minQp ;
+	encop.userQpMinEnable = (0 != rc_.minQp);
+	encop.userQpMax = rc_.maxQp ;
+	encop.userQpMaxEnable = (0 != rc_.maxQp);
+
+	if (!open(encop))
 		return ;
-	}
 
-debugPrint( "encoder initialized\n" );
-
-	SearchRamParam search_pa = {0};
-	iram_t iram;
-	int ram_size;
-
-	memset(&iram, 0, sizeof(iram_t));
-	ram_size = ((picwidth + 15) & ~15) * 36 + 2048;
-	IOGetIramBase(&iram);
-	if ((iram.end - iram.start) < ram_size) {
-		debugPrint("vpu iram is less than needed: %u..%u/%u\n", iram.start,iram.end,ram_size);
-		debugPrint("NOT Using IRAM for ME\n" );
-	} else {
-		/* Allocate max iram for vpu encoder search ram*/
-		ram_size = iram.end - iram.start;
-		search_pa.searchRamAddr = iram.start;
-		search_pa.SearchRamSize = ram_size;
-		debugPrint( "search iram %u..%u for %u bytes\n", iram.start, iram.end, ram_size );
-		ret = vpu_EncGiveCommand(handle_, ENC_SET_SEARCHRAM_PARAM, &search_pa);
-		if (ret != RETCODE_SUCCESS) {
-			fprintf(stderr, "Encoder SET_SEARCHRAM_PARAM failed\n");
-			IOFreePhyMem(&mem_desc);
-			return ;
-		}
-		else {
-			debugPrint("Using IRAM for ME\n" );
-		}
-	}
-
-	debugPrint( "get initial info\n");
-	EncInitialInfo initinfo = {0};
-	ret = vpu_EncGetInitialInfo(handle_, &initinfo);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Encoder GetInitialInfo failed\n");
-		IOFreePhyMem(&mem_desc);
+	/* headers go to a temporary slot */
+	unsigned slot ;
+	if (!ring_.acquire(slot))
 		return ;
-	}
-
-	debugPrint( "have initial info\n" );
-
-	fbcount = numBuffers ;
-	int stride = ((picwidth + 15) & ~15)*((0 != encop.EncStdParam.mjpgParam.mjpg_sourceFormat)+1);
-
-	fb = (FrameBuffer *)calloc(fbcount, sizeof(FrameBuffer));
-	if (fb == NULL) {
-		fprintf(stderr,"Failed to allocate fb\n");
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-debugPrint( "allocated FrameBuffer fb: %p\n", fb );
-
-	for (int i = 0; i < fbcount; i++) {
-		struct v4l2_buffer const &buf = v4lbuffers[i];
-		fb[i].bufY = buf.m.offset+yoffs;
-		fb[i].bufCb = buf.m.offset+uoffs;
-		fb[i].bufCr = buf.m.offset+voffs;
-		fb[i].strideY = ((w+7)/8)*8;
-		fb[i].strideC = (((w/2)+7)/8)*8;
-	}
-debugPrint( "registering frame buffer\n" );
-	ret = vpu_EncRegisterFrameBuffer(handle_, fb, fbcount, stride, stride);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Register frame buffer failed\n");
-		free(fb);
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-	else
-		debugPrint( "registered frame buffer\n" );
-
-debugPrint( "%u frame buffers allocated and registered\n", fbcount );
-
 	EncHeaderParam enchdr_param = {0};
 	enchdr_param.headerType = SPS_RBSP;
+	enchdr_param.buf = ring_.slotPhys(slot);
+	enchdr_param.size = ring_.slotSize();
 	vpu_EncGiveCommand(handle_, ENC_PUT_AVC_HEADER, &enchdr_param);
-	char *vbuf = (char *)(virt_bsbuf_addr + enchdr_param.buf - phy_bsbuf_addr);
+	char *vbuf = (char *)ring_.toVirt(enchdr_param.buf);
 	spslen=enchdr_param.size ;
 	spsdata = malloc(spslen);
 	memcpy(spsdata,vbuf,spslen);
 	printf("%s: %u bytes of SPS data\n", __func__, spslen);
 
 	enchdr_param.headerType = PPS_RBSP;
+	enchdr_param.buf = ring_.slotPhys(slot);
+	enchdr_param.size = ring_.slotSize();
 	vpu_EncGiveCommand(handle_, ENC_PUT_AVC_HEADER, &enchdr_param);
-	vbuf = (char *)(virt_bsbuf_addr + enchdr_param.buf - phy_bsbuf_addr);
+	vbuf = (char *)ring_.toVirt(enchdr_param.buf);
 	ppslen=enchdr_param.size ;
 	ppsdata = malloc(ppslen);
 	memcpy(ppsdata,vbuf,ppslen);
 	printf("%s: %u bytes of SPS data\n", __func__, ppslen);
+	ring_.release(slot);
+
+	fd_ = wfd_ = eventfd(0,0);
+	if (0 > fd_) {
+		int fds[2];
+		if (0 != pipe(fds)) {
+			perror("encoder completion fd");
+			return ;
+		}
+		fd_ = fds[0];
+		wfd_ = fds[1];
+	}
+	fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+	if (0 != pthread_create(&thread_,0,waitThread,this)) {
+		perror("encoder thread");
+		return ;
+	}
+	haveThread_ = true ;
 	initialized_ = true ;
 
 debugPrint("Saved AVC header... Done with %s\n", __func__ );
@@ -295,64 +140,318 @@ debugPrint("Saved AVC header... Done with %s\n", __func__ );
 
 h264_encoder_t::~h264_encoder_t(void) {
 
+	if (pending_) {
+		void const *outData ;
+		unsigned outLength ;
+		bool iframe ;
+		void *opaque ;
+		if (encode_complete(outData,outLength,iframe,opaque,1000))
+			releaseOutput(outData);
+	}
+	if (haveThread_) {
+		pthread_mutex_lock(&lock_);
+		stop_ = true ;
+		pthread_cond_signal(&cond_);
+		pthread_mutex_unlock(&lock_);
+		pthread_join(thread_,0);
+	}
+	if (wfd_ != fd_)
+		close(wfd_);
+	if (0 <= fd_)
+		close(fd_);
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
 	if (spsdata)
 		free(spsdata);
 	if (ppsdata)
 		free(ppsdata);
-	debugPrint( "closing encoder\n" );
-	RetCode rc = vpu_EncClose(handle_);
-	if( RETCODE_SUCCESS != rc )
-		fprintf(stderr, "Error %d closing encoder\n", rc );
-	else {
-		debugPrint( "encoder closed\n" );
-	}
 }
 
-bool h264_encoder_t::get_bufs( unsigned index, unsigned char *&y, unsigned char *&u, unsigned char *&v )
+bool h264_encoder_t::encode(unsigned index, void const *&outData, unsigned &outLength, bool &iframe)
 {
-	unsigned char *base = buffers[index];
-	y = base + yoffs ;
-	u = base + uoffs ;
-	v = base + voffs ;
-	return true ;
+	void *opaque ;
+	return start_encode(index,0)
+		&& encode_complete(outData,outLength,iframe,opaque,-1);
 }
 
-bool h264_encoder_t::encode(unsigned index, void const *&outData, unsigned &outLength, bool &iframe)
+bool h264_encoder_t::start_encode(unsigned index, void *opaque)
 {
+	if (pending_) {
+		fprintf(stderr,"%s: encode already in progress\n", __func__);
+		return false ;
+	}
+	if (changes_)
+		applyChanges();
+
 	EncParam  enc_param = {0};
 
-	enc_param.sourceFrame = &fb[index];
-	enc_param.quantParam = 25;
-	enc_param.forceIPicture = (0 == (frameidx%gopsize));
-	frameidx++ ;
+	enc_param.quantParam = rc_.qp ;
+	enc_param.forceIPicture = forceIntra_
+				  || (0 == frameidx)
+				  || (gopsize && (0 == (frameidx%gopsize)));
 	enc_param.skipPicture = 0;
-	RetCode ret = vpu_EncStartOneFrame(handle_, &enc_param);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"vpu_EncStartOneFrame failed Err code:%d\n",
-								ret);
+	if (!startFrame(index,enc_param))
+		return false ;
+	forceIntra_ = false ;
+	frameidx++ ;
+
+	pthread_mutex_lock(&lock_);
+	opaque_ = opaque ;
+	pending_ = true ;
+	encoding_ = true ;
+	pthread_cond_signal(&cond_);
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+bool h264_encoder_t::encode_complete
+	( void const *&outData,
+	  unsigned &outLength,
+	  bool &iframe,
+	  void *&opaque,
+	  int timeoutMs )
+{
+	if (!pending_)
+		return false ;
+
+	struct pollfd pfd ;
+	pfd.fd = fd_ ;
+	pfd.events = POLLIN ;
+	int numReady ;
+	do {
+		numReady = poll(&pfd,1,timeoutMs);
+	} while ((0 > numReady) && (EINTR == errno));
+	if (0 >= numReady)
 		return false ;
+
+	uint64_t count ;
+	if (wfd_ == fd_) {
+		read(fd_,&count,sizeof(count));
+	} else {
+		char c ;
+		read(fd_,&c,sizeof(c));
 	}
 
-	while (vpu_IsBusy()) {
-		vpu_WaitForInt(30);
-		if(vpu_IsBusy()){
-			debugPrint( "busy\n");
-		}
+	opaque = opaque_ ;
+	pending_ = false ;
+
+	/*
+	 * A frame that filled its slot was truncated. Drop it, and
+	 * restart the reference chain so the decoder can recover.
+	 */
+	if (!finishFrame(outData,outLength,iframe)) {
+		forceIntra_ = true ;
+		return false ;
 	}
+	return true ;
+}
 
-	EncOutputInfo outinfo = {0};
-	ret = vpu_EncGetOutputInfo(handle_, &outinfo);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"vpu_EncGetOutputInfo failed Err code: %d\n",
-								ret);
+/*
+ * Called between frames, while the VPU is idle, to pass on changes
+ * made by the setters.
+ */
+void h264_encoder_t::applyChanges(void)
+{
+	unsigned changes = __sync_fetch_and_and(&changes_,0);
+	int value ;
+	if (changes & CHANGE_BITRATE) {
+		value = kbps_ ;
+		if (RETCODE_SUCCESS != vpu_EncGiveCommand(handle_, ENC_SET_BITRATE, &value))
+			fprintf(stderr, "%s: error setting bitrate %d\n", __func__, value);
+	}
+	if (changes & CHANGE_FPS) {
+		value = rc_.fps ;
+		if (RETCODE_SUCCESS != vpu_EncGiveCommand(handle_, ENC_SET_FRAME_RATE, &value))
+			fprintf(stderr, "%s: error setting frame rate %d\n", __func__, value);
+	}
+	if (changes & CHANGE_GOP) {
+		value = gopsize ;
+		if (RETCODE_SUCCESS != vpu_EncGiveCommand(handle_, ENC_SET_GOP_NUMBER, &value))
+			fprintf(stderr, "%s: error setting GOP size %d\n", __func__, value);
+	}
+	if (changes & CHANGE_REFRESH) {
+		value = rc_.intraRefresh ;
+		if (RETCODE_SUCCESS != vpu_EncGiveCommand(handle_, ENC_SET_INTRA_MB_REFRESH_NUMBER, &value))
+			fprintf(stderr, "%s: error setting intra refresh %d\n", __func__, value);
+	}
+	if (changes & CHANGE_SLICE) {
+		EncSliceMode mode ;
+		sliceModeFor(rc_.sliceBytes,mode);
+		if (RETCODE_SUCCESS != vpu_EncGiveCommand(handle_, ENC_SET_SLICE_INFO, &mode))
+			fprintf(stderr, "%s: error setting slice size %u\n", __func__, rc_.sliceBytes);
+	}
+}
+
+/*
+ * A GOP size of 0 means no periodic I-frames, which only makes sense
+ * if intra refresh will repair the picture. Otherwise every frame is
+ * an I-frame, as it always has been.
+ */
+unsigned h264_encoder_t::gopFor(unsigned requested, unsigned intraRefresh)
+{
+	if (requested || intraRefresh)
+		return requested ;
+	return 1 ;
+}
+
+void h264_encoder_t::sliceModeFor(unsigned bytes, EncSliceMode &mode)
+{
+	mode.sliceMode = (0 != bytes);	/* 0: 1 slice per picture; 1: Multiple slices per picture */
+	mode.sliceSizeMode = 0;		/* 0: sliceSize defined by bits; 1: sliceSize defined by MB number */
+	mode.sliceSize = bytes ? bytes*8 : 4000 ;
+}
+
+bool h264_encoder_t::setBitrate(unsigned kbps)
+{
+	if (0 == rc_.kbps) {
+		fprintf(stderr, "%s: encoder uses constant QP\n", __func__);
+		return false ;
+	}
+	if (0 == kbps)
+		return false ;
+	if (32767 < kbps)
+		kbps = 32767 ;
+	pthread_mutex_lock(&lock_);
+	rc_.kbps = kbps_ = kbps ;
+	__sync_fetch_and_or(&changes_,CHANGE_BITRATE);
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+bool h264_encoder_t::setQP(unsigned qp)
+{
+	if (0 != rc_.kbps) {
+		fprintf(stderr, "%s: encoder uses rate control\n", __func__);
 		return false ;
 	}
-	outData = (void *)(virt_bsbuf_addr + outinfo.bitstreamBuffer - phy_bsbuf_addr);
-	outLength = outinfo.bitstreamSize ;
-	iframe = (0 == outinfo.picType);
+	rc_.qp = (51 < qp) ? 51 : qp ;
+	return true ;
+}
+
+void h264_encoder_t::setFrameRate(unsigned fps)
+{
+	if (fps) {
+		rc_.fps = fps ;
+		__sync_fetch_and_or(&changes_,CHANGE_FPS);
+	}
+}
+
+void h264_encoder_t::setGOP(unsigned gopSize)
+{
+	gopsize = gopFor(gopSize,rc_.intraRefresh);
+	__sync_fetch_and_or(&changes_,CHANGE_GOP);
+}
+
+void h264_encoder_t::setIntraRefresh(unsigned numMbs)
+{
+	rc_.intraRefresh = numMbs ;
+	__sync_fetch_and_or(&changes_,CHANGE_REFRESH);
+	if (0 == gopsize)
+		setGOP(0);
+}
+
+void h264_encoder_t::setSliceSize(unsigned bytes)
+{
+	rc_.sliceBytes = bytes ;
+	__sync_fetch_and_or(&changes_,CHANGE_SLICE);
+}
+
+bool h264_encoder_t::reconfigure(unsigned gopSize, rateControl_t const &rc)
+{
+	if (pending_)
+		return false ;
+	if (((0 != rc.kbps) != (0 != rc_.kbps))
+	    || (rc.vbvBits != rc_.vbvBits)
+	    || (rc.initialDelayMs != rc_.initialDelayMs)
+	    || (rc.minQp != rc_.minQp)
+	    || (rc.maxQp != rc_.maxQp)
+	    || (rc.intraQp != rc_.intraQp))
+		return false ;
+
+	if (rc.kbps)
+		setBitrate(rc.kbps);
+	else
+		setQP(rc.qp);
+	rc_.minKbps = rc.minKbps ;
+	if (rc.fps && (rc.fps != rc_.fps))
+		setFrameRate(rc.fps);
+	if (rc.intraRefresh != rc_.intraRefresh)
+		setIntraRefresh(rc.intraRefresh);
+	if (rc.sliceBytes != rc_.sliceBytes)
+		setSliceSize(rc.sliceBytes);
+	if (gopFor(gopSize,rc.intraRefresh) != gopsize)
+		setGOP(gopSize);
+
+	frameidx = 0 ;
+	lastCut_ = lastRaise_ = 0 ;
+	forceIntra_ = true ;
 	return true ;
 }
 
+void h264_encoder_t::rateFeedback(bool congested)
+{
+	if (0 == rc_.kbps)
+		return ;
+	pthread_mutex_lock(&lock_);
+	unsigned kbps = kbps_ ;
+	unsigned const frame = frameidx ;
+	if (congested) {
+		// give the sink's queue time to drain before cutting again
+		if (frame - lastCut_ >= (rc_.fps+1)/2) {
+			unsigned floor = rc_.minKbps ? rc_.minKbps : rc_.kbps/8 ;
+			if (0 == floor)
+				floor = 1 ;
+			kbps -= kbps/4 ;
+			if (kbps < floor)
+				kbps = floor ;
+			lastCut_ = frame ;
+		}
+	} else if ((kbps < rc_.kbps) && (frame != lastRaise_)) {
+		kbps += (rc_.kbps+31)/32 ;
+		if (kbps > rc_.kbps)
+			kbps = rc_.kbps ;
+		lastRaise_ = frame ;
+	}
+	if (kbps != kbps_) {
+		kbps_ = kbps ;
+		__sync_fetch_and_or(&changes_,CHANGE_BITRATE);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+void *h264_encoder_t::waitThread(void *arg)
+{
+	((h264_encoder_t *)arg)->waitLoop();
+	return 0 ;
+}
+
+/*
+ * Turns the VPU interrupt into a readable fd_: sleeps until
+ * start_encode() kicks off a frame, then waits for the VPU.
+ */
+void h264_encoder_t::waitLoop(void)
+{
+	pthread_mutex_lock(&lock_);
+	while (!stop_) {
+		if (!encoding_) {
+			pthread_cond_wait(&cond_,&lock_);
+			continue ;
+		}
+		pthread_mutex_unlock(&lock_);
+		waitIdle();
+		pthread_mutex_lock(&lock_);
+		encoding_ = false ;
+		if (wfd_ == fd_) {
+			uint64_t one = 1 ;
+			write(wfd_,&one,sizeof(one));
+		} else {
+			char c = 0 ;
+			write(wfd_,&c,sizeof(c));
+		}
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
 bool h264_encoder_t::getSPS(void const *&sps, unsigned &len){
 	sps = (char *)spsdata+1 ; len = spslen-1 ; return (0 < spslen);
 }
@@ -365,53 +464,8 @@ bool h264_encoder_t::getPPS(void const *&pps, unsigned &len){
 #ifdef MODULETEST
 #include "cameraParams.h"
 #define NUMBUFFERS 4
-extern "C" {
-#include "libavformat/avformat.h"
-};
-
-#define STREAM_DURATION   5.0
-#define STREAM_FRAME_RATE 25 /* 25 images/s */
-#define STREAM_NB_FRAMES  ((int)(STREAM_DURATION * STREAM_FRAME_RATE))
-
-/* add a video output stream */
-static AVStream *add_video_stream(AVFormatContext *oc,cameraParams_t &params)
-{
-    AVCodecContext *c;
-    AVStream *st;
-
-    st = av_new_stream(oc, 0);
-    if (!st) {
-        fprintf(stderr, "Could not alloc stream\n");
-        exit(1);
-    }
-
-    c = st->codec;
-    c->codec_id = CODEC_ID_H264;
-    c->codec_type = AVMEDIA_TYPE_VIDEO;
-
-    /* put sample parameters */
-    c->bit_rate = 400000;
-    /* resolution must be a multiple of two */
-    c->width = params.getCameraWidth();
-    c->height = params.getCameraHeight();
-    /* time base: this is the fundamental unit of time (in seconds) in terms
-       of which frame timestamps are represented. for fixed-fps content,
-       timebase should be 1/framerate and timestamp increments should be
-       identically 1. */
-    c->time_base.den = params.getCameraFPS();
-    c->time_base.num = 1;
-    c->gop_size = params.getGOP(); /* emit one intra frame every twelve frames at most */
-    c->pix_fmt = PIX_FMT_YUV420P ;
-    c->flags |= CODEC_FLAG_GLOBAL_HEADER;
-
-    return st;
-}
-
-static void dump_avoutfmt(struct AVOutputFormat *outfmt) {
-	printf("--> avformat: %s/%s/%s/%s\n",
-	       outfmt->name, outfmt->long_name, outfmt->mime_type, outfmt->extensions);
-	printf("audio codec %d, video codec %d\n", outfmt->audio_codec, outfmt->video_codec);
-}
+#include "mp4Mux.h"
+#include "physPool.h"
 
 // Clamp range of y
 static unsigned yvalue(unsigned i){
@@ -463,7 +517,7 @@ static imgFile_t *parseImgFiles(int &argc, char const **&argv,unsigned totalsize
 	return rval ;
 }
 
-static bool fill_yuv(unsigned &iteration,cameraParams_t &params, imgFile_t *&images,unsigned char *yuv, unsigned ysize, unsigned uvsize){
+static bool fill_yuv(unsigned &iteration,cameraParams_t &params, imgFile_t *&images,unsigned char *yuv, unsigned width, unsigned ysize, unsigned uvsize){
 	if (images) {
 		if (0 == images->iterations) {
 			printf( "reading %s\n", images->name);
@@ -488,8 +542,13 @@ static bool fill_yuv(unsigned &iteration,cameraParams_t &params, imgFile_t *&ima
 			frameCount = NUMBUFFERS ;
 		}
 		if (iteration < frameCount) {
+			// checkerboard panning right over a background that steps through yvalue()
 			unsigned    yval = yvalue(iteration);
-			memset (yuv, yval,ysize);
+			for (unsigned i = 0 ; i < ysize ; i++) {
+				unsigned const x = i % width + 2*iteration ;
+				unsigned const y = i / width ;
+				yuv[i] = (((x/32)+(y/32)) & 1) ? 235-((x^y)&31) : yval ;
+			}
 			memset (yuv+ysize,0x80,2*uvsize);
 			return true ;
 		}
@@ -499,7 +558,7 @@ static bool fill_yuv(unsigned &iteration,cameraParams_t &params, imgFile_t *&ima
 }
 
 static void writeHeaders(h264_encoder_t &encoder,
-			 AVFormatContext *oc )
+			 mp4Mux_t &mux )
 {
 	void const *spsdata ;
 	unsigned sps_len ;
@@ -508,21 +567,8 @@ static void writeHeaders(h264_encoder_t &encoder,
 	if (encoder.getSPS(spsdata,sps_len)
 	    &&
 	    encoder.getPPS(ppsdata,pps_len)) {
-		char *const tmp = (char *)malloc(sps_len+pps_len);
-		memcpy(tmp,spsdata,sps_len);
-		memcpy(tmp+sps_len,ppsdata,pps_len);
-		AVPacket pkt;
-		av_init_packet(&pkt);
-		pkt.flags |= AV_PKT_FLAG_KEY;
-		pkt.stream_index = 0 ;
-		pkt.data = (uint8_t *)tmp ;
-		pkt.size = sps_len+pps_len ;
-		int ret = av_write_frame(oc,&pkt);
-		if (0 != ret) {
-			printf( "error %d writing %u bytes of SPS header\n", ret, pkt.size);
-		}
-		free(tmp);
-
+		mux.addHeader(spsdata,sps_len);
+		mux.addHeader(ppsdata,pps_len);
 	}
 }
 
@@ -530,24 +576,16 @@ int main (int argc, char const **argv) {
 	cameraParams_t params(argc,argv);
 	if (1 < argc) {
 		char const *outfile = argv[1];
-		char const *format = (2<argc) ? argv[2] : "MP4" ;
-		printf("save output to %s, format %s\n", outfile, format);
+		printf("save output to %s\n", outfile);
 		vpu_t vpu ;
 		if (vpu.worked()) {
 			printf("vpu opened\n");
 			params.dump();
-			unsigned ysize;
-			unsigned yoffs;
-			unsigned yadder;
-			unsigned uvsize;
-			unsigned uvrowdiv;
-			unsigned uvcoldiv;
-			unsigned uoffs;
-			unsigned voffs;
-			unsigned uvadder;
-			unsigned totalsize;
-			if (fourccOffsets(params.getCameraFourcc(),params.getCameraWidth(),params.getCameraHeight(),
-					  ysize, yoffs, yadder, uvsize, uvrowdiv, uvcoldiv, uoffs,  voffs,  uvadder, totalsize)) {
+			frameLayout_t layout(params.getCameraFourcc(),params.getCameraWidth(),params.getCameraHeight());
+			if (layout.valid() && layout.info->yuv) {
+				unsigned const totalsize = layout.size ;
+				unsigned const ysize = layout.y.width*layout.y.height ;
+				unsigned const uvsize = layout.u.width*layout.u.height ;
 				imgFile_t *images = parseImgFiles(argc,argv,totalsize);
                                 imgFile_t *im = images ;
 				while (im) {
@@ -559,109 +597,88 @@ int main (int argc, char const **argv) {
 				       params.getCameraWidth(),
 				       params.getCameraHeight(),
 				       totalsize);
-				printf("yOffs: %u, uoffs %u, voffs %u\n", yoffs, uoffs, voffs);
+				printf("yOffs: %u, uoffs %u, voffs %u\n", layout.y.offset, layout.u.offset, layout.v.offset);
 				printf("ySize: %u, uvsize %u\n", ysize, uvsize);
-				struct v4l2_buffer v4lbuffers[NUMBUFFERS];
+				bufferHandle_t handles[NUMBUFFERS];
 				unsigned char *buffers[NUMBUFFERS];
+				physPool_t &pool = physPool_t::shared();
+				physPool_t::block_t *blocks[NUMBUFFERS];
 				for (unsigned i = 0 ; i < NUMBUFFERS ; i++) {
-					vpu_mem_desc mem_desc = {0};
-					mem_desc.size = totalsize ;
-					if (0 != IOGetPhyMem(&mem_desc)) {
+					blocks[i] = pool.alloc(totalsize);
+					if (0 == blocks[i]) {
 						fprintf(stderr,"Unable to obtain physical memory\n");
+						while (i--)
+							pool.release(blocks[i]);
 						return -1 ;
 					}
-					v4lbuffers[i].m.offset = mem_desc.phy_addr ;
-					int virt_bsbuf_addr = IOGetVirtMem(&mem_desc);
-					if (virt_bsbuf_addr <= 0) {
-						fprintf(stderr,"Unable to map physical memory\n");
-						IOFreePhyMem(&mem_desc);
-						return -1 ;
-					}
-                                        buffers[i] = (unsigned char *)virt_bsbuf_addr ;
+					handles[i].dmafd = blocks[i]->fd ;
+					handles[i].phys = blocks[i]->phys ;
+					handles[i].length = totalsize ;
+					handles[i].index = i ;
+					buffers[i] = handles[i].virt = blocks[i]->virt ;
 				}
 				printf("allocated %u buffers of %u bytes each\n", NUMBUFFERS,totalsize);
+				h264_encoder_t::rateControl_t rc ;
+				rc.fps = params.getCameraFPS();
+				rc.kbps = params.getBitrate();
+				rc.qp = params.getQP();
+				rc.sliceBytes = params.getSliceBytes();
+				rc.intraRefresh = params.getIntraRefresh();
 				h264_encoder_t encoder(vpu,
 						       params.getCameraWidth(),
 						       params.getCameraHeight(),
 						       params.getCameraFourcc(),
 						       params.getGOP(),
-						       v4lbuffers,
+						       handles,
 						       NUMBUFFERS,
-						       buffers);
+						       0,
+						       rc);
 				if (encoder.initialized()) {
-					AVRational codec_timebase = {1, 30};
 					printf("Initialized encoder\n");
-					av_register_all();
-					struct AVOutputFormat *outfmt = av_oformat_next(0);
-#if 1
-					while (outfmt) {
-						dump_avoutfmt(outfmt);
-                                                outfmt = av_oformat_next(outfmt);
-					}
-#endif
-					AVFormatContext *oc ;
-					avformat_alloc_output_context2(&oc,NULL,NULL,outfile);
-
-					outfmt= oc->oformat ;
-					if (0 == outfmt) {
-						fprintf (stderr, "unknown file format\n");
+					mp4Mux_t mux(mp4Mux_t::H264,
+						     params.getCameraWidth(),
+						     params.getCameraHeight());
+					if (!mux.open(outfile)) {
+						for (unsigned i = 0 ; i < NUMBUFFERS ; i++)
+							pool.release(blocks[i]);
 						return -1 ;
 					}
-
-					dump_avoutfmt(outfmt);
-
-					AVStream *video_st = add_video_stream(oc, params);
-
-					if (avio_open(&oc->pb, outfile, AVIO_FLAG_WRITE) < 0) {
-						fprintf(stderr, "Could not open '%s'\n", outfile);
-						return 1 ;
-					}
-
-					printf( "writing header: %d  programs, %d streams\n", oc->nb_programs, oc->nb_streams);
-					printf("ocodec write_header: %p:%p/%p\n", oc->oformat ? oc->oformat->write_header : 0, outfmt, outfmt->write_header );
-					av_write_header(oc);
-
-					int64_t pts = 0LL ;
+					unsigned const fps = params.getCameraFPS() ? params.getCameraFPS() : 30 ;
 					unsigned i = 0 ;
-					unsigned gopSize = (0 == params.getGOP()) ? 0xFFFFFFFF : params.getGOP();
 
-					while (fill_yuv(i,params,images,buffers[i%NUMBUFFERS],ysize,uvsize)) {
+					// fill the next buffer while the VPU encodes this one
+					bool more = fill_yuv(i,params,images,buffers[i%NUMBUFFERS],layout.y.width,ysize,uvsize);
+					while (more) {
 						if (0 == (i)){ // %gopSize)) {
-							writeHeaders(encoder,oc);
+							writeHeaders(encoder,mux);
+						}
+						if (!encoder.start_encode(i%NUMBUFFERS,(void *)(unsigned long)i)) {
+							fprintf (stderr, "encode error(%d)\n", i);
+							break;
 						}
+						i++ ;
+						more = fill_yuv(i,params,images,buffers[i%NUMBUFFERS],layout.y.width,ysize,uvsize);
 
                                                 void const *outData ;
                                                 unsigned    outLength ;
-						if (encoder.encode(i%NUMBUFFERS,outData,outLength)) {
-// printf( "%02x %02x %02x %02x %02x\n", ((uint8_t *)outData)[0], ((uint8_t *)outData)[1], ((uint8_t *)outData)[2], ((uint8_t *)outData)[3], ((uint8_t *)outData)[4]);
-							AVPacket pkt;
-							av_init_packet(&pkt);
-
-							if (0 == (i%gopSize)){
-//								pkt.flags |= PKT_FLAG_KEY;
-//                                                                ((uint8_t *)outData)[4] |= 0x05 ;
-							}
-							pkt.pts = 0x8000000000000000LL ; // av_rescale_q(i, codec_timebase, video_st->time_base); ;
-							pkt.dts = pkt.pts ;
-							pkt.stream_index= video_st->index;
-							pkt.data= (uint8_t *)outData;
-							pkt.size= outLength;
-#if 1
-							int ret = av_write_frame(oc, &pkt);
-							if (0 != ret) {
-								fprintf (stderr, "Error %d:%m writing video frame\n", ret);
-								break;
-							}
-#endif
+						bool	    iframe ;
+						void	   *tag = 0 ;
+						if (encoder.encode_complete(outData,outLength,iframe,tag,-1)) {
+							// the tag is the frame number, for the capture time
+							mux.addFrame(outData,outLength,
+								     (long long)(unsigned long)tag*1000000/fps,
+								     iframe);
+							encoder.releaseOutput(outData);
 						} else
-							fprintf (stderr, "encode error(%d): %p/%u\n", i,outData,outLength);
-						i++ ;
+							fprintf (stderr, "encode error(%lu)\n", (unsigned long)tag);
 					}
-					int rval = av_write_trailer(oc);
-					printf( "write trailer: %d\n", rval);
-					avio_close(oc->pb);
+					mux.close();
+					printf("%u frames in %u fragments, %u write errors\n",
+					       mux.numFrames(), mux.numFragments(), mux.numWriteErrors());
 				} else
 					fprintf (stderr, "Error initializing encoder\n");
+				for (unsigned i = 0 ; i < NUMBUFFERS ; i++)
+					pool.release(blocks[i]);
 			} else {
 				fprintf (stderr, "Unsupported fourcc\n");
 			}
@@ -669,7 +686,7 @@ int main (int argc, char const **argv) {
 			fprintf (stderr, "Error connecting to VPU\n");
 	}
 	else
-		fprintf (stderr, "Usage: %s [cameraparams] outfile[.mp4]\n", argv[0]);
+		fprintf (stderr, "Usage: %s [cameraparams] outfile.mp4\n", argv[0]);
 	return 0 ;
 }
 
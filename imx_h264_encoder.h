@@ -15,7 +15,7 @@
  *		get_bufs();
  *		fill in YUV data
  *		encode()
- *		process output data
+ *		process output data, then releaseOutput()
  *	}
  *
  * but this class also supports queueing and asynchronous completion
@@ -28,7 +28,7 @@
  *		   start_encode()
  *		}
  *		if( encode_complete() ) {
- *		   process output data
+ *		   process output data, then releaseOutput()
  *		}
  *		... poll other devices
  *	}
@@ -38,75 +38,173 @@
  * parameter will provide at least timing information about when the
  * frame of data was received (from a camera).
  *
+ * The VPU encodes one frame at a time, so only one start_encode()
+ * may be outstanding. A helper thread waits for the VPU interrupt
+ * and signals getFd(), which can be added to a poll() set along
+ * with the camera and display. The frame buffer passed to
+ * start_encode() must not be touched (or requeued to the camera)
+ * until encode_complete() returns its tag.
+ *
+ * Rate control is set up by a rateControl_t at construction. The
+ * bitrate, frame rate, GOP size, quantizer and intra refresh can be
+ * changed from any thread while encoding, and take effect with the
+ * next start_encode(). The VBV size and QP limits are fixed once
+ * the encoder is opened.
+ *
+ * For streaming over lossy links, frames can be split into slices
+ * of about sliceBytes each (see h264Nal.h), and gradual intra refresh
+ * can replace periodic I-frames: with intraRefresh set and a gopSize
+ * of 0, only the first frame (and any forceIntra()) is an I-frame,
+ * and every macroblock is refreshed within
+ * (macroblocks per frame)/intraRefresh frames.
+ *
+ * VPU setup, buffers and per-frame statistics come from vpuEncoder_t.
+ *
  * Copyright Boundary Devices, Inc. 2010
  */
-extern "C" {
-#include <vpu_lib.h>
-#include <vpu_io.h>
-};
-
 #include "imx_vpu.h"
+#include "vpuEncoder.h"
+#include <pthread.h>
 
-class h264_encoder_t {
+class h264_encoder_t : public vpuEncoder_t {
 public:
+	/*
+	 * With kbps == 0, every frame is coded at a fixed quantizer (qp).
+	 * Otherwise the VPU's rate control aims for kbps, holding the
+	 * output within a VBV buffer of vbvBits (CBR) or letting it vary
+	 * from frame to frame when vbvBits is 0 (VBR).
+	 */
+	struct rateControl_t {
+		rateControl_t(void)
+			: fps(30), kbps(0), minKbps(0), vbvBits(0), initialDelayMs(0)
+			, qp(25), minQp(0), maxQp(0), intraQp(0), intraRefresh(0)
+			, sliceBytes(0){}
+
+		unsigned	fps ;
+		unsigned	kbps ;		// target bitrate, 0 for constant QP
+		unsigned	minKbps ;	// floor for rateFeedback(), 0 for kbps/8
+		unsigned	vbvBits ;	// 0 for VBR
+		unsigned	initialDelayMs ;// VBV fill before decoding starts
+		unsigned	qp ;		// 0..51, constant QP only
+		unsigned	minQp ;		// 0 for no limit
+		unsigned	maxQp ;		// 0 for no limit
+		unsigned	intraQp ;	// 0 to let rate control choose
+		unsigned	intraRefresh ;	// intra macroblocks per P frame
+		unsigned	sliceBytes ;	// 0 for one slice per picture
+	};
+
 	h264_encoder_t(vpu_t &vpu,
 			unsigned width,
 			unsigned height,
 			unsigned fourcc,
 		        unsigned gopSize,
-                        struct v4l2_buffer *v4lbuffers,
+			bufferHandle_t const *buffers,
 			unsigned numBuffers,
-			unsigned char **buffers);
+			unsigned stride = 0,	// bytes per line of Y, if padded
+			rateControl_t const &rc = rateControl_t());
+
+	// synchronous encode
+	bool encode( unsigned index, void const *&outData, unsigned &outLength, bool &iframe);
 
-	bool initialized( void ) const { return initialized_ ; }
+	// queued encode: returns false if an encode is already in flight
+	bool start_encode( unsigned index, void *opaque );
+	bool busy( void ) const { return pending_ ; }
 
-	inline unsigned fourcc(void) const { return fourcc_ ; }
-	inline unsigned width(void) const { return w_ ; }
-	inline unsigned height(void) const { return h_ ; }
-	inline unsigned yuvSize(void) const { return imgSize_ ; }
+	/*
+	 * Waits up to timeoutMs (-1 forever) for the outstanding encode.
+	 * The tag is the opaque parameter passed to start_encode().
+	 * Returns false without output if the frame overflowed its
+	 * output buffer, and the next frame will be an I-frame.
+	 */
+	bool encode_complete( void const *&outData, unsigned &outLength, bool &iframe, void *&opaque, int timeoutMs = 0 );
 
-	bool get_bufs( unsigned index, unsigned char *&y, unsigned char *&u, unsigned char *&v );
+	/*
+	 * Output data from encode() or encode_complete() stays valid
+	 * until it is released (releaseOutput()), from any thread.
+	 * Encoding fails while all outputs are held.
+	 */
 
-	// synchronous encode
-	bool encode( unsigned index, void const *&outData, unsigned &outLength, bool &iframe);
+	// readable when encode_complete() won't block
+	int getFd( void ) const { return fd_ ; }
+
+	// current settings, including changes not yet applied
+	rateControl_t const &rateControl( void ) const { return rc_ ; }
+	unsigned currentKbps( void ) const { return kbps_ ; }
+
+	/*
+	 * Runtime changes. setBitrate() sets the target for rateFeedback()
+	 * and fails if the encoder was opened with constant QP, setQP()
+	 * fails if it wasn't.
+	 */
+	bool setBitrate( unsigned kbps );
+	bool setQP( unsigned qp );
+	void setFrameRate( unsigned fps );
+	void setGOP( unsigned gopSize );
+	void setIntraRefresh( unsigned numMbs );
+	void setSliceSize( unsigned bytes );
+
+	// make the next frame an I-frame, e.g. when a receiver lost data
+	void forceIntra( void ){ forceIntra_ = true ; }
+
+	/*
+	 * Starts a new stream on an open encoder (see encoderPool_t):
+	 * applies the new settings and makes the next frame an IDR frame
+	 * at the start of a GOP. Fails if an encode is in flight or the
+	 * settings that are fixed at open (rate control on or off, VBV,
+	 * QP limits) differ.
+	 */
+	bool reconfigure( unsigned gopSize, rateControl_t const &rc );
+
+	/*
+	 * Congestion feedback from a network sink, typically once for
+	 * each item sent. The bitrate is cut by a quarter (at most every
+	 * half second) while congested, and climbs back toward the
+	 * target by 1/32 per frame when not.
+	 */
+	void rateFeedback( bool congested );
 
 	// get AVC headers
 	bool getSPS( void const *&sps, unsigned &len);
 	bool getPPS( void const *&pps, unsigned &len);
 	~h264_encoder_t(void);
 private:
-#if 0
-	struct frame_buf {
-		int addrY;
-		int addrCb;
-		int addrCr;
-		int mvColBuf;
-		vpu_mem_desc desc;
+	static void *waitThread( void *arg );
+	void waitLoop( void );
+	void applyChanges( void );
+
+	enum {
+		CHANGE_BITRATE	= 1,
+		CHANGE_FPS	= 2,
+		CHANGE_GOP	= 4,
+		CHANGE_REFRESH	= 8,
+		CHANGE_SLICE	= 16
 	};
-#endif
 
-	bool 	  	initialized_ ;
-	unsigned	fourcc_ ;
-	unsigned  	w_ ;
-	unsigned  	h_ ;
-	unsigned  	imgSize_ ;
-        EncHandle 	handle_ ;
-	PhysicalAddress phy_bsbuf_addr; /* Physical bitstream buffer */
-	unsigned	virt_bsbuf_addr;		/* Virtual bitstream buffer */
-	int 		picwidth;	/* Picture width */
-	int 		picheight;	/* Picture height */
-	unsigned	fbcount;	/* Total number of framebuffers allocated */
-	FrameBuffer	*fb; /* frame buffer base given to encoder */
-	unsigned char  **buffers ; /* mmapped */
-	unsigned	yoffs ;
-	unsigned	uoffs ;
-	unsigned	voffs ;
+	static unsigned gopFor( unsigned requested, unsigned intraRefresh );
+	static void sliceModeFor( unsigned bytes, EncSliceMode &mode );
+
+	bool volatile	forceIntra_ ;
 	void	       *spsdata ;
 	unsigned 	spslen ;
 	void	       *ppsdata ;
 	unsigned 	ppslen ;
 	unsigned	gopsize ;
 	unsigned	frameidx ;
+	rateControl_t	rc_ ;
+	unsigned volatile kbps_ ;	// after rateFeedback()
+	unsigned volatile changes_ ;	// CHANGE_x, applied by start_encode()
+	unsigned	lastCut_ ;	// frameidx of the last bitrate cut
+	unsigned	lastRaise_ ;
+	int		fd_ ;		// eventfd, or read end of pipe
+	int		wfd_ ;		// write end (== fd_ for eventfd)
+	pthread_t	thread_ ;
+	pthread_mutex_t	lock_ ;
+	pthread_cond_t	cond_ ;
+	bool		haveThread_ ;
+	bool volatile	stop_ ;
+	bool volatile	pending_ ;	// started, not yet completed
+	bool volatile	encoding_ ;	// waitThread hasn't seen the interrupt
+	void	       *opaque_ ;
 };
 
 #endif
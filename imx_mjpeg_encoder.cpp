@@ -19,8 +19,6 @@
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
 
-#define STREAM_BUF_SIZE		0x80000
-
 static unsigned char lumaDcBits[16] = {
 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01,
 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -157,110 +155,18 @@ mjpeg_encoder_t::mjpeg_encoder_t(
 	unsigned w,
 	unsigned h,
 	unsigned fourcc,
-	int 	 fdCamera,
+	bufferHandle_t const *cameraBuffers,
 	unsigned numBuffers,
-	unsigned char **cameraBuffers)
-	: initialized_(false)
-	, fourcc_(fourcc)
-	, w_(w)
-	, h_(h)
-	, imgSize_(0)
-	, handle_(0)
-	, buffers(cameraBuffers)
-	, yoffs(0)
-	, uoffs(0)
-	, voffs(0)
+	unsigned stride)
+	: vpuEncoder_t(w,h,fourcc,cameraBuffers,numBuffers,stride)
 {
-	if( (0 == w) || (0 == h) ) {
-		fprintf(stderr, "Invalid w or h (%ux%u)\n", w, h );
-		return ;
-	}
-	fprintf(stderr, "%s: %ux%u - %u buffers\n", __func__, w_, h_, numBuffers );
-	vpu_mem_desc mem_desc = {0};
-
-	unsigned ysize ;
-	unsigned yadder ;
-	unsigned uvsize ;
-	unsigned uvrowdiv ;
-	unsigned uvcoldiv ;
-	unsigned uvadder ;
-	unsigned totalsize ;
-	if( !fourccOffsets(fourcc,w,h,ysize,yoffs,yadder,uvsize,uvrowdiv,uvcoldiv,uoffs,voffs,uvadder,totalsize) ){
-		fprintf(stderr, "Invalid fourcc 0x%x\n", fourcc);
-		return ;
-	}
-	imgSize_ = totalsize ;
-
-printf( "%s: fourcc offsets %u/%u/%u, adders %u/%u\n", __func__, yoffs, uoffs,voffs, yadder,uvadder);
-printf( "%s: sizes %u/%u: %u\n", __func__, ysize, uvsize, totalsize);
-
-	/* get physical contigous bit stream buffer */
-	mem_desc.size = STREAM_BUF_SIZE;
-	if (0 != IOGetPhyMem(&mem_desc)) {
-		fprintf(stderr,"Unable to obtain physical memory\n");
-		return ;
-	}
-
-	/* mmap that physical buffer */
-	virt_bsbuf_addr = IOGetVirtMem(&mem_desc);
-	if (virt_bsbuf_addr <= 0) {
-		fprintf(stderr,"Unable to map physical memory\n");
-		IOFreePhyMem(&mem_desc);
+	if (!usable())
 		return ;
-	}
-
-	debugPrint( "stream buffer: %u bytes: phys 0x%lx, cpu 0x%lx, virt 0x%lx (%x)\n",
-		    mem_desc.size, mem_desc.phy_addr, mem_desc.cpu_addr, mem_desc.virt_uaddr, virt_bsbuf_addr );
-
-	phy_bsbuf_addr = mem_desc.phy_addr;
-
-	EncOpenParam encop = {0};
-	/* Fill up parameters for encoding */
-	encop.bitstreamBuffer = phy_bsbuf_addr;
-	encop.bitstreamBufferSize = STREAM_BUF_SIZE;
-	encop.bitstreamFormat = STD_MJPG ;
-
-	encop.picWidth = picwidth = w;
-	encop.picHeight = picheight = h;
-
-	/*Note: Frame rate cannot be less than 15fps per H.263 spec */
-	encop.frameRateInfo = 30;
-	encop.bitRate = 0 ;
-	encop.gopSize = 1 ;
-	encop.slicemode.sliceMode = 0;	/* 0: 1 slice per picture; 1: Multiple slices per picture */
-	encop.slicemode.sliceSizeMode = 0; /* 0: silceSize defined by bits; 1: sliceSize defined by MB number*/
-	encop.slicemode.sliceSize = 4000;  /* Size of a slice in bits or MB numbers */
-
-	encop.initialDelay = 0;
-	encop.vbvBufferSize = 0;        /* 0 = ignore 8 */
-	encop.intraRefresh = 0;
-	encop.sliceReport = 0;
-	encop.mbReport = 0;
-	encop.mbQpReport = 0;
-	encop.rcIntraQp = -1;
-	encop.userQpMax = 0;
-	encop.userGamma = (Uint32)(0.75*32768);         /*  (0*32768 <= gamma <= 1*32768) */
-	encop.RcIntervalMode= 1;        /* 0:normal, 1:frame_level, 2:slice_level, 3: user defined Mb_level */
-	encop.MbInterval = 0;
 
-	if (uvsize == ysize/2) {
-	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 1 ; // YUV422 horizontal
-	} else if (uvsize == ysize/4) {
-	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 0 ; // YUV420
-	} else
-		printf( "%s: unknown input format: %u/%u\n", __func__,ysize,uvsize );
-printf( "%s: mjpg_source format %d\n", __func__, encop.EncStdParam.mjpgParam.mjpg_sourceFormat);
-	encop.ringBufferEnable = 0;
-	encop.dynamicAllocEnable = 0;
-	encop.chromaInterleave = (uoffs < voffs) ? (uoffs+uvsize > voffs)
-						 : (voffs+uvsize > uoffs);
+	EncOpenParam encop ;
+	defaultParams(encop,STD_MJPG);
 printf( "%s: chroma interleaved: %d\n", __func__, encop.chromaInterleave);
-	Uint8 *qMatTable = encop.EncStdParam.mjpgParam.mjpg_qMatTable = (Uint8*)calloc(192,1);
-	if (qMatTable == NULL) {
-		fprintf(stderr,"Failed to allocate qMatTable\n");
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
+	Uint8 *qMatTable = encop.EncStdParam.mjpgParam.mjpg_qMatTable = qMatTable_ ;
 
 	/* Rearrange and insert pre-defined Q-matrix to deticated variable. */
 	for(int i = 0; i < 64; i += 4)
@@ -287,15 +193,8 @@ printf( "%s: chroma interleaved: %d\n", __func__, encop.chromaInterleave);
 		qMatTable[i + 3] = chromaRQ2[i - 128];
 	}
 
-	unsigned char *huffTable = encop.EncStdParam.mjpgParam.mjpg_hufTable = (Uint8*)calloc(432,1);
-	if (huffTable == NULL) {
-		free(qMatTable);
-		fprintf(stderr,"Failed to allocate huffTable\n");
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
+	unsigned char *huffTable = encop.EncStdParam.mjpgParam.mjpg_hufTable = huffTable_ ;
 
-debugPrint("allocated qMat and huff tables\n");
 	/* Don't consider user defined hufftable this time */
 	/* Rearrange and insert pre-defined Huffman table to deticated variable. */
 	for(int i = 0; i < 16; i += 4)
@@ -355,216 +254,26 @@ debugPrint("allocated qMat and huff tables\n");
 		huffTable[i + 3] = chromaAcValue[i - 264];
 	}
 
-	debugPrint("check open params\n");
-
-	if (encop.bitstreamBuffer % 4) {	/* not 4-bit aligned */
-		printf( "--> bitstreamBuffer %lx\n", encop.bitstreamBuffer);
-	}
-	if (encop.bitstreamBufferSize % 1024 ||
-	    encop.bitstreamBufferSize < 1024 ||
-	    encop.bitstreamBufferSize > 16383 * 1024) {
-		printf( "--> bitstreamBufferSize %ld\n", encop.bitstreamBufferSize);
-	}
-	if (encop.bitstreamFormat != STD_MPEG4 &&
-	    encop.bitstreamFormat != STD_H263 &&
-	    encop.bitstreamFormat != STD_AVC &&
-	    encop.bitstreamFormat != STD_MJPG) {
-		printf( "--> bitstreamFormat %x\n", encop.bitstreamFormat);
-	}
-	if (encop.bitRate > 32767 || encop.bitRate < 0) {
-		printf( "--> bitrate %d\n", encop.bitRate);
-	}
-	if (encop.bitRate != 0 && encop.initialDelay > 32767) {
-		printf( "--> bitrate %d, initial delay %d\n", encop.bitRate, encop.initialDelay);
-	}
-	if (encop.bitRate != 0 && encop.initialDelay != 0 &&
-	    encop.vbvBufferSize < 0) {
-		printf( "--> bitrate %d, initial delay %d, vbvBufferSize %d\n", encop.bitRate, encop.initialDelay, encop.vbvBufferSize );
-	}
-	if (encop.gopSize > 60) {
-		printf( "--> gopSize %d\n", encop.gopSize );
-	}
-	if (encop.slicemode.sliceMode != 0 && encop.slicemode.sliceMode != 1) {
-		printf( "--> sliceMode %d\n", encop.slicemode.sliceMode );
-	}
-	if (encop.slicemode.sliceMode == 1) {
-		if (encop.slicemode.sliceSizeMode != 0 &&
-		    encop.slicemode.sliceSizeMode != 1) {
-			printf( "--> slicemode.sliceSizeMode %d\n", encop.slicemode.sliceSizeMode );
-		}
-		if (encop.slicemode.sliceSize == 0) {
-			printf( "--> slicemode.sliceSize %d\n", encop.slicemode.sliceSize );
-		}
-	}
-	if (cpu_is_mx27()) {
-		if (encop.sliceReport != 0 && encop.sliceReport != 1) {
-			printf( "--> sliceReport %d\n", encop.sliceReport );
-		}
-		if (encop.mbReport != 0 && encop.mbReport != 1) {
-			printf( "--> mbReport %d\n", encop.mbReport );
-		}
-	}
-	if (encop.intraRefresh < 0 || encop.intraRefresh >=
-	    (encop.picWidth * encop.picHeight / 256)) {
-		debugPrint( "--> intraRefresh %d, width %d, height %d\n", encop.intraRefresh, encop.picWidth, encop.picHeight );
-	}
-
-	debugPrint( "format %d, %ux%u\n", encop.bitstreamFormat, encop.picWidth, encop.picHeight );
-
-	if (encop.picWidth < 32 || encop.picHeight < 16) {
-	debugPrint( "bad size\n");
-	}
-
-debugPrint( "opening encoder\n" );
-
-	RetCode ret = vpu_EncOpen(&handle_, &encop);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Encoder open failed %d\n", ret);
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-
-debugPrint( "encoder initialized\n" );
-
-	SearchRamParam search_pa = {0};
-	iram_t iram;
-	int ram_size;
-
-	memset(&iram, 0, sizeof(iram_t));
-	ram_size = ((picwidth + 15) & ~15) * 36 + 2048;
-	IOGetIramBase(&iram);
-	if ((iram.end - iram.start) < ram_size) {
-		debugPrint("vpu iram is less than needed: %u..%u/%u\n", iram.start,iram.end,ram_size);
-		debugPrint("NOT Using IRAM for ME\n" );
-	} else {
-		/* Allocate max iram for vpu encoder search ram*/
-		ram_size = iram.end - iram.start;
-		search_pa.searchRamAddr = iram.start;
-		search_pa.SearchRamSize = ram_size;
-		debugPrint( "search iram %u..%u for %u bytes\n", iram.start, iram.end, ram_size );
-		ret = vpu_EncGiveCommand(handle_, ENC_SET_SEARCHRAM_PARAM, &search_pa);
-		if (ret != RETCODE_SUCCESS) {
-			fprintf(stderr, "Encoder SET_SEARCHRAM_PARAM failed\n");
-			IOFreePhyMem(&mem_desc);
-			return ;
-		}
-		else {
-			debugPrint("Using IRAM for ME\n" );
-		}
-	}
-
-	debugPrint( "get initial info\n");
-	EncInitialInfo initinfo = {0};
-	ret = vpu_EncGetInitialInfo(handle_, &initinfo);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Encoder GetInitialInfo failed\n");
-		IOFreePhyMem(&mem_desc);
+	if (!open(encop))
 		return ;
-	}
-
-	debugPrint( "have initial info\n" );
-
-	fbcount = numBuffers ;
-	int stride = ((picwidth + 15) & ~15)*((0 != encop.EncStdParam.mjpgParam.mjpg_sourceFormat)+1);
-
-	fb = (FrameBuffer *)calloc(fbcount, sizeof(FrameBuffer));
-	if (fb == NULL) {
-		fprintf(stderr,"Failed to allocate fb\n");
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-debugPrint( "allocated FrameBuffer fb: %p\n", fb );
-
-	for (int i = 0; i < fbcount; i++) {
-		struct v4l2_buffer buf ; memset(&buf,0,sizeof(buf));
-
-		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory      = V4L2_MEMORY_MMAP;
-		buf.index       = i ;
 
-		if (0 > ioctl (fdCamera, VIDIOC_QUERYBUF, &buf)) {
-			perror ("VIDIOC_QUERYBUF");
-			free(fb);
-			IOFreePhyMem(&mem_desc);
-			return ;
-		}
-		fb[i].bufY = buf.m.offset+yoffs;
-		fb[i].bufCb = buf.m.offset+uoffs;
-		fb[i].bufCr = buf.m.offset+voffs;
-	}
-debugPrint( "registering frame buffer\n" );
-	ret = vpu_EncRegisterFrameBuffer(handle_, fb, fbcount, stride, stride);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"Register frame buffer failed\n");
-		free(fb);
-		IOFreePhyMem(&mem_desc);
-		return ;
-	}
-	else
-		debugPrint( "registered frame buffer\n" );
-
-debugPrint( "%u frame buffers allocated and registered\n", fbcount );
-
-debugPrint( "freeing huffTable and qMatTable\n" );
-if (huffTable)
-	free(huffTable);
-if (qMatTable)
-	free(qMatTable);
 	initialized_ = true ;
 debugPrint("Done with %s\n", __func__ );
 }
 
 mjpeg_encoder_t::~mjpeg_encoder_t(void) {
-
-	debugPrint( "closing encoder\n" );
-	RetCode rc = vpu_EncClose(handle_);
-	if( RETCODE_SUCCESS != rc )
-		fprintf(stderr, "Error %d closing encoder\n", rc );
-	else {
-		debugPrint( "encoder closed\n" );
-	}
-}
-
-bool mjpeg_encoder_t::get_bufs( unsigned index, unsigned char *&y, unsigned char *&u, unsigned char *&v )
-{
-	unsigned char *base = buffers[index];
-	y = base + yoffs ;
-	u = base + uoffs ;
-	v = base + voffs ;
-	return true ;
 }
 
 bool mjpeg_encoder_t::encode(unsigned index, void const *&outData, unsigned &outLength)
 {
 	EncParam  enc_param = {0};
 
-	enc_param.sourceFrame = &fb[index];
 	enc_param.quantParam = 23;
 	enc_param.forceIPicture = 0;
 	enc_param.skipPicture = 0;
-	RetCode ret = vpu_EncStartOneFrame(handle_, &enc_param);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"vpu_EncStartOneFrame failed Err code:%d\n",
-								ret);
-		return false ;
-	}
-
-	while (vpu_IsBusy()) {
-		vpu_WaitForInt(30);
-		if(vpu_IsBusy()){
-			debugPrint( "busy\n");
-		}
-	}
-
-	EncOutputInfo outinfo = {0};
-	ret = vpu_EncGetOutputInfo(handle_, &outinfo);
-	if (ret != RETCODE_SUCCESS) {
-		fprintf(stderr,"vpu_EncGetOutputInfo failed Err code: %d\n",
-								ret);
+	if (!startFrame(index,enc_param))
 		return false ;
-	}
-
-	outData = (void *)(virt_bsbuf_addr + outinfo.bitstreamBuffer - phy_bsbuf_addr);
-	outLength = outinfo.bitstreamSize ;
-	return true ;
+	waitIdle();
+	bool iframe ;
+	return finishFrame(outData,outLength,iframe);
 }
@@ -6,8 +6,10 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 #include "hexDump.h"
 #include "fourcc.h"
 
@@ -15,22 +17,20 @@ extern "C" {
 #include <jpeglib.h>
 };
 
-#define BYTESPERMEMCHUNK 16384
-
-struct memChunk_t {
-   unsigned long  length_ ; // bytes used so far
-   memChunk_t    *next_ ;   // next chunk
-   JOCTET         data_[BYTESPERMEMCHUNK-8];
-};
-
-struct memDest_t {
+/*
+ * Output goes straight into a flat buffer. If the buffer can grow,
+ * it's doubled when full. Otherwise the rest of the image is thrown
+ * away and the encode fails.
+ */
+struct bufferDest_t {
    struct       jpeg_destination_mgr pub; /* public fields */
-   memChunk_t  *chunkHead_ ;
-   memChunk_t  *chunkTail_ ;
+   unsigned char *data_ ;
+   unsigned       size_ ;
+   bool           grow_ ;
+   bool           overflow_ ;
+   JOCTET         discard_[512];
 };
 
-typedef memDest_t  *memDestPtr_t ;
-
 static void dumpcinfo( jpeg_compress_struct const &cinfo )
 {
    hexDumper_t dump( &cinfo, sizeof( cinfo ) );
@@ -39,123 +39,154 @@ static void dumpcinfo( jpeg_compress_struct const &cinfo )
    fflush( stdout );
 }
 
-static void dumpMemDest( memDest_t const &md )
-{
-   hexDumper_t dump( &md, sizeof( md ) );
-   while( dump.nextLine() )
-      printf( "%s\n", dump.getLine() );
-   fflush( stdout );
-}
-
 /*
  * Initialize destination --- called by jpeg_start_compress
  * before any data is actually written.
  */
 static void init_destination (j_compress_ptr cinfo)
 {
-   memDestPtr_t dest = (memDestPtr_t) cinfo->dest;
-   
-   assert( 0 == dest->chunkHead_ );
-
-   /* Allocate first memChunk */
-   dest->chunkHead_ = dest->chunkTail_ = new memChunk_t ;
-   memset( dest->chunkHead_, 0, sizeof( *dest->chunkHead_ ) );
-   dest->pub.next_output_byte = dest->chunkHead_->data_ ;
-   dest->pub.free_in_buffer   = sizeof( dest->chunkHead_->data_ );
+   bufferDest_t *dest = (bufferDest_t *) cinfo->dest;
+   if ( dest->grow_ && ( 0 == dest->size_ ) ) {
+      dest->data_ = (unsigned char *)malloc( 65536 );
+      dest->size_ = dest->data_ ? 65536 : 0 ;
+   }
+   dest->overflow_ = false ;
+   dest->pub.next_output_byte = dest->data_ ;
+   dest->pub.free_in_buffer   = dest->size_ ;
+   if ( 0 == dest->size_ ) {
+      dest->pub.next_output_byte = dest->discard_ ;
+      dest->pub.free_in_buffer   = sizeof( dest->discard_ );
+      dest->overflow_ = true ;
+   }
 }
 
-
 /*
  * Empty the output buffer --- called whenever buffer fills up.
  */
-
 static boolean empty_output_buffer (j_compress_ptr cinfo)
 {
-   memDestPtr_t const dest = (memDestPtr_t) cinfo->dest;
-   
-   assert( 0 != dest->chunkTail_ );
-
-   //
-   // free_in_buffer member doesn't seem to be filled in
-   //
-   dest->chunkTail_->length_ = sizeof( dest->chunkTail_->data_ ); //  - dest->pub.free_in_buffer ;
-
-   memChunk_t * const next = new memChunk_t ;
-   memset( next, 0, sizeof( *next ) );
-   dest->chunkTail_->next_ = next ;
-   dest->chunkTail_ = next ;
-   
-   dest->pub.next_output_byte = next->data_ ;
-   dest->pub.free_in_buffer   = sizeof( next->data_ );
-
+   bufferDest_t * const dest = (bufferDest_t *) cinfo->dest;
+   if ( dest->grow_ && !dest->overflow_ ) {
+      unsigned const used = dest->size_ ;
+      unsigned char *data = (unsigned char *)realloc( dest->data_, 2*used );
+      if ( data ) {
+         dest->data_ = data ;
+         dest->size_ = 2*used ;
+         dest->pub.next_output_byte = data+used ;
+         dest->pub.free_in_buffer   = used ;
+         return TRUE ;
+      }
+   }
+   dest->overflow_ = true ;
+   dest->pub.next_output_byte = dest->discard_ ;
+   dest->pub.free_in_buffer   = sizeof( dest->discard_ );
    return TRUE;
 }
 
-
 /*
  * Terminate destination --- called by jpeg_finish_compress
- * after all data has been written.  Usually needs to flush buffer.
- *
- * NB: *not* called by jpeg_abort or jpeg_destroy; surrounding
- * application must deal with any cleanup that should happen even
- * for error exit.
+ * after all data has been written. The length is taken from
+ * free_in_buffer afterwards.
  */
 static void term_destination (j_compress_ptr cinfo)
 {
-   //
-   // just account for data used
-   //
-   memDest_t  *const dest = (memDestPtr_t) cinfo->dest ;
-   memChunk_t  *tail = dest->chunkTail_ ;
-   assert( 0 != tail );   
-   assert( sizeof( tail->data_ ) >= dest->pub.free_in_buffer );
-   assert( tail->data_ <= dest->pub.next_output_byte );
-   assert( tail->data_ + sizeof( tail->data_ ) >= dest->pub.next_output_byte + dest->pub.free_in_buffer );
-
-   tail->length_ = sizeof( tail->data_ ) - dest->pub.free_in_buffer ;
 }
 
-/*
- * Prepare for output to a chunked memory stream.
- */
-void jpeg_mem_dest( j_compress_ptr cinfo )
+static unsigned bytesWritten( bufferDest_t const &dest )
 {
-   assert( 0 == cinfo->dest );
-   cinfo->dest = (struct jpeg_destination_mgr *)
-                 (*cinfo->mem->alloc_small)
-                     ( (j_common_ptr) cinfo, 
-                       JPOOL_IMAGE,
-		       sizeof(memDest_t)
-                     );
-   memDest_t *dest = (memDest_t *) cinfo->dest ;
-   dest->pub.init_destination    = init_destination ;
-   dest->pub.empty_output_buffer = empty_output_buffer ;
-   dest->pub.term_destination    = term_destination ;
-   dest->chunkHead_ = 
-   dest->chunkTail_ = 0 ;
+   return dest.overflow_ ? 0 : dest.size_ - dest.pub.free_in_buffer ;
 }
 
-struct resolution_t {
-	unsigned w ;
-	unsigned h ;
-};
+#include "libjpeg_encoder.h"
 
-static struct resolution_t const known_resolutions[] = {
-	{ 640, 480 }
+struct libjpeg_encoder_t::stripe_t {
+	libjpeg_encoder_t      *owner ;
+	struct jpeg_compress_struct cinfo ;
+	struct jpeg_error_mgr	jerr ;
+	bufferDest_t		dest ;
+	unsigned		firstMCURow ;
+	unsigned		numMCURows ;
+	unsigned char	       *rows ;		// for formats that aren't planar
+	pthread_t		thread ;
+	bool			haveThread ;
+	bool			worked ;
 };
 
-#define ARRAY_SIZE(__arr) (sizeof(__arr)/sizeof(__arr[0]))
+/*
+ * Returns true if libjpeg can read the rows of a component in place:
+ * no interleaving, and whole blocks so it never reads past a row.
+ */
+static bool inPlace( frameLayout_t::component_t const &comp )
+{
+	return (1 == comp.step) && (0 == (comp.width % DCTSIZE));
+}
 
-static resolution_t const *find_res(unsigned ybytes){
-	for (int i = 0 ; i < ARRAY_SIZE(known_resolutions); i++) {
-		if (ybytes == (known_resolutions[i].w*known_resolutions[i].h)) {
-			return known_resolutions+i;
+static unsigned paddedWidth( unsigned width )
+{
+	return (width+DCTSIZE-1) & ~(DCTSIZE-1);
+}
+
+/*
+ * Fills one row of a JPEG component from the frame, repeating the
+ * last sample out to a whole block. Chroma is averaged down or
+ * repeated when the JPEG's subsampling differs from the input's
+ * (colDelta and rowDelta are the differences in shifts).
+ */
+static void fillRow
+	( unsigned char *out,
+	  unsigned outWidth,
+	  frameLayout_t::component_t const &comp,
+	  unsigned char const *data,
+	  unsigned outRow,
+	  int colDelta,
+	  int rowDelta )
+{
+	unsigned row0 = (0 < rowDelta) ? outRow << 1 : (0 > rowDelta) ? outRow >> 1 : outRow ;
+	unsigned row1 = (0 < rowDelta) ? row0+1 : row0 ;
+	if (row0 >= comp.height)
+		row0 = comp.height-1 ;
+	if (row1 >= comp.height)
+		row1 = comp.height-1 ;
+	unsigned char const *in0 = data+comp.offset+row0*comp.stride ;
+	unsigned char const *in1 = data+comp.offset+row1*comp.stride ;
+	unsigned const step = comp.step ;
+	unsigned col ;
+	if ((0 == colDelta) && (0 == rowDelta)) {
+		for (col = 0 ; col < outWidth ; col++)
+			out[col] = in0[col*step];
+	} else {
+		for (col = 0 ; col < outWidth ; col++) {
+			unsigned x0 = (0 < colDelta) ? col << 1 : (0 > colDelta) ? col >> 1 : col ;
+			unsigned x1 = (0 < colDelta) ? x0+1 : x0 ;
+			if (x1 >= comp.width)
+				x1 = comp.width-1 ;
+			out[col] = (in0[x0*step]+in0[x1*step]+in1[x0*step]+in1[x1*step]+2) >> 2 ;
 		}
 	}
-	return 0 ;
+	for ( ; col < paddedWidth(outWidth) ; col++)
+		out[col] = out[outWidth-1];
 }
 
-#include "libjpeg_encoder.h"
+libjpeg_encoder_t::libjpeg_encoder_t
+	( frameLayout_t const &layout,
+	  settings_t const &settings,
+	  unsigned stripes )
+	: colShift_(0)
+	, rowShift_(0)
+	, numStripes_(0)
+	, stripes_(0)
+	, stripeMCURows_(0)
+	, output_(0)
+	, outputSize_(0)
+	, generation_(0)
+	, pending_(0)
+	, shutdown_(false)
+	, data_(0)
+	, jpegData_(0)
+	, jpegSize_(0)
+{
+	init(layout,settings,stripes);
+}
 
 libjpeg_encoder_t::libjpeg_encoder_t
 	( unsigned width,
@@ -163,152 +194,530 @@ libjpeg_encoder_t::libjpeg_encoder_t
 	  unsigned fourcc,
 	  unsigned char const *data,
 	  unsigned dataSize)
-	: jpegData_(0)
+	: colShift_(0)
+	, rowShift_(0)
+	, numStripes_(0)
+	, stripes_(0)
+	, stripeMCURows_(0)
+	, output_(0)
+	, outputSize_(0)
+	, generation_(0)
+	, pending_(0)
+	, shutdown_(false)
+	, data_(0)
+	, jpegData_(0)
 	, jpegSize_(0)
 {
 	if (!supported_fourcc(fourcc)) {
 		fprintf (stderr, "Unsupported fourcc %s\n", fourcc_str(fourcc));
 		return ;
 	}
-	unsigned ysize;
-	unsigned yoffs;
-	unsigned yadder;
-	unsigned uvsize;
-	unsigned uvrowdiv;
-	unsigned uvcoldiv;
-	unsigned uoffs; 
-	unsigned voffs; 
-	unsigned uvadder;
-	unsigned totalsize;
-	if (!fourccOffsets(fourcc,
-                           width,
-                           height,
-                           ysize,
-                           yoffs,
-                           yadder,
-                           uvsize,
-                           uvrowdiv,
-                           uvcoldiv,
-                           uoffs, 
-                           voffs, 
-                           uvadder,
-                           totalsize)) {
-		fprintf (stderr, "Error calculating params for fourcc %s\n", fourcc_str(fourcc));
-		return ;
-	}
-	if (totalsize != dataSize) {
-		fprintf (stderr, "data size mismatch: %u != %u\n\n", totalsize, dataSize);
+	init(frameLayout_t(fourcc,width,height),settings_t(),1);
+	if (initialized())
+		encode(data,dataSize);
+}
+
+libjpeg_encoder_t::libjpeg_encoder_t
+	( frameLayout_t const &layout,
+	  unsigned char const *data,
+	  unsigned dataSize)
+	: colShift_(0)
+	, rowShift_(0)
+	, numStripes_(0)
+	, stripes_(0)
+	, stripeMCURows_(0)
+	, output_(0)
+	, outputSize_(0)
+	, generation_(0)
+	, pending_(0)
+	, shutdown_(false)
+	, data_(0)
+	, jpegData_(0)
+	, jpegSize_(0)
+{
+	init(layout,settings_t(),1);
+	if (initialized())
+		encode(data,dataSize);
+}
+
+void libjpeg_encoder_t::init
+	( frameLayout_t const &layout,
+	  settings_t const &settings,
+	  unsigned stripes )
+{
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&start_,0);
+	pthread_cond_init(&done_,0);
+	if (!layout.valid() || !layout.info->yuv
+	    || (1 < layout.info->uvColShift) || (1 < layout.info->uvRowShift)) {
+		fprintf (stderr, "Error calculating params for fourcc %s\n",
+			 layout.valid() ? layout.info->name : "?");
 		return ;
 	}
-        struct jpeg_compress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-        cinfo.err = jpeg_std_error(&jerr);
-	jpeg_create_compress( &cinfo );
-	cinfo.in_color_space = JCS_YCbCr; /* arbitrary guess */
-	jpeg_set_defaults(&cinfo);
-	cinfo.dct_method = JDCT_ISLOW;
-	cinfo.in_color_space = JCS_YCbCr;
-	cinfo.input_components = 3;
-	cinfo.data_precision = 8;
-	cinfo.image_width = (JDIMENSION)width;
-	cinfo.image_height = (JDIMENSION)height;
-	jpeg_set_colorspace(&cinfo,JCS_YCbCr);
-	jpeg_set_quality(&cinfo,100,0);
-	jpeg_mem_dest( &cinfo );
-	jpeg_start_compress( &cinfo, TRUE );
-	unsigned const row_stride = 3*sizeof(JSAMPLE)*width; // RGB
-	JSAMPARRAY const buffer = (*cinfo.mem->alloc_sarray)( (j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
-	unsigned char const *yIn = data+yoffs;
-	unsigned char const *uIn = yIn+uoffs ;
-	unsigned char const *vIn = yIn+voffs ;
-	unsigned const uvstride = width/uvcoldiv;
-	for( int row = 0 ; row < height ; row++ )
-	{
-		JSAMPLE *nextOut = buffer[0];
-		unsigned rowoffs = (row/uvrowdiv)*uvstride;
-		for( int col = 0 ; col < width ; col++ )
-		{
-			unsigned coloffs = col/uvcoldiv;
-			unsigned char u = (uIn+rowoffs)[coloffs];
-			unsigned char v = (vIn+rowoffs)[coloffs];
-			*nextOut++ = *yIn++ ;
-			*nextOut++ = u ;
-			*nextOut++ = v ;
-		} // for each column
-		jpeg_write_scanlines( &cinfo, buffer, 1 );
-	} // for each row
-	jpeg_finish_compress( &cinfo );
-
-        memDest_t * const dest = (memDest_t *)cinfo.dest ;
-	memChunk_t *chunk = dest->chunkHead_ ;
-	unsigned numChunks = 0 ;
-	totalsize=0;
-	while (chunk) {
-		++numChunks ;
-		totalsize += chunk->length_;
-		chunk = chunk->next_ ;
+	layout_ = layout ;
+	switch (settings.subsampling) {
+		case SUBSAMPLE_444: colShift_ = 0 ; rowShift_ = 0 ; break ;
+		case SUBSAMPLE_422: colShift_ = 1 ; rowShift_ = 0 ; break ;
+		case SUBSAMPLE_420: colShift_ = 1 ; rowShift_ = 1 ; break ;
+		default:
+			colShift_ = layout.info->uvColShift ;
+			rowShift_ = layout.info->uvRowShift ;
 	}
 
-	jpegSize_ = totalsize ;
-	unsigned char *nextOut = jpegData_ = new unsigned char [totalsize];
-	totalsize=0;
-	
-	while (dest->chunkHead_) {
-		chunk = dest->chunkHead_->next_ ;
-		memcpy(nextOut,dest->chunkHead_->data_,dest->chunkHead_->length_);
-		nextOut += dest->chunkHead_->length_;
-		delete dest->chunkHead_ ;
-                dest->chunkHead_ = chunk ;
+	/*
+	 * Stripes are whole multiples of eight restart intervals, so
+	 * the restart markers (RST0-7) in each one continue the count
+	 * from the one before. Huffman tables must be the same in
+	 * every stripe, so optimized tables rule them out.
+	 */
+	unsigned const mcuHeight = DCTSIZE << rowShift_ ;
+	unsigned const mcuRows = (layout.height+mcuHeight-1)/mcuHeight ;
+	unsigned restartRows = settings.restartRows ;
+	if (settings.optimize)
+		stripes = 1 ;
+	else if ((1 < stripes) && (0 == restartRows))
+		restartRows = 1 ;
+	if (stripes > MAXSTRIPES)
+		stripes = MAXSTRIPES ;
+	if (restartRows && (stripes > mcuRows/(8*restartRows)))
+		stripes = mcuRows/(8*restartRows);
+	if (1 > stripes)
+		stripes = 1 ;
+	unsigned const unit = 8*(restartRows ? restartRows : 1);
+	stripeMCURows_ = ((mcuRows+stripes-1)/stripes + unit-1)/unit*unit ;
+	stripes = (mcuRows+stripeMCURows_-1)/stripeMCURows_ ;
+
+	unsigned const chromaWidth = (layout.width+(1<<colShift_)-1) >> colShift_ ;
+	bool const sameChroma = (colShift_ == layout.info->uvColShift)
+			     && (rowShift_ == layout.info->uvRowShift);
+	bool const copyRows = !inPlace(layout.y) || !sameChroma
+			   || !inPlace(layout.u) || !inPlace(layout.v);
+	unsigned const rowBytes = mcuHeight*paddedWidth(layout.width)
+				+ 2*DCTSIZE*paddedWidth(chromaWidth);
+
+	stripes_ = new stripe_t [stripes];
+	memset(stripes_,0,stripes*sizeof(stripes_[0]));
+	for (unsigned i = 0 ; i < stripes ; i++) {
+		stripe_t &s = stripes_[i];
+		s.owner = this ;
+		s.firstMCURow = i*stripeMCURows_ ;
+		s.numMCURows = (i+1 < stripes) ? stripeMCURows_ : mcuRows-s.firstMCURow ;
+		if (copyRows)
+			s.rows = (unsigned char *)malloc(rowBytes);
+
+		jpeg_compress_struct &cinfo = s.cinfo ;
+		cinfo.err = jpeg_std_error(&s.jerr);
+		jpeg_create_compress(&cinfo);
+		cinfo.in_color_space = JCS_YCbCr;
+		jpeg_set_defaults(&cinfo);
+		cinfo.dct_method = settings.fastDCT ? JDCT_IFAST : JDCT_ISLOW;
+		cinfo.optimize_coding = settings.optimize ? TRUE : FALSE;
+		cinfo.input_components = 3;
+		cinfo.data_precision = 8;
+		cinfo.image_width = (JDIMENSION)layout.width;
+		cinfo.image_height = (JDIMENSION)((i+1 < stripes)
+						  ? s.numMCURows*mcuHeight
+						  : layout.height-s.firstMCURow*mcuHeight);
+		jpeg_set_colorspace(&cinfo,JCS_YCbCr);
+		jpeg_set_quality(&cinfo,settings.quality,TRUE);
+		cinfo.raw_data_in = TRUE;
+		cinfo.comp_info[0].h_samp_factor = 1 << colShift_ ;
+		cinfo.comp_info[0].v_samp_factor = 1 << rowShift_ ;
+		for (unsigned c = 1 ; c < 3 ; c++) {
+			cinfo.comp_info[c].h_samp_factor = 1 ;
+			cinfo.comp_info[c].v_samp_factor = 1 ;
+		}
+		cinfo.restart_in_rows = restartRows ;
+
+		s.dest.pub.init_destination    = init_destination ;
+		s.dest.pub.empty_output_buffer = empty_output_buffer ;
+		s.dest.pub.term_destination    = term_destination ;
+		s.dest.grow_ = true ;
+		cinfo.dest = &s.dest.pub ;
+	}
+	numStripes_ = stripes ;
+
+	// a stripe without a thread is encoded by the caller
+	for (unsigned i = 1 ; i < stripes ; i++) {
+		if (0 == pthread_create(&stripes_[i].thread,0,threadRoutine,stripes_+i))
+			stripes_[i].haveThread = true ;
+		else
+			perror("libjpeg_encoder thread");
 	}
-        jpeg_destroy_compress(&cinfo);
 }
 
 libjpeg_encoder_t::~libjpeg_encoder_t( void )
 {
-	if (jpegData_) {
-		delete [] jpegData_ ;
+	pthread_mutex_lock(&lock_);
+	shutdown_ = true ;
+	pthread_cond_broadcast(&start_);
+	pthread_mutex_unlock(&lock_);
+	for (unsigned i = 0 ; i < numStripes_ ; i++) {
+		stripe_t &s = stripes_[i];
+		if (s.haveThread)
+			pthread_join(s.thread,0);
+		jpeg_destroy_compress(&s.cinfo);
+		free(s.dest.data_);
+		free(s.rows);
 	}
+	delete [] stripes_ ;
+	free(output_);
+	pthread_cond_destroy(&done_);
+	pthread_cond_destroy(&start_);
+	pthread_mutex_destroy(&lock_);
 }
 
+bool libjpeg_encoder_t::encodeStripe(stripe_t &s)
+{
+	unsigned const mcuHeight = DCTSIZE << rowShift_ ;
+	frameLayout_t::component_t const *const comps[3] = {
+		&layout_.y, &layout_.u, &layout_.v
+	};
+	int const colDelta = (int)colShift_-layout_.info->uvColShift ;
+	int const rowDelta = (int)rowShift_-layout_.info->uvRowShift ;
+	unsigned const chromaWidth = (layout_.width+(1<<colShift_)-1) >> colShift_ ;
+	unsigned const chromaHeight = (layout_.height+(1<<rowShift_)-1) >> rowShift_ ;
+	JSAMPROW rows[3][2*DCTSIZE];
+	JSAMPARRAY planes[3] = { rows[0], rows[1], rows[2] };
+
+	jpeg_start_compress(&s.cinfo, TRUE);
+	for (unsigned m = 0 ; m < s.numMCURows ; m++) {
+		unsigned char *scratch = s.rows ;
+		for (unsigned c = 0 ; c < 3 ; c++) {
+			frameLayout_t::component_t const &comp = *comps[c];
+			unsigned const compRows = c ? DCTSIZE : mcuHeight ;
+			unsigned const width = c ? chromaWidth : layout_.width ;
+			unsigned const height = c ? chromaHeight : layout_.height ;
+			unsigned const first = (s.firstMCURow+m)*compRows ;
+			bool const direct = inPlace(comp)
+					 && ((0 == c) || ((0 == colDelta) && (0 == rowDelta)));
+			for (unsigned r = 0 ; r < compRows ; r++) {
+				// repeat the last row to fill the last MCU row
+				unsigned row = first+r ;
+				if (row >= height)
+					row = height-1 ;
+				if (direct) {
+					rows[c][r] = (JSAMPROW)(data_+comp.offset+row*comp.stride);
+					continue ;
+				}
+				fillRow(scratch,width,comp,data_,row,
+					c ? colDelta : 0, c ? rowDelta : 0);
+				rows[c][r] = scratch ;
+				scratch += paddedWidth(width);
+			}
+		}
+		jpeg_write_raw_data(&s.cinfo, planes, mcuHeight);
+	}
+	jpeg_finish_compress(&s.cinfo);
+	return !s.dest.overflow_ ;
+}
 
-#ifdef __MODULETEST_LIBJPEG_ENCODER__
-#include "memFile.h"
+/*
+ * Returns the offset of the entropy-coded data, just past the SOS
+ * header, and the offset of the SOF0 marker.
+ */
+static unsigned scanStart(unsigned char const *data, unsigned length, unsigned &sof)
+{
+	unsigned i = 2 ;	// SOI
+	while (i+4 <= length) {
+		if (0xff != data[i])
+			return 0 ;
+		unsigned const marker = data[i+1];
+		if (0xc0 == marker)
+			sof = i ;
+		i += 2+((data[i+2]<<8)|data[i+3]);
+		if (0xda == marker)
+			return i ;
+	}
+	return 0 ;
+}
+
+/*
+ * Joins the stripes: the headers of the first, with the full image
+ * height, then the entropy-coded data of each with a restart marker
+ * in between.
+ */
+bool libjpeg_encoder_t::join(unsigned char *outBuf, unsigned outSize)
+{
+	unsigned starts[MAXSTRIPES];
+	unsigned lengths[MAXSTRIPES];
+	unsigned sof = 0 ;
+	unsigned total = 2 ;	// EOI
+	for (unsigned i = 0 ; i < numStripes_ ; i++) {
+		stripe_t const &s = stripes_[i];
+		lengths[i] = bytesWritten(s.dest);
+		unsigned stripeSof = 0 ;
+		starts[i] = scanStart(s.dest.data_,lengths[i],stripeSof);
+		if (!s.worked || (0 == starts[i]) || (starts[i]+2 > lengths[i])) {
+			fprintf (stderr, "%s: stripe %u failed\n", __PRETTY_FUNCTION__, i);
+			return false ;
+		}
+		if (0 == i) {
+			sof = stripeSof ;
+			starts[0] = 0 ;
+		}
+		lengths[i] -= 2 ;	// EOI
+		total += lengths[i]-starts[i] + (i ? 2 : 0);
+	}
+	if (0 == sof)
+		return false ;
+
+	if (0 == outBuf) {
+		if (total > outputSize_) {
+			unsigned char *output = (unsigned char *)realloc(output_,total);
+			if (0 == output)
+				return false ;
+			output_ = output ;
+			outputSize_ = total ;
+		}
+		outBuf = output_ ;
+	} else if (total > outSize) {
+		fprintf (stderr, "JPEG output overflow: %u > %u\n", total, outSize);
+		return false ;
+	}
+
+	unsigned char *nextOut = outBuf ;
+	for (unsigned i = 0 ; i < numStripes_ ; i++) {
+		if (i) {
+			unsigned const restarts = i*stripeMCURows_/stripes_[0].cinfo.restart_in_rows ;
+			*nextOut++ = 0xff ;
+			*nextOut++ = 0xd0 + ((restarts-1) & 7);
+		}
+		memcpy(nextOut,stripes_[i].dest.data_+starts[i],lengths[i]-starts[i]);
+		nextOut += lengths[i]-starts[i];
+	}
+	*nextOut++ = 0xff ;
+	*nextOut++ = 0xd9 ;
+	outBuf[sof+5] = layout_.height >> 8 ;
+	outBuf[sof+6] = layout_.height ;
+
+	jpegData_ = outBuf ;
+	jpegSize_ = total ;
+	return true ;
+}
+
+bool libjpeg_encoder_t::encode
+	( unsigned char const *data,
+	  unsigned dataSize)
+{
+	return encode(data,dataSize,0,0);
+}
+
+bool libjpeg_encoder_t::encode
+	( unsigned char const *data,
+	  unsigned dataSize,
+	  unsigned char *outBuf,
+	  unsigned outSize)
+{
+	jpegData_ = 0 ;
+	jpegSize_ = 0 ;
+	if (!initialized())
+		return false ;
+	// drivers may round sizeimage up
+	if (layout_.size > dataSize) {
+		fprintf (stderr, "data size mismatch: %u > %u\n\n", layout_.size, dataSize);
+		return false ;
+	}
+	data_ = data ;
+
+	if (1 == numStripes_) {
+		bufferDest_t &dest = stripes_[0].dest ;
+		unsigned char *const ownData = dest.data_ ;
+		unsigned const ownSize = dest.size_ ;
+		if (outBuf) {
+			dest.data_ = outBuf ;
+			dest.size_ = outSize ;
+			dest.grow_ = false ;
+		}
+		bool const worked = encodeStripe(stripes_[0]);
+		unsigned const length = bytesWritten(dest);
+		unsigned char *const out = dest.data_ ;
+		if (outBuf) {
+			dest.data_ = ownData ;
+			dest.size_ = ownSize ;
+			dest.grow_ = true ;
+		}
+		if (!worked) {
+			fprintf (stderr, "JPEG output overflow: %u bytes\n", outSize);
+			return false ;
+		}
+		jpegData_ = out ;
+		jpegSize_ = length ;
+		return true ;
+	}
+
+	unsigned numThreads = 0 ;
+	for (unsigned i = 0 ; i < numStripes_ ; i++)
+		numThreads += stripes_[i].haveThread ;
+	pthread_mutex_lock(&lock_);
+	pending_ = numThreads ;
+	generation_++ ;
+	pthread_cond_broadcast(&start_);
+	pthread_mutex_unlock(&lock_);
+
+	for (unsigned i = 0 ; i < numStripes_ ; i++) {
+		if (!stripes_[i].haveThread)
+			stripes_[i].worked = encodeStripe(stripes_[i]);
+	}
+
+	pthread_mutex_lock(&lock_);
+	while (pending_)
+		pthread_cond_wait(&done_,&lock_);
+	pthread_mutex_unlock(&lock_);
+
+	return join(outBuf,outSize);
+}
+
+void *libjpeg_encoder_t::threadRoutine(void *arg)
+{
+	stripe_t *stripe = (stripe_t *)arg ;
+	stripe->owner->run(*stripe);
+	return 0 ;
+}
+
+void libjpeg_encoder_t::run(stripe_t &stripe)
+{
+	pthread_mutex_lock(&lock_);
+	unsigned seen = 0 ;
+	while (!shutdown_) {
+		if (seen == generation_) {
+			pthread_cond_wait(&start_,&lock_);
+			continue ;
+		}
+		seen = generation_ ;
+		pthread_mutex_unlock(&lock_);
+
+		stripe.worked = encodeStripe(stripe);
+
+		pthread_mutex_lock(&lock_);
+		if (0 == --pending_)
+			pthread_cond_broadcast(&done_);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+#ifdef STANDALONE_LIBJPEG_ENCODER
+/*
+ * Encodes synthetic frames at several sizes and settings and reports
+ * the throughput (megapixels per second) and size of each:
+ *
+ *	libjpeg_bench [frames [fourcc [stripes [out.jpg]]]]
+ *
+ * The last image of the first setting is written to out.jpg.
+ */
 #include <stdlib.h>
 
+static long long tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000 ;
+}
+
+static void fill(unsigned char *data, frameLayout_t const &layout)
+{
+	for (unsigned row = 0 ; row < layout.y.height ; row++)
+		for (unsigned col = 0 ; col < layout.y.width ; col++)
+			data[layout.y.offset+row*layout.y.stride+col*layout.y.step]
+				= col+row+(((col*row)>>5)&31);
+	for (unsigned row = 0 ; row < layout.u.height ; row++)
+		for (unsigned col = 0 ; col < layout.u.width ; col++) {
+			data[layout.u.offset+row*layout.u.stride+col*layout.u.step] = 2*col ;
+			data[layout.v.offset+row*layout.v.stride+col*layout.v.step] = 2*row ;
+		}
+}
+
+struct benchSetting_t {
+	char const *name ;
+	unsigned quality ;
+	libjpeg_encoder_t::subsampling_e subsampling ;
+	bool fastDCT ;
+	bool optimize ;
+	unsigned restartRows ;
+};
+
+static benchSetting_t const settings[] = {
+	{ "q100 islow",		100, libjpeg_encoder_t::SUBSAMPLE_SOURCE, false, false, 0 },
+	{ "q90 islow",		90, libjpeg_encoder_t::SUBSAMPLE_SOURCE, false, false, 0 },
+	{ "q90 islow opt",	90, libjpeg_encoder_t::SUBSAMPLE_SOURCE, false, true, 0 },
+	{ "q90 ifast",		90, libjpeg_encoder_t::SUBSAMPLE_SOURCE, true, false, 0 },
+	{ "q90 ifast 420",	90, libjpeg_encoder_t::SUBSAMPLE_420, true, false, 0 },
+	{ "q90 islow 444",	90, libjpeg_encoder_t::SUBSAMPLE_444, false, false, 0 },
+	{ "q75 ifast 420",	75, libjpeg_encoder_t::SUBSAMPLE_420, true, false, 0 },
+	{ "q90 ifast rst1",	90, libjpeg_encoder_t::SUBSAMPLE_SOURCE, true, false, 1 },
+};
+
+static struct {
+	unsigned w ;
+	unsigned h ;
+} const sizes[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 2592, 1944 }
+};
+
+#define ARRAY_SIZE(__arr) (sizeof(__arr)/sizeof(__arr[0]))
+
 int main (int argc, char const * const argv[])
 {
-	if (4 > argc) {
-		printf( "Usage: %s infile w h\n", argv[0]);
+	unsigned const frames = (1 < argc) ? strtoul(argv[1],0,0) : 10 ;
+	unsigned fourcc = 0x32315559 ;	// YU12
+	if ((2 < argc) && !supported_fourcc(argv[2],fourcc)) {
+		fprintf(stderr, "Invalid fourcc %s\n", argv[2]);
 		return -1 ;
 	}
-	memFile_t fIn(argv[1]);
-	if (!fIn.worked()) {
-		perror(argv[1]);
-		return -1;
-	}
-	unsigned w = strtoul(argv[2],0,0);
-	unsigned h = strtoul(argv[3],0,0);
-	unsigned iterations = 0 ;
-	while (1) {
-		libjpeg_encoder_t encoder(w,h,0x32315559,
-					  (unsigned char *)fIn.getData(),
-					  fIn.getLength());
-		if (encoder.worked()) {
-			if ((4 < argc) && (0 == iterations)) {
-				FILE *fOut = fopen(argv[4],"wb");
+	unsigned const stripes = (3 < argc) ? strtoul(argv[3],0,0) : 1 ;
+	char const *outFile = (4 < argc) ? argv[4] : 0 ;
+
+	printf("%s, %u frames, %u stripes\n", fourcc_str(fourcc), frames, stripes);
+	printf("%-10s %-16s %8s %12s %10s\n", "size", "settings", "MP/s", "bytes/frame", "ms/frame");
+	for (unsigned s = 0 ; s < ARRAY_SIZE(sizes); s++) {
+		frameLayout_t layout(fourcc,sizes[s].w,sizes[s].h);
+		if (!layout.valid()) {
+			fprintf(stderr, "invalid size %ux%u\n", sizes[s].w, sizes[s].h);
+			continue ;
+		}
+		unsigned char *data = (unsigned char *)malloc(layout.size);
+		fill(data,layout);
+		char size[32];
+		snprintf(size,sizeof(size),"%ux%u",layout.width,layout.height);
+		for (unsigned i = 0 ; i < ARRAY_SIZE(settings); i++) {
+			libjpeg_encoder_t::settings_t settings_ ;
+			settings_.quality = settings[i].quality ;
+			settings_.subsampling = settings[i].subsampling ;
+			settings_.fastDCT = settings[i].fastDCT ;
+			settings_.optimize = settings[i].optimize ;
+			settings_.restartRows = settings[i].restartRows ;
+			libjpeg_encoder_t encoder(layout,settings_,stripes);
+			if (!encoder.initialized())
+				return -1 ;
+			// the first encode allocates the output buffer
+			encoder.encode(data,layout.size);
+			unsigned long long bytes = 0 ;
+			long long const start = tickUs();
+			for (unsigned n = 0 ; n < frames ; n++) {
+				if (!encoder.encode(data,layout.size)) {
+					fprintf(stderr, "Error encoding %s %s\n", size, settings[i].name);
+					return -1 ;
+				}
+				bytes += encoder.dataSize();
+			}
+			long long const elapsed = tickUs()-start ;
+			printf("%-10s %-16s %8.1f %12llu %10.1f\n", size, settings[i].name,
+			       elapsed ? (double)layout.width*layout.height*frames/elapsed : 0.0,
+			       frames ? bytes/frames : 0,
+			       frames ? elapsed/1000.0/frames : 0.0);
+			if (outFile && (0 == i) && (s+1 == ARRAY_SIZE(sizes))) {
+				FILE *fOut = fopen(outFile,"wb");
 				if (fOut) {
 					fwrite(encoder.jpegData(),encoder.dataSize(),1,fOut);
 					fclose(fOut);
-					printf( "wrote %u bytes to %s\n", encoder.dataSize(),argv[4]);
 				} else
-					perror(argv[4]);
-			} else
-				printf( "%u bytes\n", encoder.dataSize());
-		} else {
-			fprintf(stderr, "Error converting %s\n", argv[1]);
-			break;
+					perror(outFile);
+			}
 		}
-		iterations++ ;
+		free(data);
 	}
 	return 0 ;
 }
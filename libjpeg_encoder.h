@@ -1,25 +1,119 @@
 #ifndef __LIBJPEG_ENCODER_H__
 #define __LIBJPEG_ENCODER_H__
 /*
- * libjpeg_encoder.h: 
- * 
+ * libjpeg_encoder.h:
+ *
  * Declares class libjpeg_encoder_t for use in producing JPEG-encoded
  * blob from a YUV image.
  *
+ * An encoder is set up once for a frame layout and then reused for
+ * each image: the compressor, its tables and the output buffer are
+ * kept from one encode() to the next. Planar data goes to libjpeg
+ * as raw (already subsampled) rows straight from the frame, so
+ * 4:2:0 and 4:2:2 aren't converted to 4:4:4 and back. Packed and
+ * semi-planar formats are split into rows first.
+ *
+ * For large stills, the image can be encoded in horizontal stripes
+ * on several threads. Each stripe is a run of restart intervals
+ * (one per MCU row), so the stripes are joined into one baseline
+ * JPEG with a restart marker at each seam. Optimized Huffman
+ * tables are built per image, so they turn striping off.
+ *
+ * The settings trade size for speed (see libjpeg_bench):
+ * IFAST and coarser chroma are quicker, optimized tables are
+ * smaller but take a second pass.
+ *
  */
 
+#include "fourcc.h"
+#include <pthread.h>
+
 class libjpeg_encoder_t {
 public:
+	enum {
+		MAXSTRIPES = 4
+	};
+
+	enum subsampling_e {
+		SUBSAMPLE_SOURCE,	// as the input frame
+		SUBSAMPLE_444,
+		SUBSAMPLE_422,
+		SUBSAMPLE_420
+	};
+
+	struct settings_t {
+		settings_t(void)
+			: quality(100), subsampling(SUBSAMPLE_SOURCE)
+			, fastDCT(false), optimize(false), restartRows(0){}
+
+		unsigned	quality ;	// 1..100
+		subsampling_e	subsampling ;
+		bool		fastDCT ;	// JDCT_IFAST rather than JDCT_ISLOW
+		bool		optimize ;	// Huffman tables for each image
+		unsigned	restartRows ;	// MCU rows per restart interval, 0 for none
+	};
+
+	// persistent encoder, see encode()
+	libjpeg_encoder_t( frameLayout_t const &layout,
+			   settings_t const &settings = settings_t(),
+			   unsigned stripes = 1 );
+
+	// encode a single image, check worked()
 	libjpeg_encoder_t( unsigned width,
 			   unsigned height,
 			   unsigned fourcc,
 			   unsigned char const *data,
 			   unsigned dataSize);
+	// for frames with padded lines (e.g. camera_t::layout())
+	libjpeg_encoder_t( frameLayout_t const &layout,
+			   unsigned char const *data,
+			   unsigned dataSize);
 	~libjpeg_encoder_t( void );
+
+	bool initialized( void ) const { return 0 != numStripes_ ; }
+	unsigned numStripes( void ) const { return numStripes_ ; }
+
+	// into a buffer owned by the encoder, valid until the next encode
+	bool encode( unsigned char const *data, unsigned dataSize );
+
+	// into the caller's buffer. Fails if the image doesn't fit.
+	bool encode( unsigned char const *data, unsigned dataSize,
+		     unsigned char *outBuf, unsigned outSize );
+
+	// results of the last encode
 	bool worked( void ) const { return (0 != jpegData_); }
 	unsigned char const *jpegData(void) const { return jpegData_; }
 	unsigned dataSize(void) const { return jpegSize_ ; }
 private:
+	libjpeg_encoder_t(libjpeg_encoder_t const &); // no copies
+
+	struct stripe_t ;
+
+	void init(frameLayout_t const &layout, settings_t const &settings, unsigned stripes);
+	bool encodeStripe(stripe_t &stripe);
+	bool join(unsigned char *outBuf, unsigned outSize);
+	static void *threadRoutine(void *arg);
+	void run(stripe_t &stripe);
+
+	frameLayout_t	layout_ ;
+	unsigned	colShift_ ;	// of the JPEG chroma, which may
+	unsigned	rowShift_ ;	// differ from the input
+	unsigned	numStripes_ ;
+	stripe_t       *stripes_ ;
+	unsigned	stripeMCURows_ ;	// MCU rows in each but the last
+
+	unsigned char  *output_ ;	// for encode() without a buffer
+	unsigned	outputSize_ ;
+
+	// stripe workers
+	pthread_mutex_t	lock_ ;
+	pthread_cond_t	start_ ;
+	pthread_cond_t	done_ ;
+	unsigned	generation_ ;
+	unsigned	pending_ ;
+	bool		shutdown_ ;
+	unsigned char const *data_ ;	// image being encoded
+
 	unsigned char  *jpegData_ ;
 	unsigned	jpegSize_ ;
 };
@@ -0,0 +1,856 @@
+/*
+ * Module mp4Mux.cpp
+ *
+ * This module defines the methods of the mp4Mux_t class
+ * as declared in mp4Mux.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "mp4Mux.h"
+#include "h264Nal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifndef ANDROID
+#include <linux/falloc.h>
+#endif
+#include "debugPrint.h"
+
+bool mp4Mux_t::buffer_t::reserve(unsigned bytes)
+{
+	if (length+bytes <= size)
+		return true ;
+	unsigned newSize = size ? size : 4096 ;
+	while (newSize < length+bytes)
+		newSize *= 2 ;
+	unsigned char *newData = (unsigned char *)realloc(data,newSize);
+	if (0 == newData)
+		return false ;
+	data = newData ;
+	size = newSize ;
+	return true ;
+}
+
+void mp4Mux_t::buffer_t::put(void const *bytes, unsigned count)
+{
+	if (reserve(count)) {
+		memcpy(data+length,bytes,count);
+		length += count ;
+	}
+}
+
+void mp4Mux_t::buffer_t::put8(unsigned v)
+{
+	unsigned char b = (unsigned char)v ;
+	put(&b,1);
+}
+
+void mp4Mux_t::buffer_t::put16(unsigned v)
+{
+	unsigned char b[2] = { (unsigned char)(v>>8), (unsigned char)v };
+	put(b,sizeof(b));
+}
+
+void mp4Mux_t::buffer_t::put24(unsigned v)
+{
+	unsigned char b[3] = { (unsigned char)(v>>16), (unsigned char)(v>>8), (unsigned char)v };
+	put(b,sizeof(b));
+}
+
+void mp4Mux_t::buffer_t::put32(unsigned v)
+{
+	unsigned char b[4] = { (unsigned char)(v>>24), (unsigned char)(v>>16),
+			       (unsigned char)(v>>8), (unsigned char)v };
+	put(b,sizeof(b));
+}
+
+void mp4Mux_t::buffer_t::put64(unsigned long long v)
+{
+	put32((unsigned)(v>>32));
+	put32((unsigned)v);
+}
+
+unsigned mp4Mux_t::buffer_t::begin(char const *type)
+{
+	unsigned offset = length ;
+	put32(0);
+	put(type,4);
+	return offset ;
+}
+
+unsigned mp4Mux_t::buffer_t::beginFull(char const *type, unsigned version, unsigned flags)
+{
+	unsigned offset = begin(type);
+	put8(version);
+	put24(flags);
+	return offset ;
+}
+
+void mp4Mux_t::buffer_t::end(unsigned offset)
+{
+	unsigned boxSize = length-offset ;
+	if (offset+4 <= length) {
+		data[offset] = boxSize >> 24 ;
+		data[offset+1] = boxSize >> 16 ;
+		data[offset+2] = boxSize >> 8 ;
+		data[offset+3] = boxSize ;
+	}
+}
+
+mp4Mux_t::mp4Mux_t
+	( codec_e codec,
+	  unsigned width,
+	  unsigned height,
+	  unsigned fragmentMs )
+	: codec_(codec)
+	, width_(width)
+	, height_(height)
+	, fragmentTicks_(fragmentMs*(TIMESCALE/1000))
+	, fd_(-1)
+	, spsLen_(0)
+	, ppsLen_(0)
+	, configLen_(0)
+	, current_(0)
+	, index_(0)
+	, numIndex_(0)
+	, maxIndex_(0)
+	, numFree_(0)
+	, numQueued_(0)
+	, moovQueued_(false)
+	, haveThread_(false)
+	, busy_(false)
+	, shutdown_(false)
+	, allocated_(0)
+	, frames_(0)
+	, dropped_(0)
+	, writeErrors_(0)
+{
+	memset(&moov_,0,sizeof(moov_));
+	memset(fragments_,0,sizeof(fragments_));
+	for (unsigned i = 0 ; i < NUMFRAGMENTS ; i++)
+		free_[numFree_++] = fragments_+i ;
+	reset();
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&cond_,0);
+	if (0 != pthread_create(&thread_,0,threadRoutine,this)) {
+		perror("mp4Mux thread");
+		return ;
+	}
+	haveThread_ = true ;
+}
+
+mp4Mux_t::~mp4Mux_t(void)
+{
+	close();
+	if (haveThread_) {
+		pthread_mutex_lock(&lock_);
+		shutdown_ = true ;
+		pthread_cond_broadcast(&cond_);
+		pthread_mutex_unlock(&lock_);
+		pthread_join(thread_,0);
+	}
+	for (unsigned i = 0 ; i < NUMFRAGMENTS ; i++) {
+		free(fragments_[i].header.data);
+		free(fragments_[i].payload.data);
+	}
+	free(moov_.data);
+	free(index_);
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+void mp4Mux_t::reset(void)
+{
+	started_ = false ;
+	waitKey_ = true ;
+	firstUs_ = 0 ;
+	lastDuration_ = TIMESCALE/30 ;
+	sequence_ = 1 ;
+	fileOffset_ = 0 ;
+	numIndex_ = 0 ;
+	moov_.length = 0 ;
+	allocated_ = 0 ;
+}
+
+bool mp4Mux_t::open(char const *fileName)
+{
+	if (!haveThread_)
+		return false ;
+	close();
+	int fd = ::open(fileName,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if (0 > fd) {
+		perror(fileName);
+		return false ;
+	}
+	reset();
+	fd_ = fd ;
+	return true ;
+}
+
+void mp4Mux_t::close(void)
+{
+	if (0 > fd_)
+		return ;
+	if (current_) {
+		if (current_->numSamples) {
+			sample_t const &last = current_->samples[current_->numSamples-1];
+			closeFragment(last.time+lastDuration_);
+		} else {
+			pthread_mutex_lock(&lock_);
+			free_[numFree_++] = current_ ;
+			pthread_mutex_unlock(&lock_);
+			current_ = 0 ;
+		}
+	}
+
+	drain();
+	if (started_) {
+		buffer_t mfra ;
+		memset(&mfra,0,sizeof(mfra));
+		writeIndex(mfra);
+		if (mfra.length != (unsigned)write(fd_,mfra.data,mfra.length)) {
+			perror("mp4Mux index");
+			writeErrors_++ ;
+		}
+		free(mfra.data);
+	}
+	// give back whatever was preallocated past the end
+	off_t end = lseek(fd_,0,SEEK_CUR);
+	if (0 <= end)
+		ftruncate(fd_,end);
+	::close(fd_);
+	fd_ = -1 ;
+}
+
+void mp4Mux_t::drain(void)
+{
+	pthread_mutex_lock(&lock_);
+	while (numQueued_ || busy_ || moovQueued_)
+		pthread_cond_wait(&cond_,&lock_);
+	pthread_mutex_unlock(&lock_);
+}
+
+void mp4Mux_t::addHeader(void const *data, unsigned length)
+{
+	unsigned offset = 0, start, nalLength ;
+	while (h264NextNAL(data,length,offset,start,nalLength)) {
+		unsigned char const *nal = (unsigned char const *)data+start ;
+		if ((0 == nalLength) || (MAXPARAMSET < nalLength))
+			continue ;
+		unsigned type = nal[0] & 0x1f ;
+		if (7 == type) {
+			memcpy(sps_,nal,nalLength);
+			spsLen_ = nalLength ;
+		} else if (8 == type) {
+			memcpy(pps_,nal,nalLength);
+			ppsLen_ = nalLength ;
+		}
+	}
+}
+
+/*
+ * Queues ftyp and moov, once the decoder configuration is known.
+ */
+bool mp4Mux_t::writeHeader(void)
+{
+	static unsigned const matrix[9] = {
+		0x00010000, 0, 0,
+		0, 0x00010000, 0,
+		0, 0, 0x40000000
+	};
+	if ((H264 == codec_) && ((4 > spsLen_) || (0 == ppsLen_))) {
+		ERRMSG("%s: no SPS/PPS before the first keyframe\n", __func__);
+		return false ;
+	}
+	buffer_t &b = moov_ ;
+	b.length = 0 ;
+
+	unsigned ftyp = b.begin("ftyp");
+	b.put("isom",4);
+	b.put32(0x200);
+	b.put("isomiso2iso6mp41",16);
+	if (H264 == codec_)
+		b.put("avc1",4);
+	b.end(ftyp);
+
+	unsigned moov = b.begin("moov");
+	unsigned mvhd = b.beginFull("mvhd",0,0);
+	b.put32(0);			// creation
+	b.put32(0);			// modification
+	b.put32(TIMESCALE);
+	b.put32(0);			// duration, from the fragments
+	b.put32(0x00010000);		// rate
+	b.put16(0x0100);		// volume
+	b.put16(0);
+	b.put32(0);
+	b.put32(0);
+	for (unsigned i = 0 ; i < 9 ; i++)
+		b.put32(matrix[i]);
+	for (unsigned i = 0 ; i < 6 ; i++)
+		b.put32(0);
+	b.put32(2);			// next track
+	b.end(mvhd);
+
+	unsigned trak = b.begin("trak");
+	unsigned tkhd = b.beginFull("tkhd",0,3);	// enabled, in movie
+	b.put32(0);
+	b.put32(0);
+	b.put32(1);			// track
+	b.put32(0);
+	b.put32(0);			// duration
+	b.put32(0);
+	b.put32(0);
+	b.put16(0);			// layer
+	b.put16(0);			// alternate group
+	b.put16(0);			// volume
+	b.put16(0);
+	for (unsigned i = 0 ; i < 9 ; i++)
+		b.put32(matrix[i]);
+	b.put32(width_<<16);
+	b.put32(height_<<16);
+	b.end(tkhd);
+
+	unsigned mdia = b.begin("mdia");
+	unsigned mdhd = b.beginFull("mdhd",0,0);
+	b.put32(0);
+	b.put32(0);
+	b.put32(TIMESCALE);
+	b.put32(0);
+	b.put16(0x55c4);		// 'und'
+	b.put16(0);
+	b.end(mdhd);
+
+	unsigned hdlr = b.beginFull("hdlr",0,0);
+	b.put32(0);
+	b.put("vide",4);
+	b.put32(0);
+	b.put32(0);
+	b.put32(0);
+	b.put("VideoHandler",13);
+	b.end(hdlr);
+
+	unsigned minf = b.begin("minf");
+	unsigned vmhd = b.beginFull("vmhd",0,1);
+	b.put16(0);
+	b.put16(0);
+	b.put16(0);
+	b.put16(0);
+	b.end(vmhd);
+	unsigned dinf = b.begin("dinf");
+	unsigned dref = b.beginFull("dref",0,0);
+	b.put32(1);
+	b.end(b.beginFull("url ",0,1));	// data is in this file
+	b.end(dref);
+	b.end(dinf);
+
+	unsigned stbl = b.begin("stbl");
+	unsigned stsd = b.beginFull("stsd",0,0);
+	b.put32(1);
+	unsigned entry = b.begin((H264 == codec_) ? "avc1" : "mp4v");
+	for (unsigned i = 0 ; i < 6 ; i++)
+		b.put8(0);
+	b.put16(1);			// data reference
+	b.put16(0);
+	b.put16(0);
+	b.put32(0);
+	b.put32(0);
+	b.put32(0);
+	b.put16(width_);
+	b.put16(height_);
+	b.put32(0x00480000);		// 72 dpi
+	b.put32(0x00480000);
+	b.put32(0);
+	b.put16(1);			// frames per sample
+	for (unsigned i = 0 ; i < 32 ; i++)
+		b.put8(0);		// compressor name
+	b.put16(0x18);			// depth
+	b.put16(0xffff);
+	if (H264 == codec_) {
+		unsigned avcC = b.begin("avcC");
+		b.put8(1);
+		b.put8(sps_[1]);	// profile
+		b.put8(sps_[2]);	// constraints
+		b.put8(sps_[3]);	// level
+		b.put8(0xff);		// 4-byte NAL lengths
+		b.put8(0xe1);		// one SPS
+		b.put16(spsLen_);
+		b.put(sps_,spsLen_);
+		b.put8(1);		// one PPS
+		b.put16(ppsLen_);
+		b.put(pps_,ppsLen_);
+		b.end(avcC);
+	} else {
+		// lengths use the four-byte form
+		unsigned esds = b.beginFull("esds",0,0);
+		b.put8(3);		// ES descriptor
+		b.put32(0x80808000 | (3+5+13+5+configLen_+5+1));
+		b.put16(1);
+		b.put8(0);
+		b.put8(4);		// decoder configuration
+		b.put32(0x80808000 | (13+5+configLen_));
+		b.put8(0x20);		// MPEG-4 visual
+		b.put8(0x11);		// video stream
+		b.put24(0);
+		b.put32(0);
+		b.put32(0);
+		b.put8(5);		// decoder specific info
+		b.put32(0x80808000 | configLen_);
+		b.put(config_,configLen_);
+		b.put8(6);		// SL configuration
+		b.put32(0x80808001);
+		b.put8(2);
+		b.end(esds);
+	}
+	b.end(entry);
+	b.end(stsd);
+	// the sample tables are empty, the samples are in the fragments
+	unsigned stts = b.beginFull("stts",0,0);
+	b.put32(0);
+	b.end(stts);
+	unsigned stsc = b.beginFull("stsc",0,0);
+	b.put32(0);
+	b.end(stsc);
+	unsigned stsz = b.beginFull("stsz",0,0);
+	b.put32(0);
+	b.put32(0);
+	b.end(stsz);
+	unsigned stco = b.beginFull("stco",0,0);
+	b.put32(0);
+	b.end(stco);
+	b.end(stbl);
+	b.end(minf);
+	b.end(mdia);
+	b.end(trak);
+
+	unsigned mvex = b.begin("mvex");
+	unsigned trex = b.beginFull("trex",0,0);
+	b.put32(1);			// track
+	b.put32(1);			// sample description
+	b.put32(0);
+	b.put32(0);
+	b.put32(0);
+	b.end(trex);
+	b.end(mvex);
+	b.end(moov);
+
+	fileOffset_ = b.length ;
+	pthread_mutex_lock(&lock_);
+	moovQueued_ = true ;
+	pthread_cond_broadcast(&cond_);
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+bool mp4Mux_t::startFragment(void)
+{
+	pthread_mutex_lock(&lock_);
+	fragment_t *frag = numFree_ ? free_[--numFree_] : 0 ;
+	pthread_mutex_unlock(&lock_);
+	if (0 == frag)
+		return false ;
+	frag->numSamples = 0 ;
+	frag->header.length = 0 ;
+	frag->payload.length = 0 ;
+	current_ = frag ;
+	return true ;
+}
+
+void mp4Mux_t::addSample
+	( unsigned char const *data,
+	  unsigned length,
+	  unsigned long long time,
+	  bool keyframe )
+{
+	buffer_t &payload = current_->payload ;
+	unsigned const start = payload.length ;
+	if (H264 == codec_) {
+		unsigned offset = 0, nalStart, nalLength ;
+		while (h264NextNAL(data,length,offset,nalStart,nalLength)) {
+			if (0 == nalLength)
+				continue ;
+			unsigned type = data[nalStart] & 0x1f ;
+			if ((7 == type) || (8 == type)) {
+				addHeader(data+nalStart-3,nalLength+3);
+				continue ;
+			}
+			if (9 == type)
+				continue ;	// access unit delimiter
+			if (payload.reserve(4+nalLength)) {
+				payload.put32(nalLength);
+				payload.put(data+nalStart,nalLength);
+			}
+		}
+	} else
+		payload.put(data,length);
+
+	if (payload.length == start)
+		return ;
+	sample_t &s = current_->samples[current_->numSamples++];
+	s.size = payload.length-start ;
+	s.time = time ;
+	s.keyframe = keyframe ;
+}
+
+/*
+ * Builds the moof and mdat header for the current fragment and
+ * hands it to the writer. nextTime is the time of the following
+ * frame, for the duration of the last one.
+ */
+void mp4Mux_t::closeFragment(unsigned long long nextTime)
+{
+	fragment_t *frag = current_ ;
+	current_ = 0 ;
+	buffer_t &b = frag->header ;
+	b.length = 0 ;
+
+	unsigned moof = b.begin("moof");
+	unsigned mfhd = b.beginFull("mfhd",0,0);
+	b.put32(sequence_++);
+	b.end(mfhd);
+	unsigned traf = b.begin("traf");
+	unsigned tfhd = b.beginFull("tfhd",0,0x020000);	// offsets from the moof
+	b.put32(1);
+	b.end(tfhd);
+	unsigned tfdt = b.beginFull("tfdt",1,0);
+	b.put64(frag->samples[0].time);
+	b.end(tfdt);
+	// data offset, and per-sample duration, size and flags
+	unsigned trun = b.beginFull("trun",0,0x000701);
+	b.put32(frag->numSamples);
+	unsigned dataOffset = b.length ;
+	b.put32(0);
+	for (unsigned i = 0 ; i < frag->numSamples ; i++) {
+		sample_t const &s = frag->samples[i];
+		unsigned long long const next = (i+1 < frag->numSamples) ? frag->samples[i+1].time : nextTime ;
+		// trun durations are 32 bits: across a gap that long, the next tfdt has the time
+		unsigned duration = ((next > s.time) && (next-s.time <= 0xffffffffULL))
+				    ? (unsigned)(next-s.time) : lastDuration_ ;
+		lastDuration_ = duration ;
+		b.put32(duration);
+		b.put32(s.size);
+		b.put32(s.keyframe ? 0x02000000 : 0x01010000);
+	}
+	b.end(trun);
+	b.end(traf);
+	b.end(moof);
+
+	unsigned offset = b.length+8 ;
+	b.data[dataOffset] = offset >> 24 ;
+	b.data[dataOffset+1] = offset >> 16 ;
+	b.data[dataOffset+2] = offset >> 8 ;
+	b.data[dataOffset+3] = offset ;
+	b.put32(8+frag->payload.length);
+	b.put("mdat",4);
+
+	if (frag->samples[0].keyframe) {
+		if (numIndex_ == maxIndex_) {
+			unsigned newMax = maxIndex_ ? 2*maxIndex_ : 256 ;
+			index_t *newIndex = (index_t *)realloc(index_,newMax*sizeof(index_[0]));
+			if (newIndex) {
+				index_ = newIndex ;
+				maxIndex_ = newMax ;
+			}
+		}
+		if (numIndex_ < maxIndex_) {
+			index_[numIndex_].time = frag->samples[0].time ;
+			index_[numIndex_].offset = fileOffset_ ;
+			numIndex_++ ;
+		}
+	}
+	fileOffset_ += b.length+frag->payload.length ;
+	queue(frag);
+}
+
+void mp4Mux_t::queue(fragment_t *frag)
+{
+	pthread_mutex_lock(&lock_);
+	queue_[numQueued_++] = frag ;
+	pthread_cond_broadcast(&cond_);
+	pthread_mutex_unlock(&lock_);
+}
+
+void mp4Mux_t::addFrame
+	( void const *data,
+	  unsigned length,
+	  long long timeUs,
+	  bool keyframe )
+{
+	if ((0 > fd_) || (0 == length))
+		return ;
+	unsigned char const *bytes = (unsigned char const *)data ;
+	if (!started_) {
+		if (!keyframe)
+			return ;
+		if (H264 == codec_) {
+			addHeader(data,length);
+		} else {
+			// VOS/VOL headers run up to the first VOP
+			unsigned i ;
+			for (i = 0 ; i+4 <= length ; i++) {
+				if ((0 == bytes[i]) && (0 == bytes[i+1])
+				    && (1 == bytes[i+2]) && (0xb6 == bytes[i+3]))
+					break ;
+			}
+			configLen_ = (i+4 <= length) && (i <= MAXCONFIG) ? i : 0 ;
+			memcpy(config_,bytes,configLen_);
+		}
+		if (!writeHeader())
+			return ;
+		started_ = true ;
+		firstUs_ = timeUs ;
+	}
+	unsigned long long const time = (timeUs > firstUs_) ? (timeUs-firstUs_)*9/100 : 0 ;
+	frames_++ ;
+
+	if (current_ && current_->numSamples) {
+		bool const full = (MAXSAMPLES == current_->numSamples);
+		bool const cut = keyframe && (time-current_->samples[0].time >= fragmentTicks_);
+		if (full || cut)
+			closeFragment(time);
+	}
+	if (0 == current_) {
+		if (waitKey_ && !keyframe) {
+			dropped_++ ;
+			return ;
+		}
+		if (!startFragment()) {
+			// the writer is behind, so skip to the next GOP
+			dropped_++ ;
+			waitKey_ = true ;
+			return ;
+		}
+		waitKey_ = false ;
+	}
+	addSample(bytes,length,time,keyframe);
+}
+
+/*
+ * The movie fragment random access box lists the fragments that
+ * start with a keyframe, so players can seek without reading
+ * every moof.
+ */
+void mp4Mux_t::writeIndex(buffer_t &b)
+{
+	unsigned mfra = b.begin("mfra");
+	unsigned tfra = b.beginFull("tfra",1,0);
+	b.put32(1);			// track
+	b.put32(0);			// one-byte traf, trun and sample numbers
+	b.put32(numIndex_);
+	for (unsigned i = 0 ; i < numIndex_ ; i++) {
+		b.put64(index_[i].time);
+		b.put64(index_[i].offset);
+		b.put8(1);
+		b.put8(1);
+		b.put8(1);
+	}
+	b.end(tfra);
+	unsigned mfro = b.beginFull("mfro",0,0);
+	unsigned sizeAt = b.length ;
+	b.put32(0);
+	b.end(mfro);
+	b.end(mfra);
+	unsigned size = b.length-mfra ;
+	b.data[sizeAt] = size >> 24 ;
+	b.data[sizeAt+1] = size >> 16 ;
+	b.data[sizeAt+2] = size >> 8 ;
+	b.data[sizeAt+3] = size ;
+}
+
+void *mp4Mux_t::threadRoutine(void *arg)
+{
+	((mp4Mux_t *)arg)->run();
+	return 0 ;
+}
+
+static bool writeAll(int fd, struct iovec *iov, unsigned count)
+{
+	while (count) {
+		ssize_t numWritten = writev(fd,iov,count);
+		if (0 > numWritten) {
+			if (EINTR == errno)
+				continue ;
+			return false ;
+		}
+		while (count && ((size_t)numWritten >= iov->iov_len)) {
+			numWritten -= iov->iov_len ;
+			iov++ ;
+			count-- ;
+		}
+		if (count) {
+			iov->iov_base = (char *)iov->iov_base+numWritten ;
+			iov->iov_len -= numWritten ;
+		}
+	}
+	return true ;
+}
+
+/*
+ * Writes everything queued with one writev(), and preallocates
+ * well past it when needed.
+ */
+void mp4Mux_t::run(void)
+{
+	bool canAllocate = true ;
+	pthread_mutex_lock(&lock_);
+	while (!shutdown_) {
+		if ((0 == numQueued_) && !moovQueued_) {
+			pthread_cond_wait(&cond_,&lock_);
+			continue ;
+		}
+		struct iovec iov[1+2*NUMFRAGMENTS];
+		fragment_t *batch[NUMFRAGMENTS];
+		unsigned numIov = 0 ;
+		unsigned numBatch = 0 ;
+		size_t total = 0 ;
+		bool const moov = moovQueued_ ;
+		if (moov) {
+			iov[numIov].iov_base = moov_.data ;
+			iov[numIov++].iov_len = moov_.length ;
+			total += moov_.length ;
+		}
+		for (unsigned i = 0 ; i < numQueued_ ; i++) {
+			fragment_t *frag = batch[numBatch++] = queue_[i];
+			iov[numIov].iov_base = frag->header.data ;
+			iov[numIov++].iov_len = frag->header.length ;
+			iov[numIov].iov_base = frag->payload.data ;
+			iov[numIov++].iov_len = frag->payload.length ;
+			total += frag->header.length+frag->payload.length ;
+		}
+		numQueued_ = 0 ;
+		busy_ = true ;
+		int const fd = fd_ ;
+		pthread_mutex_unlock(&lock_);
+
+#ifndef ANDROID
+		off_t const end = lseek(fd,0,SEEK_CUR)+total ;
+		if (canAllocate && (end > allocated_)) {
+			if (0 == fallocate(fd,FALLOC_FL_KEEP_SIZE,allocated_,end+PREALLOCATE-allocated_))
+				allocated_ = end+PREALLOCATE ;
+			else {
+				debugPrint("%s: fallocate: %m\n", __func__);
+				canAllocate = false ;
+			}
+		}
+#endif
+		bool worked = writeAll(fd,iov,numIov);
+		if (!worked)
+			perror("mp4Mux");
+
+		pthread_mutex_lock(&lock_);
+		if (!worked)
+			writeErrors_++ ;
+		if (moov)
+			moovQueued_ = false ;
+		for (unsigned i = 0 ; i < numBatch ; i++)
+			free_[numFree_++] = batch[i];
+		busy_ = false ;
+		pthread_cond_broadcast(&cond_);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+#ifdef STANDALONE_MP4MUX
+
+/*
+ * Returns true if an H.264 NAL unit starts a new access unit in
+ * a stream that already has picture data in the current one.
+ */
+static bool startsH264Frame(unsigned char const *nal, unsigned length)
+{
+	unsigned type = nal[0] & 0x1f ;
+	if ((9 == type) || (7 == type) || (8 == type) || (6 == type))
+		return true ;
+	// first_mb_in_slice == 0
+	return ((1 == type) || (5 == type)) && (1 < length) && (nal[1] & 0x80);
+}
+
+/*
+ * Splits an elementary stream (Annex B H.264 or MPEG-4 part 2)
+ * into frames and writes them at a fixed frame rate. With hours,
+ * the frames after the first are stamped that much later, as in
+ * a long recording, to check timestamps past 32 bits of 90 kHz.
+ */
+int main(int argc, char const * const argv[])
+{
+	if (5 > argc) {
+		fprintf(stderr, "Usage: %s in.h264|in.m4v out.mp4 width height [fps [hours]]\n", argv[0]);
+		return -1 ;
+	}
+	char const *inFile = argv[1];
+	unsigned const fps = (5 < argc) ? strtoul(argv[5],0,0) : 30 ;
+	long long const laterUs = (6 < argc) ? strtoll(argv[6],0,0)*3600*1000000LL : 0 ;
+	unsigned len = strlen(inFile);
+	mp4Mux_t::codec_e codec = ((4 < len) && (0 == strcmp(inFile+len-4,".m4v")))
+				? mp4Mux_t::MPEG4 : mp4Mux_t::H264 ;
+
+	FILE *fIn = fopen(inFile,"rb");
+	if (0 == fIn) {
+		perror(inFile);
+		return -1 ;
+	}
+	fseek(fIn,0,SEEK_END);
+	unsigned const size = ftell(fIn);
+	fseek(fIn,0,SEEK_SET);
+	unsigned char *data = (unsigned char *)malloc(size);
+	if ((0 == data) || (size != fread(data,1,size,fIn))) {
+		perror(inFile);
+		return -1 ;
+	}
+	fclose(fIn);
+
+	mp4Mux_t mux(codec,strtoul(argv[3],0,0),strtoul(argv[4],0,0));
+	if (!mux.open(argv[2]))
+		return -1 ;
+
+	unsigned frameStart = 0 ;
+	bool haveFrame = false ;	// picture data since frameStart
+	bool keyframe = false ;
+	unsigned frame = 0 ;
+	unsigned offset = 0, start, nalLength ;
+	for (;;) {
+		bool const more = h264NextNAL(data,size,offset,start,nalLength);
+		unsigned nalOffset = more ? start-3 : size ;
+		if (more && (0 < nalOffset) && (0 == data[nalOffset-1]))
+			nalOffset-- ;
+		bool boundary = !more ;
+		if (more && haveFrame) {
+			unsigned char const *nal = data+start ;
+			if (mp4Mux_t::H264 == codec)
+				boundary = startsH264Frame(nal,nalLength);
+			else
+				boundary = (0xb6 == nal[0]) || (0xb0 == nal[0]) || (0xb3 == nal[0]) ;
+		}
+		if (boundary && haveFrame) {
+			mux.drain();	// a file can wait, unlike a camera
+			mux.addFrame(data+frameStart,nalOffset-frameStart,
+				     (long long)frame*1000000/fps+(frame ? laterUs : 0),keyframe);
+			frame++ ;
+			frameStart = nalOffset ;
+			haveFrame = keyframe = false ;
+		}
+		if (!more)
+			break ;
+		unsigned char const *nal = data+start ;
+		if (mp4Mux_t::H264 == codec) {
+			unsigned type = nal[0] & 0x1f ;
+			if ((1 <= type) && (5 >= type))
+				haveFrame = true ;
+			if (5 == type)
+				keyframe = true ;
+		} else if ((0xb6 == nal[0]) && (1 < nalLength)) {
+			haveFrame = true ;
+			keyframe = (0 == (nal[1] & 0xc0));
+		}
+	}
+	mux.close();
+	printf("%u frames in %u fragments, %u dropped, %u write errors\n",
+	       mux.numFrames(), mux.numFragments(), mux.numDropped(), mux.numWriteErrors());
+	free(data);
+	return mux.numWriteErrors() ? -1 : 0 ;
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef __MP4MUX_H__
+#define __MP4MUX_H__ "$Id$"
+
+/*
+ * mp4Mux.h
+ *
+ * This header file declares the mp4Mux_t class, which writes an
+ * H.264 or MPEG-4 video stream to a fragmented MP4 file (ISO/IEC
+ * 14496-12):
+ *
+ *	ftyp, moov		- written with the first keyframe
+ *	moof, mdat		- one fragment per GOP, or every
+ *				  fragmentMs if GOPs are shorter
+ *	mfra			- index of the fragments, for seeking
+ *
+ * Timestamps are the capture times on a 90 kHz clock, kept in 64
+ * bits (32 would wrap after about 13 hours) and written as version 1
+ * tfdt and tfra boxes. Since the VPU doesn't produce B-frames,
+ * decode and presentation times are the same. A file that was
+ * never closed (e.g. power loss) can still be played up to the
+ * last complete fragment.
+ *
+ * H.264 input is Annex B, as it comes from the encoder. SPS and
+ * PPS are passed to addHeader() (or found in the keyframe) and
+ * go into the avcC box. Other NAL units are stored with 4-byte
+ * lengths. For MPEG-4, the VOS/VOL headers in front of the first
+ * keyframe go into the esds box.
+ *
+ * Fragments are built in memory and written by a separate thread,
+ * several at a time when it falls behind. The file is preallocated
+ * ahead of the data with fallocate() so that the file system can
+ * keep it contiguous. addFrame() never waits on the disk: when all
+ * NUMFRAGMENTS buffers are waiting to be written, frames are
+ * dropped (and counted) up to the next keyframe.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+
+class mp4Mux_t {
+public:
+	enum codec_e {
+		H264,
+		MPEG4
+	};
+
+	enum {
+		TIMESCALE	= 90000,
+		NUMFRAGMENTS	= 4,		// buffers
+		MAXSAMPLES	= 256,		// frames per fragment
+		MAXPARAMSET	= 256,		// bytes of SPS or PPS
+		MAXCONFIG	= 256,		// bytes of MPEG-4 headers
+		PREALLOCATE	= 8<<20		// bytes ahead of the data
+	};
+
+	mp4Mux_t(codec_e codec, unsigned width, unsigned height,
+		 unsigned fragmentMs = 1000);
+	~mp4Mux_t(void);	// closes the file
+
+	bool open(char const *fileName);
+	void close(void);	// writes the last fragment and the index
+	bool isOpen(void) const { return 0 <= fd_ ; }
+
+	// H.264 SPS or PPS, in Annex B form
+	void addHeader(void const *data, unsigned length);
+
+	// frames before the first keyframe are skipped
+	void addFrame(void const *data, unsigned length,
+		      long long timeUs, bool keyframe);
+
+	// waits for the queued fragments to be written
+	void drain(void);
+
+	// statistics
+	unsigned numFrames(void) const { return frames_ ; }
+	unsigned numFragments(void) const { return sequence_-1 ; }
+	unsigned numDropped(void) const { return dropped_ ; }
+	unsigned numWriteErrors(void) const { return writeErrors_ ; }
+
+private:
+	mp4Mux_t(mp4Mux_t const &); // no copies
+
+	// big-endian box builder
+	struct buffer_t {
+		unsigned char  *data ;
+		unsigned	length ;
+		unsigned	size ;
+
+		bool reserve(unsigned bytes);
+		void put(void const *bytes, unsigned count);
+		void put8(unsigned v);
+		void put16(unsigned v);
+		void put24(unsigned v);
+		void put32(unsigned v);
+		void put64(unsigned long long v);
+		unsigned begin(char const *type);	// returns the offset
+		unsigned beginFull(char const *type, unsigned version, unsigned flags);
+		void end(unsigned offset);		// fills in the size
+	};
+
+	struct sample_t {
+		unsigned	size ;
+		unsigned long long time ;	// 90 kHz, from the first frame
+		bool		keyframe ;
+	};
+
+	struct fragment_t {
+		buffer_t	header ;	// moof and mdat header
+		buffer_t	payload ;
+		sample_t	samples[MAXSAMPLES];
+		unsigned	numSamples ;
+	};
+
+	struct index_t {
+		unsigned long long time ;
+		unsigned long long offset ;	// of the moof
+	};
+
+	void reset(void);
+	bool writeHeader(void);
+	void closeFragment(unsigned long long nextTime);
+	bool startFragment(void);
+	void addSample(unsigned char const *data, unsigned length, unsigned long long time, bool keyframe);
+	void queue(fragment_t *frag);
+	void writeIndex(buffer_t &buf);
+	static void *threadRoutine(void *arg);
+	void run(void);
+
+	codec_e const	codec_ ;
+	unsigned const	width_ ;
+	unsigned const	height_ ;
+	unsigned const	fragmentTicks_ ;
+	int		fd_ ;
+
+	unsigned char	sps_[MAXPARAMSET];
+	unsigned	spsLen_ ;
+	unsigned char	pps_[MAXPARAMSET];
+	unsigned	ppsLen_ ;
+	unsigned char	config_[MAXCONFIG];	// MPEG-4 VOS/VOL
+	unsigned	configLen_ ;
+
+	bool		started_ ;	// ftyp and moov queued
+	bool		waitKey_ ;
+	long long	firstUs_ ;
+	unsigned	lastDuration_ ;
+	unsigned	sequence_ ;	// of the next moof
+	unsigned long long fileOffset_ ;	// bytes queued
+	fragment_t     *current_ ;
+	buffer_t	moov_ ;		// ftyp and moov
+	index_t	       *index_ ;	// one per fragment that starts with a keyframe
+	unsigned	numIndex_ ;
+	unsigned	maxIndex_ ;
+
+	fragment_t	fragments_[NUMFRAGMENTS];
+	fragment_t     *free_[NUMFRAGMENTS];
+	unsigned	numFree_ ;
+	fragment_t     *queue_[NUMFRAGMENTS];
+	unsigned	numQueued_ ;
+	bool		moovQueued_ ;
+
+	pthread_mutex_t	lock_ ;
+	pthread_cond_t	cond_ ;
+	pthread_t	thread_ ;
+	bool		haveThread_ ;
+	bool		busy_ ;		// writer has a batch
+	bool		shutdown_ ;
+	off_t		allocated_ ;	// preallocated up to here
+
+	unsigned	frames_ ;
+	unsigned	dropped_ ;
+	unsigned	writeErrors_ ;
+};
+
+#endif
@@ -20,42 +20,81 @@
 
 #include "physMem.h"
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
 
 #define MAP_SHIFT 12
 #define MAP_SIZE (1<<MAP_SHIFT)
 #define MAP_MASK ( MAP_SIZE - 1 )
 
-physMem_t::physMem_t( unsigned long physAddr, unsigned long size, unsigned long mode )
-   : fd_( open( "/dev/mem", mode ) )
+/*
+ * From <linux/dma-buf.h>, which older kernel headers don't have.
+ */
+struct dmaBufSync_t {
+	unsigned long long flags ;
+};
+#define DMABUF_SYNC_READ	(1 << 0)
+#define DMABUF_SYNC_WRITE	(2 << 0)
+#define DMABUF_SYNC_START	(0 << 2)
+#define DMABUF_SYNC_END		(1 << 2)
+#define DMABUF_IOCTL_SYNC	_IOW('b', 0, struct dmaBufSync_t)
+
+physMem_t::physMem_t( unsigned long physAddr, unsigned long size, unsigned long mode, cache_e cache )
+   : fd_( open( "/dev/mem", (int)mode | ((CACHED != cache) ? O_SYNC : 0) ) )
+   , dmabuf_(false)
+   , cache_(cache)
    , map_(0)
    , mem_(0)
    , mapSize_(0)
+   , size_(0)
+{
+   if( 0 <= fd_ )
+      map( physAddr, size, mode );
+}
+
+physMem_t::physMem_t( int dmabufFd, unsigned long size, unsigned long mode )
+   : fd_( dmabufFd )
+   , dmabuf_(true)
+   , cache_(CACHED)
+   , map_(0)
+   , mem_(0)
+   , mapSize_(0)
+   , size_(0)
+{
+   if( 0 <= fd_ )
+      map( 0, size, mode );
+}
+
+void physMem_t::map( unsigned long offset, unsigned long size, unsigned long mode )
 {
-   if( !worked() )
-      return ;
    unsigned mapMode = (O_RDONLY == mode)
                       ? PROT_READ
                       : PROT_READ | PROT_WRITE ;
-   unsigned startPage = physAddr >> MAP_SHIFT ;
-   unsigned lastPage = (physAddr+size-1) >> MAP_SHIFT ;
-   unsigned mapSize = (lastPage-startPage+1)<<MAP_SHIFT ;
+   unsigned long startPage = offset >> MAP_SHIFT ;
+   unsigned long lastPage = (offset+size-1) >> MAP_SHIFT ;
+   unsigned long mapSize = (lastPage-startPage+1)<<MAP_SHIFT ;
 
-   map_ = mmap(0, mapSize, mapMode, MAP_SHARED, fd_, physAddr & ~MAP_MASK );
+   map_ = mmap(0, mapSize, mapMode, MAP_SHARED, fd_, offset & ~MAP_MASK );
    if( MAP_FAILED == map_ ){
       map_ = 0 ;
       return ;
    }
-   mem_ = (unsigned char *)map_ + (physAddr & MAP_MASK);
+   mem_ = (unsigned char *)map_ + (offset & MAP_MASK);
    mapSize_ = mapSize ;
+   size_ = size ;
 }
 
 physMem_t::~physMem_t( void )
 {
-      if( mem_ ){
-         munmap(mem_, mapSize_);
-         mem_ = 0 ;
+      if( map_ ){
+         munmap(map_, mapSize_);
+         map_ = mem_ = 0 ;
       }
       if( 0 <= fd_ ){
          close(fd_);
@@ -63,10 +102,110 @@ physMem_t::~physMem_t( void )
       }
 }
 
-void physMem_t::invalidate(void){
-	int rval = msync(mem_,mapSize_, MS_SYNC|MS_INVALIDATE);
-	if (0 != rval)
-		perror("msync");
+bool physMem_t::sync(unsigned long long flags){
+	struct dmaBufSync_t sync ;
+	sync.flags = flags ;
+	if (0 == ioctl(fd_, DMABUF_IOCTL_SYNC, &sync))
+		return true ;
+	perror("DMA_BUF_IOCTL_SYNC");
+	return false ;
+}
+
+static unsigned long long syncDirection(unsigned long mode){
+	switch (mode & O_ACCMODE) {
+		case O_RDONLY: return DMABUF_SYNC_READ ;
+		case O_WRONLY: return DMABUF_SYNC_WRITE ;
+		default: return DMABUF_SYNC_READ|DMABUF_SYNC_WRITE ;
+	}
+}
+
+/*
+ * /dev/mem mappings have nothing to start: write-combined memory
+ * has no cached lines to discard, and a cached one can't be
+ * maintained from user space.
+ */
+bool physMem_t::beginAccess(unsigned long mode){
+	if( !worked() )
+		return false ;
+	if (dmabuf_)
+		return sync(DMABUF_SYNC_START|syncDirection(mode));
+	return CACHED != cache_ ;
+}
+
+bool physMem_t::endAccess(unsigned long mode){
+	if( !worked() )
+		return false ;
+	if (dmabuf_)
+		return sync(DMABUF_SYNC_END|syncDirection(mode));
+	if (CACHED == cache_)
+		return false ;
+	if (O_RDONLY != (mode & O_ACCMODE))
+		__sync_synchronize();	// drain the write buffer
+	return true ;
+}
+
+bool physMem_t::invalidate(void){
+	return invalidate(0, size_);
+}
+
+/*
+ * A dma-buf can only be synced whole, so these bracket an access
+ * to all of it.
+ */
+bool physMem_t::invalidate(unsigned long offset, unsigned long length){
+	if( !worked() || (offset > size_) || (length > size_-offset) )
+		return false ;
+	bool const started = beginAccess(O_RDONLY);
+	return endAccess(O_RDONLY) && started ;
+}
+
+bool physMem_t::flush(unsigned long offset, unsigned long length){
+	if( !worked() || (offset > size_) || (length > size_-offset) )
+		return false ;
+	bool const started = beginAccess(O_WRONLY);
+	return endAccess(O_WRONLY) && started ;
+}
+
+/*
+ * Uncached reads cost a bus transaction each, so read in the
+ * widest units there are: 64 bytes at a time through NEON, or
+ * aligned words without it.
+ */
+bool physMem_t::copyOut(void *dest, unsigned long offset, unsigned long length) const
+{
+	if( !worked() || (offset > size_) || (length > size_-offset) )
+		return false ;
+	unsigned char const *src = (unsigned char const *)mem_ + offset ;
+	unsigned char *out = (unsigned char *)dest ;
+	while( length && ((unsigned long)src & 15) ){
+		*out++ = *src++ ;
+		length-- ;
+	}
+#ifdef __ARM_NEON__
+	while( 64 <= length ){
+		uint8x16_t const a = vld1q_u8(src);
+		uint8x16_t const b = vld1q_u8(src+16);
+		uint8x16_t const c = vld1q_u8(src+32);
+		uint8x16_t const d = vld1q_u8(src+48);
+		vst1q_u8(out, a);
+		vst1q_u8(out+16, b);
+		vst1q_u8(out+32, c);
+		vst1q_u8(out+48, d);
+		src += 64 ;
+		out += 64 ;
+		length -= 64 ;
+	}
+#endif
+	while( sizeof(unsigned long) <= length ){
+		unsigned long const w = *(unsigned long const *)src ;
+		memcpy(out, &w, sizeof(w));
+		src += sizeof(w);
+		out += sizeof(w);
+		length -= sizeof(w);
+	}
+	while( length-- )
+		*out++ = *src++ ;
+	return true ;
 }
 
 #ifdef STANDALONE
@@ -77,6 +216,7 @@ void physMem_t::invalidate(void){
 
 static bool deposit = 0 ;
 static bool binary = 0 ;
+static bool uncached = 0 ;
 static unsigned long value = 0 ;
 
 static void parseArgs( int &argc, char const **argv )
@@ -90,6 +230,8 @@ static void parseArgs( int &argc, char const **argv )
 			} else if( 'b' == tolower(*param) ){
 				binary = true ;
 				fflush(stdout);
+			} else if( 'u' == tolower(*param) ){
+				uncached = true ;
 			}
 			else
 				printf( "unknown option %s\n", param );
@@ -115,7 +257,8 @@ int main( int argc, char const *argv[] )
       else
          length = 512 ;
 
-      physMem_t phys(address, length, deposit ? O_RDWR : O_RDONLY );
+      physMem_t phys(address, length, deposit ? O_RDWR : O_RDONLY,
+                     uncached ? physMem_t::WRITECOMBINE : physMem_t::CACHED );
       if( phys.worked() )
       {
          if( deposit ){
@@ -126,21 +269,31 @@ int main( int argc, char const *argv[] )
                length -= sizeof(*longs);
             }
          }
-	 if(!binary){
-		 hexDumper_t dump( phys.ptr(), length, address );
-		 while( dump.nextLine() )
-		    printf( "%s\n", dump.getLine() );
-	 }
-	 else {
-		 write(1, phys.ptr(), length);
-		 fflush(stdout);
-	 }
+         else {
+            // one pass over the mapping, then work from the copy
+            void *copy = malloc(length);
+            if( !copy || !phys.copyOut(copy, 0, length) ){
+               perror( "copy" );
+               free(copy);
+               return -1 ;
+            }
+            if(!binary){
+               hexDumper_t dump( copy, length, address );
+               while( dump.nextLine() )
+                  printf( "%s\n", dump.getLine() );
+            }
+            else {
+               write(1, copy, length);
+               fflush(stdout);
+            }
+            free(copy);
+         }
       }
       else
          perror( "map" );
    }
    else
-      fprintf( stderr, "Usage: %s address [length=512]\n", argv[0] );
+      fprintf( stderr, "Usage: %s [-b] [-u] [-dvalue] address [length=512]\n", argv[0] );
    return 0 ;
 }
 #endif
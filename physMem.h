@@ -8,6 +8,35 @@
  * which can be used to read [and write] a section
  * of physical memory (use with care!).
  *
+ * /dev/mem mappings are chosen by cache_e:
+ *
+ *    CACHED       - RAM is cached. Registers are always mapped
+ *                   as device memory, whatever is asked for.
+ *    WRITECOMBINE - the file is opened O_SYNC, which ARM kernels
+ *                   map as write-combined (uncached but buffered)
+ *                   for RAM.
+ *    UNCACHED     - the same mapping: /dev/mem doesn't offer RAM
+ *                   any less cached than write-combined. Kept so
+ *                   callers can say what they need.
+ *
+ * User space can't clean or invalidate the CPU caches for a
+ * /dev/mem mapping, so map memory that a device reads or writes
+ * (an IPU or VPU buffer) WRITECOMBINE or UNCACHED. flush() then
+ * only drains the write buffer, and invalidate() has nothing to do.
+ * On a CACHED /dev/mem mapping, both return false.
+ *
+ * A dma-buf (from the second constructor) is mapped cached, and
+ * the exporter does the cache maintenance. Each CPU access goes
+ * between beginAccess() and endAccess(), given the same O_RDONLY,
+ * O_WRONLY or O_RDWR, which issue DMA_BUF_SYNC_START and _END.
+ * invalidate() and flush() issue a matched START/END pair for
+ * reading (before reading what the device wrote) or writing (after
+ * writing what it will read). All of them cover the whole buffer.
+ *
+ * Reading uncached memory a byte at a time is very slow. For
+ * bulk reads, copyOut() moves it into a cached buffer in large
+ * bursts (with NEON where there is NEON).
+ *
  * Change History : 
  *
  * $Log: physMem.h,v $
@@ -26,20 +55,49 @@
 
 class physMem_t {
 public:
-   physMem_t( unsigned long physAddr, unsigned long size, unsigned long mode = O_RDONLY );
+   enum cache_e {
+      CACHED,
+      WRITECOMBINE,
+      UNCACHED
+   };
+
+   physMem_t( unsigned long physAddr, unsigned long size,
+              unsigned long mode = O_RDONLY, cache_e cache = CACHED );
+   // maps (and then owns) a dma-buf fd
+   physMem_t( int dmabufFd, unsigned long size, unsigned long mode = O_RDONLY );
    ~physMem_t( void );
 
-   bool worked() const { return 0 <= fd_ ; }
+   bool worked() const { return 0 != mem_ ; }
 
    void *ptr() const { return mem_ ; }
+   unsigned long size() const { return size_ ; }
+
+   // bracket CPU access, mode O_RDONLY, O_WRONLY or O_RDWR.
+   // false if the caches can't be maintained.
+   bool beginAccess( unsigned long mode );
+   bool endAccess( unsigned long mode );
+
+   // ranges are bytes from ptr(). false if the caches can't be maintained.
+   bool invalidate();
+   bool invalidate( unsigned long offset, unsigned long length );
+   bool flush( unsigned long offset, unsigned long length );
 
-   void invalidate();
+   // reads [offset,offset+length) into dest. Returns false if out of range.
+   bool copyOut( void *dest, unsigned long offset, unsigned long length ) const ;
 
 private:
+   physMem_t( physMem_t const & ); // no copies
+
+   void map( unsigned long offset, unsigned long size, unsigned long mode );
+   bool sync( unsigned long long flags );
+
    int   fd_ ;
+   bool  dmabuf_ ;
+   cache_e cache_ ;
    void *map_ ;   // start of page
    void *mem_ ;   // start of data
-   unsigned mapSize_ ;
+   unsigned long mapSize_ ;
+   unsigned long size_ ;
 };
 
 #endif
@@ -0,0 +1,291 @@
+/*
+ * Module physPool.cpp
+ *
+ * This module defines the methods of the physPool_t class
+ * as declared in physPool.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "physPool.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "debugPrint.h"
+
+#ifdef VPU_SOFTWARE
+#include <sys/mman.h>
+#endif
+
+physPool_t::physPool_t(void)
+{
+	pthread_mutex_init(&lock_,0);
+	memset(free_,0,sizeof(free_));
+	memset(&stats_,0,sizeof(stats_));
+}
+
+physPool_t::~physPool_t(void)
+{
+	trim();
+	if (stats_.blocks)
+		fprintf(stderr, "%s: %u blocks (%llu bytes) still in use\n",
+			__func__, stats_.blocks, stats_.inUse);
+	pthread_mutex_destroy(&lock_);
+}
+
+physPool_t &physPool_t::shared(void)
+{
+	static physPool_t pool ;
+	return pool ;
+}
+
+unsigned physPool_t::classSize(unsigned sizeClass)
+{
+	unsigned const octave = sizeClass/STEPS ;
+	unsigned const step = sizeClass%STEPS ;
+	return (STEPS+step) << (MINSHIFT+octave-2);
+}
+
+// smallest class that holds bytes, or NUMCLASSES if none do
+unsigned physPool_t::classFor(unsigned bytes)
+{
+	unsigned c = 0 ;
+	while ((c < NUMCLASSES) && (classSize(c) < bytes))
+		c++ ;
+	return c ;
+}
+
+/*
+ * Gets a new block from the kernel. Called without the lock,
+ * since it can take a while.
+ */
+physPool_t::block_t *physPool_t::obtain(unsigned sizeClass)
+{
+	block_t *block = new block_t ;
+	memset(block,0,sizeof(*block));
+	block->size = classSize(sizeClass);
+	block->sizeClass = sizeClass ;
+	block->fd = -1 ;
+#ifdef VPU_SOFTWARE
+	block->fd = memfd_create("physPool", MFD_CLOEXEC);
+	if ((0 <= block->fd) && (0 != ftruncate(block->fd,block->size))) {
+		close(block->fd);
+		block->fd = -1 ;
+	}
+	void *mem = (0 <= block->fd)
+		? mmap(0,block->size,PROT_READ|PROT_WRITE,MAP_SHARED,block->fd,0)
+		: mmap(0,block->size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if (MAP_FAILED == mem) {
+		perror("physPool");
+		if (0 <= block->fd)
+			close(block->fd);
+		delete block ;
+		return 0 ;
+	}
+	block->virt = (unsigned char *)mem ;
+	block->phys = IOMapUserMem(mem,block->size);
+	if (0 == block->phys) {
+		munmap(mem,block->size);
+		if (0 <= block->fd)
+			close(block->fd);
+		delete block ;
+		return 0 ;
+	}
+#else
+	block->mem.size = block->size ;
+	if (0 != IOGetPhyMem(&block->mem)) {
+		fprintf(stderr,"Unable to obtain %u bytes of physical memory\n", block->size);
+		delete block ;
+		return 0 ;
+	}
+	if (IOGetVirtMem(&block->mem) <= 0) {
+		fprintf(stderr,"Unable to map physical memory\n");
+		IOFreePhyMem(&block->mem);
+		delete block ;
+		return 0 ;
+	}
+	block->virt = (unsigned char *)block->mem.virt_uaddr ;
+	block->phys = block->mem.phy_addr ;
+#endif
+	debugPrint( "physPool: %u bytes at phys 0x%x, virt %p\n",
+		    block->size, block->phys, block->virt );
+	return block ;
+}
+
+void physPool_t::free(block_t *block)
+{
+#ifdef VPU_SOFTWARE
+	IOUnmapUserMem(block->virt);
+	munmap(block->virt,block->size);
+	if (0 <= block->fd)
+		close(block->fd);
+#else
+	IOFreeVirtMem(&block->mem);
+	IOFreePhyMem(&block->mem);
+#endif
+	delete block ;
+}
+
+physPool_t::block_t *physPool_t::alloc(unsigned bytes)
+{
+	unsigned const c = classFor(bytes ? bytes : 1);
+	pthread_mutex_lock(&lock_);
+	stats_.allocs++ ;
+	if (NUMCLASSES <= c) {
+		stats_.failed++ ;
+		pthread_mutex_unlock(&lock_);
+		fprintf(stderr, "%s: %u bytes is too large\n", __func__, bytes);
+		return 0 ;
+	}
+	block_t *block = free_[c];
+	if (block) {
+		free_[c] = block->next ;
+		stats_.reused++ ;
+		stats_.inUse += block->size ;
+		pthread_mutex_unlock(&lock_);
+		block->next = 0 ;
+		return block ;
+	}
+	pthread_mutex_unlock(&lock_);
+
+	block = obtain(c);
+
+	pthread_mutex_lock(&lock_);
+	if (block) {
+		stats_.blocks++ ;
+		stats_.inUse += block->size ;
+		stats_.held += block->size ;
+		if (stats_.held > stats_.highWater)
+			stats_.highWater = stats_.held ;
+	} else
+		stats_.failed++ ;
+	pthread_mutex_unlock(&lock_);
+	return block ;
+}
+
+void physPool_t::release(block_t *block)
+{
+	if (0 == block)
+		return ;
+	pthread_mutex_lock(&lock_);
+	stats_.inUse -= block->size ;
+	block->next = free_[block->sizeClass];
+	free_[block->sizeClass] = block ;
+	pthread_mutex_unlock(&lock_);
+}
+
+void physPool_t::trim(void)
+{
+	block_t *list = 0 ;
+	pthread_mutex_lock(&lock_);
+	for (unsigned c = 0 ; c < NUMCLASSES ; c++) {
+		while (free_[c]) {
+			block_t *block = free_[c];
+			free_[c] = block->next ;
+			stats_.blocks-- ;
+			stats_.held -= block->size ;
+			block->next = list ;
+			list = block ;
+		}
+	}
+	pthread_mutex_unlock(&lock_);
+	while (list) {
+		block_t *block = list ;
+		list = block->next ;
+		free(block);
+	}
+}
+
+physPool_t::stats_t physPool_t::stats(void) const
+{
+	pthread_mutex_lock(&lock_);
+	stats_t rval = stats_ ;
+	pthread_mutex_unlock(&lock_);
+	return rval ;
+}
+
+void physPool_t::dumpStats(void) const
+{
+	stats_t const s = stats();
+	printf( "%8s %8s %8s %8s %12s %12s %12s\n",
+		"allocs", "reused", "failed", "blocks", "inUse", "held", "highWater");
+	printf( "%8u %8u %8u %8u %12llu %12llu %12llu\n",
+		s.allocs, s.reused, s.failed, s.blocks, s.inUse, s.held, s.highWater);
+}
+
+#ifdef STANDALONE_PHYSPOOL
+#include <stdlib.h>
+#include <time.h>
+
+static long long tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((long long)ts.tv_sec*1000000)+(ts.tv_nsec/1000);
+}
+
+int main(int argc, char const *argv[])
+{
+	unsigned const iterations = (1 < argc) ? strtoul(argv[1],0,0) : 100 ;
+	unsigned errors = 0 ;
+
+	// every size fits its class, and the class is at most 25% larger
+	for (unsigned bytes = 1 ; bytes <= (64<<20) ; bytes += 1+bytes/7) {
+		unsigned c = 0 ;
+		while (physPool_t::classSize(c) < bytes)
+			c++ ;
+		unsigned const size = physPool_t::classSize(c);
+		if ((4096 < bytes) && (size > bytes+bytes/4)) {
+			fprintf(stderr, "%u bytes in a %u byte class\n", bytes, size);
+			errors++ ;
+		}
+	}
+
+	/*
+	 * An encoder's worth of memory (a bitstream ring and four
+	 * 720p frames), allocated and released the way the recorder
+	 * opens and closes encoders.
+	 */
+	unsigned const sizes[] = { 0x80000*4, 1280*720*3/2, 1280*720*3/2, 1280*720*3/2, 1280*720*3/2 };
+	unsigned const numSizes = sizeof(sizes)/sizeof(sizes[0]);
+	physPool_t pool ;
+	long long firstUs = 0 ;
+	long long reuseUs = 0 ;
+	for (unsigned i = 0 ; i < iterations ; i++) {
+		physPool_t::block_t *blocks[numSizes];
+		long long start = tickUs();
+		for (unsigned b = 0 ; b < numSizes ; b++) {
+			blocks[b] = pool.alloc(sizes[b]);
+			if (0 == blocks[b]) {
+				fprintf(stderr, "alloc %u failed\n", sizes[b]);
+				return -1 ;
+			}
+			if ((blocks[b]->size < sizes[b]) || (0 == blocks[b]->phys))
+				errors++ ;
+			if (i && (blocks[b]->virt[0] != (unsigned char)(b+i-1)))
+				errors++ ;	// should be the same block as last time
+			blocks[b]->virt[0] = (unsigned char)(b+i);
+			blocks[b]->virt[sizes[b]-1] = 0 ;
+		}
+		long long elapsed = tickUs()-start ;
+		if (0 == i)
+			firstUs = elapsed ;
+		else
+			reuseUs += elapsed ;
+		for (unsigned b = numSizes ; b > 0 ; b--)
+			pool.release(blocks[b-1]);
+	}
+	physPool_t::stats_t s = pool.stats();
+	if ((s.blocks != numSizes) || s.inUse || (s.reused != (iterations-1)*numSizes))
+		errors++ ;
+	printf("first open %lld us, reuse %lld us\n", firstUs,
+	       (1 < iterations) ? reuseUs/(iterations-1) : 0);
+	pool.dumpStats();
+	pool.trim();
+	s = pool.stats();
+	if (s.blocks || s.held || (s.highWater < s.inUse))
+		errors++ ;
+	printf("%u errors\n", errors);
+	return errors ? 1 : 0 ;
+}
+#endif
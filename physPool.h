@@ -0,0 +1,91 @@
+#ifndef __PHYSPOOL_H__
+#define __PHYSPOOL_H__ "$Id$"
+
+/*
+ * physPool.h
+ *
+ * This header file declares the physPool_t class, which hands out
+ * physically contiguous, CPU-mapped blocks for the VPU (bitstream
+ * buffers, frame buffers) and keeps them when they're released.
+ *
+ * Blocks are rounded up to a size class (four per power of two,
+ * from 4k up), and a released block goes on the free list of its
+ * class for the next alloc() of that class. Opening and closing
+ * encoders then doesn't go back to the kernel each time, which is
+ * slow and, over a long recording, fragments the contiguous memory
+ * until large allocations fail. trim() gives the free blocks back.
+ *
+ * The memory comes from IOGetPhyMem(). In software VPU builds
+ * (VPU_SOFTWARE), it comes from memfd_create() instead and is
+ * given an address with IOMapUserMem(), so blocks have an fd
+ * that can be mapped elsewhere like a dma-buf.
+ *
+ * Most code uses the process-wide pool from shared().
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+extern "C" {
+#include <vpu_lib.h>
+#include <vpu_io.h>
+};
+#include <pthread.h>
+
+class physPool_t {
+public:
+	enum {
+		MINSHIFT	= 12,	// 4k
+		MAXSHIFT	= 28,	// 256M
+		STEPS		= 4,	// classes per power of two
+		NUMCLASSES	= (MAXSHIFT-MINSHIFT)*STEPS+1
+	};
+
+	struct block_t {
+		PhysicalAddress	phys ;
+		unsigned char  *virt ;
+		unsigned	size ;		// of the class, at least as requested
+		int		fd ;		// memfd, or -1
+		unsigned	sizeClass ;
+		vpu_mem_desc	mem ;
+		block_t	       *next ;		// while free
+	};
+
+	struct stats_t {
+		unsigned	allocs ;
+		unsigned	reused ;	// from a free list
+		unsigned	failed ;
+		unsigned	blocks ;	// obtained from the kernel, not yet trimmed
+		unsigned long long inUse ;	// bytes
+		unsigned long long held ;	// bytes, in use or free
+		unsigned long long highWater ;	// most ever held
+	};
+
+	physPool_t(void);
+	~physPool_t(void);	// frees the free blocks, reports leaks
+
+	static physPool_t &shared(void);
+
+	// contents are left from the last user, if any
+	block_t *alloc(unsigned bytes);
+	void release(block_t *block);
+
+	// returns the free blocks to the kernel
+	void trim(void);
+
+	static unsigned classSize(unsigned sizeClass);
+
+	stats_t stats(void) const ;
+	void dumpStats(void) const ;
+
+private:
+	physPool_t(physPool_t const &); // no copies
+
+	static unsigned classFor(unsigned bytes);
+	block_t *obtain(unsigned sizeClass);
+	void free(block_t *block);
+
+	mutable pthread_mutex_t	lock_ ;
+	block_t		       *free_[NUMCLASSES];
+	stats_t			stats_ ;
+};
+
+#endif
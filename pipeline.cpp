@@ -0,0 +1,403 @@
+/*
+ * Module pipeline.cpp
+ *
+ * This module defines the methods of the pipelineItem_t,
+ * pipelineStage_t and pipeline_t classes as declared in
+ * pipeline.h
+ *
+ * All queues are protected by a single pipeline lock. At video
+ * frame rates there are only a few hundred queue operations per
+ * second, so contention isn't a concern.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "pipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "debugPrint.h"
+
+long long pipeline_t::tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((long long)ts.tv_sec*1000000)+(ts.tv_nsec/1000);
+}
+
+pipelineItem_t *pipelineItem_t::alloc
+	( unsigned type,
+	  unsigned dataLength,
+	  release_t onRelease,
+	  void *opaque )
+{
+	pipelineItem_t *item = (pipelineItem_t *)malloc(sizeof(pipelineItem_t)+dataLength);
+	if (0 == item) {
+		ERRMSG("%s: out of memory\n", __PRETTY_FUNCTION__);
+		return 0 ;
+	}
+	memset(item,0,sizeof(*item));
+	item->type = type ;
+	item->frame.index = -1 ;
+	item->data = dataLength ? item->buffer() : 0 ;
+	item->length = dataLength ;
+	item->startUs = pipeline_t::tickUs();
+	item->refs_ = 1 ;
+	item->onRelease_ = onRelease ;
+	item->opaque_ = opaque ;
+	return item ;
+}
+
+void pipelineItem_t::addRef(void)
+{
+	__sync_fetch_and_add(&refs_,1);
+}
+
+void pipelineItem_t::release(void)
+{
+	if (0 == __sync_sub_and_fetch(&refs_,1)) {
+		if (onRelease_)
+			onRelease_(this,opaque_);
+		free(this);
+	}
+}
+
+pipelineStage_t::pipelineStage_t(char const *name, unsigned maxQueued)
+	: name_(name)
+	, maxQueued_(maxQueued ? maxQueued : 1)
+	, queue_(0)
+	, head_(0)
+	, count_(0)
+	, busy_(false)
+	, numOutputs_(0)
+	, pipeline_(0)
+{
+	queue_ = (entry_t *)calloc(maxQueued_,sizeof(queue_[0]));
+	resetStats();
+}
+
+pipelineStage_t::~pipelineStage_t(void)
+{
+	while (count_) {
+		queue_[head_].item->release();
+		head_ = (head_+1) % maxQueued_ ;
+		--count_ ;
+	}
+	free(queue_);
+}
+
+bool pipelineStage_t::connect(pipelineStage_t &next)
+{
+	if (MAXOUTPUTS <= numOutputs_) {
+		ERRMSG("%s: too many outputs for %s\n", __PRETTY_FUNCTION__, name_);
+		return false ;
+	}
+	outputs_[numOutputs_++] = &next ;
+	return true ;
+}
+
+void pipelineStage_t::resetStats(void)
+{
+	memset(&stats_,0,sizeof(stats_));
+}
+
+void pipelineStage_t::emit(pipelineItem_t *item)
+{
+	for (unsigned i = 0 ; i < numOutputs_ ; i++) {
+		item->addRef();
+		if (pipeline_)
+			pipeline_->submit(outputs_[i],item);
+		else
+			item->release();
+	}
+}
+
+pipeline_t::pipeline_t(unsigned numWorkers)
+	: numWorkers_((MAXWORKERS < numWorkers) ? MAXWORKERS : (numWorkers ? numWorkers : 1))
+	, source_(0)
+	, numStages_(0)
+	, nextStage_(0)
+	, numThreads_(0)
+	, haveSourceThread_(false)
+	, running_(false)
+	, stop_(false)
+{
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&cond_,0);
+}
+
+pipeline_t::~pipeline_t(void)
+{
+	stop();
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+bool pipeline_t::setSource(pipelineSource_t &source)
+{
+	if (running_ || source_)
+		return false ;
+	source_ = &source ;
+	source.pipeline_ = this ;
+	return true ;
+}
+
+bool pipeline_t::add(pipelineStage_t &stage)
+{
+	if (running_ || (MAXSTAGES <= numStages_))
+		return false ;
+	stages_[numStages_++] = &stage ;
+	stage.pipeline_ = this ;
+	return true ;
+}
+
+bool pipeline_t::start(void)
+{
+	if (running_ || (0 == source_))
+		return false ;
+	stop_ = false ;
+	running_ = true ;
+	for (numThreads_ = 0 ; numThreads_ < numWorkers_ ; numThreads_++) {
+		if (0 != pthread_create(workers_+numThreads_,0,workerThread,this)) {
+			perror("pthread_create(worker)");
+			stop();
+			return false ;
+		}
+	}
+	if (0 != pthread_create(&sourceThread_,0,sourceThread,this)) {
+		perror("pthread_create(source)");
+		stop();
+		return false ;
+	}
+	haveSourceThread_ = true ;
+	return true ;
+}
+
+void pipeline_t::stop(void)
+{
+	if (!running_)
+		return ;
+	pthread_mutex_lock(&lock_);
+	stop_ = true ;
+	pthread_cond_broadcast(&cond_);
+	pthread_mutex_unlock(&lock_);
+
+	if (haveSourceThread_) {
+		pthread_join(sourceThread_,0);
+		haveSourceThread_ = false ;
+	}
+	while (numThreads_)
+		pthread_join(workers_[--numThreads_],0);
+
+	// drop anything still queued
+	for (unsigned s = 0 ; s < numStages_ ; s++) {
+		pipelineStage_t &stage = *stages_[s];
+		while (stage.count_) {
+			stage.queue_[stage.head_].item->release();
+			stage.head_ = (stage.head_+1) % stage.maxQueued_ ;
+			--stage.count_ ;
+		}
+	}
+	running_ = false ;
+}
+
+void pipeline_t::submit(pipelineStage_t *stage, pipelineItem_t *item)
+{
+	pthread_mutex_lock(&lock_);
+	if (stop_ || (stage->count_ >= stage->maxQueued_)) {
+		stage->stats_.dropped++ ;
+		pthread_mutex_unlock(&lock_);
+		item->release();
+		return ;
+	}
+	pipelineStage_t::entry_t &e = stage->queue_[(stage->head_+stage->count_) % stage->maxQueued_];
+	e.item = item ;
+	e.queuedUs = tickUs();
+	if (++stage->count_ > stage->stats_.maxDepth)
+		stage->stats_.maxDepth = stage->count_ ;
+	pthread_cond_signal(&cond_);
+	pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * Returns the next idle stage with work queued, round-robin so
+ * that a busy producer can't starve the other stages.
+ * Called with the lock held.
+ */
+pipelineStage_t *pipeline_t::nextStage(void)
+{
+	for (unsigned i = 0 ; i < numStages_ ; i++) {
+		unsigned idx = (nextStage_+i) % numStages_ ;
+		pipelineStage_t *stage = stages_[idx];
+		if (stage->count_ && !stage->busy_) {
+			nextStage_ = (idx+1) % numStages_ ;
+			return stage ;
+		}
+	}
+	return 0 ;
+}
+
+void pipeline_t::runWorker(void)
+{
+	pthread_mutex_lock(&lock_);
+	while (!stop_) {
+		pipelineStage_t *stage = nextStage();
+		if (0 == stage) {
+			pthread_cond_wait(&cond_,&lock_);
+			continue ;
+		}
+		pipelineStage_t::entry_t e = stage->queue_[stage->head_];
+		stage->head_ = (stage->head_+1) % stage->maxQueued_ ;
+		--stage->count_ ;
+		stage->busy_ = true ;
+		pthread_mutex_unlock(&lock_);
+
+		long long start = tickUs();
+		stage->process(e.item);
+		e.item->release();
+		long long end = tickUs();
+
+		pthread_mutex_lock(&lock_);
+		stage->busy_ = false ;
+		pipelineStage_t::stats_t &stats = stage->stats_ ;
+		unsigned waitUs = start-e.queuedUs ;
+		unsigned processUs = end-start ;
+		stats.processed++ ;
+		if (waitUs > stats.maxWaitUs)
+			stats.maxWaitUs = waitUs ;
+		if (processUs > stats.maxProcessUs)
+			stats.maxProcessUs = processUs ;
+		stats.avgWaitUs += ((int)waitUs-(int)stats.avgWaitUs)/16 ;
+		stats.avgProcessUs += ((int)processUs-(int)stats.avgProcessUs)/16 ;
+		if (stage->count_)
+			pthread_cond_signal(&cond_);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+void pipeline_t::runSource(void)
+{
+	while (!stop_) {
+		if (!source_->produce())
+			break;
+	}
+	debugPrint("%s: source %s done\n", __PRETTY_FUNCTION__, source_->name());
+}
+
+void *pipeline_t::sourceThread(void *arg)
+{
+	((pipeline_t *)arg)->runSource();
+	return 0 ;
+}
+
+void *pipeline_t::workerThread(void *arg)
+{
+	((pipeline_t *)arg)->runWorker();
+	return 0 ;
+}
+
+void pipeline_t::dumpStats(void) const
+{
+	printf( "%-12s %8s %8s %6s %10s %10s %10s %10s\n",
+		"stage", "frames", "dropped", "depth", "avgWait", "maxWait", "avgProc", "maxProc");
+	for (unsigned s = 0 ; s < numStages_ ; s++) {
+		pipelineStage_t::stats_t const &stats = stages_[s]->stats();
+		printf( "%-12s %8u %8u %6u %10u %10u %10u %10u\n",
+			stages_[s]->name(), stats.processed, stats.dropped, stats.maxDepth,
+			stats.avgWaitUs, stats.maxWaitUs, stats.avgProcessUs, stats.maxProcessUs);
+	}
+}
+
+void pipeline_t::resetStats(void)
+{
+	pthread_mutex_lock((pthread_mutex_t *)&lock_);
+	for (unsigned s = 0 ; s < numStages_ ; s++)
+		stages_[s]->resetStats();
+	pthread_mutex_unlock((pthread_mutex_t *)&lock_);
+}
+
+#ifdef STANDALONE_PIPELINE
+
+#include <unistd.h>
+
+/*
+ * Feeds a counter source at roughly 30fps into a fast stage
+ * and a slow one, and checks that the slow stage doesn't hold
+ * up the fast one.
+ */
+class counterSource_t : public pipelineSource_t {
+public:
+	counterSource_t(unsigned count) : pipelineSource_t("counter"), remaining_(count){}
+	virtual bool produce(void){
+		if (0 == remaining_)
+			return false ;
+		usleep(33333);
+		pipelineItem_t *item = pipelineItem_t::alloc(pipelineItem_t::RAW,sizeof(unsigned));
+		if (item) {
+			*(unsigned *)item->buffer() = remaining_ ;
+			emit(item);
+			item->release();
+		}
+		--remaining_ ;
+		return true ;
+	}
+private:
+	unsigned remaining_ ;
+};
+
+class sleepStage_t : public pipelineStage_t {
+public:
+	sleepStage_t(char const *name, unsigned delayUs, unsigned maxQueued)
+		: pipelineStage_t(name,maxQueued), delayUs_(delayUs), last_(~0U), outOfOrder_(0){}
+	virtual void process(pipelineItem_t *item){
+		unsigned value = *(unsigned const *)item->data ;
+		if (value >= last_)
+			++outOfOrder_ ;
+		last_ = value ;
+		usleep(delayUs_);
+	}
+	unsigned outOfOrder(void) const { return outOfOrder_ ; }
+private:
+	unsigned const	delayUs_ ;
+	unsigned	last_ ;
+	unsigned	outOfOrder_ ;
+};
+
+int main(int argc, char const **argv) {
+	unsigned const numFrames = (1 < argc) ? strtoul(argv[1],0,0) : 60 ;
+	counterSource_t source(numFrames);
+	sleepStage_t fast("fast",1000,2);
+	sleepStage_t slow("slow",100000,4);
+	pipeline_t pipeline(2);
+	pipeline.setSource(source);
+	pipeline.add(fast);
+	pipeline.add(slow);
+	source.connect(fast);
+	source.connect(slow);
+	if (!pipeline.start()) {
+		ERRMSG("Error starting pipeline\n");
+		return -1 ;
+	}
+	sleep((numFrames/30)+1);
+	pipeline.stop();
+	pipeline.dumpStats();
+
+	int rval = 0 ;
+	if (fast.stats().processed != numFrames) {
+		printf( "fast stage only saw %u of %u frames\n", fast.stats().processed, numFrames);
+		rval = -1 ;
+	}
+	if (0 == slow.stats().dropped) {
+		printf( "slow stage should have dropped frames\n");
+		rval = -1 ;
+	}
+	if (fast.outOfOrder() || slow.outOfOrder()) {
+		printf( "frames out of order\n");
+		rval = -1 ;
+	}
+	printf( "%s\n", rval ? "FAIL" : "PASS");
+	return rval ;
+}
+
+#endif
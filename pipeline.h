@@ -0,0 +1,189 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__ "$Id$"
+
+/*
+ * pipeline.h
+ *
+ * This header file declares a small frame-processing pipeline:
+ *
+ *	pipelineItem_t	 - a reference-counted unit of work (a camera
+ *			   frame, or encoded data derived from one)
+ *	pipelineStage_t	 - a transform or sink with a bounded input
+ *			   queue, connected to up to MAXOUTPUTS stages
+ *	pipelineSource_t - a stage that produces items in its own thread
+ *	pipeline_t	 - owns the source thread and a pool of workers
+ *			   that run the other stages
+ *
+ * A stage only ever processes one item at a time, so its items are
+ * handled in order, but different stages run in parallel. When a
+ * stage's queue is full, new items are dropped (and counted) rather
+ * than blocking the stage feeding it, so a slow sink such as a disk
+ * or network never throttles capture or preview.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "camera.h"
+#include <pthread.h>
+
+struct pipelineItem_t {
+	enum {
+		RAW		= 1,	// camera frame
+		H264		= 2,
+		JPEG		= 4,
+		HEADER		= 8,	// SPS or PPS
+		KEYFRAME	= 16
+	};
+
+	typedef void (*release_t)(pipelineItem_t *item, void *opaque);
+
+	/*
+	 * Allocates an item with refcount 1. If dataLength is non-zero,
+	 * the item owns a buffer of that size at data, filled in by the
+	 * caller before the item is emitted.
+	 */
+	static pipelineItem_t *alloc(unsigned type,
+				     unsigned dataLength = 0,
+				     release_t onRelease = 0,
+				     void *opaque = 0);
+
+	void addRef(void);
+	void release(void);
+
+	unsigned char *buffer(void) const { return (unsigned char *)(this+1); }
+
+	unsigned	type ;
+	cameraFrame_t	frame ;		// source frame, index -1 if none
+	void const     *data ;
+	unsigned	length ;
+	long long	startUs ;	// when the item entered the pipeline
+private:
+	int volatile	refs_ ;
+	release_t	onRelease_ ;
+	void	       *opaque_ ;
+};
+
+class pipeline_t ;
+
+class pipelineStage_t {
+public:
+	enum {
+		MAXOUTPUTS = 8
+	};
+
+	struct stats_t {
+		unsigned	processed ;
+		unsigned	dropped ;	// queue full
+		unsigned	maxDepth ;
+		unsigned	avgWaitUs ;	// time spent queued
+		unsigned	maxWaitUs ;
+		unsigned	avgProcessUs ;	// time spent in process()
+		unsigned	maxProcessUs ;
+	};
+
+	pipelineStage_t(char const *name, unsigned maxQueued);
+	virtual ~pipelineStage_t(void);
+
+	char const *name(void) const { return name_ ; }
+
+	bool connect(pipelineStage_t &next);
+
+	stats_t const &stats(void) const { return stats_ ; }
+	void resetStats(void);
+
+	// current queue depth, a hint only since it isn't locked
+	unsigned queued(void) const { return count_ ; }
+	unsigned maxQueued(void) const { return maxQueued_ ; }
+
+	/*
+	 * Handles a single item. The caller releases the item when this
+	 * returns, so use addRef() to keep it longer, and emit() to pass
+	 * it (or new items) downstream.
+	 */
+	virtual void process(pipelineItem_t *item) = 0 ;
+
+protected:
+	void emit(pipelineItem_t *item);
+
+private:
+	friend class pipeline_t ;
+
+	struct entry_t {
+		pipelineItem_t *item ;
+		long long	queuedUs ;
+	};
+
+	char const     *name_ ;
+	unsigned const	maxQueued_ ;
+	entry_t	       *queue_ ;
+	unsigned	head_ ;
+	unsigned	count_ ;
+	bool		busy_ ;
+	pipelineStage_t *outputs_[MAXOUTPUTS];
+	unsigned	numOutputs_ ;
+	pipeline_t     *pipeline_ ;
+	stats_t		stats_ ;
+};
+
+class pipelineSource_t : public pipelineStage_t {
+public:
+	pipelineSource_t(char const *name) : pipelineStage_t(name,1){}
+	virtual ~pipelineSource_t(void){}
+
+	/*
+	 * Called repeatedly from the source thread. Should wait (briefly)
+	 * for input and emit() any items produced. Return false to stop.
+	 */
+	virtual bool produce(void) = 0 ;
+
+	virtual void process(pipelineItem_t *){}
+};
+
+class pipeline_t {
+public:
+	enum {
+		MAXSTAGES = 16,
+		MAXWORKERS = 8
+	};
+
+	pipeline_t(unsigned numWorkers = 2);
+	~pipeline_t(void);
+
+	bool setSource(pipelineSource_t &source);
+	bool add(pipelineStage_t &stage);
+
+	bool start(void);
+	void stop(void);
+	bool running(void) const { return running_ ; }
+
+	void dumpStats(void) const ;
+	void resetStats(void);
+
+	static long long tickUs(void);
+private:
+	friend class pipelineStage_t ;
+
+	void submit(pipelineStage_t *stage, pipelineItem_t *item);
+	pipelineStage_t *nextStage(void);
+	void runSource(void);
+	void runWorker(void);
+	static void *sourceThread(void *arg);
+	static void *workerThread(void *arg);
+
+	unsigned const		numWorkers_ ;
+	pipelineSource_t       *source_ ;
+	pipelineStage_t	       *stages_[MAXSTAGES];
+	unsigned		numStages_ ;
+	unsigned		nextStage_ ;
+	pthread_mutex_t		lock_ ;
+	pthread_cond_t		cond_ ;
+	pthread_t		sourceThread_ ;
+	pthread_t		workers_[MAXWORKERS];
+	unsigned		numThreads_ ;
+	bool			haveSourceThread_ ;
+	bool volatile		running_ ;
+	bool volatile		stop_ ;
+};
+
+#endif
+
@@ -0,0 +1,618 @@
+/*
+ * Module rtpH264.cpp
+ *
+ * This module defines the methods of the rtpH264_t and
+ * rtpH264Receiver_t classes as declared in rtpH264.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "rtpH264.h"
+#include "h264Nal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+enum {
+	NAL_SPS		= 7,
+	NAL_PPS		= 8,
+	NAL_STAP_A	= 24,
+	NAL_FU_A	= 28
+};
+
+static inline void put16(unsigned char *p, unsigned v)
+{
+	p[0] = v >> 8 ;
+	p[1] = v ;
+}
+
+static inline void put32(unsigned char *p, unsigned v)
+{
+	put16(p,v>>16);
+	put16(p+2,v);
+}
+
+static inline long long microseconds(struct timeval const &tv)
+{
+	return (long long)tv.tv_sec*1000000 + tv.tv_usec ;
+}
+
+rtpH264_t::rtpH264_t(unsigned mtu, unsigned repeatMs)
+	: mtu_((mtu > OVERHEAD+100) ? mtu : DEFAULT_MTU)
+	, repeatUs_(repeatMs*1000)
+	, fd_(-1)
+	, timestamp_(0)
+	, lastParamsUs_(0)
+	, paramsChanged_(false)
+#ifdef ANDROID
+	, useMmsg_(false)
+#else
+	, useMmsg_(true)
+#endif
+	, numQueued_(0)
+{
+	memset(&dest_,0,sizeof(dest_));
+	sps_.length = pps_.length = 0 ;
+	resetStats();
+
+	// RFC 3550 wants random starting points
+	struct timeval now ;
+	gettimeofday(&now,0);
+	unsigned seed = now.tv_usec ^ (now.tv_sec << 12) ^ getpid();
+	seq_ = rand_r(&seed);
+	ssrc_ = (rand_r(&seed) << 16) ^ rand_r(&seed);
+	tsOffset_ = (rand_r(&seed) << 16) ^ rand_r(&seed);
+
+	for (unsigned i = 0 ; i < MAXBATCH ; i++) {
+		struct msghdr &msg = msgs_[i].msg_hdr ;
+		memset(&msg,0,sizeof(msg));
+		msg.msg_name = &dest_ ;
+		msg.msg_namelen = sizeof(dest_);
+		msg.msg_iov = iov_[i];
+		msg.msg_iovlen = 2 ;
+		iov_[i][0].iov_base = headers_[i];
+	}
+}
+
+rtpH264_t::~rtpH264_t(void)
+{
+	close();
+}
+
+bool rtpH264_t::open(char const *target)
+{
+	char ip[64];
+	char const *port = strchr(target,':');
+	if ((0 == port) || (unsigned)(port-target) >= sizeof(ip)) {
+		printf ("invalid ip/port. use form 192.168.0.100:0x2020\n");
+		return false ;
+	}
+	memcpy(ip,target,port-target);
+	ip[port-target] = '\0' ;
+
+	struct sockaddr_in dest ;
+	memset(&dest,0,sizeof(dest));
+	dest.sin_family = AF_INET ;
+	if (!inet_aton(ip,&dest.sin_addr)) {
+		printf ("invalid ip address %s\n", ip);
+		return false ;
+	}
+	dest.sin_port = htons(strtoul(port+1,0,0));
+
+	int fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (0 > fd) {
+		perror ("socket");
+		return false ;
+	}
+	int doit = 1 ;
+	if (0 != setsockopt (fd, SOL_SOCKET, SO_BROADCAST, &doit, sizeof(doit)))
+		perror ("SO_BROADCAST");
+	// room for a couple of large keyframes
+	int sndbuf = 512*1024 ;
+	setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	close();
+	dest_ = dest ;
+	fd_ = fd ;
+	lastParamsUs_ = 0 ;	// resend headers right away
+	return true ;
+}
+
+void rtpH264_t::close(void)
+{
+	if (0 <= fd_) {
+		::close(fd_);
+		fd_ = -1 ;
+	}
+}
+
+void rtpH264_t::resetStats(void)
+{
+	frames_ = packets_ = syscalls_ = errors_ = 0 ;
+}
+
+void rtpH264_t::remember(paramSet_t &ps, unsigned char const *nal, unsigned length)
+{
+	if (length > sizeof(ps.data)) {
+		fprintf(stderr, "%s: %u byte parameter set is too large\n", __func__, length);
+		return ;
+	}
+	if ((length != ps.length) || (0 != memcmp(ps.data,nal,length))) {
+		memcpy(ps.data,nal,length);
+		ps.length = length ;
+		paramsChanged_ = true ;
+	}
+}
+
+bool rtpH264_t::send
+	( void const *data,
+	  unsigned length,
+	  struct timeval const &captured,
+	  bool keyframe )
+{
+	if (0 > fd_)
+		return false ;
+
+	unsigned char const *const bytes = (unsigned char const *)data ;
+	unsigned offset = 0, start, nalLength ;
+	bool haveSlices = false ;
+	while (h264NextNAL(data,length,offset,start,nalLength)) {
+		if (0 == nalLength)
+			continue ;
+		unsigned const type = bytes[start] & 0x1f ;
+		if (NAL_SPS == type)
+			remember(sps_,bytes+start,nalLength);
+		else if (NAL_PPS == type)
+			remember(pps_,bytes+start,nalLength);
+		else
+			haveSlices = true ;
+	}
+	if (!haveSlices)
+		return true ;
+
+	long long const us = microseconds(captured);
+	timestamp_ = (unsigned)(us*(CLOCKRATE/1000)/1000) + tsOffset_ ;
+
+	bool ok = true ;
+	if (sps_.length && pps_.length
+	    && (keyframe
+		|| paramsChanged_
+		|| (us - lastParamsUs_ >= (long long)repeatUs_)
+		|| (us < lastParamsUs_))) {
+		ok = sendNAL(sps_.data,sps_.length,false) && ok ;
+		ok = sendNAL(pps_.data,pps_.length,false) && ok ;
+		lastParamsUs_ = us ;
+		paramsChanged_ = false ;
+	}
+
+	// hold each NAL back until we know whether it's the last
+	unsigned char const *pending = 0 ;
+	unsigned pendingLength = 0 ;
+	offset = 0 ;
+	while (h264NextNAL(data,length,offset,start,nalLength)) {
+		unsigned const type = bytes[start] & 0x1f ;
+		if ((0 == nalLength) || (NAL_SPS == type) || (NAL_PPS == type))
+			continue ;
+		if (pending)
+			ok = sendNAL(pending,pendingLength,false) && ok ;
+		pending = bytes+start ;
+		pendingLength = nalLength ;
+	}
+	ok = sendNAL(pending,pendingLength,true) && ok ;
+	ok = flush() && ok ;
+	frames_++ ;
+	return ok ;
+}
+
+bool rtpH264_t::sendNAL(unsigned char const *nal, unsigned length, bool last)
+{
+	unsigned const maxLength = maxPayload();
+	if (length <= maxLength)
+		return queue(0,0,nal,length,last);
+
+	// FU-A: the NAL header is spread over the FU indicator and header
+	unsigned char fu[2];
+	fu[0] = (nal[0] & 0xe0) | NAL_FU_A ;
+	unsigned char const type = nal[0] & 0x1f ;
+	bool ok = true ;
+	bool first = true ;
+	++nal ;
+	--length ;
+	while (0 < length) {
+		unsigned const n = (length > maxLength-2) ? maxLength-2 : length ;
+		bool const end = (n == length);
+		fu[1] = type | (first ? 0x80 : 0) | (end ? 0x40 : 0);
+		ok = queue(fu,2,nal,n,last && end) && ok ;
+		nal += n ;
+		length -= n ;
+		first = false ;
+	}
+	return ok ;
+}
+
+bool rtpH264_t::queue
+	( unsigned char const *fu,
+	  unsigned fuLen,
+	  unsigned char const *payload,
+	  unsigned length,
+	  bool marker )
+{
+	bool ok = true ;
+	if (MAXBATCH == numQueued_)
+		ok = flush();
+
+	unsigned char *hdr = headers_[numQueued_];
+	hdr[0] = 0x80 ;		// version 2, no padding, extension or CSRCs
+	hdr[1] = (marker ? 0x80 : 0) | PAYLOAD_TYPE ;
+	put16(hdr+2,seq_++);
+	put32(hdr+4,timestamp_);
+	put32(hdr+8,ssrc_);
+	if (fuLen)
+		memcpy(hdr+12,fu,fuLen);
+
+	struct iovec *iov = iov_[numQueued_];
+	iov[0].iov_len = 12+fuLen ;
+	iov[1].iov_base = (void *)payload ;
+	iov[1].iov_len = length ;
+	numQueued_++ ;
+	return ok ;
+}
+
+bool rtpH264_t::flush(void)
+{
+	bool ok = true ;
+	unsigned sent = 0 ;
+	while (sent < numQueued_) {
+		int rval ;
+#ifndef ANDROID
+		if (useMmsg_) {
+			rval = sendmmsg(fd_,msgs_+sent,numQueued_-sent,0);
+			if ((0 > rval) && (ENOSYS == errno)) {
+				useMmsg_ = false ;
+				continue ;
+			}
+		} else
+#endif
+			rval = (0 <= sendmsg(fd_,&msgs_[sent].msg_hdr,0)) ? 1 : -1 ;
+		syscalls_++ ;
+		if (0 < rval) {
+			sent += rval ;
+			continue ;
+		}
+		if (EINTR == errno)
+			continue ;
+		// drop the packet that failed and carry on with the rest
+		if (ok)
+			perror("rtp");
+		ok = false ;
+		errors_++ ;
+		sent++ ;
+	}
+	packets_ += numQueued_ ;
+	numQueued_ = 0 ;
+	return ok ;
+}
+
+bool rtpH264_t::sdp(char *buf, unsigned size) const
+{
+	char const *ip = inet_ntoa(dest_.sin_addr);
+	int len = snprintf(buf, size,
+			   "v=0\r\n"
+			   "o=- %u 0 IN IP4 %s\r\n"
+			   "s=i.MX camera\r\n"
+			   "c=IN IP4 %s\r\n"
+			   "t=0 0\r\n"
+			   "m=video %u RTP/AVP %u\r\n"
+			   "a=rtpmap:%u H264/%u\r\n"
+			   "a=fmtp:%u packetization-mode=1\r\n",
+			   ssrc_, ip, ip,
+			   ntohs(dest_.sin_port), PAYLOAD_TYPE,
+			   PAYLOAD_TYPE, CLOCKRATE,
+			   PAYLOAD_TYPE);
+	return (0 < len) && ((unsigned)len < size);
+}
+
+rtpH264Receiver_t::rtpH264Receiver_t(unsigned short port, unsigned maxFrame)
+	: fd_(socket(AF_INET, SOCK_DGRAM, 0))
+	, port_(0)
+	, maxFrame_(maxFrame)
+	, frame_((unsigned char *)malloc(maxFrame))
+	, length_(0)
+	, haveSeq_(false)
+	, nextSeq_(0)
+	, inFragment_(false)
+	, fragStart_(0)
+	, done_(false)
+	, packets_(0)
+	, lost_(0)
+	, maxPacket_(0)
+{
+	if (0 > fd_) {
+		perror("socket");
+		return ;
+	}
+	int rcvbuf = 1<<20 ;
+	setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	struct sockaddr_in addr ;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET ;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	socklen_t addrLen = sizeof(addr);
+	if ((0 != bind(fd_,(struct sockaddr *)&addr,sizeof(addr)))
+	    ||
+	    (0 != getsockname(fd_,(struct sockaddr *)&addr,&addrLen))) {
+		perror("bind");
+		::close(fd_);
+		fd_ = -1 ;
+		return ;
+	}
+	port_ = ntohs(addr.sin_port);
+}
+
+rtpH264Receiver_t::~rtpH264Receiver_t(void)
+{
+	if (0 <= fd_)
+		::close(fd_);
+	if (frame_)
+		free(frame_);
+}
+
+bool rtpH264Receiver_t::append(unsigned char const *data, unsigned length, bool startCode)
+{
+	static unsigned char const code[] = { 0, 0, 0, 1 };
+	if (length_ + length + (startCode ? sizeof(code) : 0) > maxFrame_)
+		return false ;
+	if (startCode) {
+		memcpy(frame_+length_,code,sizeof(code));
+		length_ += sizeof(code);
+	}
+	memcpy(frame_+length_,data,length);
+	length_ += length ;
+	return true ;
+}
+
+bool rtpH264Receiver_t::receive
+	( void const *&data,
+	  unsigned &length,
+	  unsigned &timestamp,
+	  int timeoutMs )
+{
+	if (!worked())
+		return false ;
+	if (done_) {
+		length_ = 0 ;
+		done_ = false ;
+	}
+
+	unsigned char pkt[65536];
+	while (1) {
+		struct pollfd pfd ;
+		pfd.fd = fd_ ;
+		pfd.events = POLLIN ;
+		int numReady = poll(&pfd,1,timeoutMs);
+		if (0 > numReady) {
+			if (EINTR == errno)
+				continue ;
+			perror("poll");
+			return false ;
+		}
+		if (0 == numReady)
+			return false ;
+		int n = recv(fd_,pkt,sizeof(pkt),0);
+		if (12 > n)
+			continue ;
+		packets_++ ;
+		if ((unsigned)n > maxPacket_)
+			maxPacket_ = n ;
+		if (2 != (pkt[0] >> 6))
+			continue ;
+
+		unsigned short const seq = (pkt[2] << 8) | pkt[3] ;
+		if (haveSeq_ && (seq != nextSeq_)) {
+			lost_ += (unsigned short)(seq-nextSeq_);
+			if (inFragment_) {
+				length_ = fragStart_ ;	// drop the partial NAL
+				inFragment_ = false ;
+			}
+		}
+		haveSeq_ = true ;
+		nextSeq_ = seq+1 ;
+
+		unsigned hdrLen = 12 + 4*(pkt[0] & 0x0f);
+		if ((pkt[0] & 0x10) && (hdrLen+4 <= (unsigned)n))
+			hdrLen += 4 + 4*((pkt[hdrLen+2] << 8) | pkt[hdrLen+3]);
+		if (hdrLen >= (unsigned)n)
+			continue ;
+		unsigned payloadLen = n-hdrLen ;
+		if (pkt[0] & 0x20) {
+			// the last byte counts the padding, itself included
+			if (pkt[n-1] >= payloadLen)
+				continue ;
+			payloadLen -= pkt[n-1];
+		}
+
+		unsigned char const *payload = pkt+hdrLen ;
+		unsigned const type = payload[0] & 0x1f ;
+		if ((0 < type) && (NAL_STAP_A > type)) {
+			inFragment_ = false ;
+			append(payload,payloadLen,true);
+		} else if (NAL_STAP_A == type) {
+			unsigned pos = 1 ;
+			while (pos+2 < payloadLen) {
+				unsigned const len = (payload[pos] << 8) | payload[pos+1] ;
+				pos += 2 ;
+				if (pos+len > payloadLen)
+					break ;
+				append(payload+pos,len,true);
+				pos += len ;
+			}
+		} else if ((NAL_FU_A == type) && (2 < payloadLen)) {
+			unsigned char const fuHeader = payload[1] ;
+			if (fuHeader & 0x80) {
+				unsigned char const nalHeader = (payload[0] & 0xe0) | (fuHeader & 0x1f);
+				fragStart_ = length_ ;
+				inFragment_ = append(&nalHeader,1,true);
+			}
+			if (inFragment_)
+				inFragment_ = append(payload+2,payloadLen-2,false);
+			if (fuHeader & 0x40)
+				inFragment_ = false ;
+		}
+
+		if (pkt[1] & 0x80) {
+			data = frame_ ;
+			length = length_ ;
+			timestamp = (pkt[4] << 24) | (pkt[5] << 16) | (pkt[6] << 8) | pkt[7] ;
+			done_ = true ;
+			return true ;
+		}
+	}
+}
+
+#ifdef STANDALONE_RTPH264
+
+/*
+ * Loopback test: sends a series of frames with a mix of small,
+ * packet-sized and fragmented slices to a local receiver, and checks
+ * that each comes back intact, with parameter sets repeated, in
+ * MTU-sized packets and a 90 kHz timestamp.
+ */
+
+// appends a NAL unit whose payload contains no start codes
+static unsigned putNAL(unsigned char *out, unsigned char header, unsigned length, unsigned seed)
+{
+	static unsigned char const code[] = { 0, 0, 0, 1 };
+	memcpy(out,code,sizeof(code));
+	out[4] = header ;
+	for (unsigned i = 1 ; i < length ; i++)
+		out[4+i] = 1 + ((seed + i*7) % 255);
+	return sizeof(code)+length ;
+}
+
+int main(int argc, char const * const argv[])
+{
+	unsigned const numFrames = (1 < argc) ? strtoul(argv[1],0,0) : 60 ;
+	unsigned const mtu = (2 < argc) ? strtoul(argv[2],0,0) : rtpH264_t::DEFAULT_MTU ;
+
+	rtpH264Receiver_t rx ;
+	if (!rx.worked()) {
+		fprintf(stderr, "Error creating receiver\n");
+		return -1 ;
+	}
+	rtpH264_t tx(mtu,250);
+	char target[32];
+	snprintf(target,sizeof(target),"127.0.0.1:%u",rx.port());
+	if (!tx.open(target)) {
+		fprintf(stderr, "Error opening %s\n", target);
+		return -1 ;
+	}
+	char sdp[512];
+	if (tx.sdp(sdp,sizeof(sdp)))
+		printf("%s", sdp);
+
+	unsigned char params[64];
+	unsigned const spsLen = putNAL(params,0x67,12,1);
+	unsigned const ppsLen = putNAL(params+spsLen,0x68,5,2);
+
+	unsigned char *frame = (unsigned char *)malloc(256*1024);
+	struct timeval start ;
+	gettimeofday(&start,0);
+
+	unsigned errors = 0 ;
+	unsigned withParams = 0 ;
+	unsigned prevTimestamp = 0 ;
+	for (unsigned n = 0 ; n < numFrames ; n++) {
+		bool const keyframe = (0 == (n % 30));
+		long long const us = (long long)start.tv_sec*1000000 + start.tv_usec + n*1000000LL/30 ;
+		struct timeval captured ;
+		captured.tv_sec = us / 1000000 ;
+		captured.tv_usec = us % 1000000 ;
+		unsigned char const nalHeader = keyframe ? 0x65 : 0x41 ;
+		unsigned length = 0 ;
+		length += putNAL(frame+length,nalHeader,100+n,n);
+		length += putNAL(frame+length,nalHeader,tx.maxPayload(),n+1);
+		length += putNAL(frame+length,nalHeader,tx.maxPayload()+1,n+2);
+		length += putNAL(frame+length,nalHeader,keyframe ? 100000 : 5000+n*97,n+3);
+
+		// headers arrive separately, as they do from encodeStage_t
+		if (keyframe)
+			tx.send(params,spsLen+ppsLen,captured,false);
+		if (!tx.send(frame,length,captured,keyframe)) {
+			fprintf(stderr, "frame %u: send error\n", n);
+			errors++ ;
+		}
+
+		void const *data ;
+		unsigned rxLength ;
+		unsigned timestamp ;
+		if (!rx.receive(data,rxLength,timestamp,1000)) {
+			fprintf(stderr, "frame %u: not received\n", n);
+			errors++ ;
+			continue ;
+		}
+		bool const hasParams = (rxLength == spsLen+ppsLen+length)
+				       && (0 == memcmp(data,params,spsLen+ppsLen));
+		unsigned const skip = hasParams ? spsLen+ppsLen : 0 ;
+		if ((rxLength-skip != length)
+		    ||
+		    (0 != memcmp((unsigned char const *)data+skip,frame,length))) {
+			fprintf(stderr, "frame %u: %u bytes sent, %u received\n", n, length, rxLength);
+			errors++ ;
+		}
+		if (keyframe && !hasParams) {
+			fprintf(stderr, "frame %u: keyframe without SPS/PPS\n", n);
+			errors++ ;
+		}
+		withParams += hasParams ;
+		int const step = timestamp-prevTimestamp ;
+		if (n && ((2999 > step) || (3001 < step))) {
+			fprintf(stderr, "frame %u: timestamp step %d\n", n, step);
+			errors++ ;
+		}
+		prevTimestamp = timestamp ;
+	}
+
+	if (rx.maxPacket() > mtu-28) {
+		fprintf(stderr, "%u byte packet exceeds MTU %u\n", rx.maxPacket(), mtu);
+		errors++ ;
+	}
+	if (rx.numLost()) {
+		fprintf(stderr, "%u packets lost\n", rx.numLost());
+		errors++ ;
+	}
+
+	// padding that claims more than the payload must be dropped, not read past
+	int const sock = socket(AF_INET,SOCK_DGRAM,0);
+	struct sockaddr_in addr ;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET ;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(rx.port());
+	unsigned char bad[16];
+	memset(bad,0,sizeof(bad));
+	bad[0] = 0xa0 ;			// version 2, padding
+	bad[1] = 0x80 | 96 ;		// marker
+	bad[12] = 0x41 ;		// a P slice
+	bad[sizeof(bad)-1] = 0xff ;
+	sendto(sock,bad,sizeof(bad),0,(struct sockaddr *)&addr,sizeof(addr));
+	close(sock);
+	void const *data ;
+	unsigned rxLength ;
+	unsigned timestamp ;
+	if (rx.receive(data,rxLength,timestamp,200)) {
+		fprintf(stderr, "over-padded packet returned %u bytes\n", rxLength);
+		errors++ ;
+	}
+
+	printf("%u frames, %u packets in %u system calls, %u with SPS/PPS, largest packet %u\n",
+	       tx.numFrames(), tx.numPackets(), tx.numSyscalls(), withParams, rx.maxPacket());
+	printf("%u errors\n", errors);
+	free(frame);
+	return errors ? -1 : 0 ;
+}
+#endif
@@ -0,0 +1,164 @@
+#ifndef __RTPH264_H__
+#define __RTPH264_H__ "$Id$"
+
+/*
+ * rtpH264.h
+ *
+ * This header file declares the rtpH264_t class, which sends H.264
+ * access units over UDP as RTP (RFC 3550) using the RFC 6184 payload
+ * format in packetization mode 1:
+ *
+ *	- a NAL unit that fits in one packet is sent as is
+ *	- larger NAL units are split into FU-A fragments
+ *	- the marker bit is set on the last packet of each frame
+ *	- timestamps are the capture time on a 90 kHz clock
+ *
+ * SPS and PPS are remembered as they pass through, and resent ahead
+ * of every keyframe and at least every repeatMs, so a receiver that
+ * joins late (or a stream using intra refresh, which has no periodic
+ * keyframes) can start decoding.
+ *
+ * All of the packets for a frame are handed to the kernel with one
+ * sendmmsg() call where possible. Payloads are sent from the
+ * caller's buffer without copying.
+ *
+ * rtpH264Receiver_t reassembles the stream into Annex B frames. It
+ * is mostly useful for loopback tests.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdio.h>
+
+class rtpH264_t {
+public:
+	enum {
+		DEFAULT_MTU	= 1500,
+		OVERHEAD	= 20+8+12,	// IP, UDP and RTP headers
+		PAYLOAD_TYPE	= 96,		// first dynamic type
+		CLOCKRATE	= 90000,
+		MAXBATCH	= 64,		// packets per system call
+		MAXPARAMSET	= 256		// bytes of SPS or PPS
+	};
+
+	rtpH264_t(unsigned mtu = DEFAULT_MTU, unsigned repeatMs = 1000);
+	~rtpH264_t(void);
+
+	// target is of the form 192.168.0.100:0x2020
+	bool open(char const *target);
+	void close(void);
+	bool isOpen(void) const { return 0 <= fd_ ; }
+
+	/*
+	 * Sends each NAL unit of an Annex B buffer. SPS and PPS NAL units
+	 * are only remembered, and go out ahead of the next frame.
+	 * Returns false if the network refused any packet (e.g. ENOBUFS).
+	 */
+	bool send(void const *data, unsigned length,
+		  struct timeval const &captured, bool keyframe);
+
+	// SDP describing the stream, for players that need one
+	bool sdp(char *buf, unsigned size) const ;
+
+	unsigned mtu(void) const { return mtu_ ; }
+	unsigned maxPayload(void) const { return mtu_-OVERHEAD ; }
+
+	// statistics
+	unsigned numFrames(void) const { return frames_ ; }
+	unsigned numPackets(void) const { return packets_ ; }
+	unsigned numSyscalls(void) const { return syscalls_ ; }
+	unsigned numErrors(void) const { return errors_ ; }	// packets not sent
+	void resetStats(void);
+
+private:
+	rtpH264_t(rtpH264_t const &); // no copies
+
+#ifdef ANDROID
+	// Bionic has no sendmmsg(), so flush() uses sendmsg()
+	struct message_t {
+		struct msghdr	msg_hdr ;
+		unsigned	msg_len ;
+	};
+#else
+	typedef struct mmsghdr message_t ;
+#endif
+
+	struct paramSet_t {
+		unsigned	length ;
+		unsigned char	data[MAXPARAMSET];
+	};
+
+	void remember(paramSet_t &ps, unsigned char const *nal, unsigned length);
+	bool sendNAL(unsigned char const *nal, unsigned length, bool last);
+	bool queue(unsigned char const *fu, unsigned fuLen,
+		   unsigned char const *payload, unsigned length, bool marker);
+	bool flush(void);
+
+	unsigned const	mtu_ ;
+	unsigned const	repeatUs_ ;
+	int		fd_ ;
+	sockaddr_in	dest_ ;
+	unsigned short	seq_ ;
+	unsigned	ssrc_ ;
+	unsigned	tsOffset_ ;
+	unsigned	timestamp_ ;	// of the frame being sent
+	long long	lastParamsUs_ ;
+	paramSet_t	sps_ ;
+	paramSet_t	pps_ ;
+	bool		paramsChanged_ ;
+
+	bool		useMmsg_ ;	// sendmmsg() isn't in kernels before 3.0
+	unsigned	numQueued_ ;
+	unsigned char	headers_[MAXBATCH][12+2];	// RTP and FU-A
+	struct iovec	iov_[MAXBATCH][2];
+	message_t	msgs_[MAXBATCH];
+
+	unsigned	frames_ ;
+	unsigned	packets_ ;
+	unsigned	syscalls_ ;
+	unsigned	errors_ ;
+};
+
+class rtpH264Receiver_t {
+public:
+	// port 0 picks a free one, see port()
+	rtpH264Receiver_t(unsigned short port = 0, unsigned maxFrame = 1<<20);
+	~rtpH264Receiver_t(void);
+
+	bool worked(void) const { return (0 <= fd_) && (0 != frame_) ; }
+	unsigned short port(void) const { return port_ ; }
+
+	/*
+	 * Waits up to timeoutMs for the rest of a frame. The frame is
+	 * returned in Annex B form (four-byte start codes) and stays
+	 * valid until the next call.
+	 */
+	bool receive(void const *&data, unsigned &length,
+		     unsigned &timestamp, int timeoutMs);
+
+	unsigned numPackets(void) const { return packets_ ; }
+	unsigned numLost(void) const { return lost_ ; }	// from sequence gaps
+	unsigned maxPacket(void) const { return maxPacket_ ; }
+private:
+	bool append(unsigned char const *data, unsigned length, bool startCode);
+
+	int		fd_ ;
+	unsigned short	port_ ;
+	unsigned const	maxFrame_ ;
+	unsigned char  *frame_ ;
+	unsigned	length_ ;
+	bool		haveSeq_ ;
+	unsigned short	nextSeq_ ;
+	bool		inFragment_ ;
+	unsigned	fragStart_ ;	// of the NAL being reassembled
+	bool		done_ ;		// frame_ was returned
+	unsigned	packets_ ;
+	unsigned	lost_ ;
+	unsigned	maxPacket_ ;
+};
+
+#endif
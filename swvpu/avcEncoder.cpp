@@ -0,0 +1,1195 @@
+/*
+ * Module avcEncoder.cpp
+ *
+ * This module defines the methods of the avcEncoder_t class
+ * as declared in avcEncoder.h
+ *
+ * Section numbers refer to ITU-T H.264 (03/2010).
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "avcEncoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct avcEncoder_t::macroblock_t {
+	unsigned	mbx ;
+	unsigned	mby ;
+	unsigned char	srcY[256];
+	unsigned char	srcC[2][64];
+	unsigned char	predY[256];
+	unsigned char	predC[2][64];
+	int		lumaDC[16];		// Intra 16x16, by block (raster)
+	int		luma[16][16];		// levels by block and coefficient (raster)
+	int		chromaDC[2][4];
+	int		chroma[2][4][16];
+	unsigned	predMode ;		// Intra 16x16: 0 vertical, 1 horizontal, 2 DC
+	unsigned	chromaMode ;		// 0 DC, 1 horizontal, 2 vertical
+	unsigned	cbpLuma ;		// a bit per 8x8, all or none for Intra 16x16
+	unsigned	cbpChroma ;		// 0 none, 1 DC only, 2 DC and AC
+	int		mvx ;			// quarter pels
+	int		mvy ;
+};
+
+// 4x4 frame scan (8.5.6), as raster indices
+static unsigned char const zigzag[16] = {
+	0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15
+};
+
+// quantizer multipliers and rescaling factors (8.5.9), by QP%6 and position class
+static int const quantMF[6][3] = {
+	{ 13107, 5243, 8066 }, { 11916, 4660, 7490 }, { 10082, 4194, 6554 },
+	{ 9362, 3647, 5825 }, { 8192, 3355, 5243 }, { 7282, 2893, 4559 }
+};
+static int const rescaleV[6][3] = {
+	{ 10, 16, 13 }, { 11, 18, 14 }, { 13, 20, 16 },
+	{ 14, 23, 18 }, { 16, 25, 20 }, { 18, 29, 23 }
+};
+
+// QPc by qPI from 30 up (Table 8-15)
+static unsigned char const chromaQp[22] = {
+	29, 30, 31, 32, 32, 33, 34, 34, 35, 35, 36, 36, 37, 37, 37, 38, 38, 38, 39, 39, 39, 39
+};
+
+// codeNum of each inter coded_block_pattern (Table 9-4)
+static unsigned char const interCbpCode[48] = {
+	 0,  2,  3,  7,  4,  8, 17, 13,  5, 18,  9, 14, 10, 15, 16, 11,
+	 1, 32, 33, 36, 34, 37, 44, 40, 35, 45, 38, 41, 39, 42, 43, 19,
+	 6, 24, 25, 20, 26, 21, 46, 28, 27, 47, 22, 29, 23, 30, 31, 12
+};
+
+/*
+ * coeff_token (Table 9-5), by TotalCoeff*4+TrailingOnes, for
+ * 0 <= nC < 2, 2 <= nC < 4, 4 <= nC < 8 and 8 <= nC
+ */
+static unsigned char const coeffTokenLen[4][4*17] = {
+	{ 1, 0, 0, 0,
+	  6, 2, 0, 0,	 8, 6, 3, 0,	 9, 8, 7, 5,	10, 9, 8, 6,
+	 11,10, 9, 7,	13,11,10, 8,	13,13,11, 9,	13,13,13,10,
+	 14,14,13,11,	14,14,14,13,	15,15,14,14,	15,15,15,14,
+	 16,15,15,15,	16,16,16,15,	16,16,16,16,	16,16,16,16 },
+	{ 2, 0, 0, 0,
+	  6, 2, 0, 0,	 6, 5, 3, 0,	 7, 6, 6, 4,	 8, 6, 6, 4,
+	  8, 7, 7, 5,	 9, 8, 8, 6,	11, 9, 9, 6,	11,11,11, 7,
+	 12,11,11, 9,	12,12,12,11,	12,12,12,11,	13,13,13,12,
+	 13,13,13,13,	13,14,13,13,	14,14,14,13,	14,14,14,14 },
+	{ 4, 0, 0, 0,
+	  6, 4, 0, 0,	 6, 5, 4, 0,	 6, 5, 5, 4,	 7, 5, 5, 4,
+	  7, 5, 5, 4,	 7, 6, 6, 4,	 7, 6, 6, 4,	 8, 7, 7, 5,
+	  8, 8, 7, 6,	 9, 8, 8, 7,	 9, 9, 8, 8,	 9, 9, 9, 8,
+	 10, 9, 9, 9,	10,10,10,10,	10,10,10,10,	10,10,10,10 },
+	{ 6, 0, 0, 0,
+	  6, 6, 0, 0,	 6, 6, 6, 0,	 6, 6, 6, 6,	 6, 6, 6, 6,
+	  6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6,
+	  6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6,
+	  6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6,	 6, 6, 6, 6 }
+};
+static unsigned char const coeffTokenCode[4][4*17] = {
+	{ 1, 0, 0, 0,
+	  5, 1, 0, 0,	 7, 4, 1, 0,	 7, 6, 5, 3,	 7, 6, 5, 3,
+	  7, 6, 5, 4,	15, 6, 5, 4,	11,14, 5, 4,	 8,10,13, 4,
+	 15,14, 9, 4,	11,10,13,12,	15,14, 9,12,	11,10,13, 8,
+	 15, 1, 9,12,	11,14,13, 8,	 7,10, 9,12,	 4, 6, 5, 8 },
+	{ 3, 0, 0, 0,
+	 11, 2, 0, 0,	 7, 7, 3, 0,	 7,10, 9, 5,	 7, 6, 5, 4,
+	  4, 6, 5, 6,	 7, 6, 5, 8,	15, 6, 5, 4,	11,14,13, 4,
+	 15,10, 9, 4,	11,14,13,12,	 8,10, 9, 8,	15,14,13,12,
+	 11,10, 9,12,	 7,11, 6, 8,	 9, 8,10, 1,	 7, 6, 5, 4 },
+	{ 15, 0, 0, 0,
+	 15,14, 0, 0,	11,15,13, 0,	 8,12,14,12,	15,10,11,11,
+	 11, 8, 9,10,	 9,14,13, 9,	 8,10, 9, 8,	15,14,13,13,
+	 11,14,10,12,	15,10,13,12,	11,14, 9,12,	 8,10,13, 8,
+	 13, 7, 9,12,	 9,12,11,10,	 5, 8, 7, 6,	 1, 4, 3, 2 },
+	{ 3, 0, 0, 0,
+	  0, 1, 0, 0,	 4, 5, 6, 0,	 8, 9,10,11,	12,13,14,15,
+	 16,17,18,19,	20,21,22,23,	24,25,26,27,	28,29,30,31,
+	 32,33,34,35,	36,37,38,39,	40,41,42,43,	44,45,46,47,
+	 48,49,50,51,	52,53,54,55,	56,57,58,59,	60,61,62,63 }
+};
+
+// for chroma DC (nC == -1)
+static unsigned char const chromaDCTokenLen[4*5] = {
+	2, 0, 0, 0,	6, 1, 0, 0,	6, 6, 3, 0,	6, 7, 7, 6,	6, 8, 8, 7
+};
+static unsigned char const chromaDCTokenCode[4*5] = {
+	1, 0, 0, 0,	7, 1, 0, 0,	4, 6, 1, 0,	3, 3, 2, 5,	2, 3, 2, 0
+};
+
+// total_zeros (Tables 9-7, 9-8) by TotalCoeff-1 and total_zeros
+static unsigned char const totalZerosLen[15][16] = {
+	{ 1,3,3,4,4,5,5,6,6,7,7,8,8,9,9,9 },
+	{ 3,3,3,3,3,4,4,4,4,5,5,6,6,6,6 },
+	{ 4,3,3,3,4,4,3,3,4,5,5,6,5,6 },
+	{ 5,3,4,4,3,3,3,4,3,4,5,5,5 },
+	{ 4,4,4,3,3,3,3,3,4,5,4,5 },
+	{ 6,5,3,3,3,3,3,3,4,3,6 },
+	{ 6,5,3,3,3,2,3,4,3,6 },
+	{ 6,4,5,3,2,2,3,3,6 },
+	{ 6,6,4,2,2,3,2,5 },
+	{ 5,5,3,2,2,2,4 },
+	{ 4,4,3,3,1,3 },
+	{ 4,4,2,1,3 },
+	{ 3,3,1,2 },
+	{ 2,2,1 },
+	{ 1,1 }
+};
+static unsigned char const totalZerosCode[15][16] = {
+	{ 1,3,2,3,2,3,2,3,2,3,2,3,2,3,2,1 },
+	{ 7,6,5,4,3,5,4,3,2,3,2,3,2,1,0 },
+	{ 5,7,6,5,4,3,4,3,2,3,2,1,1,0 },
+	{ 3,7,5,4,6,5,4,3,3,2,2,1,0 },
+	{ 5,4,3,7,6,5,4,3,2,1,1,0 },
+	{ 1,1,7,6,5,4,3,2,1,1,0 },
+	{ 1,1,5,4,3,3,2,1,1,0 },
+	{ 1,1,1,3,3,2,2,1,0 },
+	{ 1,0,1,3,2,1,1,1 },
+	{ 1,0,1,3,2,1,1 },
+	{ 0,1,1,2,1,3 },
+	{ 0,1,1,1,1 },
+	{ 0,1,1,1 },
+	{ 0,1,1 },
+	{ 0,1 }
+};
+static unsigned char const chromaDCZerosLen[3][4] = {
+	{ 1,2,3,3 }, { 1,2,2 }, { 1,1 }
+};
+static unsigned char const chromaDCZerosCode[3][4] = {
+	{ 1,1,1,0 }, { 1,1,0 }, { 1,0 }
+};
+
+// run_before (Table 9-10) by min(zerosLeft,7)-1 and run_before
+static unsigned char const runBeforeLen[7][15] = {
+	{ 1,1 },
+	{ 1,2,2 },
+	{ 2,2,2,2 },
+	{ 2,2,2,3,3 },
+	{ 2,2,3,3,3,3 },
+	{ 2,3,3,3,3,3,3 },
+	{ 3,3,3,3,3,3,3,4,5,6,7,8,9,10,11 }
+};
+static unsigned char const runBeforeCode[7][15] = {
+	{ 1,0 },
+	{ 1,1,0 },
+	{ 3,2,1,0 },
+	{ 3,2,1,1,0 },
+	{ 3,2,3,2,1,0 },
+	{ 3,0,1,3,2,5,4 },
+	{ 7,6,5,4,3,2,1,1,1,1,1,1,1,1,1 }
+};
+
+/*
+ * Baseline streams can't escape a level with a prefix over 15, which
+ * limits levels to this. Only very low QPs get near it.
+ */
+#define MAXLEVEL	2063
+
+/*
+ * In P-frames, a macroblock is only intra coded if its prediction
+ * is better than the reference by this much (SAD), since that costs
+ * more bits for the same residual.
+ */
+#define INTRABIAS	256
+
+/*
+ * Motion search: a diamond search over even whole-pel vectors (so
+ * chroma needs no interpolation either) within this many pels, kept
+ * inside the reference.
+ */
+#define SEARCHRANGE	32
+
+static inline unsigned posClass(unsigned i)
+{
+	unsigned const x = i & 3 ;
+	unsigned const y = i >> 2 ;
+	if (0 == ((x|y) & 1))
+		return 0 ;
+	return ((x & y) & 1) ? 1 : 2 ;
+}
+
+static inline int clip255(int v)
+{
+	return (v < 0) ? 0 : (v > 255) ? 255 : v ;
+}
+
+static inline int quantize(int coef, int mf, unsigned shift, int round)
+{
+	int level = ((coef < 0 ? -coef : coef)*mf + round) >> shift ;
+	if (level > MAXLEVEL)
+		level = MAXLEVEL ;
+	return (coef < 0) ? -level : level ;
+}
+
+// W = Cf X Cf' (8.5.12 run forwards)
+static void forward4x4(int const *in, int *out)
+{
+	int tmp[16];
+	for (unsigned i = 0 ; i < 4 ; i++) {
+		int const *r = in+4*i ;
+		int const s03 = r[0]+r[3], d03 = r[0]-r[3];
+		int const s12 = r[1]+r[2], d12 = r[1]-r[2];
+		tmp[4*i+0] = s03+s12 ;
+		tmp[4*i+1] = 2*d03+d12 ;
+		tmp[4*i+2] = s03-s12 ;
+		tmp[4*i+3] = d03-2*d12 ;
+	}
+	for (unsigned j = 0 ; j < 4 ; j++) {
+		int const s03 = tmp[j]+tmp[12+j], d03 = tmp[j]-tmp[12+j];
+		int const s12 = tmp[4+j]+tmp[8+j], d12 = tmp[4+j]-tmp[8+j];
+		out[j] = s03+s12 ;
+		out[4+j] = 2*d03+d12 ;
+		out[8+j] = s03-s12 ;
+		out[12+j] = d03-2*d12 ;
+	}
+}
+
+// 8.5.12.2, in place: scaled coefficients in, residual out
+static void inverse4x4(int *d)
+{
+	int tmp[16];
+	for (unsigned i = 0 ; i < 4 ; i++) {
+		int const *r = d+4*i ;
+		int const e0 = r[0]+r[2], e1 = r[0]-r[2];
+		int const e2 = (r[1]>>1)-r[3], e3 = r[1]+(r[3]>>1);
+		tmp[4*i+0] = e0+e3 ;
+		tmp[4*i+1] = e1+e2 ;
+		tmp[4*i+2] = e1-e2 ;
+		tmp[4*i+3] = e0-e3 ;
+	}
+	for (unsigned j = 0 ; j < 4 ; j++) {
+		int const e0 = tmp[j]+tmp[8+j], e1 = tmp[j]-tmp[8+j];
+		int const e2 = (tmp[4+j]>>1)-tmp[12+j], e3 = tmp[4+j]+(tmp[12+j]>>1);
+		d[j] = (e0+e3+32) >> 6 ;
+		d[4+j] = (e1+e2+32) >> 6 ;
+		d[8+j] = (e1-e2+32) >> 6 ;
+		d[12+j] = (e0-e3+32) >> 6 ;
+	}
+}
+
+// 4x4 Hadamard, for the Intra 16x16 DC
+static void hadamard4x4(int const *in, int *out)
+{
+	int tmp[16];
+	for (unsigned i = 0 ; i < 4 ; i++) {
+		int const *r = in+4*i ;
+		int const s01 = r[0]+r[1], d01 = r[0]-r[1];
+		int const s23 = r[2]+r[3], d23 = r[2]-r[3];
+		tmp[4*i+0] = s01+s23 ;
+		tmp[4*i+1] = s01-s23 ;
+		tmp[4*i+2] = d01-d23 ;
+		tmp[4*i+3] = d01+d23 ;
+	}
+	for (unsigned j = 0 ; j < 4 ; j++) {
+		int const s01 = tmp[j]+tmp[4+j], d01 = tmp[j]-tmp[4+j];
+		int const s23 = tmp[8+j]+tmp[12+j], d23 = tmp[8+j]-tmp[12+j];
+		out[j] = s01+s23 ;
+		out[4+j] = s01-s23 ;
+		out[8+j] = d01-d23 ;
+		out[12+j] = d01+d23 ;
+	}
+}
+
+// residual of a 4x4 block at (x,y) of a macroblock plane with the given width
+static void residual4x4(unsigned char const *src, unsigned char const *pred,
+			unsigned width, unsigned x, unsigned y, int *out)
+{
+	for (unsigned r = 0 ; r < 4 ; r++)
+		for (unsigned c = 0 ; c < 4 ; c++) {
+			unsigned const i = (y+r)*width+x+c ;
+			out[4*r+c] = src[i]-pred[i];
+		}
+}
+
+// adds residual d to the prediction for a block at (x,y), into a frame
+static void reconstruct4x4(unsigned char const *pred, unsigned width, unsigned x, unsigned y,
+			   int const *d, unsigned char *out, unsigned stride)
+{
+	for (unsigned r = 0 ; r < 4 ; r++)
+		for (unsigned c = 0 ; c < 4 ; c++)
+			out[(y+r)*stride+x+c] = clip255(pred[(y+r)*width+x+c]+d[4*r+c]);
+}
+
+static unsigned nonZero(int const *levels, unsigned first)
+{
+	unsigned n = 0 ;
+	for (unsigned i = first ; i < 16 ; i++)
+		n += (0 != levels[i]);
+	return n ;
+}
+
+static unsigned sad(unsigned char const *a, unsigned char const *b, unsigned n)
+{
+	unsigned rval = 0 ;
+	for (unsigned i = 0 ; i < n ; i++)
+		rval += (a[i] > b[i]) ? a[i]-b[i] : b[i]-a[i];
+	return rval ;
+}
+
+/*
+ * residual_block_cavlc() (7.3.5.3.3): levels are in scan order,
+ * count of them, and nC is -1 for chroma DC.
+ */
+static void writeResidual(bitWriter_t &bw, int const *levels, unsigned count, int nC)
+{
+	unsigned pos[16];	// of the non-zero levels, in scan order
+	unsigned total = 0 ;
+	for (unsigned i = 0 ; i < count ; i++) {
+		if (levels[i])
+			pos[total++] = i ;
+	}
+	unsigned t1 = 0 ;
+	while ((t1 < 3) && (t1 < total)) {
+		int const l = levels[pos[total-1-t1]];
+		if ((1 != l) && (-1 != l))
+			break;
+		t1++ ;
+	}
+
+	if (0 > nC)
+		bw.u(chromaDCTokenLen[total*4+t1],chromaDCTokenCode[total*4+t1]);
+	else {
+		unsigned const table = (nC < 2) ? 0 : (nC < 4) ? 1 : (nC < 8) ? 2 : 3 ;
+		bw.u(coeffTokenLen[table][total*4+t1],coeffTokenCode[table][total*4+t1]);
+	}
+	if (0 == total)
+		return ;
+
+	for (unsigned i = 0 ; i < t1 ; i++)
+		bw.u(1,levels[pos[total-1-i]] < 0);
+
+	unsigned suffixLength = ((10 < total) && (3 > t1)) ? 1 : 0 ;
+	for (unsigned i = t1 ; i < total ; i++) {
+		int const level = levels[pos[total-1-i]];
+		unsigned levelCode = (0 < level) ? 2*level-2 : -2*level-1 ;
+		if ((i == t1) && (3 > t1))
+			levelCode -= 2 ;
+		if (0 == suffixLength) {
+			if (14 > levelCode)
+				bw.u(levelCode+1,1);
+			else if (30 > levelCode) {
+				bw.u(15,1);
+				bw.u(4,levelCode-14);
+			} else {
+				bw.u(16,1);
+				bw.u(12,levelCode-30);
+			}
+		} else if (levelCode < (15u << suffixLength)) {
+			bw.u((levelCode >> suffixLength)+1,1);
+			bw.u(suffixLength,levelCode);
+		} else {
+			bw.u(16,1);
+			bw.u(12,levelCode-(15 << suffixLength));
+		}
+		if (0 == suffixLength)
+			suffixLength = 1 ;
+		unsigned const magnitude = (0 < level) ? level : -level ;
+		if ((magnitude > (3u << (suffixLength-1))) && (6 > suffixLength))
+			suffixLength++ ;
+	}
+
+	if (total < count) {
+		unsigned const totalZeros = pos[total-1]+1-total ;
+		if (0 > nC)
+			bw.u(chromaDCZerosLen[total-1][totalZeros],chromaDCZerosCode[total-1][totalZeros]);
+		else
+			bw.u(totalZerosLen[total-1][totalZeros],totalZerosCode[total-1][totalZeros]);
+		unsigned zerosLeft = totalZeros ;
+		for (unsigned i = total-1 ; (0 < i) && (0 < zerosLeft) ; i--) {
+			unsigned const run = pos[i]-pos[i-1]-1 ;
+			unsigned const table = ((7 < zerosLeft) ? 7 : zerosLeft)-1 ;
+			bw.u(runBeforeLen[table][run],runBeforeCode[table][run]);
+			zerosLeft -= run ;
+		}
+	}
+}
+
+avcEncoder_t::avcEncoder_t(unsigned width, unsigned height)
+	: width_(width)
+	, height_(height)
+	, mbWidth_((width+15)/16)
+	, mbHeight_((height+15)/16)
+{
+	unsigned const mbs = mbWidth_*mbHeight_ ;
+	unsigned const lumaSize = 256*mbs ;
+	frame_t *frames[2] = { &cur_, &ref_ };
+	for (unsigned f = 0 ; f < 2 ; f++) {
+		frames[f]->y = new unsigned char [lumaSize*3/2];
+		frames[f]->cb = frames[f]->y+lumaSize ;
+		frames[f]->cr = frames[f]->cb+lumaSize/4 ;
+		memset(frames[f]->y,0x80,lumaSize*3/2);
+	}
+	nzY_ = new unsigned char [mbs][16];
+	nzC_ = new unsigned char [mbs][2][4];
+	slice_ = new unsigned [mbs];
+	motion_ = new motion_t [mbs];
+	refresh_ = 0 ;
+}
+
+avcEncoder_t::~avcEncoder_t(void)
+{
+	delete [] cur_.y ;
+	delete [] ref_.y ;
+	delete [] nzY_ ;
+	delete [] nzC_ ;
+	delete [] slice_ ;
+	delete [] motion_ ;
+}
+
+void avcEncoder_t::putSPS(bitWriter_t &bw) const
+{
+	unsigned const cropRight = (mbWidth_*16-width_)/2 ;
+	unsigned const cropBottom = (mbHeight_*16-height_)/2 ;
+	unsigned const mbs = mbWidth_*mbHeight_ ;
+	bw.startNAL(0x67);
+	bw.u(8,66);		// baseline
+	bw.u(8,0xc0);		// constraint_set0/1
+	bw.u(8,(1620 >= mbs) ? 30 : (3600 >= mbs) ? 31 : (8192 >= mbs) ? 40 : 51);
+	bw.ue(0);		// seq_parameter_set_id
+	bw.ue(0);		// log2_max_frame_num_minus4
+	bw.ue(2);		// pic_order_cnt_type
+	bw.ue(1);		// max_num_ref_frames
+	bw.u(1,0);		// gaps_in_frame_num_value_allowed_flag
+	bw.ue(mbWidth_-1);
+	bw.ue(mbHeight_-1);
+	bw.u(1,1);		// frame_mbs_only_flag
+	bw.u(1,1);		// direct_8x8_inference_flag
+	if (cropRight || cropBottom) {
+		bw.u(1,1);
+		bw.ue(0);
+		bw.ue(cropRight);
+		bw.ue(0);
+		bw.ue(cropBottom);
+	} else
+		bw.u(1,0);
+	bw.u(1,0);		// vui_parameters_present_flag
+	bw.trailingBits();
+}
+
+void avcEncoder_t::putPPS(bitWriter_t &bw, int chromaQpOffset) const
+{
+	bw.startNAL(0x68);
+	bw.ue(0);		// pic_parameter_set_id
+	bw.ue(0);		// seq_parameter_set_id
+	bw.u(1,0);		// entropy_coding_mode_flag: CAVLC
+	bw.u(1,0);		// bottom_field_pic_order_in_frame_present_flag
+	bw.ue(0);		// num_slice_groups_minus1
+	bw.ue(0);		// num_ref_idx_l0_default_active_minus1
+	bw.ue(0);		// num_ref_idx_l1_default_active_minus1
+	bw.u(1,0);		// weighted_pred_flag
+	bw.u(2,0);		// weighted_bipred_idc
+	bw.se(0);		// pic_init_qp_minus26
+	bw.se(0);		// pic_init_qs_minus26
+	bw.se(chromaQpOffset);
+	bw.u(1,1);		// deblocking_filter_control_present_flag
+	bw.u(1,0);		// constrained_intra_pred_flag
+	bw.u(1,0);		// redundant_pic_cnt_present_flag
+	bw.trailingBits();
+}
+
+// copies a macroblock of the source, repeating the last row and column past the edges
+void avcEncoder_t::loadSource(picture_t const &pic, unsigned mbx, unsigned mby, macroblock_t &mb) const
+{
+	mb.mbx = mbx ;
+	mb.mby = mby ;
+	for (unsigned r = 0 ; r < 16 ; r++) {
+		unsigned row = mby*16+r ;
+		if (row >= height_)
+			row = height_-1 ;
+		unsigned char const *in = pic.y+row*pic.strideY ;
+		unsigned col = mbx*16 ;
+		if (col+16 <= width_)
+			memcpy(mb.srcY+16*r,in+col,16);
+		else for (unsigned c = 0 ; c < 16 ; c++, col++)
+			mb.srcY[16*r+c] = in[(col < width_) ? col : width_-1];
+	}
+	unsigned const cw = (width_+1)/2 ;
+	unsigned const ch = (height_+1)/2 ;
+	for (unsigned plane = 0 ; plane < 2 ; plane++) {
+		unsigned char const *base = plane ? pic.cr : pic.cb ;
+		for (unsigned r = 0 ; r < 8 ; r++) {
+			unsigned row = mby*8+r ;
+			if (row >= ch)
+				row = ch-1 ;
+			unsigned char const *in = base+row*pic.strideC ;
+			for (unsigned c = 0 ; c < 8 ; c++) {
+				unsigned col = mbx*8+c ;
+				mb.srcC[plane][8*r+c] = in[((col < cw) ? col : cw-1)*pic.stepC];
+			}
+		}
+	}
+}
+
+// neighbour has been coded, in the same slice as mbAddr
+bool avcEncoder_t::available(unsigned mbAddr, unsigned neighbour) const
+{
+	return slice_[neighbour] == slice_[mbAddr];
+}
+
+// 9.2.1: from the blocks to the left and above
+int avcEncoder_t::lumaNC(unsigned mbAddr, unsigned x, unsigned y) const
+{
+	int nA = -1, nB = -1 ;
+	if (x)
+		nA = nzY_[mbAddr][4*y+x-1];
+	else if ((mbAddr % mbWidth_) && available(mbAddr,mbAddr-1))
+		nA = nzY_[mbAddr-1][4*y+3];
+	if (y)
+		nB = nzY_[mbAddr][4*(y-1)+x];
+	else if ((mbAddr >= mbWidth_) && available(mbAddr,mbAddr-mbWidth_))
+		nB = nzY_[mbAddr-mbWidth_][12+x];
+	if ((0 <= nA) && (0 <= nB))
+		return (nA+nB+1) >> 1 ;
+	return (0 <= nA) ? nA : (0 <= nB) ? nB : 0 ;
+}
+
+int avcEncoder_t::chromaNC(unsigned mbAddr, unsigned plane, unsigned x, unsigned y) const
+{
+	int nA = -1, nB = -1 ;
+	if (x)
+		nA = nzC_[mbAddr][plane][2*y];
+	else if ((mbAddr % mbWidth_) && available(mbAddr,mbAddr-1))
+		nA = nzC_[mbAddr-1][plane][2*y+1];
+	if (y)
+		nB = nzC_[mbAddr][plane][x];
+	else if ((mbAddr >= mbWidth_) && available(mbAddr,mbAddr-mbWidth_))
+		nB = nzC_[mbAddr-mbWidth_][plane][2+x];
+	if ((0 <= nA) && (0 <= nB))
+		return (nA+nB+1) >> 1 ;
+	return (0 <= nA) ? nA : (0 <= nB) ? nB : 0 ;
+}
+
+/*
+ * Residual and reconstruction of both chroma planes. For intra
+ * macroblocks, picks the prediction first (8.3.4).
+ */
+void avcEncoder_t::codeChroma(macroblock_t &mb, unsigned qpc, bool intra)
+{
+	unsigned const mbAddr = mb.mby*mbWidth_+mb.mbx ;
+	unsigned const stride = 8*mbWidth_ ;
+	unsigned char *const recon[2] = {
+		cur_.cb+mb.mby*8*stride+mb.mbx*8,
+		cur_.cr+mb.mby*8*stride+mb.mbx*8
+	};
+	if (intra) {
+		bool const haveTop = mb.mby && available(mbAddr,mbAddr-mbWidth_);
+		bool const haveLeft = mb.mbx && available(mbAddr,mbAddr-1);
+		unsigned char pred[3][2][64];
+		for (unsigned plane = 0 ; plane < 2 ; plane++) {
+			unsigned char const *top = recon[plane]-stride ;
+			unsigned char const *left = recon[plane]-1 ;
+			// DC, by 4x4 block
+			for (unsigned b = 0 ; b < 4 ; b++) {
+				unsigned const x = 4*(b&1), y = 4*(b>>1);
+				unsigned sumTop = 0, sumLeft = 0 ;
+				for (unsigned i = 0 ; i < 4 ; i++) {
+					if (haveTop)
+						sumTop += top[x+i];
+					if (haveLeft)
+						sumLeft += left[(y+i)*stride];
+				}
+				unsigned dc = 128 ;
+				if ((1 == b) && haveTop)
+					dc = (sumTop+2) >> 2 ;
+				else if ((2 == b) && haveLeft)
+					dc = (sumLeft+2) >> 2 ;
+				else if ((1 != b) && (2 != b) && haveTop && haveLeft)
+					dc = (sumTop+sumLeft+4) >> 3 ;
+				else if (haveLeft)
+					dc = (sumLeft+2) >> 2 ;
+				else if (haveTop)
+					dc = (sumTop+2) >> 2 ;
+				for (unsigned r = 0 ; r < 4 ; r++)
+					memset(pred[0][plane]+8*(y+r)+x,dc,4);
+			}
+			for (unsigned r = 0 ; r < 8 ; r++)
+				for (unsigned c = 0 ; c < 8 ; c++) {
+					pred[1][plane][8*r+c] = haveLeft ? left[r*stride] : 0 ;
+					pred[2][plane][8*r+c] = haveTop ? top[c] : 0 ;
+				}
+		}
+		unsigned best = 0 ;
+		unsigned bestCost = sad(mb.srcC[0],pred[0][0],64)+sad(mb.srcC[1],pred[0][1],64);
+		for (unsigned mode = 1 ; mode < 3 ; mode++) {
+			if (((1 == mode) && !haveLeft) || ((2 == mode) && !haveTop))
+				continue;
+			unsigned const cost = sad(mb.srcC[0],pred[mode][0],64)+sad(mb.srcC[1],pred[mode][1],64);
+			if (cost < bestCost) {
+				best = mode ;
+				bestCost = cost ;
+			}
+		}
+		mb.chromaMode = best ;
+		memcpy(mb.predC,pred[best],sizeof(mb.predC));
+	}
+
+	unsigned const qbits = 15+qpc/6 ;
+	int const round = (1 << qbits)/(intra ? 3 : 6);
+	int const *mf = quantMF[qpc%6];
+	int const *v = rescaleV[qpc%6];
+	bool dc = false, ac = false ;
+	for (unsigned plane = 0 ; plane < 2 ; plane++) {
+		int coef[4][16];
+		for (unsigned b = 0 ; b < 4 ; b++) {
+			int res[16];
+			residual4x4(mb.srcC[plane],mb.predC[plane],8,4*(b&1),4*(b>>1),res);
+			forward4x4(res,coef[b]);
+			mb.chroma[plane][b][0] = 0 ;
+			for (unsigned i = 1 ; i < 16 ; i++) {
+				int const level = quantize(coef[b][i],mf[posClass(i)],qbits,round);
+				mb.chroma[plane][b][i] = level ;
+				ac = ac || level ;
+			}
+		}
+		int const w[4] = {
+			coef[0][0]+coef[1][0]+coef[2][0]+coef[3][0],
+			coef[0][0]-coef[1][0]+coef[2][0]-coef[3][0],
+			coef[0][0]+coef[1][0]-coef[2][0]-coef[3][0],
+			coef[0][0]-coef[1][0]-coef[2][0]+coef[3][0]
+		};
+		for (unsigned i = 0 ; i < 4 ; i++) {
+			mb.chromaDC[plane][i] = quantize(w[i],mf[0],qbits+1,2*round);
+			dc = dc || mb.chromaDC[plane][i];
+		}
+	}
+	mb.cbpChroma = ac ? 2 : dc ? 1 : 0 ;
+
+	for (unsigned plane = 0 ; plane < 2 ; plane++) {
+		int const *c = mb.chromaDC[plane];
+		int const f[4] = {
+			c[0]+c[1]+c[2]+c[3],
+			c[0]-c[1]+c[2]-c[3],
+			c[0]+c[1]-c[2]-c[3],
+			c[0]-c[1]-c[2]+c[3]
+		};
+		for (unsigned b = 0 ; b < 4 ; b++) {
+			int d[16];
+			d[0] = ((f[b]*16*v[0]) << (qpc/6)) >> 5 ;
+			for (unsigned i = 1 ; i < 16 ; i++)
+				d[i] = (mb.chroma[plane][b][i]*v[posClass(i)]) << (qpc/6);
+			inverse4x4(d);
+			reconstruct4x4(mb.predC[plane],8,4*(b&1),4*(b>>1),d,recon[plane],stride);
+			nzC_[mbAddr][plane][b] = nonZero(mb.chroma[plane][b],1);
+		}
+	}
+}
+
+// 8.3.3: DC first, then vertical and horizontal where there are neighbours
+unsigned avcEncoder_t::predictIntra(macroblock_t &mb, unsigned mbAddr) const
+{
+	unsigned const stride = 16*mbWidth_ ;
+	unsigned char const *recon = cur_.y+mb.mby*16*stride+mb.mbx*16 ;
+	bool const haveTop = mb.mby && available(mbAddr,mbAddr-mbWidth_);
+	bool const haveLeft = mb.mbx && available(mbAddr,mbAddr-1);
+	unsigned char const *top = recon-stride ;
+	unsigned char const *left = recon-1 ;
+	unsigned sumTop = 0, sumLeft = 0 ;
+	for (unsigned i = 0 ; i < 16 ; i++) {
+		if (haveTop)
+			sumTop += top[i];
+		if (haveLeft)
+			sumLeft += left[i*stride];
+	}
+	unsigned const dc = (haveTop && haveLeft) ? (sumTop+sumLeft+16) >> 5
+			  : haveTop ? (sumTop+8) >> 4
+			  : haveLeft ? (sumLeft+8) >> 4
+			  : 128 ;
+	memset(mb.predY,dc,256);
+	mb.predMode = 2 ;
+	unsigned bestCost = sad(mb.srcY,mb.predY,256);
+	unsigned char pred[256];
+	if (haveTop) {
+		for (unsigned r = 0 ; r < 16 ; r++)
+			memcpy(pred+16*r,top,16);
+		unsigned const cost = sad(mb.srcY,pred,256);
+		if (cost < bestCost) {
+			memcpy(mb.predY,pred,256);
+			mb.predMode = 0 ;
+			bestCost = cost ;
+		}
+	}
+	if (haveLeft) {
+		for (unsigned r = 0 ; r < 16 ; r++)
+			memset(pred+16*r,left[r*stride],16);
+		unsigned const cost = sad(mb.srcY,pred,256);
+		if (cost < bestCost) {
+			memcpy(mb.predY,pred,256);
+			mb.predMode = 1 ;
+			bestCost = cost ;
+		}
+	}
+	return bestCost ;
+}
+
+// intra refresh: the next count macroblocks from refresh_ (wrapping) are intra coded
+bool avcEncoder_t::refresh(unsigned mbAddr, int count) const
+{
+	if (0 >= count)
+		return false ;
+	unsigned const total = mbWidth_*mbHeight_ ;
+	unsigned const n = ((unsigned)count < total) ? count : total ;
+	return ((mbAddr+total-refresh_) % total) < n ;
+}
+
+// motion of a neighbour, as 8.4.1.3.2 sees it
+avcEncoder_t::motion_t avcEncoder_t::neighbourMotion(unsigned mbAddr, int dx, int dy, bool &avail) const
+{
+	motion_t const none = { 0, 0, -1 };
+	int const x = (int)(mbAddr % mbWidth_)+dx ;
+	int const y = (int)(mbAddr / mbWidth_)+dy ;
+	avail = (0 <= x) && (x < (int)mbWidth_) && (0 <= y)
+		&& available(mbAddr,y*mbWidth_+x);
+	return avail ? motion_[y*mbWidth_+x] : none ;
+}
+
+static inline int median(int a, int b, int c)
+{
+	int const lo = (a < b) ? a : b ;
+	int const hi = (a < b) ? b : a ;
+	return (c < lo) ? lo : (c > hi) ? hi : c ;
+}
+
+// 8.4.1.3: the vector a 16x16 partition's mvd is relative to
+void avcEncoder_t::predictMV(unsigned mbAddr, int &mvx, int &mvy) const
+{
+	bool haveA, haveB, haveC ;
+	motion_t const a = neighbourMotion(mbAddr,-1,0,haveA);
+	motion_t b = neighbourMotion(mbAddr,0,-1,haveB);
+	motion_t c = neighbourMotion(mbAddr,1,-1,haveC);
+	if (!haveC)
+		c = neighbourMotion(mbAddr,-1,-1,haveC);
+	if (!haveB && !haveC && haveA)
+		b = c = a ;
+	unsigned const matches = (0 == a.ref)+(0 == b.ref)+(0 == c.ref);
+	if (1 == matches) {
+		motion_t const &m = (0 == a.ref) ? a : (0 == b.ref) ? b : c ;
+		mvx = m.x ;
+		mvy = m.y ;
+	} else {
+		mvx = median(a.x,b.x,c.x);
+		mvy = median(a.y,b.y,c.y);
+	}
+}
+
+// 8.4.1.1: the vector of a P_Skip macroblock
+void avcEncoder_t::skipMV(unsigned mbAddr, int &mvx, int &mvy) const
+{
+	bool haveA, haveB ;
+	motion_t const a = neighbourMotion(mbAddr,-1,0,haveA);
+	motion_t const b = neighbourMotion(mbAddr,0,-1,haveB);
+	if (!haveA || !haveB
+	    || ((0 == a.ref) && (0 == a.x) && (0 == a.y))
+	    || ((0 == b.ref) && (0 == b.x) && (0 == b.y)))
+		mvx = mvy = 0 ;
+	else
+		predictMV(mbAddr,mvx,mvy);
+}
+
+static unsigned seBits(int v)
+{
+	unsigned x = (0 < v) ? 2*v : -2*v+1 ;
+	unsigned bits = 1 ;
+	while (x >>= 1)
+		bits += 2 ;
+	return bits ;
+}
+
+/*
+ * Searches the reference for the source macroblock, trading SAD
+ * against the bits of the motion vector, and leaves the prediction
+ * in mb. Returns the SAD.
+ */
+unsigned avcEncoder_t::predictInter(macroblock_t &mb, unsigned mbAddr, unsigned qp) const
+{
+	unsigned const stride = 16*mbWidth_ ;
+	int const x0 = 16*mb.mbx ;
+	int const y0 = 16*mb.mby ;
+	int const maxX = 16*(mbWidth_-1);
+	int const maxY = 16*(mbHeight_-1);
+	int const lambda = 1+qp/8 ;
+	int px, py ;
+	predictMV(mbAddr,px,py);
+
+	int bestX = 0, bestY = 0 ;
+	unsigned bestSad = ~0U, bestCost = ~0U ;
+	int const starts[2][2] = { { 0, 0 }, { (px/8)*2, (py/8)*2 } };
+	for (unsigned s = 0 ; s < 2 ; s++) {
+		int x = starts[s][0], y = starts[s][1];
+		if ((x0+x < 0) || (x0+x > maxX) || (y0+y < 0) || (y0+y > maxY))
+			continue;
+		unsigned char pred[256];
+		bool moved = true ;
+		while (moved) {
+			moved = false ;
+			static int const steps[5][2] = { { 0, 0 }, { -2, 0 }, { 2, 0 }, { 0, -2 }, { 0, 2 } };
+			int const cx = x, cy = y ;
+			for (unsigned i = 0 ; i < 5 ; i++) {
+				int const dx = cx+steps[i][0];
+				int const dy = cy+steps[i][1];
+				if ((x0+dx < 0) || (x0+dx > maxX) || (y0+dy < 0) || (y0+dy > maxY)
+				    || (SEARCHRANGE < abs(dx)) || (SEARCHRANGE < abs(dy)))
+					continue;
+				unsigned char const *in = ref_.y+(y0+dy)*stride+x0+dx ;
+				for (unsigned r = 0 ; r < 16 ; r++)
+					memcpy(pred+16*r,in+r*stride,16);
+				unsigned const sadVal = sad(mb.srcY,pred,256);
+				unsigned const cost = sadVal+lambda*(seBits(4*dx-px)+seBits(4*dy-py));
+				if (cost < bestCost) {
+					bestCost = cost ;
+					bestSad = sadVal ;
+					if ((dx != bestX) || (dy != bestY)) {
+						bestX = dx ;
+						bestY = dy ;
+						moved = (0 != i);
+					}
+				}
+			}
+			x = bestX ;
+			y = bestY ;
+		}
+	}
+
+	mb.mvx = 4*bestX ;
+	mb.mvy = 4*bestY ;
+	unsigned char const *in = ref_.y+(y0+bestY)*stride+x0+bestX ;
+	for (unsigned r = 0 ; r < 16 ; r++)
+		memcpy(mb.predY+16*r,in+r*stride,16);
+	unsigned const offsetC = (y0+bestY)/2*(stride/2)+(x0+bestX)/2 ;
+	for (unsigned r = 0 ; r < 8 ; r++) {
+		memcpy(mb.predC[0]+8*r,ref_.cb+offsetC+r*stride/2,8);
+		memcpy(mb.predC[1]+8*r,ref_.cr+offsetC+r*stride/2,8);
+	}
+	return bestSad ;
+}
+
+void avcEncoder_t::codeIntra(macroblock_t &mb, unsigned mbAddr, unsigned qp, unsigned qpc)
+{
+	unsigned const stride = 16*mbWidth_ ;
+	unsigned char *const recon = cur_.y+mb.mby*16*stride+mb.mbx*16 ;
+	unsigned const qbits = 15+qp/6 ;
+	int const round = (1 << qbits)/3 ;
+	int const *mf = quantMF[qp%6];
+	int const *v = rescaleV[qp%6];
+	int dcCoef[16];
+	bool ac = false ;
+	for (unsigned b = 0 ; b < 16 ; b++) {
+		int res[16], coef[16];
+		residual4x4(mb.srcY,mb.predY,16,4*(b&3),4*(b>>2),res);
+		forward4x4(res,coef);
+		dcCoef[b] = coef[0];
+		mb.luma[b][0] = 0 ;
+		for (unsigned i = 1 ; i < 16 ; i++) {
+			mb.luma[b][i] = quantize(coef[i],mf[posClass(i)],qbits,round);
+			ac = ac || mb.luma[b][i];
+		}
+	}
+	int dcH[16];
+	hadamard4x4(dcCoef,dcH);
+	for (unsigned i = 0 ; i < 16 ; i++)
+		mb.lumaDC[i] = quantize(dcH[i]/2,mf[0],qbits+1,2*round);
+	mb.cbpLuma = ac ? 15 : 0 ;
+
+	// 8.5.10: the DC goes back through the Hadamard before scaling
+	int dcF[16];
+	hadamard4x4(mb.lumaDC,dcF);
+	int const dcScale = 16*v[0];
+	for (unsigned b = 0 ; b < 16 ; b++) {
+		int d[16];
+		d[0] = (36 <= qp)
+			? (dcF[b]*dcScale) << (qp/6-6)
+			: (dcF[b]*dcScale + (1 << (5-qp/6))) >> (6-qp/6);
+		for (unsigned i = 1 ; i < 16 ; i++)
+			d[i] = (mb.luma[b][i]*v[posClass(i)]) << (qp/6);
+		inverse4x4(d);
+		reconstruct4x4(mb.predY,16,4*(b&3),4*(b>>2),d,recon,stride);
+		nzY_[mbAddr][b] = nonZero(mb.luma[b],1);
+	}
+	codeChroma(mb,qpc,true);
+}
+
+void avcEncoder_t::codeInter(macroblock_t &mb, unsigned mbAddr, unsigned qp, unsigned qpc)
+{
+	unsigned const stride = 16*mbWidth_ ;
+	unsigned const offset = mb.mby*16*stride+mb.mbx*16 ;
+	unsigned const qbits = 15+qp/6 ;
+	int const round = (1 << qbits)/6 ;
+	int const *mf = quantMF[qp%6];
+	int const *v = rescaleV[qp%6];
+	mb.cbpLuma = 0 ;
+	for (unsigned b = 0 ; b < 16 ; b++) {
+		int res[16], coef[16];
+		residual4x4(mb.srcY,mb.predY,16,4*(b&3),4*(b>>2),res);
+		forward4x4(res,coef);
+		for (unsigned i = 0 ; i < 16 ; i++)
+			mb.luma[b][i] = quantize(coef[i],mf[posClass(i)],qbits,round);
+		nzY_[mbAddr][b] = nonZero(mb.luma[b],0);
+		if (nzY_[mbAddr][b])
+			mb.cbpLuma |= 1 << (((b >> 3) << 1) | ((b & 3) >> 1));
+		int d[16];
+		for (unsigned i = 0 ; i < 16 ; i++)
+			d[i] = (mb.luma[b][i]*v[posClass(i)]) << (qp/6);
+		inverse4x4(d);
+		reconstruct4x4(mb.predY,16,4*(b&3),4*(b>>2),d,cur_.y+offset,stride);
+	}
+	codeChroma(mb,qpc,false);
+}
+
+void avcEncoder_t::writeChroma(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr)
+{
+	if (0 == mb.cbpChroma)
+		return ;
+	for (unsigned plane = 0 ; plane < 2 ; plane++)
+		writeResidual(bw,mb.chromaDC[plane],4,-1);
+	if (2 > mb.cbpChroma)
+		return ;
+	for (unsigned plane = 0 ; plane < 2 ; plane++)
+		for (unsigned b = 0 ; b < 4 ; b++) {
+			int levels[15];
+			for (unsigned i = 0 ; i < 15 ; i++)
+				levels[i] = mb.chroma[plane][b][zigzag[i+1]];
+			writeResidual(bw,levels,15,chromaNC(mbAddr,plane,b&1,b>>1));
+		}
+}
+
+// luma 4x4 blocks go in 8x8 order (6.4.3)
+static inline unsigned blockRaster(unsigned blkIdx)
+{
+	unsigned const x = (blkIdx & 1) | ((blkIdx >> 1) & 2);
+	unsigned const y = ((blkIdx >> 1) & 1) | ((blkIdx >> 2) & 2);
+	return 4*y+x ;
+}
+
+void avcEncoder_t::writeIntra(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr, bool pSlice)
+{
+	// mb_type: I_16x16_..., which follow the 5 P types in a P slice
+	bw.ue((pSlice ? 5 : 0)+1+mb.predMode+4*mb.cbpChroma+(mb.cbpLuma ? 12 : 0));
+	bw.ue(mb.chromaMode);
+	bw.se(0);		// mb_qp_delta
+	int levels[16];
+	for (unsigned i = 0 ; i < 16 ; i++)
+		levels[i] = mb.lumaDC[zigzag[i]];
+	writeResidual(bw,levels,16,lumaNC(mbAddr,0,0));
+	if (mb.cbpLuma) {
+		for (unsigned blk = 0 ; blk < 16 ; blk++) {
+			unsigned const b = blockRaster(blk);
+			for (unsigned i = 0 ; i < 15 ; i++)
+				levels[i] = mb.luma[b][zigzag[i+1]];
+			writeResidual(bw,levels,15,lumaNC(mbAddr,b&3,b>>2));
+		}
+	}
+	writeChroma(bw,mb,mbAddr);
+}
+
+void avcEncoder_t::writeInter(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr)
+{
+	unsigned const cbp = mb.cbpLuma | (mb.cbpChroma << 4);
+	int px, py ;
+	predictMV(mbAddr,px,py);
+	bw.ue(0);		// mb_type: P_L0_16x16
+	bw.se(mb.mvx-px);	// mvd_l0
+	bw.se(mb.mvy-py);
+	bw.ue(interCbpCode[cbp]);
+	if (0 == cbp)
+		return ;
+	bw.se(0);		// mb_qp_delta
+	for (unsigned blk = 0 ; blk < 16 ; blk++) {
+		if (0 == (mb.cbpLuma & (1 << (blk >> 2))))
+			continue;
+		unsigned const b = blockRaster(blk);
+		int levels[16];
+		for (unsigned i = 0 ; i < 16 ; i++)
+			levels[i] = mb.luma[b][zigzag[i]];
+		writeResidual(bw,levels,16,lumaNC(mbAddr,b&3,b>>2));
+	}
+	writeChroma(bw,mb,mbAddr);
+}
+
+unsigned avcEncoder_t::encode(bitWriter_t &bw, picture_t const &pic, EncOpenParam const &op,
+			      bool idr, unsigned frameNum, unsigned idrPicId, unsigned qp)
+{
+	frame_t const prev = ref_ ;
+	ref_ = cur_ ;
+	cur_ = prev ;
+
+	if (51 < qp)
+		qp = 51 ;
+	int qpi = (int)qp+op.EncStdParam.avcParam.avc_chromaQpOffset ;
+	qpi = (qpi < 0) ? 0 : (qpi > 51) ? 51 : qpi ;
+	unsigned const qpc = (30 > qpi) ? qpi : chromaQp[qpi-30];
+
+	EncSliceMode const &sm = op.slicemode ;
+	unsigned const total = mbWidth_*mbHeight_ ;
+	bool const sliced = sm.sliceMode && (0 < sm.sliceSize);
+	unsigned const mbsPerSlice = (sliced && sm.sliceSizeMode) ? sm.sliceSize : total ;
+	unsigned const bitsPerSlice = (sliced && !sm.sliceSizeMode) ? sm.sliceSize : 0 ;
+
+	if (idr)
+		refresh_ = 0 ;
+	else if (0 < op.intraRefresh)
+		refresh_ = (refresh_+op.intraRefresh) % total ;
+
+	macroblock_t mb ;
+	unsigned slices = 0 ;
+	unsigned mbAddr = 0 ;
+	while (mbAddr < total) {
+		bw.startNAL(idr ? 0x65 : 0x61);
+		bw.ue(mbAddr);		// first_mb_in_slice
+		bw.ue(idr ? 7 : 5);	// slice_type: I or P, as are all others
+		bw.ue(0);		// pic_parameter_set_id
+		bw.u(4,frameNum);
+		if (idr) {
+			bw.ue(idrPicId);
+			bw.u(1,0);	// no_output_of_prior_pics_flag
+			bw.u(1,0);	// long_term_reference_flag
+		} else {
+			bw.u(1,0);	// num_ref_idx_active_override_flag
+			bw.u(1,0);	// ref_pic_list_modification_flag_l0
+			bw.u(1,0);	// adaptive_ref_pic_marking_mode_flag
+		}
+		bw.se((int)qp-26);	// slice_qp_delta
+		bw.ue(1);		// disable_deblocking_filter_idc
+
+		unsigned const start = bw.bits();
+		unsigned count = 0 ;
+		unsigned skipRun = 0 ;
+		while (mbAddr < total) {
+			slice_[mbAddr] = slices ;
+			loadSource(pic,mbAddr % mbWidth_,mbAddr / mbWidth_,mb);
+			motion_t &motion = motion_[mbAddr];
+			if (idr) {
+				motion.ref = -1 ;
+				predictIntra(mb,mbAddr);
+				codeIntra(mb,mbAddr,qp,qpc);
+				writeIntra(bw,mb,mbAddr,false);
+			} else if (refresh(mbAddr,op.intraRefresh)
+				   || (predictIntra(mb,mbAddr)+INTRABIAS < predictInter(mb,mbAddr,qp))) {
+				motion.ref = -1 ;
+				predictIntra(mb,mbAddr);
+				codeIntra(mb,mbAddr,qp,qpc);
+				bw.ue(skipRun);
+				skipRun = 0 ;
+				writeIntra(bw,mb,mbAddr,true);
+			} else {
+				codeInter(mb,mbAddr,qp,qpc);
+				int sx, sy ;
+				skipMV(mbAddr,sx,sy);
+				if (mb.cbpLuma || mb.cbpChroma || (sx != mb.mvx) || (sy != mb.mvy)) {
+					bw.ue(skipRun);	// mb_skip_run
+					skipRun = 0 ;
+					writeInter(bw,mb,mbAddr);
+				} else
+					skipRun++ ;	// P_Skip
+				motion.ref = 0 ;
+			}
+			motion.x = (0 == motion.ref) ? mb.mvx : 0 ;
+			motion.y = (0 == motion.ref) ? mb.mvy : 0 ;
+			mbAddr++ ;
+			if (++count >= mbsPerSlice)
+				break;
+			if (bitsPerSlice && (bw.bits()-start >= bitsPerSlice))
+				break;
+		}
+		if (skipRun)
+			bw.ue(skipRun);
+		bw.trailingBits();
+		slices++ ;
+	}
+	return slices ;
+}
+
+#ifdef STANDALONE_AVCENCODER
+/*
+ * Encodes a moving test pattern and writes the stream and the
+ * reconstructed frames, which a decoder should reproduce exactly:
+ *
+ *	avcEncoder [w h [frames [qp [gop [out.h264 [recon.yuv]]]]]]
+ *
+ * Prints the size of each frame.
+ */
+static void pattern(unsigned char *y, unsigned char *cb, unsigned char *cr,
+		    unsigned w, unsigned h, unsigned n)
+{
+	unsigned seed = 12345+n ;
+	for (unsigned row = 0 ; row < h ; row++)
+		for (unsigned col = 0 ; col < w ; col++) {
+			seed = seed*1103515245+12345 ;
+			unsigned const x = col+2*n ;
+			unsigned v = ((x/32 + row/32) & 1) ? 200 : 60 ;
+			v += (x*row/64) & 31 ;
+			v += (seed >> 28);
+			y[row*w+col] = (unsigned char)v ;
+		}
+	for (unsigned row = 0 ; row < (h+1)/2 ; row++)
+		for (unsigned col = 0 ; col < (w+1)/2 ; col++) {
+			cb[row*((w+1)/2)+col] = (unsigned char)(128+(col+n)%64-32);
+			cr[row*((w+1)/2)+col] = (unsigned char)(96+row%80);
+		}
+}
+
+int main(int argc, char const *argv[])
+{
+	unsigned const w = (2 < argc) ? strtoul(argv[1],0,0) : 320 ;
+	unsigned const h = (2 < argc) ? strtoul(argv[2],0,0) : 240 ;
+	unsigned const frames = (3 < argc) ? strtoul(argv[3],0,0) : 10 ;
+	unsigned const qp = (4 < argc) ? strtoul(argv[4],0,0) : 28 ;
+	unsigned const gop = (5 < argc) ? strtoul(argv[5],0,0) : 5 ;
+	FILE *fOut = (6 < argc) ? fopen(argv[6],"wb") : 0 ;
+	FILE *fRecon = (7 < argc) ? fopen(argv[7],"wb") : 0 ;
+
+	unsigned const cw = (w+1)/2, ch = (h+1)/2 ;
+	unsigned char *y = new unsigned char [w*h+2*cw*ch];
+	unsigned char *cb = y+w*h ;
+	unsigned char *cr = cb+cw*ch ;
+	unsigned const outSize = 4*w*h+4096 ;
+	unsigned char *out = new unsigned char [outSize];
+
+	EncOpenParam op ;
+	memset(&op,0,sizeof(op));
+	if (8 < argc) {
+		op.slicemode.sliceMode = 1 ;
+		op.slicemode.sliceSizeMode = 1 ;
+		op.slicemode.sliceSize = strtoul(argv[8],0,0);
+	}
+	avcEncoder_t encoder(w,h);
+	bitWriter_t hdr(out,outSize);
+	encoder.putSPS(hdr);
+	encoder.putPPS(hdr,0);
+	if (fOut)
+		fwrite(out,1,hdr.length(),fOut);
+
+	unsigned long long bytes = 0 ;
+	unsigned idrPicId = 0, frameNum = 0 ;
+	for (unsigned n = 0 ; n < frames ; n++) {
+		pattern(y,cb,cr,w,h,n);
+		avcEncoder_t::picture_t pic = { y, cb, cr, w, cw, 1 };
+		bool const idr = (0 == n % (gop ? gop : 1));
+		if (idr) {
+			idrPicId++ ;
+			frameNum = 0 ;
+		} else
+			frameNum = (frameNum+1) & 15 ;
+		bitWriter_t bw(out,outSize);
+		unsigned const slices = encoder.encode(bw,pic,op,idr,frameNum,idrPicId & 0xffff,qp);
+		printf("frame %u: %c, %u slices, %u bytes\n", n, idr ? 'I' : 'P', slices, bw.length());
+		bytes += bw.length();
+		if (fOut)
+			fwrite(out,1,bw.length(),fOut);
+		if (fRecon) {
+			for (unsigned row = 0 ; row < h ; row++)
+				fwrite(encoder.reconY()+row*encoder.strideY(),1,w,fRecon);
+			for (unsigned row = 0 ; row < ch ; row++)
+				fwrite(encoder.reconCb()+row*encoder.strideC(),1,cw,fRecon);
+			for (unsigned row = 0 ; row < ch ; row++)
+				fwrite(encoder.reconCr()+row*encoder.strideC(),1,cw,fRecon);
+		}
+	}
+	printf("%u frames, %llu bytes at QP %u\n", frames, bytes, qp);
+	if (fOut)
+		fclose(fOut);
+	if (fRecon)
+		fclose(fRecon);
+	delete [] out ;
+	delete [] y ;
+	return 0 ;
+}
+#endif
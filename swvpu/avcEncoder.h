@@ -0,0 +1,181 @@
+#ifndef __AVCENCODER_H__
+#define __AVCENCODER_H__ "$Id$"
+
+/*
+ * avcEncoder.h
+ *
+ * This header file declares the avcEncoder_t class, the H.264
+ * encoder behind the software VPU's STD_AVC, and the bitWriter_t
+ * it writes NAL units with.
+ *
+ * The output is Baseline profile (CAVLC), coded the way a simple
+ * hardware encoder codes it:
+ *
+ *	- I-frames are IDR pictures of Intra 16x16 macroblocks, each
+ *	  predicted vertically, horizontally or from the DC, whichever
+ *	  is closest to the source
+ *	- P-frames predict each 16x16 macroblock from the previous
+ *	  frame with a whole-pel motion search (no sub-pel vectors or
+ *	  smaller partitions), or intra if that's clearly closer, and
+ *	  skip the ones with nothing left after quantizing
+ *	- intra refresh (EncOpenParam.intraRefresh) intra codes that
+ *	  many macroblocks of each P-frame, moving through the picture
+ *	- residuals go through the 4x4 integer transform and a
+ *	  quantizer, so QP, GOP length and slice settings change the
+ *	  size of the output as they do on the VPU
+ *	- the deblocking filter is off
+ *
+ * The reconstructed picture is kept as the next reference, and
+ * matches what a decoder produces exactly.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+#include "vpu_lib.h"
+
+/*
+ * Bit writer for H.264 NAL units. Adds emulation prevention bytes
+ * as it goes, and stops writing (but keeps counting) when full.
+ */
+class bitWriter_t {
+public:
+	bitWriter_t(unsigned char *buf, unsigned size)
+		: buf_(buf), size_(size), pos_(0), bits_(0), numBits_(0), zeros_(0), epb_(false) {}
+
+	void startNAL(unsigned char header){
+		epb_ = false ;
+		putByte(0); putByte(0); putByte(0); putByte(1);
+		zeros_ = 0 ;
+		epb_ = true ;
+		putByte(header);
+	}
+	void u(unsigned n, unsigned v){
+		while (n--) {
+			bits_ = (bits_ << 1) | ((v >> n) & 1);
+			if (8 == ++numBits_) {
+				putByte(bits_);
+				bits_ = numBits_ = 0 ;
+			}
+		}
+	}
+	void ue(unsigned v){
+		unsigned const x = v+1 ;
+		unsigned len = 0 ;
+		while (x >> (len+1))
+			len++ ;
+		u(len,0);
+		u(len+1,x);
+	}
+	void se(int v){ ue((0 < v) ? 2*v-1 : -2*v); }
+	bool aligned(void) const { return 0 == numBits_ ; }
+	void alignZero(void){ while (numBits_) u(1,0); }
+	void trailingBits(void){ u(1,1); alignZero(); }
+	void putByte(unsigned b){
+		if (epb_ && (2 <= zeros_) && (3 >= b)) {
+			put(3);
+			zeros_ = 0 ;
+		}
+		put(b);
+		zeros_ = b ? 0 : zeros_+1 ;
+	}
+	unsigned length(void) const { return pos_ ; }
+	unsigned bits(void) const { return 8*pos_+numBits_ ; }
+	bool overflow(void) const { return pos_ > size_ ; }
+private:
+	void put(unsigned b){
+		if (pos_ < size_)
+			buf_[pos_] = (unsigned char)b ;
+		pos_++ ;
+	}
+	unsigned char  *buf_ ;
+	unsigned	size_ ;
+	unsigned	pos_ ;
+	unsigned	bits_ ;
+	unsigned	numBits_ ;
+	unsigned	zeros_ ;
+	bool		epb_ ;
+};
+
+class avcEncoder_t {
+public:
+	// a source frame, 4:2:0
+	struct picture_t {
+		unsigned char const *y ;
+		unsigned char const *cb ;
+		unsigned char const *cr ;
+		unsigned	strideY ;
+		unsigned	strideC ;
+		unsigned	stepC ;		// 2 if Cb and Cr are interleaved
+	};
+
+	avcEncoder_t(unsigned width, unsigned height);
+	~avcEncoder_t(void);
+
+	void putSPS(bitWriter_t &bw) const ;
+	void putPPS(bitWriter_t &bw, int chromaQpOffset) const ;
+
+	/*
+	 * Encodes pic as slices of an IDR picture or of a P picture
+	 * (predicted from the last one encoded), all at qp, and
+	 * returns the number of slices. The slice settings and chroma
+	 * QP offset come from op.
+	 */
+	unsigned encode(bitWriter_t &bw, picture_t const &pic, EncOpenParam const &op,
+			bool idr, unsigned frameNum, unsigned idrPicId, unsigned qp);
+
+	// of the last picture encoded, in macroblock-sized planes
+	unsigned char const *reconY(void) const { return cur_.y ; }
+	unsigned char const *reconCb(void) const { return cur_.cb ; }
+	unsigned char const *reconCr(void) const { return cur_.cr ; }
+	unsigned strideY(void) const { return 16*mbWidth_ ; }
+	unsigned strideC(void) const { return 8*mbWidth_ ; }
+
+private:
+	avcEncoder_t(avcEncoder_t const &); // no copies
+
+	struct frame_t {
+		unsigned char  *y ;
+		unsigned char  *cb ;
+		unsigned char  *cr ;
+	};
+
+	// one macroblock being coded
+	struct macroblock_t ;
+
+	// of each macroblock in the picture: quarter pels, ref -1 if intra
+	struct motion_t {
+		int	x ;
+		int	y ;
+		int	ref ;
+	};
+
+	void loadSource(picture_t const &pic, unsigned mbx, unsigned mby, macroblock_t &mb) const ;
+	unsigned predictIntra(macroblock_t &mb, unsigned mbAddr) const ;
+	unsigned predictInter(macroblock_t &mb, unsigned mbAddr, unsigned qp) const ;
+	motion_t neighbourMotion(unsigned mbAddr, int dx, int dy, bool &avail) const ;
+	void predictMV(unsigned mbAddr, int &mvx, int &mvy) const ;
+	void skipMV(unsigned mbAddr, int &mvx, int &mvy) const ;
+	void codeIntra(macroblock_t &mb, unsigned mbAddr, unsigned qp, unsigned qpc);
+	void codeInter(macroblock_t &mb, unsigned mbAddr, unsigned qp, unsigned qpc);
+	void codeChroma(macroblock_t &mb, unsigned qpc, bool intra);
+	void writeIntra(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr, bool pSlice);
+	void writeInter(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr);
+	void writeChroma(bitWriter_t &bw, macroblock_t const &mb, unsigned mbAddr);
+	int lumaNC(unsigned mbAddr, unsigned x, unsigned y) const ;
+	int chromaNC(unsigned mbAddr, unsigned plane, unsigned x, unsigned y) const ;
+	bool available(unsigned mbAddr, unsigned neighbour) const ;
+	bool refresh(unsigned mbAddr, int count) const ;
+
+	unsigned	width_ ;
+	unsigned	height_ ;
+	unsigned	mbWidth_ ;
+	unsigned	mbHeight_ ;
+	frame_t		cur_ ;		// being reconstructed
+	frame_t		ref_ ;		// the previous picture
+	unsigned char  (*nzY_)[16];	// coefficients in each 4x4 block, raster order
+	unsigned char  (*nzC_)[2][4];
+	unsigned       *slice_ ;	// of each macroblock
+	motion_t       *motion_ ;
+	unsigned	refresh_ ;	// first macroblock of the intra refresh
+};
+
+#endif
@@ -0,0 +1,826 @@
+/*
+ * Module swvpu.cpp
+ *
+ * This module implements the encoder subset of the i.MX vpu_lib
+ * and vpu_io API (see vpu_lib.h and vpu_io.h in this directory)
+ * in software, so that the encoder classes and the pipelines built
+ * on them can be run, profiled and benchmarked on an ordinary
+ * Linux machine. Build with "make VPU=sw".
+ *
+ *	- memory from IOGetPhyMem() is heap memory at a made-up
+ *	  32-bit address, and IOMapUserMem() gives other buffers
+ *	  (e.g. from a camera without physical addresses) one.
+ *	- frames are encoded in a separate thread, so vpu_IsBusy()
+ *	  and vpu_WaitForInt() behave as they do with the hardware.
+ *	  Set SWVPU_MBPS to a macroblock rate (the i.MX51 manages
+ *	  about 1280x720 at 30fps, or 108000) to also emulate its speed.
+ *	- STD_MJPG is encoded with libjpeg. STD_AVC is encoded as
+ *	  Baseline H.264 by avcEncoder_t (see avcEncoder.h), with a
+ *	  simple rate control when bitRate is set. The emulated GOP
+ *	  structure, slice modes and output buffer handling (including
+ *	  overflow) match the hardware. Other formats aren't supported.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "vpu_lib.h"
+#include "vpu_io.h"
+#include "avcEncoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+
+extern "C" {
+#include <jpeglib.h>
+};
+
+#define PAGE_SIZE	4096
+#define PHYS_BASE	0x10000000
+
+/*
+ * Emulated physical memory
+ */
+struct region_t {
+	PhysicalAddress	phys ;
+	unsigned char  *virt ;
+	unsigned	size ;
+	bool		owned ;
+	region_t       *next ;
+};
+
+static pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER ;
+static region_t *regions = 0 ;
+static PhysicalAddress nextPhys = PHYS_BASE ;
+
+static PhysicalAddress addRegion(unsigned char *virt, unsigned size, bool owned)
+{
+	unsigned const pages = (size+PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+	if (0xF0000000-nextPhys < pages) {
+		fprintf(stderr, "swvpu: out of address space\n");
+		return 0 ;
+	}
+	region_t *r = new region_t ;
+	r->phys = nextPhys ;
+	r->virt = virt ;
+	r->size = size ;
+	r->owned = owned ;
+	r->next = regions ;
+	regions = r ;
+	nextPhys += pages ;
+	return r->phys ;
+}
+
+// returns the CPU address of [addr,addr+len), or 0 if it isn't mapped
+static unsigned char *toVirt(PhysicalAddress addr, unsigned len)
+{
+	unsigned char *rval = 0 ;
+	pthread_mutex_lock(&memLock);
+	for (region_t *r = regions ; r ; r = r->next) {
+		if ((addr >= r->phys) && (addr-r->phys+len <= r->size)) {
+			rval = r->virt + (addr-r->phys);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memLock);
+	return rval ;
+}
+
+int IOGetPhyMem(vpu_mem_desc *buff)
+{
+	void *mem ;
+	if ((0 >= buff->size) || (0 != posix_memalign(&mem,PAGE_SIZE,buff->size)))
+		return -1 ;
+	memset(mem,0,buff->size);
+	pthread_mutex_lock(&memLock);
+	buff->phy_addr = addRegion((unsigned char *)mem,buff->size,true);
+	pthread_mutex_unlock(&memLock);
+	if (0 == buff->phy_addr) {
+		free(mem);
+		return -1 ;
+	}
+	buff->cpu_addr = buff->phy_addr ;
+	buff->virt_uaddr = 0 ;
+	return 0 ;
+}
+
+int IOFreePhyMem(vpu_mem_desc *buff)
+{
+	pthread_mutex_lock(&memLock);
+	for (region_t **pr = &regions ; *pr ; pr = &(*pr)->next) {
+		region_t *r = *pr ;
+		if (r->owned && (r->phys == buff->phy_addr)) {
+			*pr = r->next ;
+			free(r->virt);
+			delete r ;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memLock);
+	buff->phy_addr = buff->cpu_addr = buff->virt_uaddr = 0 ;
+	return 0 ;
+}
+
+int IOGetVirtMem(vpu_mem_desc *buff)
+{
+	unsigned char *virt = toVirt(buff->phy_addr,buff->size);
+	if (0 == virt)
+		return -1 ;
+	buff->virt_uaddr = (unsigned long)virt ;
+	if (sizeof(int) == sizeof(virt))
+		return (int)buff->virt_uaddr ;
+	return 1 ;	// use virt_uaddr
+}
+
+int IOFreeVirtMem(vpu_mem_desc *buff)
+{
+	buff->virt_uaddr = 0 ;
+	return 0 ;
+}
+
+void IOGetIramBase(iram_t *iram)
+{
+	iram->start = iram->end = 0 ;
+}
+
+unsigned long IOMapUserMem(void *virt, unsigned size)
+{
+	PhysicalAddress rval = 0 ;
+	pthread_mutex_lock(&memLock);
+	for (region_t *r = regions ; r ; r = r->next) {
+		if ((r->virt == virt) && (r->size >= size)) {
+			rval = r->phys ;
+			break;
+		}
+	}
+	if (0 == rval)
+		rval = addRegion((unsigned char *)virt,size,false);
+	pthread_mutex_unlock(&memLock);
+	return rval ;
+}
+
+void IOUnmapUserMem(void *virt)
+{
+	pthread_mutex_lock(&memLock);
+	for (region_t **pr = &regions ; *pr ; pr = &(*pr)->next) {
+		region_t *r = *pr ;
+		if (!r->owned && (r->virt == virt)) {
+			*pr = r->next ;
+			delete r ;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memLock);
+}
+
+struct CodecInst {
+	EncOpenParam	open ;
+	unsigned	mbWidth ;
+	unsigned	mbHeight ;
+	FrameBuffer    *fbs ;
+	int		numFbs ;
+	unsigned	picCount ;	// since the last I-frame
+	unsigned	frameNum ;
+	unsigned	idrPicId ;
+	avcEncoder_t   *avc ;
+	unsigned	qp ;		// under rate control
+	long long	fullness ;	// bits over the rate so far
+	// current frame
+	FrameBuffer	src ;
+	bool		intra ;
+	int		quantParam ;
+	PhysicalAddress	outAddr ;
+	unsigned	outSize ;
+	EncOutputInfo	out ;
+	bool		done ;
+};
+
+/*
+ * The emulated VPU: one frame at a time, encoded by a thread
+ */
+static struct {
+	pthread_mutex_t	lock ;
+	pthread_cond_t	cond ;
+	pthread_t	thread ;
+	unsigned	users ;
+	bool		stop ;
+	CodecInst      *job ;
+	bool volatile	busy ;
+	unsigned	mbPerSec ;
+} vpu = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static long long tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000 ;
+}
+
+// frameRateInfo is the rate in the low 16 bits, and the divisor-1 above them
+static unsigned frameRate(EncOpenParam const &op)
+{
+	unsigned const rate = op.frameRateInfo & 0xffff ;
+	unsigned const fps = rate/((op.frameRateInfo >> 16)+1);
+	return fps ? fps : 1 ;
+}
+
+/*
+ * Without rate control (bitRate 0), frames are coded at the QP
+ * given to vpu_EncStartOneFrame(). With it, each P-frame's QP moves
+ * a step towards keeping the output at bitRate kbps, and I-frames
+ * use rcIntraQp if it's set.
+ */
+static unsigned frameQP(CodecInst &inst)
+{
+	EncOpenParam const &op = inst.open ;
+	int qp ;
+	if (0 == op.bitRate)
+		qp = inst.quantParam ;
+	else if (inst.intra && (0 <= op.rcIntraQp))
+		qp = op.rcIntraQp ;
+	else {
+		long long const target = (long long)op.bitRate*1000/frameRate(op);
+		qp = inst.qp ;
+		if (inst.fullness > 2*target)
+			qp += 2 ;
+		else if (inst.fullness > target/2)
+			qp++ ;
+		else if (inst.fullness < -target/2)
+			qp-- ;
+		if (op.userQpMinEnable && (qp < op.userQpMin))
+			qp = op.userQpMin ;
+		if (op.userQpMaxEnable && (qp > op.userQpMax))
+			qp = op.userQpMax ;
+		qp = (qp < 0) ? 0 : (qp > 51) ? 51 : qp ;
+		if (!inst.intra)
+			inst.qp = qp ;
+	}
+	return (qp < 0) ? 0 : (qp > 51) ? 51 : qp ;
+}
+
+static void encodeAVC(CodecInst &inst, unsigned char *out)
+{
+	FrameBuffer const &fb = inst.src ;
+	unsigned const w = inst.open.picWidth ;
+	unsigned const h = inst.open.picHeight ;
+	unsigned const cw = (w+1)/2 ;
+	unsigned const ch = (h+1)/2 ;
+	unsigned const cstep = inst.open.chromaInterleave ? 2 : 1 ;
+	unsigned char const *y = toVirt(fb.bufY,fb.strideY*(h-1)+w);
+	unsigned char const *cb = toVirt(fb.bufCb,fb.strideC*(ch-1)+cw*cstep);
+	unsigned char const *cr = inst.open.chromaInterleave
+				  ? cb+1
+				  : toVirt(fb.bufCr,fb.strideC*(ch-1)+cw);
+	if ((0 == y) || (0 == cb) || (0 == cr)) {
+		fprintf(stderr, "swvpu: source frame 0x%x/0x%x/0x%x not mapped\n", fb.bufY, fb.bufCb, fb.bufCr);
+		return ;
+	}
+
+	avcEncoder_t::picture_t const pic = {
+		y, cb, cr, (unsigned)fb.strideY, (unsigned)fb.strideC, cstep
+	};
+	bitWriter_t bw(out,inst.outSize);
+	inst.out.numOfSlices = inst.avc->encode(bw,pic,inst.open,inst.intra,
+						inst.frameNum,inst.idrPicId,frameQP(inst));
+	inst.out.bitstreamSize = bw.overflow() ? inst.outSize : bw.length();
+	inst.out.bitstreamWrapAround = bw.overflow();
+	if (inst.open.bitRate)
+		inst.fullness += 8LL*bw.length()
+				 - (long long)inst.open.bitRate*1000/frameRate(inst.open);
+}
+
+/*
+ * libjpeg destination writing straight into the output buffer.
+ * When it fills, the rest of the frame is discarded.
+ */
+struct jpegDest_t {
+	struct jpeg_destination_mgr pub ;
+	unsigned char  *buf ;
+	unsigned	size ;
+	bool		overflow ;
+	JOCTET		discard[4096];
+};
+
+static void jpegInit(j_compress_ptr cinfo)
+{
+	jpegDest_t *dest = (jpegDest_t *)cinfo->dest ;
+	dest->pub.next_output_byte = dest->buf ;
+	dest->pub.free_in_buffer = dest->size ;
+}
+
+static boolean jpegEmpty(j_compress_ptr cinfo)
+{
+	jpegDest_t *dest = (jpegDest_t *)cinfo->dest ;
+	dest->overflow = true ;
+	dest->pub.next_output_byte = dest->discard ;
+	dest->pub.free_in_buffer = sizeof(dest->discard);
+	return TRUE ;
+}
+
+static void jpegTerm(j_compress_ptr){}
+
+static void encodeMJPG(CodecInst &inst, unsigned char *out)
+{
+	FrameBuffer const &fb = inst.src ;
+	unsigned const w = inst.open.picWidth ;
+	unsigned const h = inst.open.picHeight ;
+	bool const is422 = (0 != inst.open.EncStdParam.mjpgParam.mjpg_sourceFormat);
+	unsigned const cw = (w+1)/2 ;
+	unsigned const ch = is422 ? h : (h+1)/2 ;
+	unsigned const cstep = inst.open.chromaInterleave ? 2 : 1 ;
+	unsigned char const *y = toVirt(fb.bufY,fb.strideY*(h-1)+w);
+	unsigned char const *cb = toVirt(fb.bufCb,fb.strideC*(ch-1)+cw*cstep);
+	unsigned char const *cr = inst.open.chromaInterleave
+				  ? cb+1
+				  : toVirt(fb.bufCr,fb.strideC*(ch-1)+cw);
+	if ((0 == y) || (0 == cb) || (0 == cr)) {
+		fprintf(stderr, "swvpu: source frame 0x%x/0x%x/0x%x not mapped\n", fb.bufY, fb.bufCb, fb.bufCr);
+		return ;
+	}
+
+	struct jpeg_compress_struct cinfo ;
+	struct jpeg_error_mgr jerr ;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	jpegDest_t dest ;
+	dest.pub.init_destination = jpegInit ;
+	dest.pub.empty_output_buffer = jpegEmpty ;
+	dest.pub.term_destination = jpegTerm ;
+	dest.buf = out ;
+	dest.size = inst.outSize ;
+	dest.overflow = false ;
+	cinfo.dest = &dest.pub ;
+
+	cinfo.image_width = w ;
+	cinfo.image_height = h ;
+	cinfo.input_components = 3 ;
+	cinfo.in_color_space = JCS_YCbCr ;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_colorspace(&cinfo,JCS_YCbCr);
+	jpeg_set_quality(&cinfo,90,TRUE);
+	cinfo.dct_method = JDCT_IFAST ;
+	cinfo.raw_data_in = TRUE ;
+	cinfo.comp_info[0].h_samp_factor = 2 ;
+	cinfo.comp_info[0].v_samp_factor = is422 ? 1 : 2 ;
+	for (unsigned c = 1 ; c < 3 ; c++)
+		cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1 ;
+	jpeg_start_compress(&cinfo,TRUE);
+
+	// copy into padded rows, so libjpeg never reads past the frame
+	unsigned const yRows = is422 ? 8 : 16 ;
+	unsigned const yWidth = (w+15) & ~15 ;
+	unsigned const cWidth = yWidth/2 ;
+	JSAMPLE *const samples = new JSAMPLE [yRows*yWidth+16*cWidth];
+	JSAMPROW yRow[16], cbRow[8], crRow[8];
+	for (unsigned r = 0 ; r < yRows ; r++)
+		yRow[r] = samples+r*yWidth ;
+	for (unsigned r = 0 ; r < 8 ; r++) {
+		cbRow[r] = samples+yRows*yWidth+r*cWidth ;
+		crRow[r] = cbRow[r]+8*cWidth ;
+	}
+	JSAMPARRAY planes[3] = { yRow, cbRow, crRow };
+
+	for (unsigned row = 0 ; row < h ; row += yRows) {
+		for (unsigned r = 0 ; r < yRows ; r++) {
+			unsigned in = (row+r < h) ? row+r : h-1 ;
+			memcpy(yRow[r],y+in*fb.strideY,w);
+			memset(yRow[r]+w,yRow[r][w-1],yWidth-w);
+		}
+		for (unsigned r = 0 ; r < 8 ; r++) {
+			unsigned in = row/(yRows/8)+r ;
+			if (in >= ch)
+				in = ch-1 ;
+			unsigned char const *u = cb+in*fb.strideC ;
+			unsigned char const *v = cr+in*fb.strideC ;
+			for (unsigned c = 0 ; c < cWidth ; c++) {
+				unsigned x = ((c < cw) ? c : cw-1)*cstep ;
+				cbRow[r][c] = u[x];
+				crRow[r][c] = v[x];
+			}
+		}
+		jpeg_write_raw_data(&cinfo,planes,yRows);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	delete [] samples ;
+
+	inst.out.bitstreamSize = dest.overflow ? inst.outSize : inst.outSize-dest.pub.free_in_buffer ;
+	inst.out.bitstreamWrapAround = dest.overflow ;
+	inst.out.numOfSlices = 1 ;
+}
+
+static void encode(CodecInst &inst)
+{
+	unsigned char *out = toVirt(inst.outAddr,inst.outSize);
+	if (0 == out) {
+		fprintf(stderr, "swvpu: output buffer 0x%x/%u not mapped\n", inst.outAddr, inst.outSize);
+		return ;
+	}
+	inst.out.bitstreamBuffer = inst.outAddr ;
+	inst.out.picType = inst.intra ? 0 : 1 ;
+	if (STD_AVC == inst.open.bitstreamFormat)
+		encodeAVC(inst,out);
+	else
+		encodeMJPG(inst,out);
+}
+
+static void *vpuThread(void *)
+{
+	pthread_mutex_lock(&vpu.lock);
+	while (!vpu.stop) {
+		if (0 == vpu.job) {
+			pthread_cond_wait(&vpu.cond,&vpu.lock);
+			continue ;
+		}
+		CodecInst &inst = *vpu.job ;
+		pthread_mutex_unlock(&vpu.lock);
+
+		long long const start = tickUs();
+		encode(inst);
+		if (vpu.mbPerSec) {
+			long long const us = (long long)inst.mbWidth*inst.mbHeight*1000000/vpu.mbPerSec ;
+			long long const elapsed = tickUs()-start ;
+			if (elapsed < us)
+				usleep(us-elapsed);
+		}
+
+		pthread_mutex_lock(&vpu.lock);
+		inst.done = true ;
+		vpu.job = 0 ;
+		vpu.busy = false ;
+		pthread_cond_broadcast(&vpu.cond);
+	}
+	pthread_mutex_unlock(&vpu.lock);
+	return 0 ;
+}
+
+RetCode vpu_Init(void *)
+{
+	RetCode rval = RETCODE_SUCCESS ;
+	pthread_mutex_lock(&vpu.lock);
+	if (0 == vpu.users) {
+		char const *mbps = getenv("SWVPU_MBPS");
+		vpu.mbPerSec = mbps ? strtoul(mbps,0,0) : 0 ;
+		vpu.stop = false ;
+		vpu.job = 0 ;
+		vpu.busy = false ;
+		if (0 != pthread_create(&vpu.thread,0,vpuThread,0))
+			rval = RETCODE_FAILURE ;
+	}
+	if (RETCODE_SUCCESS == rval)
+		vpu.users++ ;
+	pthread_mutex_unlock(&vpu.lock);
+	return rval ;
+}
+
+void vpu_UnInit(void)
+{
+	pthread_mutex_lock(&vpu.lock);
+	if (vpu.users && (0 == --vpu.users)) {
+		vpu.stop = true ;
+		pthread_cond_broadcast(&vpu.cond);
+		pthread_mutex_unlock(&vpu.lock);
+		pthread_join(vpu.thread,0);
+		return ;
+	}
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+int vpu_IsBusy(void)
+{
+	return vpu.busy ;
+}
+
+RetCode vpu_WaitForInt(int timeout_in_ms)
+{
+	struct timeval now ;
+	gettimeofday(&now,0);
+	struct timespec deadline ;
+	long long ns = (long long)now.tv_usec*1000+(long long)timeout_in_ms*1000000 ;
+	deadline.tv_sec = now.tv_sec+ns/1000000000 ;
+	deadline.tv_nsec = ns%1000000000 ;
+
+	RetCode rval = RETCODE_SUCCESS ;
+	pthread_mutex_lock(&vpu.lock);
+	while (vpu.busy) {
+		if (ETIMEDOUT == pthread_cond_timedwait(&vpu.cond,&vpu.lock,&deadline)) {
+			rval = RETCODE_FAILURE ;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&vpu.lock);
+	return rval ;
+}
+
+RetCode vpu_EncOpen(EncHandle *handle, EncOpenParam *param)
+{
+	if ((STD_AVC != param->bitstreamFormat) && (STD_MJPG != param->bitstreamFormat)) {
+		fprintf(stderr, "swvpu: format %d is not supported\n", param->bitstreamFormat);
+		return RETCODE_NOT_SUPPORTED ;
+	}
+	if ((0 >= param->picWidth) || (0 >= param->picHeight)) {
+		return RETCODE_INVALID_PARAM ;
+	}
+	if (0 == toVirt(param->bitstreamBuffer,param->bitstreamBufferSize)) {
+		fprintf(stderr, "swvpu: bitstream buffer 0x%x is not mapped\n", param->bitstreamBuffer);
+		return RETCODE_INVALID_PARAM ;
+	}
+	CodecInst *inst = new CodecInst ;
+	memset(inst,0,sizeof(*inst));
+	inst->open = *param ;
+	inst->mbWidth = (param->picWidth+15)/16 ;
+	inst->mbHeight = (param->picHeight+15)/16 ;
+	if (STD_AVC == param->bitstreamFormat)
+		inst->avc = new avcEncoder_t(param->picWidth,param->picHeight);
+	inst->qp = 30 ;
+	*handle = inst ;
+	return RETCODE_SUCCESS ;
+}
+
+RetCode vpu_EncClose(EncHandle handle)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	pthread_mutex_lock(&vpu.lock);
+	while (vpu.job == handle)
+		pthread_cond_wait(&vpu.cond,&vpu.lock);
+	pthread_mutex_unlock(&vpu.lock);
+	delete handle->avc ;
+	delete handle ;
+	return RETCODE_SUCCESS ;
+}
+
+RetCode vpu_EncGetInitialInfo(EncHandle handle, EncInitialInfo *info)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	info->minFrameBufferCount = 0 ;	// avcEncoder_t keeps its own
+	return RETCODE_SUCCESS ;
+}
+
+RetCode vpu_EncRegisterFrameBuffer(EncHandle handle, FrameBuffer *bufArray,
+				   int num, int, int)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	handle->fbs = bufArray ;
+	handle->numFbs = num ;
+	return RETCODE_SUCCESS ;
+}
+
+RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *parameter)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	EncOpenParam &op = handle->open ;
+	switch (cmd) {
+		case ENC_PUT_AVC_HEADER: {
+			if (STD_AVC != op.bitstreamFormat)
+				return RETCODE_INVALID_COMMAND ;
+			EncHeaderParam *hdr = (EncHeaderParam *)parameter ;
+			if (!op.dynamicAllocEnable) {
+				hdr->buf = op.bitstreamBuffer ;
+				hdr->size = op.bitstreamBufferSize ;
+			}
+			unsigned char *out = toVirt(hdr->buf,hdr->size);
+			if (0 == out)
+				return RETCODE_INVALID_PARAM ;
+			bitWriter_t bw(out,hdr->size);
+			if (SPS_RBSP == hdr->headerType)
+				handle->avc->putSPS(bw);
+			else
+				handle->avc->putPPS(bw,op.EncStdParam.avcParam.avc_chromaQpOffset);
+			hdr->size = bw.length();
+			return bw.overflow() ? RETCODE_FAILURE : RETCODE_SUCCESS ;
+		}
+		case ENC_SET_SEARCHRAM_PARAM:
+			return RETCODE_SUCCESS ;
+		case ENC_SET_GOP_NUMBER:
+			op.gopSize = *(int *)parameter ;
+			return RETCODE_SUCCESS ;
+		case ENC_SET_INTRA_QP:
+			op.rcIntraQp = *(int *)parameter ;
+			return RETCODE_SUCCESS ;
+		case ENC_SET_BITRATE:
+			op.bitRate = *(int *)parameter ;
+			return RETCODE_SUCCESS ;
+		case ENC_SET_FRAME_RATE:
+			op.frameRateInfo = *(int *)parameter ;
+			return RETCODE_SUCCESS ;
+		case ENC_SET_INTRA_MB_REFRESH_NUMBER:
+			op.intraRefresh = *(int *)parameter ;
+			return RETCODE_SUCCESS ;
+		case ENC_SET_SLICE_INFO: {
+			EncSliceMode const *sm = (EncSliceMode const *)parameter ;
+			op.slicemode = *sm ;
+			return RETCODE_SUCCESS ;
+		}
+		default:
+			fprintf(stderr, "swvpu: command %d is not supported\n", cmd);
+			return RETCODE_INVALID_COMMAND ;
+	}
+}
+
+RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam *param)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	if ((0 == param) || (0 == param->sourceFrame))
+		return RETCODE_INVALID_PARAM ;
+	if (vpu.busy)
+		return RETCODE_FRAME_NOT_COMPLETE ;
+	CodecInst &inst = *handle ;
+	EncOpenParam const &op = inst.open ;
+	inst.src = *param->sourceFrame ;
+	inst.quantParam = param->quantParam ;
+	if (op.dynamicAllocEnable) {
+		inst.outAddr = param->picStreamBufferAddr ;
+		inst.outSize = param->picStreamBufferSize ;
+	} else {
+		inst.outAddr = op.bitstreamBuffer ;
+		inst.outSize = op.bitstreamBufferSize ;
+	}
+
+	// same GOP structure as the hardware: an I-frame every gopSize
+	inst.intra = param->forceIPicture
+		     || (0 == inst.picCount)
+		     || ((0 < op.gopSize) && (inst.picCount >= (unsigned)op.gopSize));
+	if (inst.intra) {
+		inst.picCount = 0 ;
+		inst.frameNum = 0 ;
+		inst.idrPicId = (inst.idrPicId+1) & 0xffff ;
+	} else
+		inst.frameNum = (inst.frameNum+1) & 15 ;
+	inst.picCount++ ;
+	memset(&inst.out,0,sizeof(inst.out));
+	inst.done = false ;
+
+	pthread_mutex_lock(&vpu.lock);
+	vpu.busy = true ;
+	vpu.job = &inst ;
+	pthread_cond_broadcast(&vpu.cond);
+	pthread_mutex_unlock(&vpu.lock);
+	return RETCODE_SUCCESS ;
+}
+
+RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo *info)
+{
+	if (0 == handle)
+		return RETCODE_INVALID_HANDLE ;
+	if (!handle->done)
+		return RETCODE_FRAME_NOT_COMPLETE ;
+	*info = handle->out ;
+	return RETCODE_SUCCESS ;
+}
+
+#ifdef STANDALONE_SWVPU
+/*
+ * Encodes synthetic frames with h264_encoder_t (and one frame with
+ * mjpeg_encoder_t) through the queued interface, and reports the
+ * frame rate and per-frame encode time:
+ *
+ *	swvpu_bench [w h [frames [out.h264 [out.jpg]]]]
+ *
+ * Frame n has Y = x+y+2n, U = 2x+n, V = 2y (mod 256): a pan,
+ * which the P-frames (predicted from the same place in the last
+ * frame) code as a small residual.
+ */
+#include "imx_vpu.h"
+#include "imx_h264_encoder.h"
+#include "imx_mjpeg_encoder.h"
+
+#define NUMBUFFERS 4
+
+static void fill(unsigned char *y, unsigned char *u, unsigned char *v,
+		 frameLayout_t const &layout, unsigned n)
+{
+	for (unsigned row = 0 ; row < layout.height ; row++)
+		for (unsigned col = 0 ; col < layout.width ; col++)
+			y[row*layout.y.stride+col*layout.y.step] = col+row+2*n ;
+	for (unsigned row = 0 ; row < layout.u.height ; row++)
+		for (unsigned col = 0 ; col < layout.u.width ; col++) {
+			u[row*layout.u.stride+col*layout.u.step] = 2*col+n ;
+			v[row*layout.v.stride+col*layout.v.step] = 2*row ;
+		}
+}
+
+int main(int argc, char const * const argv[])
+{
+	unsigned const w = (2 < argc) ? strtoul(argv[1],0,0) : 640 ;
+	unsigned const h = (2 < argc) ? strtoul(argv[2],0,0) : 480 ;
+	unsigned const frames = (3 < argc) ? strtoul(argv[3],0,0) : 100 ;
+	FILE *fOut = (4 < argc) ? fopen(argv[4],"wb") : 0 ;
+	unsigned const fourcc = 0x32315559 ;	// YU12
+
+	vpu_t vpu ;
+	if (!vpu.worked())
+		return -1 ;
+	frameLayout_t layout(fourcc,w,h);
+	if (!layout.valid()) {
+		fprintf(stderr, "invalid size %ux%u\n", w, h);
+		return -1 ;
+	}
+	bufferHandle_t handles[NUMBUFFERS];
+	vpu_mem_desc mem[NUMBUFFERS];
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++) {
+		memset(mem+i,0,sizeof(mem[i]));
+		mem[i].size = layout.size ;
+		if ((0 != IOGetPhyMem(mem+i)) || (0 >= IOGetVirtMem(mem+i))) {
+			fprintf(stderr, "Error allocating frame %u\n", i);
+			return -1 ;
+		}
+		handles[i].dmafd = -1 ;
+		handles[i].phys = mem[i].phy_addr ;
+		handles[i].virt = (unsigned char *)mem[i].virt_uaddr ;
+		handles[i].length = layout.size ;
+		handles[i].index = i ;
+	}
+
+	{
+		h264_encoder_t encoder(vpu,w,h,fourcc,30,handles,NUMBUFFERS);
+		if (!encoder.initialized()) {
+			fprintf(stderr, "Error initializing encoder\n");
+			return -1 ;
+		}
+		long long const start = tickUs();
+		long long startUs[NUMBUFFERS];
+		long long encodeUs = 0 ;
+		long long maxUs = 0 ;
+		unsigned long long bytes = 0 ;
+		unsigned done = 0 ;
+		for (unsigned n = 0 ; n <= frames ; n++) {
+			// fill frame n while the VPU encodes frame n-1
+			if (n < frames) {
+				unsigned char *y, *u, *v ;
+				encoder.get_bufs(n%NUMBUFFERS,y,u,v);
+				fill(y,u,v,layout,n);
+			}
+			if (encoder.busy()) {
+				void const *outData ;
+				unsigned outLength ;
+				bool iframe ;
+				void *tag ;
+				if (encoder.encode_complete(outData,outLength,iframe,tag,-1)) {
+					long long const us = tickUs()-startUs[(unsigned long)tag % NUMBUFFERS];
+					encodeUs += us ;
+					if (us > maxUs)
+						maxUs = us ;
+					bytes += outLength ;
+					done++ ;
+					if (fOut) {
+						void const *hdr ;
+						unsigned len ;
+						if (iframe && encoder.getSPS(hdr,len))
+							fwrite(hdr,1,len,fOut);
+						if (iframe && encoder.getPPS(hdr,len))
+							fwrite(hdr,1,len,fOut);
+						fwrite(outData,1,outLength,fOut);
+					}
+					encoder.releaseOutput(outData);
+				}
+			}
+			if (n < frames) {
+				startUs[n%NUMBUFFERS] = tickUs();
+				if (!encoder.start_encode(n%NUMBUFFERS,(void *)(unsigned long)n))
+					break;
+			}
+		}
+		long long const elapsed = tickUs()-start ;
+		printf("%u of %u %ux%u frames in %lld ms: %.1f fps, %llu bytes\n",
+		       done, frames, w, h, elapsed/1000,
+		       elapsed ? done*1000000.0/elapsed : 0.0, bytes);
+		if (done)
+			printf("encode: avg %lld us, max %lld us, %u overflows\n",
+			       encodeUs/done, maxUs, encoder.outputs().numOverflows());
+		encoder.dumpStats("h264");
+	}
+	if (fOut)
+		fclose(fOut);
+
+	if (5 < argc) {
+		mjpeg_encoder_t jpeg(vpu,w,h,fourcc,handles,NUMBUFFERS);
+		void const *outData ;
+		unsigned outLength ;
+		if (jpeg.initialized() && jpeg.encode(0,outData,outLength)) {
+			FILE *fJPEG = fopen(argv[5],"wb");
+			if (fJPEG) {
+				fwrite(outData,1,outLength,fJPEG);
+				fclose(fJPEG);
+				printf("wrote %u bytes to %s\n", outLength, argv[5]);
+			} else
+				perror(argv[5]);
+			jpeg.releaseOutput(outData);
+		} else
+			fprintf(stderr, "JPEG encode error\n");
+	}
+
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++)
+		IOFreePhyMem(mem+i);
+	return 0 ;
+}
+#endif
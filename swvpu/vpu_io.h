@@ -0,0 +1,56 @@
+#ifndef __SWVPU_VPU_IO_H__
+#define __SWVPU_VPU_IO_H__ "$Id$"
+
+/*
+ * swvpu/vpu_io.h
+ *
+ * Stand-in for the i.MX vpu_io.h used when building with VPU=sw.
+ * See swvpu.cpp.
+ *
+ * "Physical" memory is ordinary heap memory at a made-up 32-bit
+ * address. IOGetVirtMem() fills in virt_uaddr, which callers
+ * should use instead of its return value (a pointer may not fit
+ * in an int on a 64-bit host).
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+typedef struct vpu_mem_desc {
+	int size;
+	unsigned long phy_addr;
+	unsigned long cpu_addr;		/* kernel virtual address */
+	unsigned long virt_uaddr;	/* virtual user space address */
+} vpu_mem_desc;
+
+typedef struct iram_t {
+	unsigned long start;
+	unsigned long end;
+} iram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int IOGetPhyMem(vpu_mem_desc *buff);
+int IOFreePhyMem(vpu_mem_desc *buff);
+int IOGetVirtMem(vpu_mem_desc *buff);
+int IOFreeVirtMem(vpu_mem_desc *buff);
+void IOGetIramBase(iram_t *iram);
+
+/*
+ * Software only: gives a CPU buffer (e.g. a camera buffer that
+ * has no physical address) an address the emulated VPU can read.
+ * Mapping the same buffer again returns the same address.
+ */
+unsigned long IOMapUserMem(void *virt, unsigned size);
+
+// forgets a mapping from IOMapUserMem(), before the buffer is freed
+void IOUnmapUserMem(void *virt);
+
+static inline int cpu_is_mx27(void) { return 0 ; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
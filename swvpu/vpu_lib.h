@@ -0,0 +1,291 @@
+#ifndef __SWVPU_VPU_LIB_H__
+#define __SWVPU_VPU_LIB_H__ "$Id$"
+
+/*
+ * swvpu/vpu_lib.h
+ *
+ * Stand-in for the i.MX vpu_lib.h used when building with VPU=sw.
+ * It declares the encoder subset of the API with the same names
+ * and fields as the Freescale library, implemented in software
+ * by swvpu.cpp.
+ *
+ * Code that needs to know can test VPU_SOFTWARE.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#define VPU_SOFTWARE 1
+
+typedef unsigned char Uint8;
+typedef unsigned short Uint16;
+typedef unsigned int Uint32;
+typedef Uint32 PhysicalAddress;
+
+typedef enum {
+	STD_MPEG4 = 0,
+	STD_H263,
+	STD_AVC,
+	STD_VC1,
+	STD_MPEG2,
+	STD_DIV3,
+	STD_RV,
+	STD_MJPG
+} CodStd;
+
+typedef enum {
+	RETCODE_SUCCESS = 0,
+	RETCODE_FAILURE = -1,
+	RETCODE_INVALID_HANDLE = -2,
+	RETCODE_INVALID_PARAM = -3,
+	RETCODE_INVALID_COMMAND = -4,
+	RETCODE_ROTATOR_OUTPUT_NOT_SET = -5,
+	RETCODE_ROTATOR_STRIDE_NOT_SET = -11,
+	RETCODE_FRAME_NOT_COMPLETE = -6,
+	RETCODE_INVALID_FRAME_BUFFER = -7,
+	RETCODE_INSUFFICIENT_FRAME_BUFFERS = -8,
+	RETCODE_INVALID_STRIDE = -9,
+	RETCODE_WRONG_CALL_SEQUENCE = -10,
+	RETCODE_CALLED_BEFORE = -12,
+	RETCODE_NOT_INITIALIZED = -13,
+	RETCODE_DEBLOCKING_OUTPUT_NOT_SET = -14,
+	RETCODE_NOT_SUPPORTED = -15,
+	RETCODE_REPORT_BUF_NOT_SET = -16,
+	RETCODE_FAILURE_TIMEOUT = -17,
+	RETCODE_MEMORY_ACCESS_VIOLATION = -18,
+	RETCODE_JPEG_EOS = -19,
+	RETCODE_JPEG_BIT_EMPTY = -20
+} RetCode;
+
+typedef enum {
+	ENABLE_ROTATION,
+	DISABLE_ROTATION,
+	ENABLE_MIRRORING,
+	DISABLE_MIRRORING,
+	ENABLE_DERING,
+	DISABLE_DERING,
+	SET_MIRROR_DIRECTION,
+	SET_ROTATION_ANGLE,
+	SET_ROTATOR_OUTPUT,
+	SET_ROTATOR_STRIDE,
+	ENC_GET_SPS_RBSP,
+	ENC_GET_PPS_RBSP,
+	DEC_SET_SPS_RBSP,
+	DEC_SET_PPS_RBSP,
+	ENC_PUT_MP4_HEADER,
+	ENC_PUT_AVC_HEADER,
+	ENC_SET_SEARCHRAM_PARAM,
+	ENC_GET_VOS_HEADER,
+	ENC_GET_VO_HEADER,
+	ENC_GET_VOL_HEADER,
+	ENC_GET_JPEG_HEADER,
+	ENC_SET_INTRA_MB_REFRESH_NUMBER,
+	DEC_SET_DEBLOCK_OUTPUT,
+	ENC_ENABLE_HEC,
+	ENC_DISABLE_HEC,
+	ENC_SET_SLICE_INFO,
+	ENC_SET_GOP_NUMBER,
+	ENC_SET_INTRA_QP,
+	ENC_SET_BITRATE,
+	ENC_SET_FRAME_RATE,
+	ENC_SET_REPORT_MBINFO,
+	ENC_SET_REPORT_MVINFO,
+	ENC_SET_REPORT_SLICEINFO,
+	DEC_SET_REPORT_BUFSTAT,
+	DEC_SET_REPORT_MBINFO,
+	DEC_SET_REPORT_MVINFO,
+	DEC_SET_REPORT_USERDATA,
+	SET_DBK_OFFSET,
+	SET_WRITE_MEM_PROTECT
+} CodecCommand;
+
+typedef enum {
+	VOS_HEADER = 0,
+	VIS_HEADER,
+	VOL_HEADER
+} Mp4HeaderType;
+
+typedef enum {
+	SPS_RBSP = 0,
+	PPS_RBSP
+} AvcHeaderType;
+
+typedef struct {
+	int left;
+	int top;
+	int right;
+	int bottom;
+} Rect;
+
+typedef struct {
+	PhysicalAddress bufY;
+	PhysicalAddress bufCb;
+	PhysicalAddress bufCr;
+	PhysicalAddress bufMvCol;
+	int strideY;
+	int strideC;
+} FrameBuffer;
+
+typedef struct CodecInst EncInst;
+typedef EncInst *EncHandle;
+
+typedef struct {
+	int mp4_dataPartitionEnable;
+	int mp4_reversibleVlcEnable;
+	int mp4_intraDcVlcThr;
+	int mp4_hecEnable;
+	int mp4_verid;
+} EncMp4Param;
+
+typedef struct {
+	int h263_annexJEnable;
+	int h263_annexKEnable;
+	int h263_annexTEnable;
+} EncH263Param;
+
+typedef struct {
+	int avc_constrainedIntraPredFlag;
+	int avc_disableDeblk;
+	int avc_deblkFilterOffsetAlpha;
+	int avc_deblkFilterOffsetBeta;
+	int avc_chromaQpOffset;
+	int avc_audEnable;
+	int avc_fmoEnable;
+	int avc_fmoSliceNum;
+	int avc_fmoType;
+	int avc_fmoSliceSaveBufSize;
+} EncAvcParam;
+
+typedef struct {
+	int mjpg_sourceFormat;	/* 0: 420, 1: 422 horizontal */
+	int mjpg_restartInterval;
+	int mjpg_thumbNailEnable;
+	int mjpg_thumbNailWidth;
+	int mjpg_thumbNailHeight;
+	Uint8 *mjpg_hufTable;
+	Uint8 *mjpg_qMatTable;
+} EncMjpgParam;
+
+typedef struct {
+	int sliceMode;		/* 0: one slice per picture */
+	int sliceSizeMode;	/* 0: size in bits, 1: size in macroblocks */
+	int sliceSize;
+} EncSliceMode;
+
+typedef struct {
+	PhysicalAddress bitstreamBuffer;
+	Uint32 bitstreamBufferSize;
+	CodStd bitstreamFormat;
+
+	int picWidth;
+	int picHeight;
+	Uint32 frameRateInfo;
+	int bitRate;
+	int initialDelay;
+	int vbvBufferSize;
+	int enableAutoSkip;
+	int gopSize;
+
+	EncSliceMode slicemode;
+	int intraRefresh;
+
+	int sliceReport;
+	int mbReport;
+	int mbQpReport;
+	int rcIntraQp;
+	int chromaInterleave;
+	int dynamicAllocEnable;
+	int ringBufferEnable;
+
+	union {
+		EncMp4Param mp4Param;
+		EncH263Param h263Param;
+		EncAvcParam avcParam;
+		EncMjpgParam mjpgParam;
+	} EncStdParam;
+
+	int userQpMin;
+	int userQpMax;
+	int userQpMinEnable;
+	int userQpMaxEnable;
+
+	Uint32 userGamma;
+	int RcIntervalMode;
+	int MbInterval;
+	int avcIntra16x16OnlyModeEnable;
+} EncOpenParam;
+
+typedef struct {
+	int minFrameBufferCount;
+} EncInitialInfo;
+
+typedef struct {
+	FrameBuffer *sourceFrame;
+	int encTopOffset;
+	int encLeftOffset;
+	int forceIPicture;
+	int skipPicture;
+	int quantParam;
+	PhysicalAddress picStreamBufferAddr;
+	int picStreamBufferSize;
+	int enableAutoSkip;
+} EncParam;
+
+typedef struct {
+	int enable;
+	int type;
+	int sz;
+	Uint8 *addr;
+} EncReportInfo;
+
+typedef struct {
+	PhysicalAddress bitstreamBuffer;
+	Uint32 bitstreamSize;	/* all slices, in bytes */
+	int bitstreamWrapAround;
+	int skipEncoded;
+	int picType;		/* 0: I, 1: P */
+	int numOfSlices;
+	EncReportInfo mbInfo;
+	EncReportInfo mvInfo;
+	EncReportInfo sliceInfo;
+} EncOutputInfo;
+
+typedef struct {
+	PhysicalAddress searchRamAddr;
+	int SearchRamSize;
+} SearchRamParam;
+
+typedef struct {
+	PhysicalAddress buf;
+	int size;
+	int headerType;
+} EncHeaderParam;
+
+typedef struct {
+	int sliceMode;
+	int sliceSizeMode;
+	int sliceSize;
+} EncSliceModeParam;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+RetCode vpu_Init(void *);
+void vpu_UnInit(void);
+int vpu_IsBusy(void);
+RetCode vpu_WaitForInt(int timeout_in_ms);
+
+RetCode vpu_EncOpen(EncHandle *handle, EncOpenParam *param);
+RetCode vpu_EncClose(EncHandle handle);
+RetCode vpu_EncGetInitialInfo(EncHandle handle, EncInitialInfo *info);
+RetCode vpu_EncRegisterFrameBuffer(EncHandle handle, FrameBuffer *bufArray,
+				   int num, int frameBufStride, int sourceBufStride);
+RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam *param);
+RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo *info);
+RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *parameter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
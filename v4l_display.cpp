@@ -25,21 +25,174 @@ v4l_display_t::v4l_display_t
 	, nframes(numframes)
 	, fd(-1)
 	, bufs(0)
+	, vbufs(0)
+	, imports(0)
 	, bufs_avail(0)
+	, bufs_reclaimed(0)
 	, numQueued(0)
 	, streaming(0)
+{
+	if (!openOutput(0))
+		return ;
+
+	struct v4l2_requestbuffers reqbuf = {0};
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	reqbuf.memory = V4L2_MEMORY_MMAP;
+	reqbuf.count = nframes;
+
+	int err = ioctl(fd, VIDIOC_REQBUFS, &reqbuf);
+	if ((err == 0) && (reqbuf.count == nframes)) {
+		bufs = new struct v4l2_buffer [nframes];
+		vbufs = new unsigned char *[nframes];
+		unsigned i ;
+		for (i = 0; i < nframes; i++) {
+			struct v4l2_buffer &buffer = bufs[i];
+			buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+			buffer.memory = V4L2_MEMORY_MMAP;
+			buffer.index = i;
+
+			err = ioctl(fd, VIDIOC_QUERYBUF, &buffer);
+			if (err < 0) {
+				printf("VIDIOC_QUERYBUF, not enough buffers\n");
+				close(fd); fd = -1 ;
+				return;
+			}
+
+			vbufs[i] = (unsigned char *)
+				   mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+
+			if (vbufs[i] == (unsigned char *)MAP_FAILED) {
+				printf("mmap failed\n");
+				vbufs[i] = 0 ;
+				break;
+			}
+			memset(vbufs[i],0x80,imgSize());
+			bufs_avail |= (1<<i);
+
+			FrameBuffer &fb = fbs[i];
+			fb.strideY = ystride ;
+			fb.strideC = uvstride ;
+			fb.bufY = buffer.m.offset ;
+			fb.bufCb = fb.bufY + layout.u.offset ;
+			fb.bufCr = fb.bufY + layout.v.offset ;
+			fb.bufMvCol = 0 ;
+		}
+
+		if (nframes == i) {
+			return ;
+		}
+	} else {
+		printf("VIDIOC_REQBUFS, not enough buffers: %d/%d/%d\n",err,reqbuf.count,nframes);
+	}
+	close(fd); fd = -1 ;
+}
+
+v4l_display_t::v4l_display_t
+        ( unsigned picWidth,
+          unsigned picHeight,
+          Rect const &window,
+	  bufferHandle_t const *importBufs,
+	  unsigned numImports,
+	  unsigned stride )
+	: w(picWidth)
+	, h(picHeight)
+	, ysize(0)
+	, ystride(0)
+	, uvsize(0)
+	, uvstride(0)
+	, win(window)
+	, nframes(numImports)
+	, fd(-1)
+	, bufs(0)
+	, vbufs(0)
+	, imports(importBufs)
+	, bufs_avail(0)
+	, bufs_reclaimed(0)
+	, numQueued(0)
+	, streaming(0)
+{
+	if (MAXFBS < nframes) {
+		printf("too many buffers to import: %u, max %u\n", nframes, MAXFBS);
+		return ;
+	}
+
+	/*
+	 * Prefer DMABUF. Without an exported descriptor, fall back to the
+	 * Freescale USERPTR convention of passing the physical address
+	 * in m.offset.
+	 */
+	enum v4l2_memory memory = V4L2_MEMORY_USERPTR ;
+#ifdef VIDIOC_EXPBUF
+	if (0 <= imports[0].dmafd)
+		memory = V4L2_MEMORY_DMABUF ;
+#endif
+	for (unsigned i = 0; i < nframes; i++) {
+		if ((V4L2_MEMORY_USERPTR == memory) && (0 == imports[i].phys)) {
+			printf("import buffer %u has neither dmabuf nor physical address\n", i);
+			return ;
+		}
+	}
+
+	if (!openOutput(stride))
+		return ;
+
+	struct v4l2_requestbuffers reqbuf = {0};
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	reqbuf.memory = memory;
+	reqbuf.count = nframes;
+
+	int err = ioctl(fd, VIDIOC_REQBUFS, &reqbuf);
+	if ((err == 0) && (reqbuf.count == nframes)) {
+		bufs = new struct v4l2_buffer [nframes];
+		memset(bufs,0,nframes*sizeof(bufs[0]));
+		for (unsigned i = 0; i < nframes; i++) {
+			bufferHandle_t const &import = imports[i];
+			struct v4l2_buffer &buffer = bufs[i];
+			buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+			buffer.memory = memory;
+			buffer.index = i;
+			buffer.length = import.length ;
+			buffer.bytesused = import.length ;
+#ifdef VIDIOC_EXPBUF
+			if (V4L2_MEMORY_DMABUF == memory)
+				buffer.m.fd = import.dmafd ;
+			else
+#endif
+				buffer.m.offset = import.phys ;
+			bufs_avail |= (1<<i);
+
+			FrameBuffer &fb = fbs[i];
+			fb.strideY = ystride ;
+			fb.strideC = uvstride ;
+			fb.bufY = import.phys ;
+			fb.bufCb = fb.bufY + layout.u.offset ;
+			fb.bufCr = fb.bufY + layout.v.offset ;
+			fb.bufMvCol = 0 ;
+		}
+		return ;
+	} else {
+		printf("VIDIOC_REQBUFS(import), not enough buffers: %d/%d/%d\n",err,reqbuf.count,nframes);
+	}
+	close(fd); fd = -1 ;
+}
+
+bool v4l_display_t::openOutput(unsigned stride)
 {
 	memset(fbs,0,sizeof(fbs));
-	ystride = ((picWidth+7)/8)*8 ;
-	ysize = h*ystride ;
-	uvstride = ystride/2 ;
-	uvsize = h*uvstride/2 ;
+	if (!layout.init(V4L2_PIX_FMT_YUV420, w, h, stride ? stride : ((w+7)/8)*8)) {
+		printf("invalid stride %u for %ux%u\n", stride, w, h);
+		return false ;
+	}
+	ystride = layout.y.stride ;
+	ysize = layout.planes[0].size ;
+	uvstride = layout.u.stride ;
+	uvsize = layout.planes[1].size ;
 
 	int out = 3;
 	int fd_fb = open("/dev/fb0", O_RDWR, 0);
 	if (fd_fb < 0) {
 		printf("unable to open fb0\n");
-		return ;
+		return false ;
 	}
 
 	struct mxcfb_gbl_alpha alpha;
@@ -49,7 +202,7 @@ v4l_display_t::v4l_display_t
 	int err = ioctl(fd_fb, MXCFB_SET_GBL_ALPHA, &alpha);
 	if (err < 0) {
 		printf("set alpha blending failed\n");
-		return ;
+		return false ;
 	}
 
 	struct mxcfb_gbl_alpha a ;
@@ -58,14 +211,14 @@ v4l_display_t::v4l_display_t
 	err = ioctl(fd_fb,MXCFB_SET_GBL_ALPHA,&a);
 	if ( err ) {
 		perror( "MXCFB_SET_GBL_ALPHA");
-		return ;
+		return false ;
 	}
 	struct mxcfb_color_key key;
 	key.enable = 1 ;
 	key.color_key = 0 ;
 	if (ioctl(fd_fb,MXCFB_SET_CLR_KEY, &key) <0) {
 		perror("MXCFB_SET_CLR_KEY error!");
-		return ;
+		return false ;
 	}
 
 	close (fd_fb);
@@ -73,28 +226,28 @@ v4l_display_t::v4l_display_t
 	fd = open(v4l_device, O_RDWR|O_NONBLOCK, 0);
 	if (fd < 0) {
 		printf("unable to open %s\n", v4l_device);
-		return;
+		return false ;
 	}
 
 	err = ioctl(fd, VIDIOC_S_OUTPUT, &out);
 	if (err < 0) {
 		printf("VIDIOC_S_OUTPUT failed\n");
 		close(fd); fd = -1 ;
-		return;
+		return false ;
 	}
 
 	struct v4l2_crop vcrop ;
 	memset(&vcrop,0,sizeof(vcrop));
 	vcrop.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-	vcrop.c.top = window.top;
-	vcrop.c.left = window.left;
-	vcrop.c.width = window.right-window.left;
-	vcrop.c.height = window.bottom-window.top;
+	vcrop.c.top = win.top;
+	vcrop.c.left = win.left;
+	vcrop.c.width = win.right-win.left;
+	vcrop.c.height = win.bottom-win.top;
 	err = ioctl(fd, VIDIOC_S_CROP, &vcrop);
 	if (err < 0) {
 		printf("VIDIOC_S_CROP failed: %u:%u..%ux%u\n",vcrop.c.top,vcrop.c.left,vcrop.c.width,vcrop.c.height);
 		close(fd); fd = -1 ;
-		return;
+		return false ;
 	}
 
 	struct v4l2_format fmt ;
@@ -105,71 +258,21 @@ v4l_display_t::v4l_display_t
 	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
 	fmt.fmt.pix.width = w;
 	fmt.fmt.pix.height = h;
-	fmt.fmt.pix.bytesperline = w;
+	fmt.fmt.pix.bytesperline = ystride;
 	err = ioctl(fd, VIDIOC_S_FMT, &fmt);
 	if (err < 0) {
 		printf("VIDIOC_S_FMT failed\n");
 		close(fd); fd = -1 ;
-		return;
+		return false ;
 	}
 
 	err = ioctl(fd, VIDIOC_G_FMT, &fmt);
 	if (err < 0) {
 		printf("VIDIOC_G_FMT failed\n");
 		close(fd); fd = -1 ;
-		return;
-	}
-
-	struct v4l2_requestbuffers reqbuf = {0};
-	reqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-	reqbuf.memory = V4L2_MEMORY_MMAP;
-	reqbuf.count = nframes;
-
-	err = ioctl(fd, VIDIOC_REQBUFS, &reqbuf);
-	if ((err == 0) && (reqbuf.count == nframes)) {
-		bufs = new struct v4l2_buffer [nframes];
-		vbufs = new unsigned char *[nframes];
-		unsigned i ;
-		for (i = 0; i < nframes; i++) {
-			struct v4l2_buffer &buffer = bufs[i];
-			buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-			buffer.memory = V4L2_MEMORY_MMAP;
-			buffer.index = i;
-
-			err = ioctl(fd, VIDIOC_QUERYBUF, &buffer);
-			if (err < 0) {
-				printf("VIDIOC_QUERYBUF, not enough buffers\n");
-				close(fd); fd = -1 ;
-				return;
-			}
-
-			vbufs[i] = (unsigned char *)
-				   mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
-
-			if (vbufs[i] == (unsigned char *)MAP_FAILED) {
-				printf("mmap failed\n");
-				vbufs[i] = 0 ;
-				break;
-			}
-			memset(vbufs[i],0x80,imgSize());
-			bufs_avail |= (1<<i);
-
-			FrameBuffer &fb = fbs[i];
-			fb.strideY = w ;
-			fb.strideC = w/2 ;
-			fb.bufY = buffer.m.offset ;
-			fb.bufCb = fb.bufY + ySize();
-			fb.bufCr = fb.bufCb + uvSize();
-			fb.bufMvCol = 0 ;
-		}
-
-		if (nframes == i) {
-			return ;
-		}
-	} else {
-		printf("VIDIOC_REQBUFS, not enough buffers: %d/%d/%d\n",err,reqbuf.count,nframes);
+		return false ;
 	}
-	close(fd); fd = -1 ;
+	return true ;
 }
 
 v4l_display_t::~v4l_display_t (void)
@@ -191,8 +294,9 @@ v4l_display_t::~v4l_display_t (void)
 					munmap(vbufs[i], bufs[i].length);
 			}
 			delete [] vbufs ;
-			delete [] bufs ;
 		}
+		if (bufs)
+			delete [] bufs ;
 		close(fd);
 	}
 }
@@ -202,7 +306,7 @@ void v4l_display_t::pollBufs(void)
 	while (1) {
 		struct v4l2_buffer buffer ; memset(&buffer,0,sizeof(buffer));
 		buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-		buffer.memory = V4L2_MEMORY_MMAP;
+		buffer.memory = bufs[0].memory;
 		int err = ioctl(fd, VIDIOC_DQBUF, &buffer);
 		if (err < 0)
 			break;
@@ -213,10 +317,25 @@ void v4l_display_t::pollBufs(void)
 		unsigned mask = (1<<buffer.index);
 		assert (0 == (bufs_avail&mask));
 		bufs_avail |= (1<<buffer.index);
+		if (imports)
+			bufs_reclaimed |= mask ;
 		numQueued-- ;
 	}
 }
 
+bool v4l_display_t::reclaim (unsigned &idx)
+{
+	idx = 0 ;
+	pollBufs();
+	if (0 != bufs_reclaimed) {
+		idx = ffs(bufs_reclaimed)-1;
+		bufs_reclaimed &= ~(1<<idx);
+		return true ;
+	}
+	else
+		return false ;
+}
+
 bool v4l_display_t::getBuf (unsigned &idx)
 {
 	idx = 0 ;
@@ -7,6 +7,8 @@ extern "C" {
 #include <vpu_lib.h>
 #include <vpu_io.h>
 };
+#include "bufferHandle.h"
+#include "fourcc.h"
 
 class v4l_display_t {
 public:
@@ -15,12 +17,29 @@ public:
                   unsigned picHeight,
                   Rect const &window,
 		  unsigned numframes );
+
+	/*
+	 * Import constructor: queue the caller's buffers (normally the
+	 * camera's exported DMABUFs) to the display instead of allocating
+	 * display memory and copying into it. Use putBuf() with the
+	 * import index and reclaim() to learn when the display is done
+	 * with a buffer. If the imported buffers have padded lines,
+	 * pass the stride of the Y plane.
+	 */
+	v4l_display_t
+		( unsigned picWidth,
+                  unsigned picHeight,
+                  Rect const &window,
+		  bufferHandle_t const *imports,
+		  unsigned numImports,
+		  unsigned stride = 0 );
 	~v4l_display_t (void);
 
 	bool initialized (void) const { return 0 <= fd ; }
 	unsigned numBufs (void) const { return nframes ; }
 
-	unsigned imgSize(void)const { return ySize()+2*uvSize(); }
+	unsigned imgSize(void)const { return layout.size ; }
+	frameLayout_t const &getLayout(void) const { return layout ; }
 	unsigned ySize(void) const { return ysize ; }
 	unsigned yStride(void) const { return ystride ; }
 
@@ -31,12 +50,15 @@ public:
 
 	bool getBuf (unsigned &idx);
 	void putBuf (unsigned idx);
-	void *getY(unsigned idx) const { return vbufs[idx]; }
+	void *getY(unsigned idx) const { return imports ? imports[idx].virt : vbufs[idx]; }
+	bool importing(void) const { return 0 != imports ; }
+	bool reclaim (unsigned &idx);
 	void getFrameBuffers( FrameBuffer *&fbs, unsigned &count);
 
 	int getFd (void) const { return fd ; }
 private:
         v4l_display_t (v4l_display_t const &); // no copies
+	bool openOutput(unsigned stride);
 	enum {
 		MAXFBS = 16
 	};
@@ -46,13 +68,16 @@ private:
 	unsigned	ystride ;
 	unsigned	uvsize ;
 	unsigned	uvstride ;
+	frameLayout_t	layout ;	// always I420
 	Rect		win ;
 	unsigned	nframes ;
         FrameBuffer 	fbs[MAXFBS];
 	int 	    	fd ;
         struct v4l2_buffer *bufs ;
 	unsigned char  **vbufs ;
+	bufferHandle_t const *imports ;
 	unsigned	bufs_avail ;
+	unsigned	bufs_reclaimed ;
 	unsigned	numQueued ;
 	bool		streaming ;
 };
@@ -0,0 +1,410 @@
+/*
+ * Module vpuEncoder.cpp
+ *
+ * This module defines the methods of the vpuEncoder_t class
+ * as declared in vpuEncoder.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "vpuEncoder.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#define DEBUGPRINT
+#include "debugPrint.h"
+
+#ifdef VPU_SOFTWARE
+#define STREAM_BUF_SIZE		0x400000	/* I_PCM output is about 1.5 bytes/pixel */
+#else
+#define STREAM_BUF_SIZE		0x80000
+#endif
+
+long long vpuEncoder_t::tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((long long)ts.tv_sec*1000000)+(ts.tv_nsec/1000);
+}
+
+vpuEncoder_t::vpuEncoder_t(
+	unsigned w,
+	unsigned h,
+	unsigned fourcc,
+	bufferHandle_t const *cameraBuffers,
+	unsigned numBuffers,
+	unsigned stride)
+	: initialized_(false)
+	, handle_(0)
+	, ring_(STREAM_BUF_SIZE)
+	, outSlot_(0)
+	, fbcount(numBuffers)
+	, fourcc_(fourcc)
+	, w_(w)
+	, h_(h)
+	, imgSize_(0)
+	, buffers(cameraBuffers)
+	, fb(0)
+	, rateControl_(false)
+	, startUs_(0)
+	, qp_(0)
+{
+	memset(&stats_,0,sizeof(stats_));
+	if( (0 == w) || (0 == h) ) {
+		fprintf(stderr, "Invalid w or h (%ux%u)\n", w, h );
+		return ;
+	}
+	fprintf(stderr, "%s: %ux%u - %u buffers\n", __func__, w_, h_, numBuffers );
+	if( !layout_.init(fourcc,w,h,stride) || !layout_.info->yuv ){
+		fprintf(stderr, "Invalid fourcc 0x%x or stride %u\n", fourcc, stride);
+		return ;
+	}
+	if( 0 != (layout_.y.stride % 8) ){
+		fprintf(stderr, "VPU needs lines padded to a multiple of 8 bytes (%u)\n", layout_.y.stride);
+		return ;
+	}
+	if( !ring_.worked() ){
+		fprintf(stderr,"Unable to allocate bitstream buffers\n");
+		return ;
+	}
+	imgSize_ = layout_.size ;
+
+printf( "%s: fourcc offsets %u/%u/%u, adders %u/%u\n", __func__, layout_.y.offset, layout_.u.offset, layout_.v.offset, layout_.y.step, layout_.u.step);
+}
+
+vpuEncoder_t::~vpuEncoder_t(void)
+{
+	if (handle_) {
+		debugPrint( "closing encoder\n" );
+		RetCode rc = vpu_EncClose(handle_);
+		if( RETCODE_SUCCESS != rc )
+			fprintf(stderr, "Error %d closing encoder\n", rc );
+		else {
+			debugPrint( "encoder closed\n" );
+		}
+	}
+	if (fb)
+		free(fb);
+}
+
+void vpuEncoder_t::defaultParams(EncOpenParam &encop, CodStd format) const
+{
+	memset(&encop,0,sizeof(encop));
+	encop.bitstreamBuffer = ring_.phys();
+	encop.bitstreamBufferSize = ring_.size();
+	encop.bitstreamFormat = format ;
+
+	encop.picWidth = w_ ;
+	encop.picHeight = h_ ;
+
+	/*Note: Frame rate cannot be less than 15fps per H.263 spec */
+	encop.frameRateInfo = 30;
+	encop.bitRate = 0 ;
+	encop.gopSize = 1 ;
+	encop.slicemode.sliceMode = 0;	/* 0: 1 slice per picture; 1: Multiple slices per picture */
+	encop.slicemode.sliceSizeMode = 0; /* 0: silceSize defined by bits; 1: sliceSize defined by MB number*/
+	encop.slicemode.sliceSize = 4000;  /* Size of a slice in bits or MB numbers */
+
+	encop.initialDelay = 0;
+	encop.vbvBufferSize = 0;        /* 0 = ignore 8 */
+	encop.intraRefresh = 0;
+	encop.sliceReport = 0;
+	encop.mbReport = 0;
+	encop.mbQpReport = 0;
+	encop.rcIntraQp = -1;
+	encop.userQpMax = 0;
+	encop.userGamma = (Uint32)(0.75*32768);         /*  (0*32768 <= gamma <= 1*32768) */
+	encop.RcIntervalMode= 1;        /* 0:normal, 1:frame_level, 2:slice_level, 3: user defined Mb_level */
+	encop.MbInterval = 0;
+
+	unsigned const ysize = layout_.y.width*layout_.y.height ;
+	unsigned const uvsize = layout_.u.width*layout_.u.height ;
+	if (uvsize == ysize/2) {
+	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 1 ; // YUV422 horizontal
+	} else if (uvsize == ysize/4) {
+	    encop.EncStdParam.mjpgParam.mjpg_sourceFormat = 0 ; // YUV420
+	} else
+		printf( "%s: unknown input format: %u/%u\n", __func__,ysize,uvsize );
+	encop.ringBufferEnable = 0;
+	encop.dynamicAllocEnable = 1;	/* output slot chosen per frame */
+	encop.chromaInterleave = (1 < layout_.u.step);
+}
+
+/*
+ * Reports settings the VPU documentation says are out of range.
+ * The VPU is still asked to open with them.
+ */
+void vpuEncoder_t::checkParams(EncOpenParam const &encop) const
+{
+	debugPrint("check open params\n");
+
+	if (encop.bitstreamBuffer % 4) {	/* not 4-bit aligned */
+		printf( "--> bitstreamBuffer %x\n", (unsigned)encop.bitstreamBuffer);
+	}
+	if (encop.bitstreamBufferSize % 1024 ||
+	    encop.bitstreamBufferSize < 1024 ||
+	    encop.bitstreamBufferSize > 16383 * 1024) {
+		printf( "--> bitstreamBufferSize %u\n", (unsigned)encop.bitstreamBufferSize);
+	}
+	if (encop.bitstreamFormat != STD_MPEG4 &&
+	    encop.bitstreamFormat != STD_H263 &&
+	    encop.bitstreamFormat != STD_AVC &&
+	    encop.bitstreamFormat != STD_MJPG) {
+		printf( "--> bitstreamFormat %x\n", encop.bitstreamFormat);
+	}
+	if (encop.bitRate > 32767 || encop.bitRate < 0) {
+		printf( "--> bitrate %d\n", encop.bitRate);
+	}
+	if (encop.bitRate != 0 && encop.initialDelay > 32767) {
+		printf( "--> bitrate %d, initial delay %d\n", encop.bitRate, encop.initialDelay);
+	}
+	if (encop.bitRate != 0 && encop.initialDelay != 0 &&
+	    encop.vbvBufferSize < 0) {
+		printf( "--> bitrate %d, initial delay %d, vbvBufferSize %d\n", encop.bitRate, encop.initialDelay, encop.vbvBufferSize );
+	}
+	if (encop.gopSize > 60) {
+		printf( "--> gopSize %d\n", encop.gopSize );
+	}
+	if (encop.slicemode.sliceMode != 0 && encop.slicemode.sliceMode != 1) {
+		printf( "--> sliceMode %d\n", encop.slicemode.sliceMode );
+	}
+	if (encop.slicemode.sliceMode == 1) {
+		if (encop.slicemode.sliceSizeMode != 0 &&
+		    encop.slicemode.sliceSizeMode != 1) {
+			printf( "--> slicemode.sliceSizeMode %d\n", encop.slicemode.sliceSizeMode );
+		}
+		if (encop.slicemode.sliceSize == 0) {
+			printf( "--> slicemode.sliceSize %d\n", encop.slicemode.sliceSize );
+		}
+	}
+	if (cpu_is_mx27()) {
+		if (encop.sliceReport != 0 && encop.sliceReport != 1) {
+			printf( "--> sliceReport %d\n", encop.sliceReport );
+		}
+		if (encop.mbReport != 0 && encop.mbReport != 1) {
+			printf( "--> mbReport %d\n", encop.mbReport );
+		}
+	}
+	if (encop.intraRefresh < 0 || encop.intraRefresh >=
+	    (encop.picWidth * encop.picHeight / 256)) {
+		debugPrint( "--> intraRefresh %d, width %d, height %d\n", encop.intraRefresh, encop.picWidth, encop.picHeight );
+	}
+
+	debugPrint( "format %d, %ux%u\n", encop.bitstreamFormat, encop.picWidth, encop.picHeight );
+
+	if (encop.picWidth < 32 || encop.picHeight < 16) {
+	debugPrint( "bad size\n");
+	}
+}
+
+bool vpuEncoder_t::open(EncOpenParam &encop)
+{
+	if (!usable())
+		return false ;
+
+	checkParams(encop);
+
+debugPrint( "opening encoder\n" );
+
+	RetCode ret = vpu_EncOpen(&handle_, &encop);
+	if (ret != RETCODE_SUCCESS) {
+		fprintf(stderr,"Encoder open failed %d\n", ret);
+		handle_ = 0 ;
+		return false ;
+	}
+	rateControl_ = (0 != encop.bitRate);
+
+debugPrint( "encoder initialized\n" );
+
+	SearchRamParam search_pa ;
+	memset(&search_pa, 0, sizeof(search_pa));
+	iram_t iram;
+	unsigned long ram_size;
+
+	memset(&iram, 0, sizeof(iram_t));
+	ram_size = ((w_ + 15) & ~15) * 36 + 2048;
+	IOGetIramBase(&iram);
+	if ((iram.end - iram.start) < ram_size) {
+		debugPrint("vpu iram is less than needed: %lu..%lu/%lu\n", iram.start,iram.end,ram_size);
+		debugPrint("NOT Using IRAM for ME\n" );
+	} else {
+		/* Allocate max iram for vpu encoder search ram*/
+		ram_size = iram.end - iram.start;
+		search_pa.searchRamAddr = iram.start;
+		search_pa.SearchRamSize = (int)ram_size;
+		debugPrint( "search iram %lu..%lu for %lu bytes\n", iram.start, iram.end, ram_size );
+		ret = vpu_EncGiveCommand(handle_, ENC_SET_SEARCHRAM_PARAM, &search_pa);
+		if (ret != RETCODE_SUCCESS) {
+			fprintf(stderr, "Encoder SET_SEARCHRAM_PARAM failed\n");
+			return false ;
+		}
+		else {
+			debugPrint("Using IRAM for ME\n" );
+		}
+	}
+
+	debugPrint( "get initial info\n");
+	EncInitialInfo initinfo = {0};
+	ret = vpu_EncGetInitialInfo(handle_, &initinfo);
+	if (ret != RETCODE_SUCCESS) {
+		fprintf(stderr,"Encoder GetInitialInfo failed\n");
+		return false ;
+	}
+
+	debugPrint( "have initial info\n" );
+	return registerBuffers(encop);
+}
+
+bool vpuEncoder_t::registerBuffers(EncOpenParam const &encop)
+{
+	int fbStride = ((w_ + 15) & ~15)*((0 != encop.EncStdParam.mjpgParam.mjpg_sourceFormat)+1);
+
+	fb = (FrameBuffer *)calloc(fbcount, sizeof(FrameBuffer));
+	if (fb == NULL) {
+		fprintf(stderr,"Failed to allocate fb\n");
+		return false ;
+	}
+debugPrint( "allocated FrameBuffer fb: %p\n", fb );
+
+	for (unsigned i = 0; i < fbcount; i++) {
+		bufferHandle_t const &buf = buffers[i];
+		unsigned long phys = buf.phys ;
+#ifdef VPU_SOFTWARE
+		if (0 == phys)
+			phys = IOMapUserMem(buf.virt,buf.length);
+#endif
+		if (0 == phys) {
+			fprintf(stderr,"buffer %u has no physical address\n", i);
+			return false ;
+		}
+		fb[i].bufY = phys+layout_.y.offset;
+		fb[i].bufCb = phys+layout_.u.offset;
+		fb[i].bufCr = phys+layout_.v.offset;
+		fb[i].strideY = layout_.y.stride;
+		fb[i].strideC = layout_.u.stride;
+	}
+debugPrint( "registering frame buffer\n" );
+	RetCode ret = vpu_EncRegisterFrameBuffer(handle_, fb, fbcount, fbStride, layout_.y.stride);
+	if (ret != RETCODE_SUCCESS) {
+		fprintf(stderr,"Register frame buffer failed\n");
+		return false ;
+	}
+
+debugPrint( "%u frame buffers registered\n", fbcount );
+	return true ;
+}
+
+bool vpuEncoder_t::get_bufs( unsigned index, unsigned char *&y, unsigned char *&u, unsigned char *&v )
+{
+	unsigned char *base = buffers[index].virt;
+	y = base + layout_.y.offset ;
+	u = base + layout_.u.offset ;
+	v = base + layout_.v.offset ;
+	return true ;
+}
+
+bool vpuEncoder_t::startFrame(unsigned index, EncParam &param)
+{
+	if (index >= fbcount) {
+		fprintf(stderr,"%s: invalid buffer %u\n", __func__, index);
+		return false ;
+	}
+	if (!ring_.acquire(outSlot_)) {
+		fprintf(stderr,"%s: all %u output buffers in use\n", __func__, ring_.numSlots());
+		stats_.failed++ ;
+		return false ;
+	}
+	param.sourceFrame = &fb[index];
+	param.picStreamBufferAddr = ring_.slotPhys(outSlot_);
+	param.picStreamBufferSize = ring_.slotSize();
+	qp_ = rateControl_ ? 0 : param.quantParam ;
+	startUs_ = tickUs();
+	RetCode ret = vpu_EncStartOneFrame(handle_, &param);
+	if (ret != RETCODE_SUCCESS) {
+		fprintf(stderr,"vpu_EncStartOneFrame failed Err code:%d\n",
+								ret);
+		ring_.release(outSlot_);
+		stats_.failed++ ;
+		return false ;
+	}
+	return true ;
+}
+
+void vpuEncoder_t::waitIdle(void)
+{
+	while (vpu_IsBusy()) {
+		vpu_WaitForInt(30);
+		if(vpu_IsBusy()){
+			debugPrint( "busy\n");
+		}
+	}
+}
+
+bool vpuEncoder_t::finishFrame(void const *&outData, unsigned &outLength, bool &iframe)
+{
+	EncOutputInfo outinfo ;
+	memset(&outinfo, 0, sizeof(outinfo));
+	RetCode ret = vpu_EncGetOutputInfo(handle_, &outinfo);
+	if (ret != RETCODE_SUCCESS) {
+		fprintf(stderr,"vpu_EncGetOutputInfo failed Err code: %d\n",
+								ret);
+		ring_.release(outSlot_);
+		stats_.failed++ ;
+		return false ;
+	}
+	if (outinfo.bitstreamWrapAround
+	    || (outinfo.bitstreamSize >= ring_.slotSize())) {
+		fprintf(stderr,"%s: frame %u overflowed %u byte output buffer\n",
+			__func__, stats_.frames+stats_.failed, ring_.slotSize());
+		ring_.overflowed();
+		ring_.release(outSlot_);
+		stats_.failed++ ;
+		return false ;
+	}
+	outData = (void *)ring_.toVirt(outinfo.bitstreamBuffer);
+	outLength = outinfo.bitstreamSize ;
+	iframe = (0 == outinfo.picType);
+
+	frameStats_t &last = stats_.last ;
+	last.encodeUs = (unsigned)(tickUs()-startUs_);
+	last.bits = outLength*8 ;
+	last.picType = outinfo.picType ;
+	last.qp = qp_ ;
+	stats_.frames++ ;
+	if (iframe)
+		stats_.iframes++ ;
+	stats_.totalBits += last.bits ;
+	if (last.encodeUs > stats_.maxEncodeUs)
+		stats_.maxEncodeUs = last.encodeUs ;
+	if (last.bits > stats_.maxBits)
+		stats_.maxBits = last.bits ;
+	if (1 == stats_.frames) {
+		stats_.avgEncodeUs = last.encodeUs ;
+		stats_.avgBits = last.bits ;
+	} else {
+		stats_.avgEncodeUs += ((int)last.encodeUs-(int)stats_.avgEncodeUs)/16 ;
+		stats_.avgBits += ((int)last.bits-(int)stats_.avgBits)/16 ;
+	}
+	return true ;
+}
+
+void vpuEncoder_t::releaseOutput(void const *outData)
+{
+	ring_.release(outData);
+}
+
+void vpuEncoder_t::dumpStats(char const *name) const
+{
+	printf( "%-12s %8s %8s %8s %10s %10s %10s %10s %6s\n",
+		"encoder", "frames", "iframes", "failed", "avgEnc", "maxEnc", "avgBits", "maxBits", "qp");
+	printf( "%-12s %8u %8u %8u %10u %10u %10u %10u %6u\n",
+		name, stats_.frames, stats_.iframes, stats_.failed,
+		stats_.avgEncodeUs, stats_.maxEncodeUs, stats_.avgBits, stats_.maxBits,
+		stats_.last.qp);
+}
+
+void vpuEncoder_t::resetStats(void)
+{
+	memset(&stats_,0,sizeof(stats_));
+}
@@ -0,0 +1,135 @@
+#ifndef __VPUENCODER_H__
+#define __VPUENCODER_H__ "$Id$"
+
+/*
+ * vpuEncoder.h
+ *
+ * This header file declares the vpuEncoder_t class, the part of
+ * h264_encoder_t, mjpeg_encoder_t and mpeg4_encoder_t that doesn't
+ * depend on the codec:
+ *
+ *	- checking the frame layout against what the VPU can read
+ *	- the bitstream output ring and the FrameBuffer array
+ *	  describing the camera buffers, both freed with the encoder
+ *	- the EncOpenParam fields common to every codec
+ *	- vpu_EncOpen(), IRAM for motion search and frame buffer
+ *	  registration, and vpu_EncClose() when destroyed
+ *	- starting a frame and collecting its output, and
+ *	- per-frame statistics
+ *
+ * A codec's constructor calls defaultParams(), adjusts the result
+ * and passes it to open(). Encoding is startFrame(), then
+ * waitIdle() (from any thread), then finishFrame().
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+extern "C" {
+#include <vpu_lib.h>
+#include <vpu_io.h>
+};
+
+#include "bitstreamRing.h"
+#include "bufferHandle.h"
+#include "fourcc.h"
+
+class vpuEncoder_t {
+public:
+	// of the last frame
+	struct frameStats_t {
+		unsigned	encodeUs ;	// startFrame() to finishFrame()
+		unsigned	bits ;
+		int		picType ;	// 0: I, 1: P
+		unsigned	qp ;		// requested, 0 if rate control chose
+	};
+
+	struct stats_t {
+		unsigned	frames ;
+		unsigned	iframes ;
+		unsigned	failed ;	// including overflows
+		unsigned	avgEncodeUs ;
+		unsigned	maxEncodeUs ;
+		unsigned	avgBits ;
+		unsigned	maxBits ;
+		unsigned long long totalBits ;
+		frameStats_t	last ;
+	};
+
+	virtual ~vpuEncoder_t(void);
+
+	bool initialized( void ) const { return initialized_ ; }
+
+	inline unsigned fourcc(void) const { return fourcc_ ; }
+	inline unsigned width(void) const { return w_ ; }
+	inline unsigned height(void) const { return h_ ; }
+	inline unsigned yuvSize(void) const { return imgSize_ ; }
+
+	bool get_bufs( unsigned index, unsigned char *&y, unsigned char *&u, unsigned char *&v );
+
+	// output stays valid until released (from any thread)
+	void releaseOutput( void const *outData );
+	bitstreamRing_t const &outputs( void ) const { return ring_ ; }
+
+	stats_t const &stats( void ) const { return stats_ ; }
+	void dumpStats( char const *name ) const ;
+	void resetStats( void );
+
+protected:
+	vpuEncoder_t(unsigned width,
+		     unsigned height,
+		     unsigned fourcc,
+		     bufferHandle_t const *buffers,
+		     unsigned numBuffers,
+		     unsigned stride);
+
+	// false if the constructor found a bad layout or no memory
+	bool usable( void ) const { return 0 != imgSize_ ; }
+
+	// zero except for the settings shared by every codec
+	void defaultParams( EncOpenParam &encop, CodStd format ) const ;
+
+	// opens the encoder and registers the camera buffers
+	bool open( EncOpenParam &encop );
+
+	/*
+	 * Claims an output slot and starts the VPU on frame index.
+	 * The caller fills in the codec's fields of param.
+	 */
+	bool startFrame( unsigned index, EncParam &param );
+
+	// blocks until the VPU is done with the frame
+	static void waitIdle( void );
+
+	/*
+	 * Returns false (and releases the slot) if the VPU failed or
+	 * the frame overflowed its slot.
+	 */
+	bool finishFrame( void const *&outData, unsigned &outLength, bool &iframe );
+
+	static long long tickUs( void );
+
+	bool 	  	initialized_ ;	/* set by the codec when it's ready */
+	EncHandle 	handle_ ;
+	bitstreamRing_t	ring_ ;		/* encoded output */
+	unsigned	outSlot_ ;	/* for the frame being encoded */
+	frameLayout_t	layout_ ;
+	unsigned	fbcount ;	/* Total number of framebuffers */
+
+private:
+	vpuEncoder_t(vpuEncoder_t const &); // no copies
+
+	void checkParams( EncOpenParam const &encop ) const ;
+	bool registerBuffers( EncOpenParam const &encop );
+
+	unsigned	fourcc_ ;
+	unsigned  	w_ ;
+	unsigned  	h_ ;
+	unsigned  	imgSize_ ;
+	bufferHandle_t const *buffers ; /* shared with camera */
+	FrameBuffer	*fb ;		/* frame buffer base given to encoder */
+	bool		rateControl_ ;	/* opened with a bitrate */
+	long long	startUs_ ;
+	unsigned	qp_ ;
+	stats_t		stats_ ;
+};
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Module vpuScheduler.cpp
+ *
+ * This module defines the methods of the vpuScheduler_t class
+ * as declared in vpuScheduler.h
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "vpuScheduler.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "debugPrint.h"
+
+long long vpuScheduler_t::tickUs(void)
+{
+	struct timespec ts ;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((long long)ts.tv_sec*1000000)+(ts.tv_nsec/1000);
+}
+
+vpuScheduler_t::vpuScheduler_t(vpu_t &vpu)
+	: vpu_(vpu)
+	, haveThread_(false)
+	, stop_(false)
+	, numJobs_(0)
+	, seq_(0)
+{
+	pthread_mutex_init(&lock_,0);
+	pthread_cond_init(&cond_,0);
+	pthread_cond_init(&idle_,0);
+	memset(jobs_,0,sizeof(jobs_));
+	resetStats();
+	if (!vpu_.worked())
+		return ;
+	if (0 != pthread_create(&thread_,0,threadRoutine,this)) {
+		perror("vpuScheduler thread");
+		return ;
+	}
+	haveThread_ = true ;
+}
+
+vpuScheduler_t::~vpuScheduler_t(void)
+{
+	if (haveThread_) {
+		pthread_mutex_lock(&lock_);
+		stop_ = true ;
+		pthread_cond_signal(&cond_);
+		pthread_mutex_unlock(&lock_);
+		pthread_join(thread_,0);
+	}
+	pthread_cond_destroy(&idle_);
+	pthread_cond_destroy(&cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+bool vpuScheduler_t::submitH264
+	( h264_encoder_t &encoder,
+	  unsigned index,
+	  unsigned priority,
+	  long long deadlineUs,
+	  done_t onDone,
+	  void *opaque,
+	  void *tag )
+{
+	return submit(H264,&encoder,index,priority,deadlineUs,onDone,opaque,tag);
+}
+
+bool vpuScheduler_t::submitJPEG
+	( mjpeg_encoder_t &encoder,
+	  unsigned index,
+	  unsigned priority,
+	  long long deadlineUs,
+	  done_t onDone,
+	  void *opaque,
+	  void *tag )
+{
+	return submit(JPEG,&encoder,index,priority,deadlineUs,onDone,opaque,tag);
+}
+
+bool vpuScheduler_t::submit
+	( kind_e kind,
+	  void *encoder,
+	  unsigned index,
+	  unsigned priority,
+	  long long deadlineUs,
+	  done_t onDone,
+	  void *opaque,
+	  void *tag )
+{
+	if (!haveThread_)
+		return false ;
+	pthread_mutex_lock(&lock_);
+	job_t *job = 0 ;
+	if (!stop_) {
+		for (unsigned i = 0 ; i < MAXJOBS ; i++) {
+			if (!jobs_[i].queued && (0 == jobs_[i].encoder)) {
+				job = jobs_+i ;
+				break ;
+			}
+		}
+	}
+	if (0 == job) {
+		stats_[kind].rejected++ ;
+		pthread_mutex_unlock(&lock_);
+		return false ;
+	}
+	job->queued = true ;
+	job->kind = kind ;
+	job->encoder = encoder ;
+	job->index = index ;
+	job->priority = priority ;
+	job->deadlineUs = deadlineUs ;
+	job->submittedUs = tickUs();
+	job->seq = seq_++ ;
+	job->onDone = onDone ;
+	job->opaque = opaque ;
+	job->tag = tag ;
+	numJobs_++ ;
+	pthread_cond_signal(&cond_);
+	pthread_mutex_unlock(&lock_);
+	return true ;
+}
+
+/*
+ * Late jobs go first, by deadline. Otherwise by priority, then
+ * deadline, then the order submitted, which keeps the frames of
+ * a stream in order.
+ * Called with the lock held.
+ */
+vpuScheduler_t::job_t *vpuScheduler_t::next(long long now)
+{
+	job_t *best = 0 ;
+	bool bestLate = false ;
+	for (unsigned i = 0 ; i < MAXJOBS ; i++) {
+		job_t *job = jobs_+i ;
+		if (!job->queued)
+			continue ;
+		bool late = (job->deadlineUs < now);
+		if (0 != best) {
+			if (late != bestLate) {
+				if (!late)
+					continue ;
+			} else if (!late && (job->priority != best->priority)) {
+				if (job->priority < best->priority)
+					continue ;
+			} else if (job->deadlineUs != best->deadlineUs) {
+				if (job->deadlineUs > best->deadlineUs)
+					continue ;
+			} else if ((int)(job->seq-best->seq) > 0)
+				continue ;
+		}
+		best = job ;
+		bestLate = late ;
+	}
+	return best ;
+}
+
+void vpuScheduler_t::execute(job_t const &job, result_t &result)
+{
+	memset(&result,0,sizeof(result));
+	result.kind = job.kind ;
+	result.tag = job.tag ;
+	if (H264 == job.kind) {
+		h264_encoder_t *encoder = (h264_encoder_t *)job.encoder ;
+		void *opaque ;
+		result.worked = encoder->start_encode(job.index,job.tag)
+				&& encoder->encode_complete(result.data,result.length,
+							    result.iframe,opaque,-1);
+	} else {
+		mjpeg_encoder_t *encoder = (mjpeg_encoder_t *)job.encoder ;
+		result.worked = encoder->encode(job.index,result.data,result.length);
+		result.iframe = result.worked ;
+	}
+}
+
+void *vpuScheduler_t::threadRoutine(void *arg)
+{
+	((vpuScheduler_t *)arg)->run();
+	return 0 ;
+}
+
+void vpuScheduler_t::run(void)
+{
+	pthread_mutex_lock(&lock_);
+	while (1) {
+		job_t *job = next(tickUs());
+		if (0 == job) {
+			if (stop_)
+				break ;
+			pthread_cond_wait(&cond_,&lock_);
+			continue ;
+		}
+		job->queued = false ;
+		pthread_mutex_unlock(&lock_);
+
+		result_t result ;
+		long long start = tickUs();
+		execute(*job,result);
+		long long end = tickUs();
+		result.queueUs = start-job->submittedUs ;
+		result.encodeUs = end-start ;
+		result.late = (end > job->deadlineUs);
+		if (job->onDone)
+			job->onDone(result,job->opaque);
+
+		pthread_mutex_lock(&lock_);
+		stats_t &stats = stats_[job->kind];
+		stats.jobs++ ;
+		if (!result.worked)
+			stats.failed++ ;
+		if (result.late)
+			stats.late++ ;
+		if (result.queueUs > stats.maxQueueUs)
+			stats.maxQueueUs = result.queueUs ;
+		if (result.encodeUs > stats.maxEncodeUs)
+			stats.maxEncodeUs = result.encodeUs ;
+		stats.avgQueueUs += ((int)result.queueUs-(int)stats.avgQueueUs)/16 ;
+		stats.avgEncodeUs += ((int)result.encodeUs-(int)stats.avgEncodeUs)/16 ;
+		job->encoder = 0 ;
+		numJobs_-- ;
+		pthread_cond_broadcast(&idle_);
+	}
+	pthread_mutex_unlock(&lock_);
+}
+
+void vpuScheduler_t::drain(void)
+{
+	pthread_mutex_lock(&lock_);
+	while (numJobs_)
+		pthread_cond_wait(&idle_,&lock_);
+	pthread_mutex_unlock(&lock_);
+}
+
+void vpuScheduler_t::dumpStats(void) const
+{
+	static char const *const names[NUMKINDS] = {
+		"h264", "jpeg"
+	};
+	printf( "%-12s %8s %8s %8s %8s %10s %10s %10s %10s\n",
+		"vpu job", "jobs", "failed", "late", "rejected", "avgQueue", "maxQueue", "avgEnc", "maxEnc");
+	for (unsigned k = 0 ; k < NUMKINDS ; k++) {
+		stats_t const &stats = stats_[k];
+		printf( "%-12s %8u %8u %8u %8u %10u %10u %10u %10u\n",
+			names[k], stats.jobs, stats.failed, stats.late, stats.rejected,
+			stats.avgQueueUs, stats.maxQueueUs, stats.avgEncodeUs, stats.maxEncodeUs);
+	}
+}
+
+void vpuScheduler_t::resetStats(void)
+{
+	pthread_mutex_lock(&lock_);
+	memset(stats_,0,sizeof(stats_));
+	pthread_mutex_unlock(&lock_);
+}
+
+#ifdef STANDALONE_VPUSCHEDULER
+#include <unistd.h>
+#include <linux/videodev2.h>
+#include "physPool.h"
+
+struct testState_t {
+	unsigned	h264Frames ;
+	unsigned	nextIndex ;
+	unsigned	outOfOrder ;
+	unsigned	stills ;
+	h264_encoder_t *h264 ;
+	mjpeg_encoder_t *jpeg ;
+};
+
+static void h264Done(vpuScheduler_t::result_t const &result, void *opaque)
+{
+	testState_t &state = *(testState_t *)opaque ;
+	unsigned frame = (unsigned long)result.tag ;
+	if (frame != state.nextIndex)
+		state.outOfOrder++ ;
+	state.nextIndex = frame+1 ;
+	if (result.worked) {
+		state.h264Frames++ ;
+		state.h264->releaseOutput(result.data);
+	}
+}
+
+static void jpegDone(vpuScheduler_t::result_t const &result, void *opaque)
+{
+	testState_t &state = *(testState_t *)opaque ;
+	if (result.worked) {
+		printf("still: %u bytes, waited %u us, encoded in %u us%s\n",
+		       result.length, result.queueUs, result.encodeUs,
+		       result.late ? " (late)" : "");
+		state.stills++ ;
+		state.jpeg->releaseOutput(result.data);
+	}
+}
+
+/*
+ * Streams 60 frames at 30fps and takes a still every 20 frames,
+ * then checks that every stream frame was encoded, in order.
+ */
+int main(int argc, char const * const argv[])
+{
+	enum {
+		NUMBUFFERS = 3,
+		WIDTH = 640,
+		HEIGHT = 480,
+		FRAMEUS = 33333,
+		NUMFRAMES = 60
+	};
+	vpu_t vpu ;
+	if (!vpu.worked())
+		return -1 ;
+
+	physPool_t &frames = physPool_t::shared();
+	physPool_t::block_t *mem[NUMBUFFERS];
+	bufferHandle_t handles[NUMBUFFERS];
+	memset(handles,0,sizeof(handles));
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++) {
+		mem[i] = frames.alloc(WIDTH*HEIGHT*3/2);
+		if (0 == mem[i]) {
+			fprintf(stderr, "Error allocating frame buffer %u\n", i);
+			while (i--)
+				frames.release(mem[i]);
+			return -1 ;
+		}
+		handles[i].dmafd = mem[i]->fd ;
+		handles[i].phys = mem[i]->phys ;
+		handles[i].virt = mem[i]->virt ;
+		handles[i].length = WIDTH*HEIGHT*3/2 ;
+		handles[i].index = i ;
+		memset(handles[i].virt,0x80,handles[i].length);
+	}
+
+	int errors = 0 ;
+	{
+		h264_encoder_t h264(vpu,WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,30,handles,NUMBUFFERS);
+		mjpeg_encoder_t jpeg(vpu,WIDTH,HEIGHT,V4L2_PIX_FMT_YUV420,handles,NUMBUFFERS);
+		if (!(h264.initialized() && jpeg.initialized())) {
+			fprintf(stderr, "Error opening encoders\n");
+			return -1 ;
+		}
+		testState_t state ;
+		memset(&state,0,sizeof(state));
+		state.h264 = &h264 ;
+		state.jpeg = &jpeg ;
+
+		vpuScheduler_t scheduler(vpu);
+		long long next = vpuScheduler_t::tickUs();
+		for (unsigned i = 0 ; i < NUMFRAMES ; i++) {
+			unsigned index = i % NUMBUFFERS ;
+			if (!scheduler.submitH264(h264,index,vpuScheduler_t::PRIORITY_STREAM,
+						  next+FRAMEUS,h264Done,&state,(void *)(unsigned long)i))
+				errors++ ;
+			if (10 == (i % 20)) {
+				if (!scheduler.submitJPEG(jpeg,index,vpuScheduler_t::PRIORITY_STILL,
+							  next+10*FRAMEUS,jpegDone,&state,0))
+					errors++ ;
+			}
+			next += FRAMEUS ;
+			long long now = vpuScheduler_t::tickUs();
+			if (next > now)
+				usleep(next-now);
+		}
+		scheduler.drain();
+		scheduler.dumpStats();
+		if ((NUMFRAMES != state.h264Frames) || state.outOfOrder
+		    || (NUMFRAMES/20 != state.stills)) {
+			fprintf(stderr, "%u of %u frames, %u out of order, %u stills\n",
+				state.h264Frames, NUMFRAMES, state.outOfOrder, state.stills);
+			errors++ ;
+		}
+	}
+
+	for (unsigned i = 0 ; i < NUMBUFFERS ; i++)
+		frames.release(mem[i]);
+	printf("%d errors\n", errors);
+	return errors ? -1 : 0 ;
+}
+#endif
@@ -0,0 +1,146 @@
+#ifndef __VPUSCHEDULER_H__
+#define __VPUSCHEDULER_H__ "$Id$"
+
+/*
+ * vpuScheduler.h
+ *
+ * This header file declares the vpuScheduler_t class, which runs
+ * encode jobs for several VPU encoder instances (e.g. an H.264
+ * stream and JPEG stills of the same camera) one at a time in a
+ * dedicated thread.
+ *
+ * The VPU can only work on one frame at a time and can't be
+ * preempted, so the order of the jobs is all that can be chosen.
+ * The next job is the queued one with the highest priority, and
+ * the earliest deadline among those. A job whose deadline has
+ * passed is promoted above everything else, so a low-priority
+ * still can't be starved by a stream that keeps the VPU busy.
+ *
+ * With the stream at PRIORITY_STREAM and its deadline one frame
+ * time after capture, a still submitted with the same frame is
+ * encoded in the gap before the next stream frame arrives.
+ *
+ * Each job's completion routine is called in the scheduler thread
+ * with the output, how long the job waited for the VPU and how
+ * long the encode took. Output must be released through the
+ * encoder as usual.
+ *
+ * Deadlines use the same clock as pipeline_t::tickUs().
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "imx_vpu.h"
+#include "imx_h264_encoder.h"
+#include "imx_mjpeg_encoder.h"
+#include <pthread.h>
+
+class vpuScheduler_t {
+public:
+	enum {
+		MAXJOBS = 16
+	};
+
+	enum {
+		PRIORITY_STILL	= 1,
+		PRIORITY_STREAM	= 2
+	};
+
+	enum kind_e {
+		H264,
+		JPEG,
+		NUMKINDS
+	};
+
+	struct result_t {
+		kind_e		kind ;
+		bool		worked ;
+		void const     *data ;
+		unsigned	length ;
+		bool		iframe ;
+		void	       *tag ;		// from submit
+		unsigned	queueUs ;	// submitted to started
+		unsigned	encodeUs ;
+		bool		late ;		// finished after the deadline
+	};
+
+	typedef void (*done_t)(result_t const &result, void *opaque);
+
+	struct stats_t {
+		unsigned	jobs ;
+		unsigned	failed ;
+		unsigned	late ;
+		unsigned	rejected ;	// queue full
+		unsigned	avgQueueUs ;
+		unsigned	maxQueueUs ;
+		unsigned	avgEncodeUs ;
+		unsigned	maxEncodeUs ;
+	};
+
+	vpuScheduler_t(vpu_t &vpu);
+	~vpuScheduler_t(void);	// runs the jobs still queued
+
+	bool worked(void) const { return haveThread_ ; }
+
+	/*
+	 * Queue a frame for encoding. The frame buffer must be left
+	 * alone until onDone is called. Returns false if the queue is
+	 * full.
+	 */
+	bool submitH264(h264_encoder_t &encoder, unsigned index,
+			unsigned priority, long long deadlineUs,
+			done_t onDone, void *opaque, void *tag);
+	bool submitJPEG(mjpeg_encoder_t &encoder, unsigned index,
+			unsigned priority, long long deadlineUs,
+			done_t onDone, void *opaque, void *tag);
+
+	// jobs queued or running
+	unsigned numJobs(void) const { return numJobs_ ; }
+
+	// waits for every job to complete. Not from a completion routine.
+	void drain(void);
+
+	stats_t const &stats(kind_e kind) const { return stats_[kind]; }
+	void dumpStats(void) const ;
+	void resetStats(void);
+
+	static long long tickUs(void);
+private:
+	vpuScheduler_t(vpuScheduler_t const &); // no copies
+
+	struct job_t {
+		bool		queued ;
+		kind_e		kind ;
+		void	       *encoder ;
+		unsigned	index ;
+		unsigned	priority ;
+		long long	deadlineUs ;
+		long long	submittedUs ;
+		unsigned	seq ;
+		done_t		onDone ;
+		void	       *opaque ;
+		void	       *tag ;
+	};
+
+	bool submit(kind_e kind, void *encoder, unsigned index,
+		    unsigned priority, long long deadlineUs,
+		    done_t onDone, void *opaque, void *tag);
+	job_t *next(long long now);
+	void execute(job_t const &job, result_t &result);
+	static void *threadRoutine(void *arg);
+	void run(void);
+
+	vpu_t		       &vpu_ ;
+	pthread_mutex_t		lock_ ;
+	pthread_cond_t		cond_ ;		// job queued or stop
+	pthread_cond_t		idle_ ;		// job completed
+	pthread_t		thread_ ;
+	bool			haveThread_ ;
+	bool			stop_ ;
+	job_t			jobs_[MAXJOBS];
+	unsigned volatile	numJobs_ ;
+	unsigned		seq_ ;
+	stats_t			stats_[NUMKINDS];
+};
+
+#endif
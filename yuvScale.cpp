@@ -0,0 +1,557 @@
+/*
+ * Module yuvScale.cpp
+ *
+ * This module defines the methods of the yuvScaler_t class
+ * as declared in yuvScale.h
+ *
+ * Output sample d of a channel is centered at source position
+ * (d+0.5)*srcN/dstN-0.5, computed in 16.16 fixed point. The two
+ * nearest source samples are blended with an 8-bit weight as
+ *
+ *	(a*(256-f) + b*f + 128) >> 8
+ *
+ * first vertically (a row at a time), then horizontally. The
+ * NEON kernels use vrshrn (rounding narrow), which computes the
+ * same thing.
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "yuvScale.h"
+#include "fourcc.h"
+#include <linux/videodev2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "debugPrint.h"
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+static void sourcePos(unsigned d, unsigned srcN, unsigned dstN,
+		      unsigned &i0, unsigned &i1, unsigned &frac)
+{
+	long long pos = ((((long long)(2*d+1))*srcN) << 15)/dstN - 0x8000 ;
+	if (0 > pos)
+		pos = 0 ;
+	i0 = (unsigned)(pos >> 16);
+	frac = (unsigned)(pos >> 8) & 0xff ;
+	if (i0 >= srcN-1) {
+		i0 = i1 = srcN-1 ;
+		frac = 0 ;
+	}
+	else
+		i1 = i0+1 ;
+}
+
+static inline unsigned char blend(unsigned a, unsigned b, unsigned f)
+{
+	return (unsigned char)((a*(256-f) + b*f + 128) >> 8);
+}
+
+static inline unsigned char clamp255(int v)
+{
+	return (0 > v) ? 0 : (255 < v) ? 255 : v ;
+}
+
+static inline void yuvToRgb(unsigned y, unsigned u, unsigned v,
+			    unsigned char &r, unsigned char &g, unsigned char &b)
+{
+	int c = (int)y-16 ;
+	int d = (int)u-128 ;
+	int e = (int)v-128 ;
+	r = clamp255((298*c + 409*e + 128) >> 8);
+	g = clamp255((298*c - 100*d - 208*e + 128) >> 8);
+	b = clamp255((298*c + 516*d + 128) >> 8);
+}
+
+/*
+ * Portable kernels
+ */
+static void gatherRow_c(unsigned char const *in, unsigned step, unsigned n, unsigned char *out)
+{
+	for (unsigned i = 0 ; i < n ; i++)
+		out[i] = in[i*step];
+}
+
+static void blendRows_c(unsigned char const *r0, unsigned char const *r1,
+			unsigned f, unsigned n, unsigned char *out)
+{
+	for (unsigned i = 0 ; i < n ; i++)
+		out[i] = blend(r0[i],r1[i],f);
+}
+
+static void yuvToRgbRow_c(unsigned fourcc, unsigned char const *y,
+			  unsigned char const *u, unsigned char const *v,
+			  unsigned n, void *out)
+{
+	for (unsigned i = 0 ; i < n ; i++) {
+		unsigned char r, g, b ;
+		yuvToRgb(y[i],u[i],v[i],r,g,b);
+		if (V4L2_PIX_FMT_RGB565 == fourcc) {
+			((uint16_t *)out)[i] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+		} else {
+			unsigned char *pix = (unsigned char *)out + 4*i ;
+			if (V4L2_PIX_FMT_RGB32 == fourcc) {
+				pix[0] = 0xff ; pix[1] = r ; pix[2] = g ; pix[3] = b ;
+			} else {
+				pix[0] = b ; pix[1] = g ; pix[2] = r ; pix[3] = 0xff ;
+			}
+		}
+	}
+}
+
+#ifdef __ARM_NEON__
+/*
+ * NEON kernels. Vector loops stop short of the last element so
+ * that interleaved loads never read past the end of a row.
+ */
+static void gatherRow_neon(unsigned char const *in, unsigned step, unsigned n, unsigned char *out)
+{
+	unsigned i = 0 ;
+	if (2 == step) {
+		for ( ; i+16 < n ; i += 16)
+			vst1q_u8(out+i,vld2q_u8(in+2*i).val[0]);
+	} else if (4 == step) {
+		for ( ; i+16 < n ; i += 16)
+			vst1q_u8(out+i,vld4q_u8(in+4*i).val[0]);
+	}
+	for ( ; i < n ; i++)
+		out[i] = in[i*step];
+}
+
+static void blendRows_neon(unsigned char const *r0, unsigned char const *r1,
+			   unsigned f, unsigned n, unsigned char *out)
+{
+	uint8x8_t const w0 = vdup_n_u8(256-f);
+	uint8x8_t const w1 = vdup_n_u8(f);
+	unsigned i = 0 ;
+	for ( ; i+16 <= n ; i += 16) {
+		uint8x16_t a = vld1q_u8(r0+i);
+		uint8x16_t b = vld1q_u8(r1+i);
+		uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a),w0),vget_low_u8(b),w1);
+		uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a),w0),vget_high_u8(b),w1);
+		vst1q_u8(out+i,vcombine_u8(vrshrn_n_u16(lo,8),vrshrn_n_u16(hi,8)));
+	}
+	for ( ; i < n ; i++)
+		out[i] = blend(r0[i],r1[i],f);
+}
+
+static inline uint16x4_t rgbChannel(int32x4_t v)
+{
+	return vqmovun_s32(vshrq_n_s32(v,8));
+}
+
+static void yuvToRgbRow_neon(unsigned fourcc, unsigned char const *y,
+			     unsigned char const *u, unsigned char const *v,
+			     unsigned n, void *out)
+{
+	int16x8_t const k16 = vdupq_n_s16(16);
+	int16x8_t const k128 = vdupq_n_s16(128);
+	int32x4_t const round = vdupq_n_s32(128);
+	uint8x8_t const alpha = vdup_n_u8(0xff);
+	unsigned i = 0 ;
+	for ( ; i+8 <= n ; i += 8) {
+		int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y+i))),k16);
+		int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u+i))),k128);
+		int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v+i))),k128);
+
+		int32x4_t baseLo = vmlal_n_s16(round,vget_low_s16(c),298);
+		int32x4_t baseHi = vmlal_n_s16(round,vget_high_s16(c),298);
+
+		int32x4_t rLo = vmlal_n_s16(baseLo,vget_low_s16(e),409);
+		int32x4_t rHi = vmlal_n_s16(baseHi,vget_high_s16(e),409);
+		int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(baseLo,vget_low_s16(d),-100),vget_low_s16(e),-208);
+		int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(baseHi,vget_high_s16(d),-100),vget_high_s16(e),-208);
+		int32x4_t bLo = vmlal_n_s16(baseLo,vget_low_s16(d),516);
+		int32x4_t bHi = vmlal_n_s16(baseHi,vget_high_s16(d),516);
+
+		uint8x8_t r = vqmovn_u16(vcombine_u16(rgbChannel(rLo),rgbChannel(rHi)));
+		uint8x8_t g = vqmovn_u16(vcombine_u16(rgbChannel(gLo),rgbChannel(gHi)));
+		uint8x8_t b = vqmovn_u16(vcombine_u16(rgbChannel(bLo),rgbChannel(bHi)));
+
+		if (V4L2_PIX_FMT_RGB565 == fourcc) {
+			uint16x8_t pix = vshll_n_u8(r,8);
+			pix = vsriq_n_u16(pix,vshll_n_u8(g,8),5);
+			pix = vsriq_n_u16(pix,vshll_n_u8(b,8),11);
+			vst1q_u16((uint16_t *)out+i,pix);
+		} else {
+			uint8x8x4_t pix ;
+			if (V4L2_PIX_FMT_RGB32 == fourcc) {
+				pix.val[0] = alpha ; pix.val[1] = r ; pix.val[2] = g ; pix.val[3] = b ;
+			} else {
+				pix.val[0] = b ; pix.val[1] = g ; pix.val[2] = r ; pix.val[3] = alpha ;
+			}
+			vst4_u8((unsigned char *)out+4*i,pix);
+		}
+	}
+	if (i < n) {
+		unsigned bpp = (V4L2_PIX_FMT_RGB565 == fourcc) ? 2 : 4 ;
+		yuvToRgbRow_c(fourcc,y+i,u+i,v+i,n-i,(unsigned char *)out+i*bpp);
+	}
+}
+#endif
+
+bool yuvScaler_t::haveNeon(void)
+{
+#ifdef __ARM_NEON__
+	return true ;
+#else
+	return false ;
+#endif
+}
+
+static bool isRgbOut(unsigned fourcc)
+{
+	return (V4L2_PIX_FMT_RGB565 == fourcc)
+		|| (V4L2_PIX_FMT_RGB32 == fourcc)
+		|| (V4L2_PIX_FMT_BGR32 == fourcc);
+}
+
+bool yuvScaler_t::getChannels(frameLayout_t const &layout, channel_t *channels)
+{
+	if (!layout.valid() || !layout.info->yuv)
+		return false ;
+
+	channels[0] = layout.y ;
+	channels[1] = layout.u ;
+	channels[2] = layout.v ;
+	for (unsigned c = 0 ; c < NUMCHANNELS ; c++) {
+		if ((0 == channels[c].width) || (0 == channels[c].height))
+			return false ;
+	}
+	return true ;
+}
+
+yuvScaler_t::yuvScaler_t
+	( unsigned inFourcc, unsigned inWidth, unsigned inHeight,
+	  unsigned outFourcc, unsigned outWidth, unsigned outHeight )
+	: inLayout_(inFourcc,inWidth,inHeight)
+	, outLayout_(outFourcc,outWidth,outHeight)
+	, rgbOut_(isRgbOut(outFourcc))
+	, neon_(haveNeon())
+	, rowBuf_(0)
+{
+	init();
+}
+
+yuvScaler_t::yuvScaler_t(frameLayout_t const &in, frameLayout_t const &out)
+	: inLayout_(in)
+	, outLayout_(out)
+	, rgbOut_(out.valid() && isRgbOut(out.info->fourcc))
+	, neon_(haveNeon())
+	, rowBuf_(0)
+{
+	init();
+}
+
+void yuvScaler_t::init(void)
+{
+	memset(xIndex_,0,sizeof(xIndex_));
+	memset(xFrac_,0,sizeof(xFrac_));
+
+	if (!getChannels(inLayout_,in_)) {
+		ERRMSG("%s: unsupported input %s %ux%u\n", __PRETTY_FUNCTION__,
+		       inLayout_.valid() ? inLayout_.info->name : "?", inLayout_.width, inLayout_.height);
+		return ;
+	}
+	if (rgbOut_) {
+		// full-resolution Y, U and V rows, converted after scaling
+		for (unsigned c = 0 ; c < NUMCHANNELS ; c++) {
+			out_[c].offset = 0 ;
+			out_[c].step = 1 ;
+			out_[c].stride = outLayout_.width ;
+			out_[c].width = outLayout_.width ;
+			out_[c].height = outLayout_.height ;
+		}
+	}
+	else if (!getChannels(outLayout_,out_)) {
+		ERRMSG("%s: unsupported output %s %ux%u\n", __PRETTY_FUNCTION__,
+		       outLayout_.valid() ? outLayout_.info->name : "?", outLayout_.width, outLayout_.height);
+		return ;
+	}
+
+	for (unsigned c = 0 ; c < NUMCHANNELS ; c++) {
+		unsigned n = out_[c].width ;
+		xIndex_[c] = new unsigned [n];
+		xFrac_[c] = new unsigned char [n];
+		for (unsigned d = 0 ; d < n ; d++) {
+			unsigned i1, frac ;
+			sourcePos(d,in_[c].width,n,xIndex_[c][d],i1,frac);
+			xFrac_[c][d] = frac ;
+		}
+	}
+
+	unsigned rowSize = ((inLayout_.width > outLayout_.width) ? inLayout_.width : outLayout_.width) + 16 ;
+	rowBuf_ = new unsigned char [rowSize*6];
+	for (unsigned i = 0 ; i < 6 ; i++)
+		rows_[i] = rowBuf_ + i*rowSize ;
+}
+
+yuvScaler_t::~yuvScaler_t(void)
+{
+	for (unsigned c = 0 ; c < NUMCHANNELS ; c++) {
+		if (xIndex_[c])
+			delete [] xIndex_[c];
+		if (xFrac_[c])
+			delete [] xFrac_[c];
+	}
+	if (rowBuf_)
+		delete [] rowBuf_ ;
+}
+
+/*
+ * Produces output row 'row' of channel c in out (contiguous).
+ * Uses rows_[0..2] as scratch.
+ */
+void yuvScaler_t::scaleRow(unsigned c, unsigned char const *in, unsigned row, unsigned char *out)
+{
+	channel_t const &src = in_[c];
+	channel_t const &dst = out_[c];
+
+	unsigned y0, y1, fy ;
+	sourcePos(row,src.height,dst.height,y0,y1,fy);
+
+	unsigned char const *r0 = in + src.offset + y0*src.stride ;
+	unsigned char const *r1 = in + src.offset + y1*src.stride ;
+	if (1 != src.step) {
+#ifdef __ARM_NEON__
+		void (*gather)(unsigned char const *, unsigned, unsigned, unsigned char *) = neon_ ? gatherRow_neon : gatherRow_c ;
+#else
+		void (*gather)(unsigned char const *, unsigned, unsigned, unsigned char *) = gatherRow_c ;
+#endif
+		gather(r0,src.step,src.width,rows_[0]);
+		r0 = rows_[0];
+		if (fy) {
+			gather(r1,src.step,src.width,rows_[1]);
+			r1 = rows_[1];
+		}
+	}
+
+	bool const sameWidth = (src.width == dst.width);
+	unsigned char const *v = r0 ;
+	if (fy) {
+		unsigned char *blended = sameWidth ? out : rows_[2];
+#ifdef __ARM_NEON__
+		if (neon_)
+			blendRows_neon(r0,r1,fy,src.width,blended);
+		else
+#endif
+			blendRows_c(r0,r1,fy,src.width,blended);
+		v = blended ;
+	}
+
+	if (sameWidth) {
+		if (v != out)
+			memcpy(out,v,dst.width);
+		return ;
+	}
+
+	unsigned const *xi = xIndex_[c];
+	unsigned char const *xf = xFrac_[c];
+	for (unsigned d = 0 ; d < dst.width ; d++) {
+		unsigned x = xi[d];
+		unsigned f = xf[d];
+		out[d] = f ? blend(v[x],v[x+1],f) : v[x];
+	}
+}
+
+void yuvScaler_t::convertRow(unsigned row, unsigned char *out)
+{
+	unsigned const fourcc = outLayout_.info->fourcc ;
+	out += outLayout_.planes[0].offset + row*outLayout_.planes[0].stride ;
+#ifdef __ARM_NEON__
+	if (neon_)
+		yuvToRgbRow_neon(fourcc,rows_[3],rows_[4],rows_[5],outLayout_.width,out);
+	else
+#endif
+		yuvToRgbRow_c(fourcc,rows_[3],rows_[4],rows_[5],outLayout_.width,out);
+}
+
+void yuvScaler_t::scale(void const *inData, void *outData)
+{
+	if (!worked())
+		return ;
+	unsigned char const *in = (unsigned char const *)inData ;
+	unsigned char *out = (unsigned char *)outData ;
+	if (rgbOut_) {
+		for (unsigned row = 0 ; row < out_[0].height ; row++) {
+			scaleRow(0,in,row,rows_[3]);
+			scaleRow(1,in,row,rows_[4]);
+			scaleRow(2,in,row,rows_[5]);
+			convertRow(row,out);
+		}
+		return ;
+	}
+	for (unsigned c = 0 ; c < NUMCHANNELS ; c++) {
+		channel_t const &dst = out_[c];
+		for (unsigned row = 0 ; row < dst.height ; row++) {
+			unsigned char *outRow = out + dst.offset + row*dst.stride ;
+			if (1 == dst.step) {
+				scaleRow(c,in,row,outRow);
+			} else {
+				scaleRow(c,in,row,rows_[3]);
+				for (unsigned i = 0 ; i < dst.width ; i++)
+					outRow[i*dst.step] = rows_[3][i];
+			}
+		}
+	}
+}
+
+#ifdef STANDALONE_YUVSCALE
+
+#include "tickMs.h"
+
+/*
+ * Straightforward per-pixel implementation of the same filter,
+ * used to check the row-based (and NEON) code bit for bit.
+ */
+static unsigned char refSample(unsigned char const *in, frameLayout_t const &layout,
+			       unsigned c, unsigned dx, unsigned dy,
+			       unsigned outW, unsigned outH)
+{
+	frameLayout_t::component_t const &comp = (0 == c) ? layout.y : (1 == c) ? layout.u : layout.v ;
+
+	unsigned x0, x1, fx, y0, y1, fy ;
+	sourcePos(dx,comp.width,outW,x0,x1,fx);
+	sourcePos(dy,comp.height,outH,y0,y1,fy);
+	unsigned char const *p = in + comp.offset ;
+	unsigned a = blend(p[y0*comp.stride+x0*comp.step],p[y1*comp.stride+x0*comp.step],fy);
+	unsigned b = blend(p[y0*comp.stride+x1*comp.step],p[y1*comp.stride+x1*comp.step],fy);
+	return blend(a,b,fx);
+}
+
+static void reference(unsigned char const *in, frameLayout_t const &inLayout,
+		      unsigned char *out, frameLayout_t const &outLayout)
+{
+	unsigned const outFourcc = outLayout.info->fourcc ;
+	unsigned const outW = outLayout.width ;
+	unsigned const outH = outLayout.height ;
+	if (isRgbOut(outFourcc)) {
+		for (unsigned y = 0 ; y < outH ; y++) {
+			unsigned char *row = out + y*outLayout.planes[0].stride ;
+			for (unsigned x = 0 ; x < outW ; x++) {
+				unsigned char Y = refSample(in,inLayout,0,x,y,outW,outH);
+				unsigned char U = refSample(in,inLayout,1,x,y,outW,outH);
+				unsigned char V = refSample(in,inLayout,2,x,y,outW,outH);
+				unsigned char r, g, b ;
+				yuvToRgb(Y,U,V,r,g,b);
+				if (V4L2_PIX_FMT_RGB565 == outFourcc) {
+					uint16_t pix = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+					memcpy(row+2*x,&pix,2);
+				} else if (V4L2_PIX_FMT_RGB32 == outFourcc) {
+					row[4*x] = 0xff ; row[4*x+1] = r ; row[4*x+2] = g ; row[4*x+3] = b ;
+				} else {
+					row[4*x] = b ; row[4*x+1] = g ; row[4*x+2] = r ; row[4*x+3] = 0xff ;
+				}
+			}
+		}
+		return ;
+	}
+	for (unsigned c = 0 ; c < 3 ; c++) {
+		frameLayout_t::component_t const &comp = (0 == c) ? outLayout.y : (1 == c) ? outLayout.u : outLayout.v ;
+		for (unsigned y = 0 ; y < comp.height ; y++)
+			for (unsigned x = 0 ; x < comp.width ; x++)
+				out[comp.offset+y*comp.stride+x*comp.step]
+					= refSample(in,inLayout,c,x,y,comp.width,comp.height);
+	}
+}
+
+static unsigned const inFormats[] = {
+	V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV422P,
+	v4l2_fourcc('Y','V','1','6')
+};
+
+static unsigned const outFormats[] = {
+	V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV422P,
+	v4l2_fourcc('Y','V','1','6'), V4L2_PIX_FMT_RGB565, V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_BGR32
+};
+
+static struct {
+	unsigned inW, inH, outW, outH ;
+} const sizes[] = {
+	{ 64, 48, 64, 48 },	// format conversion only
+	{ 64, 48, 40, 30 },	// down
+	{ 64, 48, 100, 76 },	// up
+	{ 96, 64, 48, 96 },	// down horizontally, up vertically
+	{ 640, 480, 480, 272 },
+};
+
+#define ARRAY_SIZE(__arr) (sizeof(__arr)/sizeof(__arr[0]))
+
+int main(int argc, char const **argv) {
+	unsigned failures = 0, tests = 0 ;
+	srand(1);
+	for (unsigned s = 0 ; s < ARRAY_SIZE(sizes); s++) {
+		for (unsigned i = 0 ; i < ARRAY_SIZE(inFormats); i++) {
+			for (unsigned o = 0 ; o < ARRAY_SIZE(outFormats); o++) {
+				// padding is 0 or 24 pixels on input, 8 on output
+				for (unsigned padded = 0 ; padded < 2 ; padded++) {
+					unsigned inStride = padded ? (sizes[s].inW+24)*fourccInfo(inFormats[i])->yStep : 0 ;
+					unsigned outStride = padded ? (sizes[s].outW+8)*fourccInfo(outFormats[o])->yStep : 0 ;
+					frameLayout_t const inLayout(inFormats[i],sizes[s].inW,sizes[s].inH,inStride);
+					frameLayout_t const outLayout(outFormats[o],sizes[s].outW,sizes[s].outH,outStride);
+					yuvScaler_t scaler(inLayout,outLayout);
+					if (!scaler.worked()) {
+						printf( "%s->%s: not supported\n", fourcc_str(inFormats[i]), fourcc_str(outFormats[o]));
+						++failures ;
+						continue ;
+					}
+					unsigned char *in = new unsigned char [scaler.inSize()];
+					for (unsigned b = 0 ; b < scaler.inSize(); b++)
+						in[b] = rand();
+					unsigned char *expected = new unsigned char [scaler.outSize()];
+					unsigned char *actual = new unsigned char [scaler.outSize()];
+					memset(expected,0x5a,scaler.outSize());
+					reference(in,inLayout,expected,outLayout);
+					for (unsigned pass = 0 ; pass < (yuvScaler_t::haveNeon() ? 2 : 1); pass++) {
+						scaler.useNeon(0 == pass);
+						memset(actual,0x5a,scaler.outSize());
+						scaler.scale(in,actual);
+						++tests ;
+						if (0 != memcmp(expected,actual,scaler.outSize())) {
+							unsigned b = 0 ;
+							while (expected[b] == actual[b])
+								b++ ;
+							printf( "%s %ux%u -> %s %ux%u (%s%s): mismatch at byte %u (0x%02x != 0x%02x)\n",
+								fourcc_str(inFormats[i]), sizes[s].inW, sizes[s].inH,
+								fourcc_str(outFormats[o]), sizes[s].outW, sizes[s].outH,
+								(0 == pass) && yuvScaler_t::haveNeon() ? "neon" : "C",
+								padded ? ", padded" : "",
+								b, actual[b], expected[b]);
+							++failures ;
+						}
+					}
+					delete [] in ;
+					delete [] expected ;
+					delete [] actual ;
+				}
+			}
+		}
+	}
+	printf( "%u of %u conversions matched the reference\n", tests-failures, tests);
+
+	// time a VGA frame to the preview sizes we care about
+	unsigned const iterations = (1 < argc) ? strtoul(argv[1],0,0) : 20 ;
+	for (unsigned o = 0 ; o < ARRAY_SIZE(outFormats); o++) {
+		yuvScaler_t scaler(V4L2_PIX_FMT_YUYV,640,480,outFormats[o],480,272);
+		unsigned char *in = new unsigned char [scaler.inSize()];
+		unsigned char *out = new unsigned char [scaler.outSize()];
+		memset(in,0x80,scaler.inSize());
+		long long start = tickMs();
+		for (unsigned i = 0 ; i < iterations ; i++)
+			scaler.scale(in,out);
+		long long elapsed = tickMs()-start ;
+		printf( "YUYV 640x480 -> %s 480x272: %llu.%02llu ms/frame\n", fourcc_str(outFormats[o]),
+			elapsed/iterations, ((elapsed*100)/iterations)%100);
+		delete [] in ;
+		delete [] out ;
+	}
+	return failures ? -1 : 0 ;
+}
+
+#endif
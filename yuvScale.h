@@ -0,0 +1,79 @@
+#ifndef __YUVSCALE_H__
+#define __YUVSCALE_H__ "$Id$"
+
+/*
+ * yuvScale.h
+ *
+ * This header file declares the yuvScaler_t class, which scales
+ * and converts frames between pixel formats with bilinear
+ * filtering at arbitrary ratios.
+ *
+ * Input formats are the YUV formats described by frameLayout_t
+ * (I420, YV12, NV12, 422P, YV16, YUYV and UYVY). Output can be any of
+ * those or RGB565, RGB32 and BGR32 (BT.601, limited range).
+ *
+ * Each of Y, U and V is scaled on its own, a row at a time, so
+ * chroma is resampled (not just decimated) when the subsampling
+ * differs. Everything is done in 8-bit fixed point, and the NEON
+ * kernels used on ARM produce the same output, bit for bit, as
+ * the portable C code.
+ *
+ * Usage:
+ *
+ *	yuvScaler_t scaler(V4L2_PIX_FMT_YUYV, 640, 480,
+ *			   V4L2_PIX_FMT_RGB565, 320, 240);
+ *	if (scaler.worked())
+ *		scaler.scale(cameraFrame, fbMem);
+ *
+ * Copyright Boundary Devices, Inc. 2010
+ */
+
+#include "fourcc.h"
+
+class yuvScaler_t {
+public:
+	yuvScaler_t(unsigned inFourcc, unsigned inWidth, unsigned inHeight,
+		    unsigned outFourcc, unsigned outWidth, unsigned outHeight);
+
+	// for padded lines (e.g. camera_t::layout())
+	yuvScaler_t(frameLayout_t const &in, frameLayout_t const &out);
+	~yuvScaler_t(void);
+
+	bool worked(void) const { return 0 != rowBuf_ ; }
+
+	unsigned inSize(void) const { return inLayout_.size ; }
+	unsigned outSize(void) const { return outLayout_.size ; }
+
+	void scale(void const *in, void *out);
+
+	// the C code is always available, this is mostly for testing
+	void useNeon(bool use){ neon_ = use && haveNeon(); }
+	static bool haveNeon(void);
+
+private:
+	enum {
+		NUMCHANNELS = 3	// Y, U, V
+	};
+
+	// a single Y, U or V component of a frame
+	typedef frameLayout_t::component_t channel_t ;
+
+	static bool getChannels(frameLayout_t const &layout, channel_t *channels);
+	void init(void);
+	void scaleRow(unsigned c, unsigned char const *in, unsigned row, unsigned char *out);
+	void convertRow(unsigned row, unsigned char *out);
+
+	frameLayout_t const inLayout_ ;
+	frameLayout_t const outLayout_ ;
+	bool		rgbOut_ ;
+	bool		neon_ ;
+	channel_t	in_[NUMCHANNELS];
+	channel_t	out_[NUMCHANNELS];
+	unsigned       *xIndex_[NUMCHANNELS];	// left source sample per output sample
+	unsigned char  *xFrac_[NUMCHANNELS];	// weight of the right one (0-255)
+	unsigned char  *rowBuf_ ;		// scratch rows
+	unsigned char  *rows_[6];
+};
+
+#endif
+